@@ -33,7 +33,7 @@ namespace GraphicResearchHuiZhao
         [DllImport("CHOLMOD.dll", CharSet = CharSet.Unicode, CallingConvention = CallingConvention.Cdecl)]
         protected static extern unsafe void* CreateSolverCholeskyCHOLMOD(int numberOfRow, int numberOfColumn, int numberOfNoneZero, int numberOfEntries, int* Ti, int* Tj, double* Tx);
         [DllImport("CHOLMOD.dll", CharSet = CharSet.Unicode, CallingConvention = CallingConvention.Cdecl)]
-        protected static extern unsafe void SolveCholeskyCHOLMOD(void* solver, double* X, double* b);
+        protected static extern unsafe int SolveCholeskyCHOLMOD(void* solver, double* X, double* b);
         [DllImport("CHOLMOD.dll", CharSet = CharSet.Unicode, CallingConvention = CallingConvention.Cdecl)]
         protected static extern unsafe void FreeSolverCholeskyCHOLMOD(void* solver);
         [DllImport("CHOLMOD.dll", CharSet = CharSet.Unicode, CallingConvention = CallingConvention.Cdecl)]
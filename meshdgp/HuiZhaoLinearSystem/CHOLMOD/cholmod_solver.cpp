@@ -1,15 +1,45 @@
 ﻿#include "cholmod_solver.h"
+#include "../Common/worker_pool.h"
 #define TRUE 1
 #define FALSE 0
 
-DllExport void* CreateSolverCholeskyCHOLMOD(int numberOfRow,int numberOfColumn,int numberOfNoneZero,int numberOfEntries,int *Ti,int *Tj,double *Tx)
+//后台因子化的控制块，由句柄和工作线程共同持有
+struct CholmodAsync{
+	std::mutex lock;
+	std::condition_variable done;
+	int state;
+	bool cancelRequested;
+	int refs;
+	cholmod_triplet *T;
+};
+
+static void ReleaseAsync(CholmodAsync *async)
+{
+	int refs;
+	{
+		std::lock_guard<std::mutex> guard(async->lock);
+		refs = --(async->refs);
+	}
+	if(refs == 0)
+		delete async;
+}
+
+static CholmodSolver* AllocateSolver()
 {
 	//创建 Solve
 	CholmodSolver *solver = (CholmodSolver*)malloc(sizeof(CholmodSolver));
+	solver->L = NULL;
+	solver->A = NULL;
+	solver->async = NULL;
 
 	//开始 solve
 	cholmod_start(&(solver->c));
+	SolverStatsReset(&(solver->stats));
+	return solver;
+}
 
+static cholmod_triplet* CopyTriplet(CholmodSolver *solver,int numberOfRow,int numberOfColumn,int numberOfNoneZero,int numberOfEntries,int *Ti,int *Tj,double *Tx)
+{
 	//将矩阵存储为 triplet 形式
 	cholmod_triplet *tempTriplet = cholmod_allocate_triplet(numberOfRow,numberOfColumn,numberOfEntries,-1,CHOLMOD_REAL,&(solver->c));
 	tempTriplet->nzmax = numberOfEntries;
@@ -26,39 +56,166 @@ DllExport void* CreateSolverCholeskyCHOLMOD(int numberOfRow,int numberOfColumn,i
 		Jindex[m] = Tj[m];
 		valueIndex[m] = Tx[m];
 	}
+	return tempTriplet;
+}
 
+//由 triplet 创建矩阵 A 并因子化，triplet 在此释放
+static bool FactorizeTriplet(CholmodSolver *solver,cholmod_triplet *tempTriplet)
+{
 	//创建矩阵 A 可以根据 triplet 中数据转换
-	cholmod_sparse *A = cholmod_triplet_to_sparse(tempTriplet,numberOfNoneZero,&(solver->c));
+	cholmod_sparse *A = cholmod_triplet_to_sparse(tempTriplet,tempTriplet->nnz,&(solver->c));
 	solver->A = A;
 
 	//清空 triplet 内容
 	cholmod_free_triplet(&tempTriplet,&(solver->c));
+	if(A == NULL) return false;
 
 	//因子化
+	double t = SolverStatsTimer();
 	cholmod_factor *L = cholmod_analyze (A, &(solver->c));
+	solver->stats.analyzeTime = SolverStatsTimer() - t;
+	if(L == NULL) return false;
+
+	t = SolverStatsTimer();
 	cholmod_factorize(A, L,&(solver->c));
+	solver->stats.factorTime = SolverStatsTimer() - t;
 	solver->L = L;
 
+	//记录 analyze 得到的统计量
+	solver->stats.factorFlops = solver->c.fl;
+	solver->stats.factorNnz = solver->c.lnz;
+	solver->stats.matrixNnz = solver->c.anz;
+	solver->stats.ordering = L->ordering;
+
+	return solver->c.status == CHOLMOD_OK;
+}
+
+DllExport void* CreateSolverCholeskyCHOLMOD(int numberOfRow,int numberOfColumn,int numberOfNoneZero,int numberOfEntries,int *Ti,int *Tj,double *Tx)
+{
+	CholmodSolver *solver = AllocateSolver();
+	cholmod_triplet *tempTriplet = CopyTriplet(solver,numberOfRow,numberOfColumn,numberOfNoneZero,numberOfEntries,Ti,Tj,Tx);
+	FactorizeTriplet(solver,tempTriplet);
+
 	return solver;
 
 }
 
-DllExport void SolveCholeskyCHOLMOD(void *solver,double *X,double *B)
+//工作线程中执行的因子化任务
+static void FactorizeAsyncJob(CholmodSolver *solver,CholmodAsync *async)
+{
+	cholmod_triplet *tempTriplet = NULL;
+	{
+		std::lock_guard<std::mutex> guard(async->lock);
+		//排队时已被取消，此时句柄可能已被释放，不能再访问 solver
+		if(async->state != SolverStateCancelled){
+			async->state = SolverStateRunning;
+			tempTriplet = async->T;
+			async->T = NULL;
+		}
+	}
+	if(tempTriplet == NULL){
+		ReleaseAsync(async);
+		return;
+	}
+
+	bool ok = FactorizeTriplet(solver,tempTriplet);
+
+	{
+		std::lock_guard<std::mutex> guard(async->lock);
+		if(async->cancelRequested){
+			cholmod_free_factor(&(solver->L),&(solver->c));
+			cholmod_free_sparse(&(solver->A),&(solver->c));
+			async->state = SolverStateCancelled;
+		}else{
+			async->state = ok ? SolverStateReady : SolverStateFailed;
+		}
+		async->done.notify_all();
+	}
+	ReleaseAsync(async);
+}
+
+DllExport void* CreateSolverCholeskyCHOLMODAsync(int numberOfRow,int numberOfColumn,int numberOfNoneZero,int numberOfEntries,int *Ti,int *Tj,double *Tx)
+{
+	//输入数组在返回后可能失效，先拷贝到 triplet
+	CholmodSolver *solver = AllocateSolver();
+	CholmodAsync *async = new CholmodAsync();
+	async->state = SolverStatePending;
+	async->cancelRequested = false;
+	async->refs = 2;
+	async->T = CopyTriplet(solver,numberOfRow,numberOfColumn,numberOfNoneZero,numberOfEntries,Ti,Tj,Tx);
+	solver->async = async;
+
+	WorkerPool::Instance().Submit([solver,async]() { FactorizeAsyncJob(solver,async); });
+	return solver;
+}
+
+//非正定时 cholmod_factorize 仍返回 L，需检查 minor
+static bool FactorUsable(const CholmodSolver *cs)
+{
+	return cs->L != NULL && cs->L->minor >= cs->L->n;
+}
+
+DllExport int PollSolverCholeskyCHOLMOD(void *solver)
 {
-	
 	CholmodSolver *cs = (CholmodSolver*)solver;
+	if(cs->async == NULL)
+		return FactorUsable(cs) ? SolverStateReady : SolverStateFailed;
+
+	std::lock_guard<std::mutex> guard(cs->async->lock);
+	return cs->async->state;
+}
 
+DllExport int WaitSolverCholeskyCHOLMOD(void *solver)
+{
+	CholmodSolver *cs = (CholmodSolver*)solver;
+	if(cs->async == NULL)
+		return FactorUsable(cs) ? SolverStateReady : SolverStateFailed;
+
+	std::unique_lock<std::mutex> guard(cs->async->lock);
+	while(cs->async->state == SolverStatePending || cs->async->state == SolverStateRunning)
+		cs->async->done.wait(guard);
+	return cs->async->state;
+}
+
+DllExport int CancelSolverCholeskyCHOLMOD(void *solver)
+{
+	CholmodSolver *cs = (CholmodSolver*)solver;
+	if(cs->async == NULL)
+		return PollSolverCholeskyCHOLMOD(solver);
+
+	std::lock_guard<std::mutex> guard(cs->async->lock);
+	if(cs->async->state == SolverStatePending){
+		cholmod_free_triplet(&(cs->async->T),&(cs->c));
+		cs->async->state = SolverStateCancelled;
+		cs->async->done.notify_all();
+	}else if(cs->async->state == SolverStateRunning){
+		//CHOLMOD 无法中断，分解结束后丢弃结果
+		cs->async->cancelRequested = true;
+	}
+	return cs->async->state;
+}
+
+//用已有因子求解，失败时不写 X
+static bool SolveFactor(CholmodSolver *cs,double *X,double *B)
+{
 	//创建向量 b
 	cholmod_dense *b = cholmod_allocate_dense(cs->A->nrow,1,cs->A->nrow,CHOLMOD_REAL,&(cs->c));
-	
+	if(b == NULL) return false;
+
 	double *bValue = (double*)b->x;
 	for(int i = 0 ;i < b->nrow;i++){
 		bValue[i] = B[i];
 	}
 
 	//解方程，并获得结果向量 X
+	double t = SolverStatsTimer();
 	cholmod_dense *x = cholmod_solve (CHOLMOD_A,cs->L,b,&(cs->c));
+	cs->stats.solveTime += SolverStatsTimer() - t;
+	cs->stats.solveCount++;
+	//L 与 L' 两次三角求解，每个非零项一次乘加
+	cs->stats.solveFlops += 4.0 * cs->c.lnz;
 	cholmod_free_dense(&b,&(cs->c));
+	if(x == NULL) return false;
 
 	//将结果 X 项目拷贝至外部数组引用
 	double *xx = (double*)x->x;
@@ -68,19 +225,191 @@ DllExport void SolveCholeskyCHOLMOD(void *solver,double *X,double *B)
 
 	//释放掉资源
 	cholmod_free_dense(&x,&(cs->c));
+	return true;
+}
+
+DllExport int SolveCholeskyCHOLMOD(void *solver,double *X,double *B)
+{
+	
+	//异步句柄需等待因子化完成，失败或取消时不写 X
+	if(WaitSolverCholeskyCHOLMOD(solver) != SolverStateReady)
+		return -1;
+
+	return SolveFactor((CholmodSolver*)solver,X,B) ? 0 : -1;
 }
 
 DllExport void FreeSolverCholeskyCHOLMOD(void *solver)
 {
 	CholmodSolver *cs = (CholmodSolver*)solver;
+	if(cs->async != NULL){
+		CancelSolverCholeskyCHOLMOD(solver);
+		WaitSolverCholeskyCHOLMOD(solver);
+		ReleaseAsync(cs->async);
+		cs->async = NULL;
+	}
 	cholmod_free_factor(&(cs->L),&(cs->c));
 	cholmod_free_sparse(&(cs->A),&(cs->c));
 	cholmod_finish (&(cs->c));
 	free(cs);
-	cs->A = NULL;
-	cs->L = NULL;
-	cs = NULL;
-	solver = NULL;
+}
+
+DllExport int GetSolverStatsCholeskyCHOLMOD(void *solver,SolverStats *stats)
+{
+	if(solver == NULL || stats == NULL) return -1;
+
+	CholmodSolver *cs = (CholmodSolver*)solver;
+
+	//工作线程在因子化期间写 stats 与 c，结束前不可读取
+	if(cs->async != NULL){
+		std::lock_guard<std::mutex> guard(cs->async->lock);
+		if(cs->async->state == SolverStatePending || cs->async->state == SolverStateRunning)
+			return 1;
+	}
+	*stats = cs->stats;
+	stats->peakMemory = (double)cs->c.memory_usage;
+	return 0;
+}
+
+
+DllExport void* CreateSolverConstrainedCHOLMOD(int numberOfRow,int numberOfNoneZero,int *Ti,int *Tj,double *Tx,int numberOfFixed,int *fixedIndex)
+{
+	if(numberOfRow < 0 || numberOfFixed < 0) return NULL;
+
+	//map 中自由点存其自由编号，固定点存 -1-固定编号
+	int *map = (int*)malloc(sizeof(int) * (numberOfRow > 0 ? numberOfRow : 1));
+	for(int i = 0;i<numberOfRow;i++) map[i] = 0;
+
+	//fixedValue[k] 对应 fixedIndex[k]，越界或重复的编号会打乱这一对应，直接拒绝
+	for(int k = 0;k<numberOfFixed;k++){
+		int v = fixedIndex[k];
+		if(v < 0 || v >= numberOfRow || map[v] < 0){
+			free(map);
+			return NULL;
+		}
+		map[v] = -1 - k;
+	}
+
+	CholmodConstrainedSolver *solver = (CholmodConstrainedSolver*)malloc(sizeof(CholmodConstrainedSolver));
+	solver->numberOfRow = numberOfRow;
+	solver->fixedIndex = (int*)malloc(sizeof(int) * (numberOfFixed > 0 ? numberOfFixed : 1));
+	for(int k = 0;k<numberOfFixed;k++)
+		solver->fixedIndex[k] = fixedIndex[k];
+	solver->numberOfFixed = numberOfFixed;
+	solver->numberOfFree = numberOfRow - numberOfFixed;
+
+	solver->freeIndex = (int*)malloc(sizeof(int) * (solver->numberOfFree > 0 ? solver->numberOfFree : 1));
+	int freeCount = 0;
+	for(int i = 0;i<numberOfRow;i++){
+		if(map[i] < 0) continue;
+		map[i] = freeCount;
+		solver->freeIndex[freeCount++] = i;
+	}
+
+	//统计自由块与耦合块的非零项，输入只含下三角，耦合项按对称补全
+	int freeNnz = 0;
+	solver->couplingPtr = (int*)malloc(sizeof(int) * (solver->numberOfFree + 1));
+	for(int i = 0;i<=solver->numberOfFree;i++) solver->couplingPtr[i] = 0;
+	for(int m = 0;m<numberOfNoneZero;m++){
+		int fi = map[Ti[m]], fj = map[Tj[m]];
+		if(fi >= 0 && fj >= 0) freeNnz++;
+		else if(fi >= 0) solver->couplingPtr[fi + 1]++;
+		else if(fj >= 0) solver->couplingPtr[fj + 1]++;
+	}
+	for(int i = 0;i<solver->numberOfFree;i++)
+		solver->couplingPtr[i + 1] += solver->couplingPtr[i];
+
+	int couplingNnz = solver->couplingPtr[solver->numberOfFree];
+	solver->couplingCol = (int*)malloc(sizeof(int) * (couplingNnz > 0 ? couplingNnz : 1));
+	solver->couplingValue = (double*)malloc(sizeof(double) * (couplingNnz > 0 ? couplingNnz : 1));
+
+	//自由块写入 triplet，编号保持单调所以仍为下三角
+	solver->freeBlock = AllocateSolver();
+	cholmod_triplet *tempTriplet = cholmod_allocate_triplet(solver->numberOfFree,solver->numberOfFree,freeNnz,-1,CHOLMOD_REAL,&(solver->freeBlock->c));
+	int *Iindex = (int*)tempTriplet->i;
+	int *Jindex = (int*)tempTriplet->j;
+	double *valueIndex = (double*)tempTriplet->x;
+
+	int *cursor = (int*)malloc(sizeof(int) * (solver->numberOfFree > 0 ? solver->numberOfFree : 1));
+	for(int i = 0;i<solver->numberOfFree;i++) cursor[i] = solver->couplingPtr[i];
+
+	int t = 0;
+	for(int m = 0;m<numberOfNoneZero;m++){
+		int fi = map[Ti[m]], fj = map[Tj[m]];
+		if(fi >= 0 && fj >= 0){
+			Iindex[t] = fi;
+			Jindex[t] = fj;
+			valueIndex[t] = Tx[m];
+			t++;
+		}else if(fi >= 0){
+			solver->couplingCol[cursor[fi]] = -1 - fj;
+			solver->couplingValue[cursor[fi]++] = Tx[m];
+		}else if(fj >= 0){
+			solver->couplingCol[cursor[fj]] = -1 - fi;
+			solver->couplingValue[cursor[fj]++] = Tx[m];
+		}
+	}
+	tempTriplet->nnz = t;
+	free(cursor);
+	free(map);
+
+	FactorizeTriplet(solver->freeBlock,tempTriplet);
+	return solver;
+}
+
+DllExport int SolveConstrainedCHOLMOD(void *solver,double *X,double *b,double *fixedValue)
+{
+	CholmodConstrainedSolver *cs = (CholmodConstrainedSolver*)solver;
+	int nf = cs->numberOfFree;
+
+	//自由块非正定或内存不足时因子不可用
+	if(nf > 0 && !FactorUsable(cs->freeBlock))
+		return -1;
+
+	//右端项 b_f - A(free,fixed) * x_fixed
+	double *rhs = (double*)malloc(sizeof(double) * (nf > 0 ? nf : 1));
+	double *xf = (double*)malloc(sizeof(double) * (nf > 0 ? nf : 1));
+
+	#pragma omp parallel for
+	for(int i = 0;i<nf;i++){
+		double sum = b[cs->freeIndex[i]];
+		for(int k = cs->couplingPtr[i];k<cs->couplingPtr[i + 1];k++)
+			sum -= cs->couplingValue[k] * fixedValue[cs->couplingCol[k]];
+		rhs[i] = sum;
+	}
+
+	if(nf > 0 && !SolveFactor(cs->freeBlock,xf,rhs)){
+		free(rhs);
+		free(xf);
+		return -1;
+	}
+
+	//写回完整解向量
+	for(int i = 0;i<nf;i++)
+		X[cs->freeIndex[i]] = xf[i];
+	for(int k = 0;k<cs->numberOfFixed;k++)
+		X[cs->fixedIndex[k]] = fixedValue[k];
+
+	free(rhs);
+	free(xf);
+	return 0;
+}
+
+DllExport void FreeSolverConstrainedCHOLMOD(void *solver)
+{
+	CholmodConstrainedSolver *cs = (CholmodConstrainedSolver*)solver;
+	FreeSolverCholeskyCHOLMOD(cs->freeBlock);
+	free(cs->freeIndex);
+	free(cs->fixedIndex);
+	free(cs->couplingPtr);
+	free(cs->couplingCol);
+	free(cs->couplingValue);
+	free(cs);
+}
+
+DllExport int GetSolverStatsConstrainedCHOLMOD(void *solver,SolverStats *stats)
+{
+	if(solver == NULL) return -1;
+	return GetSolverStatsCholeskyCHOLMOD(((CholmodConstrainedSolver*)solver)->freeBlock,stats);
 }
 
 
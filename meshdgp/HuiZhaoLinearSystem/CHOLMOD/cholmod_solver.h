@@ -2,18 +2,58 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include "cholmod.h"
+#include "../Common/solver_stats.h"
+#ifdef _WIN32
 #define DllExport  extern "C" __declspec( dllexport )
+#else
+#define DllExport  extern "C" __attribute__((visibility("default")))
+#endif
+
+struct CholmodAsync;
 
 typedef struct cholmodsolver{
 	cholmod_factor *L;
 	cholmod_sparse *A;
 	cholmod_common c;
+	SolverStats stats;
+	struct CholmodAsync *async;  //NULL for handles factorized synchronously
 }CholmodSolver;
 
 DllExport void* CreateSolverCholeskyCHOLMOD(int numberOfRow,int numberOfColumn,int numberOfNoneZero,int numberOfEntries,int *Ti,int *Tj,double *Tx);
-DllExport void SolveCholeskyCHOLMOD(void *solver,double *X,double *b);
+//Returns 0, or -1 with X untouched when the factorization failed (not SPD, out of memory) or was cancelled.
+DllExport int SolveCholeskyCHOLMOD(void *solver,double *X,double *b);
 DllExport void FreeSolverCholeskyCHOLMOD(void *solver);
+DllExport int GetSolverStatsCholeskyCHOLMOD(void *solver,SolverStats *stats);
+
+//Asynchronous factorization: returns at once, SolveCholeskyCHOLMOD blocks until the factor is ready.
+//Poll/Wait/Cancel return a SolverState; a handle factorized synchronously is Ready only if its matrix was SPD.
+DllExport void* CreateSolverCholeskyCHOLMODAsync(int numberOfRow,int numberOfColumn,int numberOfNoneZero,int numberOfEntries,int *Ti,int *Tj,double *Tx);
+DllExport int PollSolverCholeskyCHOLMOD(void *solver);
+DllExport int WaitSolverCholeskyCHOLMOD(void *solver);
+DllExport int CancelSolverCholeskyCHOLMOD(void *solver);
+//GetSolverStatsCholeskyCHOLMOD returns 1 and leaves stats untouched while the factorization is pending or running.
+
+//Dirichlet constrained solve: the lower triangle of the full SPD matrix is given once with the
+//fixed indices, only the free block is factorized.  The fixed-to-free coupling is kept as a
+//sparse matrix and applied on every solve, so new boundary values need no refactorization.
+typedef struct cholmodconstrainedsolver{
+	CholmodSolver *freeBlock;
+	int numberOfRow;
+	int numberOfFree;
+	int numberOfFixed;
+	int *freeIndex;       //free row -> row of the full matrix
+	int *fixedIndex;      //fixed slot -> row of the full matrix
+	int *couplingPtr;     //CSR of A(free,fixed), numberOfFree+1 entries
+	int *couplingCol;     //fixed slot of each coupling entry
+	double *couplingValue;
+}CholmodConstrainedSolver;
 
+DllExport void* CreateSolverConstrainedCHOLMOD(int numberOfRow,int numberOfNoneZero,int *Ti,int *Tj,double *Tx,int numberOfFixed,int *fixedIndex);
+//Create returns NULL for fixed indices out of range or repeated, so fixedValue[k] always belongs to fixedIndex[k].
+//Solve returns 0, or -1 with X untouched when the free block could not be factorized (not SPD, out of memory).
+DllExport int SolveConstrainedCHOLMOD(void *solver,double *X,double *b,double *fixedValue);
+DllExport void FreeSolverConstrainedCHOLMOD(void *solver);
+DllExport int GetSolverStatsConstrainedCHOLMOD(void *solver,SolverStats *stats);
 
 DllExport void SolveRealByCholesky(int numberOfRow,int numberOfColumn,int numberOfNoneZero,int *Ti,int *Tj,double *Tx,double *X,double *b);
 DllExport void SolveRealByCholesky_CRS(int numberOfRow,int numberOfColumn,int numberOfNoneZero ,int *rowIndex,int *colPtr,double *values,double *X,double *b);
@@ -0,0 +1,71 @@
+#ifndef SOLVER_STATS_H
+#define SOLVER_STATS_H
+
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+//The helpers below are static inline so each wrapper that includes this
+//header gets no unused copies; MSVC spells inline __inline in C files
+#if defined(_MSC_VER) && !defined(__cplusplus)
+#define SOLVER_STATS_INLINE __inline
+#else
+#define SOLVER_STATS_INLINE inline
+#endif
+
+//Fill-reducing ordering reported by the analyze phase, numbered as CHOLMOD does
+enum SolverOrdering{
+	SolverOrderingUnknown = -1,
+	SolverOrderingNatural = 0,
+	SolverOrderingGiven = 1,
+	SolverOrderingAMD = 2,
+	SolverOrderingMETIS = 3,
+	SolverOrderingNESDIS = 4,
+	SolverOrderingCOLAMD = 5,
+	SolverOrderingPostordered = 6,
+	SolverOrderingMMD = 7
+};
+
+//Work done by one solver handle, filled in by GetSolverStats* of each library.
+//Times are wall clock seconds, solve entries accumulate over every Solve call.
+typedef struct solverstats{
+	double analyzeTime;
+	double factorTime;
+	double solveTime;
+	int solveCount;
+
+	double factorFlops;
+	double solveFlops;
+
+	double matrixNnz;   //nnz of the input matrix as seen by the factorization
+	double factorNnz;   //nnz(L), nnz(L)+nnz(U) or nnz(R)
+	double peakMemory;  //peak workspace in bytes, 0 if unknown
+
+	int ordering;       //one of SolverOrdering
+}SolverStats;
+
+static SOLVER_STATS_INLINE void SolverStatsReset(SolverStats *stats)
+{
+	memset(stats, 0, sizeof(SolverStats));
+	stats->ordering = SolverOrderingUnknown;
+}
+
+//Monotonic wall clock in seconds
+static SOLVER_STATS_INLINE double SolverStatsTimer(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER frequency, counter;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + 1.0e-9 * (double)ts.tv_nsec;
+#endif
+}
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+
+//State of an asynchronously factorized solver handle
+enum SolverState{
+	SolverStatePending = 0,
+	SolverStateRunning = 1,
+	SolverStateReady = 2,
+	SolverStateFailed = 3,
+	SolverStateCancelled = 4
+};
+
+//Fixed set of native threads running queued jobs in FIFO order.
+//One pool per library; it is never destroyed so no thread is joined
+//while the library is being unloaded.
+class WorkerPool{
+public:
+	static WorkerPool &Instance()
+	{
+		static WorkerPool *pool = new WorkerPool();
+		return *pool;
+	}
+
+	void Submit(const std::function<void()> &job)
+	{
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			jobs.push_back(job);
+		}
+		wake.notify_one();
+	}
+
+private:
+	WorkerPool()
+	{
+		//Factorizations are memory hungry and often call threaded BLAS,
+		//so only half of the cores run jobs concurrently
+		unsigned count = std::thread::hardware_concurrency() / 2;
+		if (count < 1) count = 1;
+		for (unsigned i = 0; i < count; i++)
+			std::thread(&WorkerPool::Run, this).detach();
+	}
+
+	void Run()
+	{
+		for (;;) {
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				while (jobs.empty())
+					wake.wait(guard);
+				job = jobs.front();
+				jobs.pop_front();
+			}
+			job();
+		}
+	}
+
+	std::mutex lock;
+	std::condition_variable wake;
+	std::deque< std::function<void()> > jobs;
+};
+
+#endif
@@ -1,7 +1,11 @@
 ﻿#ifndef COMPUTEEIGEN_H
 #define COMPUTEEIGEN_H
 
+#ifdef _WIN32
 #define DllExport  extern "C" __declspec( dllexport )
+#else
+#define DllExport  extern "C" __attribute__((visibility("default")))
+#endif
 
 DllExport int ComputeEigenNoSymmetricShiftModeCRS(
 	int *index,
@@ -8,4 +8,9 @@ namespace GraphicResearchHuiZhao
     {
         TaucsCG, TaucsCholesky, TaucsLU, CholmodCholesky, UmfpackLU, SuperLULU, SPQRLeastNormal, SPQRLeastSqure
     }
+
+    public enum EnumSolverState
+    {
+        Pending, Running, Ready, Failed, Cancelled
+    }
 }
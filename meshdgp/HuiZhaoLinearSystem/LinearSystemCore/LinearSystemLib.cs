@@ -73,6 +73,106 @@ namespace GraphicResearchHuiZhao
             if (solver == null) throw new Exception("Create Solver Fail");
         }
 
+        //Starts the factorization on a native worker thread and returns at once.
+        //Only CHOLMOD factorizes in the background, the other solvers factorize here.
+        public void FactorizationAsync(SparseMatrix A)
+        {
+            if (SolverType != EnumSolver.CholmodCholesky)
+            {
+                Factorization(A);
+                return;
+            }
+
+            TripletArraryData data = ConvertToTripletArrayData(A);
+
+            int rowCount = A.Rows.Count;
+            int nnz = data.nnz;
+
+            fixed (int* ri = data.rowIndex, ci = data.colIndex)
+            fixed (double* val = data.values)
+            {
+                solver = CreateSolverCholeskyCHOLMODAsync(rowCount, rowCount, nnz, nnz, ri, ci, val);
+            }
+            if (solver == null) throw new Exception("Create Solver Fail");
+        }
+
+        public EnumSolverState PollFactorization()
+        {
+            if (solver == null)
+                return EnumSolverState.Failed;
+            if (SolverType != EnumSolver.CholmodCholesky)
+                return EnumSolverState.Ready;
+            return (EnumSolverState)PollSolverCholeskyCHOLMOD(solver);
+        }
+
+        public EnumSolverState WaitFactorization()
+        {
+            if (solver == null)
+                return EnumSolverState.Failed;
+            if (SolverType != EnumSolver.CholmodCholesky)
+                return EnumSolverState.Ready;
+            return (EnumSolverState)WaitSolverCholeskyCHOLMOD(solver);
+        }
+
+        public EnumSolverState CancelFactorization()
+        {
+            if (solver == null)
+                return EnumSolverState.Failed;
+            if (SolverType != EnumSolver.CholmodCholesky)
+                return EnumSolverState.Ready;
+            return (EnumSolverState)CancelSolverCholeskyCHOLMOD(solver);
+        }
+
+        private void* constrainedSolver = null;
+
+        //Factors the free block of the SPD matrix A once.  fixedIndex are the Dirichlet rows,
+        //SolveConstrained then takes new boundary values without rebuilding the matrix.
+        public void FactorizationConstrained(SparseMatrix A, int[] fixedIndex)
+        {
+            FreeConstrainedSolver();
+
+            TripletArraryData data = ConvertToDataSymU(A);
+            int rowCount = A.Rows.Count;
+
+            fixed (int* ri = data.rowIndex, ci = data.colIndex, fi = fixedIndex)
+            fixed (double* val = data.values)
+            {
+                constrainedSolver = CreateSolverConstrainedCHOLMOD(rowCount, data.nnz, ri, ci, val, fixedIndex.Length, fi);
+            }
+            if (constrainedSolver == null) throw new Exception("Create Solver Fail");
+        }
+
+        //rightB and unknownX have the size of the full matrix, fixedValue follows the order of fixedIndex
+        public void SolveConstrained(ref double[] rightB, double[] fixedValue, ref double[] unknownX)
+        {
+            if (constrainedSolver == null)
+                return;
+
+            fixed (double* _x = unknownX, _rightB = rightB, _fixed = fixedValue)
+            {
+                if (SolveConstrainedCHOLMOD(constrainedSolver, _x, _rightB, _fixed) != 0)
+                    throw new Exception("Solve Fail");
+            }
+        }
+
+        public SolverStats GetConstrainedSolverStats()
+        {
+            SolverStats stats = new SolverStats();
+            stats.Ordering = -1;
+            if (constrainedSolver != null)
+                GetSolverStatsConstrainedCHOLMOD(constrainedSolver, &stats);
+            return stats;
+        }
+
+        public void FreeConstrainedSolver()
+        {
+            if (constrainedSolver != null)
+            {
+                FreeSolverConstrainedCHOLMOD(constrainedSolver);
+                constrainedSolver = null;
+            }
+        }
+
         public void SolveLinerSystem(ref double[] rightB, ref double[] unknownX)
         {
 
@@ -99,7 +199,8 @@ namespace GraphicResearchHuiZhao
                         SolveLUSuperLU(solver, _x, _rightB);
                         break;
                     case EnumSolver.CholmodCholesky:
-                        SolveCholeskyCHOLMOD(solver, _x, _rightB);
+                        if (SolveCholeskyCHOLMOD(solver, _x, _rightB) != 0)
+                            throw new Exception("Solve Fail");
                         break;
                     case EnumSolver.SPQRLeastNormal:
                         SolveLeastNormalByQR(solver, _x, _rightB);
@@ -111,6 +212,37 @@ namespace GraphicResearchHuiZhao
 
             }
         }
+        public SolverStats GetSolverStats()
+        {
+            SolverStats stats = new SolverStats();
+            stats.Ordering = -1;
+
+            if (solver == null)
+                return stats;
+
+            switch (SolverType)
+            {
+                case EnumSolver.TaucsCholesky:
+                    GetSolverStatsCholeskyTAUCS(solver, &stats);
+                    break;
+                case EnumSolver.UmfpackLU:
+                    GetSolverStatsLUUMFPACK(solver, &stats);
+                    break;
+                case EnumSolver.SuperLULU:
+                    GetSolverStatsLUSuperLU(solver, &stats);
+                    break;
+                case EnumSolver.CholmodCholesky:
+                    GetSolverStatsCholeskyCHOLMOD(solver, &stats);
+                    break;
+                case EnumSolver.SPQRLeastNormal:
+                case EnumSolver.SPQRLeastSqure:
+                    GetSolverStatsQRSuiteSparseQR(solver, &stats);
+                    break;
+            }
+
+            return stats;
+        }
+
         public void FreeSolver()
         {
             if (solver != null)
@@ -149,6 +281,7 @@ namespace GraphicResearchHuiZhao
                 System.GC.Collect();
                 
             }
+            FreeConstrainedSolver();
         }
 
 
@@ -14,6 +14,8 @@ namespace GraphicResearchHuiZhao
         public static extern unsafe void SolveLUSuperLU(void* solver, double* x, double* b);
         [DllImport("SuperLU.dll", CharSet = CharSet.Unicode, CallingConvention = CallingConvention.Cdecl)]
         public static extern unsafe void FreeSolverLUSuperLU(void* solver);
+        [DllImport("SuperLU.dll", CharSet = CharSet.Unicode, CallingConvention = CallingConvention.Cdecl)]
+        protected static extern unsafe int GetSolverStatsLUSuperLU(void* solver, SolverStats* stats);
 
         #endregion
 
@@ -21,9 +23,27 @@ namespace GraphicResearchHuiZhao
         [DllImport("CHOLMOD.dll", CharSet = CharSet.Unicode, CallingConvention = CallingConvention.Cdecl)]
         protected static extern unsafe void* CreateSolverCholeskyCHOLMOD(int numberOfRow, int numberOfColumn, int numberOfNoneZero, int numberOfEntries, int* Ti, int* Tj, double* Tx);
         [DllImport("CHOLMOD.dll", CharSet = CharSet.Unicode, CallingConvention = CallingConvention.Cdecl)]
-        protected static extern unsafe void SolveCholeskyCHOLMOD(void* solver, double* X, double* b);
+        protected static extern unsafe int SolveCholeskyCHOLMOD(void* solver, double* X, double* b);
         [DllImport("CHOLMOD.dll", CharSet = CharSet.Unicode, CallingConvention = CallingConvention.Cdecl)]
         protected static extern unsafe void FreeSolverCholeskyCHOLMOD(void* solver);
+        [DllImport("CHOLMOD.dll", CharSet = CharSet.Unicode, CallingConvention = CallingConvention.Cdecl)]
+        protected static extern unsafe int GetSolverStatsCholeskyCHOLMOD(void* solver, SolverStats* stats);
+        [DllImport("CHOLMOD.dll", CharSet = CharSet.Unicode, CallingConvention = CallingConvention.Cdecl)]
+        protected static extern unsafe void* CreateSolverCholeskyCHOLMODAsync(int numberOfRow, int numberOfColumn, int numberOfNoneZero, int numberOfEntries, int* Ti, int* Tj, double* Tx);
+        [DllImport("CHOLMOD.dll", CharSet = CharSet.Unicode, CallingConvention = CallingConvention.Cdecl)]
+        protected static extern unsafe int PollSolverCholeskyCHOLMOD(void* solver);
+        [DllImport("CHOLMOD.dll", CharSet = CharSet.Unicode, CallingConvention = CallingConvention.Cdecl)]
+        protected static extern unsafe int WaitSolverCholeskyCHOLMOD(void* solver);
+        [DllImport("CHOLMOD.dll", CharSet = CharSet.Unicode, CallingConvention = CallingConvention.Cdecl)]
+        protected static extern unsafe int CancelSolverCholeskyCHOLMOD(void* solver);
+        [DllImport("CHOLMOD.dll", CharSet = CharSet.Unicode, CallingConvention = CallingConvention.Cdecl)]
+        protected static extern unsafe void* CreateSolverConstrainedCHOLMOD(int numberOfRow, int numberOfNoneZero, int* Ti, int* Tj, double* Tx, int numberOfFixed, int* fixedIndex);
+        [DllImport("CHOLMOD.dll", CharSet = CharSet.Unicode, CallingConvention = CallingConvention.Cdecl)]
+        protected static extern unsafe int SolveConstrainedCHOLMOD(void* solver, double* X, double* b, double* fixedValue);
+        [DllImport("CHOLMOD.dll", CharSet = CharSet.Unicode, CallingConvention = CallingConvention.Cdecl)]
+        protected static extern unsafe void FreeSolverConstrainedCHOLMOD(void* solver);
+        [DllImport("CHOLMOD.dll", CharSet = CharSet.Unicode, CallingConvention = CallingConvention.Cdecl)]
+        protected static extern unsafe int GetSolverStatsConstrainedCHOLMOD(void* solver, SolverStats* stats);
 
         #endregion
 
@@ -34,6 +54,8 @@ namespace GraphicResearchHuiZhao
         protected static extern unsafe void* CreateSolverLUUMFPACK(int numberOfRows, int numberOfNoneZero, int* RowIndex, int* ColumnIndex, double* Value);
         [DllImport("UMFPack.dll", CharSet = CharSet.Unicode, CallingConvention = CallingConvention.Cdecl)]
         protected static extern unsafe int SolveLUUMFPACK(void* solver, double* x, double* b);
+        [DllImport("UMFPack.dll", CharSet = CharSet.Unicode, CallingConvention = CallingConvention.Cdecl)]
+        protected static extern unsafe int GetSolverStatsLUUMFPACK(void* solver, SolverStats* stats);
 
         #endregion
 
@@ -45,6 +67,8 @@ namespace GraphicResearchHuiZhao
         protected static extern unsafe int SolveCholeskyTAUCS(void* solver, double* x, double* b);
         [DllImport("taucs.dll", CharSet = CharSet.Unicode, CallingConvention = CallingConvention.Cdecl)]
         protected static extern unsafe int FreeSolverCholeskyTAUCS(void* solver);
+        [DllImport("taucs.dll", CharSet = CharSet.Unicode, CallingConvention = CallingConvention.Cdecl)]
+        protected static extern unsafe int GetSolverStatsCholeskyTAUCS(void* solver, SolverStats* stats);
 
         [DllImport("taucs.dll", CharSet = CharSet.Unicode, CallingConvention = CallingConvention.Cdecl)]
         static extern unsafe void* CreateSolverCGTAUCS(int numberOfRows, int numberOfNoneZeroEntries, int* rowIndex, int* colIndex, double* value);
@@ -77,6 +101,8 @@ namespace GraphicResearchHuiZhao
         protected static extern unsafe void SolveLeastSqureByQR(void* solver, double* X, double* b);
         [DllImport("SuiteSparseQR.dll", CharSet = CharSet.Unicode, CallingConvention = CallingConvention.Cdecl)]
         protected static extern unsafe void FreeSolverQRSuiteSparseQR(void* solver);
+        [DllImport("SuiteSparseQR.dll", CharSet = CharSet.Unicode, CallingConvention = CallingConvention.Cdecl)]
+        protected static extern unsafe int GetSolverStatsQRSuiteSparseQR(void* solver, SolverStats* stats);
         #endregion
     }
 }
@@ -0,0 +1,25 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Runtime.InteropServices;
+
+namespace GraphicResearchHuiZhao
+{
+    //Same layout as SolverStats in HuiZhaoLinearSystem/Common/solver_stats.h
+    [StructLayout(LayoutKind.Sequential)]
+    public struct SolverStats
+    {
+        public double AnalyzeTime;
+        public double FactorTime;
+        public double SolveTime;
+        public int SolveCount;
+
+        public double FactorFlops;
+        public double SolveFlops;
+
+        public double MatrixNnz;
+        public double FactorNnz;
+        public double PeakMemory;
+
+        public int Ordering;
+    }
+}
@@ -0,0 +1,78 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Runtime.InteropServices;
+
+namespace GraphicResearchHuiZhao
+{
+    //Native CSR kernels of SparseKernel.dll, used to assemble operators such as d0' * star1 * d0
+    //without managed loops.  CSC arrays of A are the CSR arrays of A'.
+    public static unsafe class SparseKernel
+    {
+        [DllImport("SparseKernel.dll", CallingConvention = CallingConvention.Cdecl)]
+        private static extern void MultiplyVectorCSRSparseKernel(int numberOfRow, int* rowPtr, int* colIndex, double* values, double* x, double* y);
+        [DllImport("SparseKernel.dll", CallingConvention = CallingConvention.Cdecl)]
+        private static extern void MultiplyVectorCSCSparseKernel(int numberOfRow, int numberOfColumn, int* colPtr, int* rowIndex, double* values, double* x, double* y);
+        [DllImport("SparseKernel.dll", CallingConvention = CallingConvention.Cdecl)]
+        private static extern void TransposeCSRSparseKernel(int numberOfRow, int numberOfColumn, int* rowPtr, int* colIndex, double* values, int* tRowPtr, int* tColIndex, double* tValues);
+        [DllImport("SparseKernel.dll", CallingConvention = CallingConvention.Cdecl)]
+        private static extern int MultiplySymbolicCSRSparseKernel(int numberOfRowA, int numberOfColumnB, int* aRowPtr, int* aColIndex, int* bRowPtr, int* bColIndex, int* cRowPtr);
+        [DllImport("SparseKernel.dll", CallingConvention = CallingConvention.Cdecl)]
+        private static extern void MultiplyNumericCSRSparseKernel(int numberOfRowA, int numberOfColumnB, int* aRowPtr, int* aColIndex, double* aValues, int* bRowPtr, int* bColIndex, double* bValues, int* cRowPtr, int* cColIndex, double* cValues);
+
+        public static double[] MultiplyCSR(int numberOfRow, int[] rowPtr, int[] colIndex, double[] values, double[] x)
+        {
+            double[] y = new double[numberOfRow];
+            fixed (int* rp = rowPtr, ci = colIndex)
+            fixed (double* v = values, _x = x, _y = y)
+            {
+                MultiplyVectorCSRSparseKernel(numberOfRow, rp, ci, v, _x, _y);
+            }
+            return y;
+        }
+
+        public static double[] MultiplyCSC(int numberOfRow, int numberOfColumn, int[] colPtr, int[] rowIndex, double[] values, double[] x)
+        {
+            double[] y = new double[numberOfRow];
+            fixed (int* cp = colPtr, ri = rowIndex)
+            fixed (double* v = values, _x = x, _y = y)
+            {
+                MultiplyVectorCSCSparseKernel(numberOfRow, numberOfColumn, cp, ri, v, _x, _y);
+            }
+            return y;
+        }
+
+        public static void TransposeCSR(int numberOfRow, int numberOfColumn, int[] rowPtr, int[] colIndex, double[] values,
+                                        out int[] tRowPtr, out int[] tColIndex, out double[] tValues)
+        {
+            tRowPtr = new int[numberOfColumn + 1];
+            tColIndex = new int[colIndex.Length];
+            tValues = new double[values.Length];
+            fixed (int* rp = rowPtr, ci = colIndex, trp = tRowPtr, tci = tColIndex)
+            fixed (double* v = values, tv = tValues)
+            {
+                TransposeCSRSparseKernel(numberOfRow, numberOfColumn, rp, ci, v, trp, tci, tv);
+            }
+        }
+
+        //C = A * B, A has numberOfRowA rows and B has numberOfColumnB columns
+        public static void MultiplyCSR(int numberOfRowA, int numberOfColumnB,
+                                       int[] aRowPtr, int[] aColIndex, double[] aValues,
+                                       int[] bRowPtr, int[] bColIndex, double[] bValues,
+                                       out int[] cRowPtr, out int[] cColIndex, out double[] cValues)
+        {
+            cRowPtr = new int[numberOfRowA + 1];
+            fixed (int* arp = aRowPtr, aci = aColIndex, brp = bRowPtr, bci = bColIndex, crp = cRowPtr)
+            fixed (double* av = aValues, bv = bValues)
+            {
+                int nnz = MultiplySymbolicCSRSparseKernel(numberOfRowA, numberOfColumnB, arp, aci, brp, bci, crp);
+                cColIndex = new int[nnz];
+                cValues = new double[nnz];
+                fixed (int* cci = cColIndex)
+                fixed (double* cv = cValues)
+                {
+                    MultiplyNumericCSRSparseKernel(numberOfRowA, numberOfColumnB, arp, aci, av, brp, bci, bv, crp, cci, cv);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,236 @@
+#include "sparse_kernel.h"
+#include <algorithm>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+static int ThreadCount()
+{
+#ifdef _OPENMP
+	return omp_get_max_threads();
+#else
+	return 1;
+#endif
+}
+
+static int ThreadId()
+{
+#ifdef _OPENMP
+	return omp_get_thread_num();
+#else
+	return 0;
+#endif
+}
+
+static int TeamSize()
+{
+#ifdef _OPENMP
+	return omp_get_num_threads();
+#else
+	return 1;
+#endif
+}
+
+//第 t 个线程负责的连续区间 [begin,end)，与线程调度无关
+static void ThreadBlock(int n,int t,int teamSize,int &begin,int &end)
+{
+	begin = (int)((long long)n * t / teamSize);
+	end = (int)((long long)n * (t + 1) / teamSize);
+}
+
+DllExport void MultiplyVectorCSRSparseKernel(int numberOfRow,int *rowPtr,int *colIndex,double *values,double *x,double *y)
+{
+	//每行独立，按行并行
+	#pragma omp parallel for schedule(static,256)
+	for(int i = 0;i<numberOfRow;i++){
+		double sum = 0;
+		#pragma omp simd reduction(+:sum)
+		for(int k = rowPtr[i];k<rowPtr[i + 1];k++)
+			sum += values[k] * x[colIndex[k]];
+		y[i] = sum;
+	}
+}
+
+DllExport void MultiplyVectorCSCSparseKernel(int numberOfRow,int numberOfColumn,int *colPtr,int *rowIndex,double *values,double *x,double *y)
+{
+	//列存储需要散射写入：0 号线程直接累加到 y，其余线程累加到私有缓冲并记下写过的行区间，
+	//同一并行区内再按线程顺序求和，结果只取决于线程数
+	int threads = ThreadCount();
+	std::vector<double*> local(threads,(double*)NULL);
+	std::vector<int> lo(threads,0), hi(threads,0);
+
+	#pragma omp parallel num_threads(threads)
+	{
+		int t = ThreadId(), team = TeamSize();
+		int j0, j1;
+		ThreadBlock(numberOfColumn,t,team,j0,j1);
+		if(t == 0){
+			std::fill(y,y + numberOfRow,0.0);
+			for(int j = j0;j<j1;j++){
+				double xj = x[j];
+				for(int k = colPtr[j];k<colPtr[j + 1];k++)
+					y[rowIndex[k]] += values[k] * xj;
+			}
+		}else{
+			//私有缓冲随调用分配、用完即释放；calloc 的大块由系统按页清零，只有写到的页有开销
+			double *buf = (double*)calloc(numberOfRow > 0 ? numberOfRow : 1,sizeof(double));
+			int mn = numberOfRow, mx = -1;
+			for(int j = j0;j<j1;j++){
+				double xj = x[j];
+				for(int k = colPtr[j];k<colPtr[j + 1];k++){
+					int i = rowIndex[k];
+					buf[i] += values[k] * xj;
+					mn = std::min(mn,i);
+					mx = std::max(mx,i);
+				}
+			}
+			local[t] = buf;
+			lo[t] = mn;
+			hi[t] = mx + 1;
+		}
+
+		#pragma omp barrier
+		#pragma omp for schedule(static)
+		for(int i = 0;i<numberOfRow;i++){
+			double sum = y[i];
+			for(int s = 1;s<team;s++)
+				if(i >= lo[s] && i < hi[s])
+					sum += local[s][i];
+			y[i] = sum;
+		}
+
+		//omp for 末尾的隐式屏障之后，其他线程已不再读取本缓冲
+		free(local[t]);
+	}
+}
+
+DllExport void TransposeCSRSparseKernel(int numberOfRow,int numberOfColumn,int *rowPtr,int *colIndex,double *values,int *tRowPtr,int *tColIndex,double *tValues)
+{
+	//每个线程在私有缓冲中统计自己行块中各列的个数，前缀和后各线程拥有互不重叠的写入区间。
+	//只有各线程用到的列区间参与求和，整个过程在一个并行区内完成
+	int threads = ThreadCount();
+	std::vector<int*> local(threads,(int*)NULL);
+	std::vector<int> lo(threads,0), hi(threads,0);
+
+	#pragma omp parallel num_threads(threads)
+	{
+		int t = ThreadId(), team = TeamSize();
+		int i0, i1;
+		ThreadBlock(numberOfRow,t,team,i0,i1);
+		int *count = (int*)calloc(numberOfColumn > 0 ? numberOfColumn : 1,sizeof(int));
+		int mn = numberOfColumn, mx = -1;
+		for(int k = rowPtr[i0];k<rowPtr[i1];k++){
+			int j = colIndex[k];
+			count[j]++;
+			mn = std::min(mn,j);
+			mx = std::max(mx,j);
+		}
+		local[t] = count;
+		lo[t] = mn;
+		hi[t] = mx + 1;
+
+		#pragma omp barrier
+		#pragma omp for schedule(static)
+		for(int j = 0;j<numberOfColumn;j++){
+			int c = 0;
+			for(int s = 0;s<team;s++)
+				if(j >= lo[s] && j < hi[s])
+					c += local[s][j];
+			tRowPtr[j] = c;
+		}
+
+		#pragma omp single
+		{
+			int offset = 0;
+			for(int j = 0;j<numberOfColumn;j++){
+				int c = tRowPtr[j];
+				tRowPtr[j] = offset;
+				offset += c;
+			}
+			tRowPtr[numberOfColumn] = offset;
+		}
+
+		//列优先、线程次之分配写入位置，使得转置后每行内的列号递增
+		#pragma omp for schedule(static)
+		for(int j = 0;j<numberOfColumn;j++){
+			int offset = tRowPtr[j];
+			for(int s = 0;s<team;s++)
+				if(j >= lo[s] && j < hi[s]){
+					int c = local[s][j];
+					local[s][j] = offset;
+					offset += c;
+				}
+		}
+
+		for(int i = i0;i<i1;i++)
+			for(int k = rowPtr[i];k<rowPtr[i + 1];k++){
+				int dst = count[colIndex[k]]++;
+				tColIndex[dst] = i;
+				tValues[dst] = values[k];
+			}
+
+		free(count);
+	}
+}
+
+DllExport int MultiplySymbolicCSRSparseKernel(int numberOfRowA,int numberOfColumnB,int *aRowPtr,int *aColIndex,int *bRowPtr,int *bColIndex,int *cRowPtr)
+{
+	//Gustavson 算法：marker 记录本行已出现的列
+	#pragma omp parallel
+	{
+		std::vector<int> marker(numberOfColumnB,-1);
+		#pragma omp for schedule(dynamic,64)
+		for(int i = 0;i<numberOfRowA;i++){
+			int nnz = 0;
+			for(int ka = aRowPtr[i];ka<aRowPtr[i + 1];ka++){
+				int r = aColIndex[ka];
+				for(int kb = bRowPtr[r];kb<bRowPtr[r + 1];kb++){
+					int j = bColIndex[kb];
+					if(marker[j] != i){
+						marker[j] = i;
+						nnz++;
+					}
+				}
+			}
+			cRowPtr[i + 1] = nnz;
+		}
+	}
+
+	cRowPtr[0] = 0;
+	for(int i = 0;i<numberOfRowA;i++)
+		cRowPtr[i + 1] += cRowPtr[i];
+	return cRowPtr[numberOfRowA];
+}
+
+DllExport void MultiplyNumericCSRSparseKernel(int numberOfRowA,int numberOfColumnB,int *aRowPtr,int *aColIndex,double *aValues,int *bRowPtr,int *bColIndex,double *bValues,int *cRowPtr,int *cColIndex,double *cValues)
+{
+	#pragma omp parallel
+	{
+		std::vector<int> marker(numberOfColumnB,-1);
+		std::vector<double> accumulator(numberOfColumnB,0.0);
+		#pragma omp for schedule(dynamic,64)
+		for(int i = 0;i<numberOfRowA;i++){
+			int *cols = cColIndex + cRowPtr[i];
+			int nnz = 0;
+			for(int ka = aRowPtr[i];ka<aRowPtr[i + 1];ka++){
+				int r = aColIndex[ka];
+				double a = aValues[ka];
+				for(int kb = bRowPtr[r];kb<bRowPtr[r + 1];kb++){
+					int j = bColIndex[kb];
+					if(marker[j] != i){
+						marker[j] = i;
+						accumulator[j] = 0;
+						cols[nnz++] = j;
+					}
+					accumulator[j] += a * bValues[kb];
+				}
+			}
+
+			std::sort(cols,cols + nnz);
+			double *vals = cValues + cRowPtr[i];
+			for(int k = 0;k<nnz;k++)
+				vals[k] = accumulator[cols[k]];
+		}
+	}
+}
@@ -0,0 +1,24 @@
+#include <stdlib.h>
+#ifdef _WIN32
+#define DllExport  extern "C" __declspec( dllexport )
+#else
+#define DllExport  extern "C" __attribute__((visibility("default")))
+#endif
+
+//Compressed sparse kernels used to assemble DEC operators natively.
+//CSR: rowPtr has numberOfRow+1 entries, colIndex/values have rowPtr[numberOfRow] entries.
+//CSC of A is the CSR of A', so every CSR routine also works column-wise on the transpose.
+//All output arrays are allocated by the caller.
+
+//y = A*x
+DllExport void MultiplyVectorCSRSparseKernel(int numberOfRow,int *rowPtr,int *colIndex,double *values,double *x,double *y);
+//y = A*x with A stored by columns
+DllExport void MultiplyVectorCSCSparseKernel(int numberOfRow,int numberOfColumn,int *colPtr,int *rowIndex,double *values,double *x,double *y);
+
+//A' in CSR, tRowPtr has numberOfColumn+1 entries.  Column indices of each row come out sorted.
+DllExport void TransposeCSRSparseKernel(int numberOfRow,int numberOfColumn,int *rowPtr,int *colIndex,double *values,int *tRowPtr,int *tColIndex,double *tValues);
+
+//C = A*B in two passes: the symbolic pass fills cRowPtr (numberOfRowA+1 entries) and
+//returns nnz(C), the numeric pass fills cColIndex/cValues with sorted column indices.
+DllExport int MultiplySymbolicCSRSparseKernel(int numberOfRowA,int numberOfColumnB,int *aRowPtr,int *aColIndex,int *bRowPtr,int *bColIndex,int *cRowPtr);
+DllExport void MultiplyNumericCSRSparseKernel(int numberOfRowA,int numberOfColumnB,int *aRowPtr,int *aColIndex,double *aValues,int *bRowPtr,int *bColIndex,double *bValues,int *cRowPtr,int *cColIndex,double *cValues);
@@ -4,6 +4,39 @@
 #define TRUE 1
 #define FALSE 0
 
+//Collect the statistics SuiteSparseQR leaves in cholmod_common after factorize
+static void RecordFactorStats(QRSolver *solver, double factorTime, double matrixNnz)
+{
+	SolverStats *stats = &(solver->stats);
+	SolverStatsReset(stats);
+
+	//SuiteSparseQR_C_factorize does analyze and factorize in one call
+	stats->factorTime = factorTime;
+	stats->matrixNnz = matrixNnz;
+	stats->factorFlops = solver->c.SPQR_xstat[0];
+	stats->factorNnz = (double)solver->c.SPQR_istat[0];
+	stats->peakMemory = (double)solver->c.memory_usage;
+
+	switch (solver->c.SPQR_istat[7])
+	{
+	case SPQR_ORDERING_FIXED:
+	case SPQR_ORDERING_NATURAL: stats->ordering = SolverOrderingNatural; break;
+	case SPQR_ORDERING_COLAMD: stats->ordering = SolverOrderingCOLAMD; break;
+	case SPQR_ORDERING_GIVEN: stats->ordering = SolverOrderingGiven; break;
+	case SPQR_ORDERING_AMD: stats->ordering = SolverOrderingAMD; break;
+	case SPQR_ORDERING_METIS: stats->ordering = SolverOrderingMETIS; break;
+	default: stats->ordering = SolverOrderingUnknown;
+	}
+}
+
+//One solve applies the Householder vectors (nnz(H)) and one triangular solve with R
+static void RecordSolveStats(QRSolver *solver, double solveTime)
+{
+	solver->stats.solveTime += solveTime;
+	solver->stats.solveFlops += 4.0 * (double)solver->c.SPQR_istat[1] + 2.0 * (double)solver->c.SPQR_istat[0];
+	solver->stats.solveCount++;
+}
+
 //[Checked! Working]
 DllExport void* CreateSolverQRSuiteSparseQR_CCS(int numberOfRow, int numberOfColumn, int numberOfNoneZero, int *rowIndex, int *colPtr, double *values)
 {
@@ -25,7 +58,9 @@ DllExport void* CreateSolverQRSuiteSparseQR_CCS(int numberOfRow, int numberOfCol
 	memcpy(val, values, sizeof(double)*numberOfNoneZero);
 
 	//Factorize
+	double t = SolverStatsTimer();
 	SuiteSparseQR_C_factorization *QR = SuiteSparseQR_C_factorize(SPQR_ORDERING_DEFAULT, SPQR_DEFAULT_TOL, A, &(solver->c));
+	RecordFactorStats(solver, SolverStatsTimer() - t, numberOfNoneZero);
 	solver->QR = QR;
 	solver->rowCount = numberOfRow;
 	solver->columnCount = numberOfColumn;
@@ -63,7 +98,9 @@ DllExport void* CreateSolverQRSuiteSparseQR_CRS(int numberOfRow, int numberOfCol
 	cholmod_l_free_sparse(&At, &(solver->c));
 
 	//Factorize
+	double t = SolverStatsTimer();
 	SuiteSparseQR_C_factorization *QR = SuiteSparseQR_C_factorize(SPQR_ORDERING_DEFAULT, SPQR_DEFAULT_TOL, A, &(solver->c));
+	RecordFactorStats(solver, SolverStatsTimer() - t, numberOfNoneZero);
 	solver->QR = QR;
 
 	cholmod_l_free_sparse(&A, &(solver->c));
@@ -106,7 +143,9 @@ DllExport void* CreateSolverQRSuiteSparseQR(int numberOfRow, int numberOfColumn,
 	cholmod_l_free_triplet(&tempTriplet, &(solver->c));
 
 	//Factorize
+	double t = SolverStatsTimer();
 	SuiteSparseQR_C_factorization *QR = SuiteSparseQR_C_factorize(SPQR_ORDERING_DEFAULT, SPQR_DEFAULT_TOL, A, &(solver->c));
+	RecordFactorStats(solver, SolverStatsTimer() - t, solver->nnz);
 	solver->QR = QR;
 
 	cholmod_l_free_sparse(&A, &(solver->c));
@@ -135,10 +174,12 @@ DllExport void SolveLeastNormalByQR(void *solver, double *X, double *b)
 	*/
 
 	// solve y = R'\(E'*b)
+	double t = SolverStatsTimer();
 	cholmod_dense *y = SuiteSparseQR_C_solve(SPQR_RTX_EQUALS_ETB, cs->QR, bPart, &(cs->c));
 
 	// compute xln = Q*y
 	cholmod_dense *x = SuiteSparseQR_C_qmult(SPQR_QX, cs->QR, y, &(cs->c));
+	RecordSolveStats(cs, SolverStatsTimer() - t);
 
 	cholmod_l_free_dense(&y, &(cs->c));
 	cholmod_l_free_dense(&bPart, &(cs->c));
@@ -171,9 +212,11 @@ DllExport void SolveLeastSqureByQR(void *solver, double *X, double *b)
 	*/
 
 	// Y = Q'*B
+	double t = SolverStatsTimer();
 	cholmod_dense *y = SuiteSparseQR_C_qmult(SPQR_QTX, cs->QR, bPart, &(cs->c));
 	// X = R\(Y)
 	cholmod_dense *x = SuiteSparseQR_C_solve(SPQR_RETX_EQUALS_B, cs->QR, y, &(cs->c));
+	RecordSolveStats(cs, SolverStatsTimer() - t);
 
 	cholmod_l_free_dense(&y, &(cs->c));
 	cholmod_l_free_dense(&bPart, &(cs->c));
@@ -206,6 +249,15 @@ DllExport void FreeSolverQRSuiteSparseQR(void *solver)
 	solver = NULL;
 }
 
+DllExport int GetSolverStatsQRSuiteSparseQR(void *solver, SolverStats *stats)
+{
+	if (solver == NULL || stats == NULL) return -1;
+
+	QRSolver *cs = (QRSolver*)solver;
+	*stats = cs->stats;
+	return 0;
+}
+
 //Addcitional Method 
 DllExport void SolveRealByQR(int numberOfRow, int numberOfColumn, int numberOfNoneZero, int *Ti, int *Tj, double *Tx, double *X, double *b)
 {
@@ -2,7 +2,12 @@
 #include <stdio.h>
 #include "cholmod.h"
 #include "SuiteSparseQR_C.h"
+#include "../Common/solver_stats.h"
+#ifdef _WIN32
 #define DllExport  extern "C" __declspec( dllexport )
+#else
+#define DllExport  extern "C" __attribute__((visibility("default")))
+#endif
 
 typedef struct QRsolver{
 	SuiteSparseQR_C_factorization *QR;
@@ -12,6 +17,7 @@ typedef struct QRsolver{
 	int nnz;
 
 	cholmod_common c;
+	SolverStats stats;
 
 }QRSolver;
 
@@ -21,6 +27,7 @@ DllExport void* CreateSolverQRSuiteSparseQR_CCS(int numberOfRow, int numberOfCol
 DllExport void* CreateSolverQRSuiteSparseQR_CRS(int numberOfRow, int numberOfColumn, int numberOfNoneZero, int *rowPtr, int *colIndex, double *values);
 DllExport void SolveLeastNormalByQR(void *solver, double *X, double *b);
 DllExport void SolveLeastSqureByQR(void *solver, double *X, double *b);
+DllExport int GetSolverStatsQRSuiteSparseQR(void *solver, SolverStats *stats);
 
 DllExport void SolveRealByQR(int numberOfRow, int numberOfColumn, int numberOfNoneZero, int *Ti, int *Tj, double *Tx, double *X, double *b);
 DllExport void SolveRealByQR_CRS(int numberOfRow, int numberOfColumn, int numberOfNoneZero, int *rowIndex, int *colPtr, double *values, double *X, double *b);
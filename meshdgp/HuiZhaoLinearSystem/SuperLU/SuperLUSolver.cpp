@@ -74,6 +74,29 @@ DllExport void* CreateSolverLUSuperLU(int numberOfRows,int numberOfColumns,int n
 		return NULL;
 	}
 
+	//记录分解的统计量
+	SolverStats *stats = &(lus->stats);
+	SolverStatsReset(stats);
+	stats->analyzeTime = lus->state.utime[COLPERM] + lus->state.utime[ETREE];
+	stats->factorTime = lus->state.utime[FACT];
+	stats->factorFlops = lus->state.ops[FACT];
+	stats->matrixNnz = numberOfNoneZero;
+	stats->factorNnz = ((SCformat*)L.Store)->nnz + ((NCformat*)U.Store)->nnz;
+
+	mem_usage_t mem;
+	dQuerySpace(&L, &U, &mem);
+	stats->peakMemory = mem.total_needed;
+
+	switch(options->ColPerm){
+	case NATURAL: stats->ordering = SolverOrderingNatural; break;
+	case MMD_ATA:
+	case MMD_AT_PLUS_A: stats->ordering = SolverOrderingMMD; break;
+	case COLAMD: stats->ordering = SolverOrderingCOLAMD; break;
+	case METIS_AT_PLUS_A: stats->ordering = SolverOrderingMETIS; break;
+	case MY_PERMC: stats->ordering = SolverOrderingGiven; break;
+	default: stats->ordering = SolverOrderingUnknown;
+	}
+
 		return lus;
 }
 
@@ -92,7 +115,11 @@ DllExport void SolveLUSuperLU(void *solver,double *x,double *b)
 
 		 if ( (lus->info) == 0 ) {
 			/* 解决 A*X=B, 并将 X 写入 B 里 */
+			double t = SolverStatsTimer();
 			dgstrs (lus->transt, &(lus->L), &(lus->U), lus->perc, lus->perr, &B,&lus->state, &(lus->info));
+			lus->stats.solveTime += SolverStatsTimer() - t;
+			lus->stats.solveFlops += lus->state.ops[SOLVE];
+			lus->stats.solveCount++;
 	   }
 
 		if(lus->info != 0){
@@ -126,6 +153,15 @@ DllExport void SolveLUSuperLU(void *solver,double *x,double *b)
 
 }
 
+ DllExport int GetSolverStatsLUSuperLU(void *solver,SolverStats *stats)
+ {
+	if(solver == NULL || stats == NULL) return -1;
+
+	SuperLUSolver *lus = (SuperLUSolver*)solver;
+	*stats = lus->stats;
+	return 0;
+ }
+
  
 //因子化具体实现较为复杂
 void
@@ -1,6 +1,11 @@
 ﻿#include <stdio.h>
 #include "slu_ddefs.h"
+#include "../Common/solver_stats.h"
+#ifdef _WIN32
 #define DllExport  extern "C" __declspec( dllexport )
+#else
+#define DllExport  extern "C" __attribute__((visibility("default")))
+#endif
 
 typedef struct superLUsolver{
 	int_t *xa;
@@ -21,6 +26,7 @@ typedef struct superLUsolver{
 	int *perr;
 	int info;
 	trans_t transt;
+	SolverStats stats;
 
 }SuperLUSolver;
 
@@ -31,6 +37,8 @@ DllExport void SolveLUSuperLU(void *solver,double *x,double *b);
 
 DllExport void FreeSolverLUSuperLU(void *solver);
 
+DllExport int GetSolverStatsLUSuperLU(void *solver,SolverStats *stats);
+
 void Factorization(superlu_options_t *options, SuperMatrix *A, int *perm_c, int *perm_r,
       SuperMatrix *L, SuperMatrix *U, 
 	  SuperLUStat_t *stat, int *info,trans_t &trans);
\ No newline at end of file
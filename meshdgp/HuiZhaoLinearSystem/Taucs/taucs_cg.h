@@ -2,7 +2,11 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include "taucs.h"
-#define DllExport __declspec( dllexport )
+#ifdef _WIN32
+#define DllExport  __declspec( dllexport )
+#else
+#define DllExport  __attribute__((visibility("default")))
+#endif
 
 
 struct CGSolver {
@@ -9,6 +9,7 @@ DllExport void * CreateSolverCholeskyTAUCS
 {
 	int rc;
 	int currCol = -1;
+	double t;
 	char* options[] = {"taucs.factor.LLT=true", NULL};
 
 	struct Solver * s = (struct Solver*) malloc(sizeof(struct Solver));
@@ -16,6 +17,8 @@ DllExport void * CreateSolverCholeskyTAUCS
 	s->n = n;
 	s->matrix = NULL;
 	s->factorization = NULL;
+	SolverStatsReset(&(s->stats));
+	s->stats.matrixNnz = nnz;
 
 	 //打开记录文件
 	taucs_logfile("c:/log.txt");
@@ -29,8 +32,10 @@ DllExport void * CreateSolverCholeskyTAUCS
 	memcpy(s->matrix->values.d, value, sizeof(double) * nnz);
 	memcpy(s->matrix->colptr, colIndex, sizeof(int) * (n+1));
 	
-	//分解矩阵	
+	//分解矩阵，taucs_linsolve 内部同时完成排序与数值分解
+	t = SolverStatsTimer();
 	rc = taucs_linsolve(s->matrix, &(s->factorization) , 0, NULL, NULL, options, NULL);
+	s->stats.factorTime = SolverStatsTimer() - t;
 	if (rc != TAUCS_SUCCESS) { FreeSolverCholeskyTAUCS(s); return NULL;};
 	
 	taucs_logfile("none");
@@ -40,6 +45,7 @@ DllExport void * CreateSolverCholeskyTAUCS
 
 DllExport int SolveCholeskyTAUCS(void * sp, double *x, double *b) {
 	int rc;
+	double t;
 	char* options [] = {"taucs.factor=false", NULL};
 
 	struct Solver * s = (struct Solver *) sp;
@@ -48,8 +54,11 @@ DllExport int SolveCholeskyTAUCS(void * sp, double *x, double *b) {
 	if (s->matrix == NULL || s->factorization == NULL) return -1;
 
 	//解方程
+	t = SolverStatsTimer();
 	rc = taucs_linsolve(s->matrix, &s->factorization, 1, x, b, options, NULL);
 	if (rc != TAUCS_SUCCESS) return rc;
+	s->stats.solveTime += SolverStatsTimer() - t;
+	s->stats.solveCount++;
 
 	return 0;
 }
@@ -59,15 +68,30 @@ DllExport double SolveEx(void * sp, double *x, int xIndex, double *b, int bIndex
 	char* options [] = {"taucs.factor=false", NULL};
 	struct Solver * s = (struct Solver *) sp;
 	double time = taucs_ctime();
+	double t = SolverStatsTimer();
 
 	rc = taucs_linsolve(s->matrix, &s->factorization, 1, x + xIndex, b + bIndex, options, NULL);
 	time = taucs_ctime() - time;
+	if (rc == TAUCS_SUCCESS) {
+		s->stats.solveTime += SolverStatsTimer() - t;
+		s->stats.solveCount++;
+	}
 
 	//return time;
 	if (rc != TAUCS_SUCCESS) return rc;
 	return 0;
 }
 
+DllExport int GetSolverStatsCholeskyTAUCS(void * sp, SolverStats *stats) {
+	struct Solver * s = (struct Solver *)sp;
+
+	if (sp == NULL || stats == NULL) return -1;
+
+	//TAUCS 不公开分解的 flop 与 nnz，只提供时间
+	*stats = s->stats;
+	return 0;
+}
+
 DllExport int FreeSolverCholeskyTAUCS(void * sp) {
 	struct Solver * s = (struct Solver *)sp;
 	int rc = 0;
@@ -1,18 +1,25 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include "taucs.h"
+#include "../Common/solver_stats.h"
 
-#define DllExport __declspec( dllexport )
+#ifdef _WIN32
+#define DllExport  __declspec( dllexport )
+#else
+#define DllExport  __attribute__((visibility("default")))
+#endif
 
 
 struct Solver {
 	int n;
 	taucs_ccs_matrix * matrix;
 	void * factorization;
+	SolverStats stats;
 };
 
 DllExport void * CreateSolverCholeskyTAUCS(int n, int nnz, int *rowIndex, int *colIndex, double *value);
 DllExport int FreeSolverCholeskyTAUCS(void * sp);
 DllExport int SolveCholeskyTAUCS(void * sp, double *x, double *b);
 DllExport double SolveEx(void * sp, double *x, int xIndex, double *b, int bIndex);
+DllExport int GetSolverStatsCholeskyTAUCS(void * sp, SolverStats *stats);
 
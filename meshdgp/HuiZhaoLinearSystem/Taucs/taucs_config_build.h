@@ -1,8 +1,13 @@
 /* This is an automatically generated file */
 /* Configuration name: anonymous */
+#ifdef _WIN32
 #define TAUCS_OSTYPE win32
-#define TAUCS_VARIANT none
 #define OSTYPE_win32
+#else
+#define TAUCS_OSTYPE linux
+#define OSTYPE_linux
+#endif
+#define TAUCS_VARIANT none
 #define OSTYPE_VARIANT_none
 #define TAUCS_CONFIG_DREAL
 #define TAUCS_CONFIG_SREAL
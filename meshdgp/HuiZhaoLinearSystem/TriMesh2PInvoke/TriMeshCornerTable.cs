@@ -0,0 +1,66 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Text;
+using System.Runtime.InteropServices;
+
+namespace GraphicResearchHuiZhao
+{
+    //Corner table of the native mesh: corner 3*f+j is vertex j of face f,
+    //Opposite[c] is the corner across the edge facing c (-1 on boundary),
+    //VertexCorner[v] is a corner of v (the first of its fan on boundary)
+    public class CornerTable
+    {
+        public int[] Faces;
+        public int[] Opposite;
+        public int[] VertexCorner;
+
+        public int Next(int c)
+        {
+            return (c % 3 == 2) ? c - 2 : c + 1;
+        }
+
+        public int Prev(int c)
+        {
+            return (c % 3 == 0) ? c + 2 : c - 1;
+        }
+
+        public int Vertex(int c)
+        {
+            return Faces[c];
+        }
+
+        //Next corner of the same vertex, -1 at a boundary
+        public int Swing(int c)
+        {
+            int o = Opposite[Next(c)];
+            return (o < 0) ? -1 : Next(o);
+        }
+    }
+
+    public static class CornerTableLib
+    {
+        //Call CurvatureLib.Init first, which loads the mesh into trimeshccdll
+        public static CornerTable GetCornerTable()
+        {
+            IntPtr faces, opposite, vertexCorner;
+            int nv;
+            int nf = GetCornerTable(out faces, out opposite, out vertexCorner, out nv);
+
+            CornerTable table = new CornerTable();
+            table.Faces = new int[nf * 3];
+            table.Opposite = new int[nf * 3];
+            table.VertexCorner = new int[nv];
+            if (nf > 0)
+            {
+                Marshal.Copy(faces, table.Faces, 0, nf * 3);
+                Marshal.Copy(opposite, table.Opposite, 0, nf * 3);
+                Marshal.Copy(vertexCorner, table.VertexCorner, 0, nv);
+            }
+            return table;
+        }
+
+        //The native arrays themselves, valid until the native mesh changes
+        [DllImport("trimeshccdll.dll", EntryPoint = "GetCornerTable", CallingConvention = CallingConvention.Cdecl)]
+        public extern static int GetCornerTable(out IntPtr faces, out IntPtr opposite, out IntPtr vertexCorner, out int numberOfVertex);
+    }
+}
@@ -4,6 +4,48 @@
 #include <stdio.h>
 #include <string.h>
 
+//从 UMFPACK 的 Info 数组中提取因子化统计量
+static void RecordFactorStats(UmfpackSolver *solver, const double *symbolicInfo, const double *numericInfo)
+{
+	SolverStats *stats = &(solver->stats);
+	SolverStatsReset(stats);
+
+	stats->analyzeTime = symbolicInfo[UMFPACK_SYMBOLIC_WALLTIME];
+	stats->factorTime = numericInfo[UMFPACK_NUMERIC_WALLTIME];
+	stats->factorFlops = numericInfo[UMFPACK_FLOPS];
+	stats->matrixNnz = numericInfo[UMFPACK_NZ];
+	stats->factorNnz = numericInfo[UMFPACK_LNZ] + numericInfo[UMFPACK_UNZ];
+	stats->peakMemory = numericInfo[UMFPACK_PEAK_MEMORY] * numericInfo[UMFPACK_SIZE_OF_UNIT];
+
+	switch ((int)symbolicInfo[UMFPACK_ORDERING_USED])
+	{
+	case UMFPACK_ORDERING_CHOLMOD:
+	case UMFPACK_ORDERING_AMD:
+		stats->ordering = SolverOrderingAMD;
+		break;
+	case UMFPACK_ORDERING_METIS:
+		stats->ordering = SolverOrderingMETIS;
+		break;
+	case UMFPACK_ORDERING_GIVEN:
+	case UMFPACK_ORDERING_USER:
+		stats->ordering = SolverOrderingGiven;
+		break;
+	case UMFPACK_ORDERING_NONE:
+		stats->ordering = SolverOrderingNatural;
+		break;
+	default:
+		stats->ordering = SolverOrderingUnknown;
+	}
+}
+
+//累计一次求解的统计量
+static void RecordSolveStats(UmfpackSolver *solver, const double *solveInfo)
+{
+	solver->stats.solveTime += solveInfo[UMFPACK_SOLVE_WALLTIME];
+	solver->stats.solveFlops += solveInfo[UMFPACK_SOLVE_FLOPS];
+	solver->stats.solveCount++;
+}
+
 DllExport void* CreateSolverLUUMFPACK(int numberOfRows, int numberOfNoneZero, int *Ti, int *Tj, double *Tx)
 {
 	//创建 Compressed Row Storage 存储结构
@@ -31,10 +73,12 @@ DllExport void* CreateSolverLUUMFPACK(int numberOfRows, int numberOfNoneZero, in
 
 	//因子化
 	void *Symbolic, *Numeric;
-	(void)umfpack_di_symbolic(numberOfRows, numberOfRows, Ap, Ai, Ax, &Symbolic, NULL, NULL);
-	(void)umfpack_di_numeric(Ap, Ai, Ax, Symbolic, &Numeric, NULL, NULL);
+	double symbolicInfo[UMFPACK_INFO], numericInfo[UMFPACK_INFO];
+	(void)umfpack_di_symbolic(numberOfRows, numberOfRows, Ap, Ai, Ax, &Symbolic, NULL, symbolicInfo);
+	(void)umfpack_di_numeric(Ap, Ai, Ax, Symbolic, &Numeric, NULL, numericInfo);
 	umfpack_di_free_symbolic(&Symbolic);
 	umpsolver->Numeric = Numeric;
+	RecordFactorStats(umpsolver, symbolicInfo, numericInfo);
 
 	return umpsolver;
 };
@@ -70,7 +114,9 @@ DllExport int SolveLUUMFPACK(void * sp, double *x, double *b)
 
 	//解方程 Ax = b
 	void *Numeric = umfSolver->Numeric;
-	(void)umfpack_di_solve(UMFPACK_A, Ap, Ai, Ax, x, b, Numeric, null, null);
+	double solveInfo[UMFPACK_INFO];
+	(void)umfpack_di_solve(UMFPACK_A, Ap, Ai, Ax, x, b, Numeric, null, solveInfo);
+	RecordSolveStats(umfSolver, solveInfo);
 
 	return 0;
 }
@@ -146,8 +192,9 @@ DllExport void* CreateSolverLUUMFPACK_CCS_Complex(int numberOfRow, int numberOfC
 	memcpy(Ai, rowIndices, sizeof(int)*nnz);
 
 	void *Symbolic, *Numeric;
-	(void)umfpack_zi_symbolic(numberOfRow, numberOfColumn, Ap, Ai, Ax, Az, &Symbolic, NULL, NULL);
-	(void)umfpack_zi_numeric(Ap, Ai, Ax, Az, Symbolic, &Numeric, NULL, NULL);
+	double symbolicInfo[UMFPACK_INFO], numericInfo[UMFPACK_INFO];
+	(void)umfpack_zi_symbolic(numberOfRow, numberOfColumn, Ap, Ai, Ax, Az, &Symbolic, NULL, symbolicInfo);
+	(void)umfpack_zi_numeric(Ap, Ai, Ax, Az, Symbolic, &Numeric, NULL, numericInfo);
 
 
 	//创建 solver
@@ -163,6 +210,7 @@ DllExport void* CreateSolverLUUMFPACK_CCS_Complex(int numberOfRow, int numberOfC
 	umpsolver->n = numberOfColumn;
 	umpsolver->m = numberOfRow;
 	umpsolver->Numeric = Numeric;
+	RecordFactorStats(umpsolver, symbolicInfo, numericInfo);
 
 	return umpsolver;
 }
@@ -179,8 +227,9 @@ DllExport void* CreateSolverLUUMFPACK_CCS(int numberOfRow, int numberOfColumn, i
 	memcpy(Ai, rowIndices, sizeof(int)*nnz);
 
 	void *Symbolic, *Numeric;
-	(void)umfpack_di_symbolic(numberOfRow, numberOfColumn, Ap, Ai, Ax, &Symbolic, NULL, NULL);
-	(void)umfpack_di_numeric(Ap, Ai, Ax, Symbolic, &Numeric, NULL, NULL);
+	double symbolicInfo[UMFPACK_INFO], numericInfo[UMFPACK_INFO];
+	(void)umfpack_di_symbolic(numberOfRow, numberOfColumn, Ap, Ai, Ax, &Symbolic, NULL, symbolicInfo);
+	(void)umfpack_di_numeric(Ap, Ai, Ax, Symbolic, &Numeric, NULL, numericInfo);
 
 	//创建 solver
 	UmfpackSolver *umpsolver = (UmfpackSolver*)malloc(sizeof(UmfpackSolver));
@@ -195,6 +244,7 @@ DllExport void* CreateSolverLUUMFPACK_CCS(int numberOfRow, int numberOfColumn, i
 	umpsolver->n = numberOfColumn;
 	umpsolver->m = numberOfRow;
 	umpsolver->Numeric = Numeric;
+	RecordFactorStats(umpsolver, symbolicInfo, numericInfo);
 
 	return umpsolver;
 }
@@ -226,7 +276,9 @@ DllExport int SolveLUUMFPACK_Complex(void * solver, double *x, double *b)
 		bz[i] = b[2 * i + 1];
 	}
 
-	umfpack_zi_solve(UMFPACK_A, Ap, Ai, Ax, Az, xx, xz, bb, bz, Numeric, NULL, NULL);
+	double solveInfo[UMFPACK_INFO];
+	umfpack_zi_solve(UMFPACK_A, Ap, Ai, Ax, Az, xx, xz, bb, bz, Numeric, NULL, solveInfo);
+	RecordSolveStats(umfSolver, solveInfo);
 	free(bb);
 	free(bz);
 
@@ -261,4 +313,13 @@ DllExport void FreeSolverLUUMFPACK_Complex(void *a)
 
 
 	a = NULL;
-}
\ No newline at end of file
+}
+
+DllExport int GetSolverStatsLUUMFPACK(void *solver, SolverStats *stats)
+{
+	if (solver == NULL || stats == NULL) return -1;
+
+	UmfpackSolver *umfSolver = (UmfpackSolver*)solver;
+	*stats = umfSolver->stats;
+	return 0;
+}
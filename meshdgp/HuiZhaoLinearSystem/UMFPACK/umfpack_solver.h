@@ -1,8 +1,13 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include "../Common/solver_stats.h"
 
 
+#ifdef _WIN32
 #define DllExport  extern "C" __declspec( dllexport )
+#else
+#define DllExport  extern "C" __attribute__((visibility("default")))
+#endif
 
 enum{
 	MartixAllZeroError
@@ -25,6 +30,7 @@ typedef struct umfpacksolver
 	long n;
 	long m;
 	void *Numeric;
+	SolverStats stats;
 }UmfpackSolver;
 
 
@@ -38,6 +44,7 @@ DllExport void* CreateSolverLUUMFPACK_CCS_Complex(int numberOfRow, int numberOfC
 DllExport void* CreateSolverLUUMFPACK_CCS(int numberOfRow, int numberOfColumn, int nnz, int *rowIndices, int *colPtr, double *Values);
 DllExport int SolveLUUMFPACK_Complex(void * solver, double *x, double *b);
 DllExport void FreeSolverLUUMFPACK_Complex(void *a);
+DllExport int GetSolverStatsLUUMFPACK(void *solver, SolverStats *stats);
 
 
 
@@ -0,0 +1,468 @@
+/*
+GlobalReg.cc
+Global registration of many scans, from pairwise ICP alignments.
+
+The pose graph is solved by Gauss-Newton on point-to-point distances
+between "virtual mates": points sampled in the overlap of each pair, and
+where pairwise ICP puts them in the other scan.  Each iteration gives each
+scan a small rotation about the center of the scene plus a translation, so
+the normal equations have a 6x6 block per scan and one per pair.  They are
+solved with the CHOLMOD wrapper when trimesh is built with it
+(TRIMESH_USE_CHOLMOD), and with a dense Cholesky factorization otherwise.
+*/
+
+#include "GlobalReg.h"
+#include "TriMesh_algo.h"
+#include "ICP.h"
+#include "KDtree.h"
+#include "timestamp.h"
+#include <cstring>
+#include <algorithm>
+#ifdef TRIMESH_USE_CHOLMOD
+#include "cholmod_solver.h"
+#endif
+using namespace std;
+#define dprintf TriMesh::dprintf
+
+
+#define GLOBAL_SAMPLES 50
+#define GLOBAL_ITERS 20
+#define GLOBAL_TOL 1.0e-7
+#define PAIR_ERR_THRESH 3.0f
+
+
+namespace trimesh {
+
+typedef Vec<3,double> dpoint;
+
+
+// A pair of overlapping scans, and the points that pairwise ICP says
+// should coincide, in the coordinates of scan i and of scan j
+struct RegPair {
+	int i, j;
+	float area, err;
+	vector<point> pi, pj;
+	RegPair(int i_, int j_) : i(i_), j(j_), area(0.0f), err(-1.0f)
+		{}
+};
+
+
+// The blocks of the normal equations contributed by one pair: i is the
+// unknown motion of scan i, j that of scan j
+struct PairSystem {
+	double Hii[6][6], Hjj[6][6], Hji[6][6], gi[6], gj[6], err2;
+};
+
+
+// Bounding box of a mesh under a transform
+static box xf_bbox(const TriMesh *mesh, const xform &xf)
+{
+	box b;
+	for (int k = 0; k < 8; k++) {
+		point corner((k & 1) ? mesh->bbox.max[0] : mesh->bbox.min[0],
+			     (k & 2) ? mesh->bbox.max[1] : mesh->bbox.min[1],
+			     (k & 4) ? mesh->bbox.max[2] : mesh->bbox.min[2]);
+		b += xf * corner;
+	}
+	return b;
+}
+
+static bool boxes_meet(const box &a, const box &b)
+{
+	for (int j = 0; j < 3; j++) {
+		if (a.min[j] > b.max[j] || b.min[j] > a.max[j])
+			return false;
+	}
+	return true;
+}
+
+
+// Up to n vertices with nonzero weight, evenly spaced through the list
+static void sample_overlap(const vector<float> &weights, int n,
+			   vector<int> &samples)
+{
+	vector<int> inside;
+	for (size_t i = 0; i < weights.size(); i++) {
+		if (weights[i])
+			inside.push_back(i);
+	}
+	int ni = inside.size(), ns = min(n, ni);
+	samples.resize(ns);
+	for (int k = 0; k < ns; k++)
+		samples[k] = inside[(size_t) k * ni / ns];
+}
+
+
+// Align scan j of a pair to scan i with ICP, and record the virtual mates
+static void align_pair(const vector<TriMesh *> &meshes,
+		       const vector<xform> &xfs, const vector<KDtree *> &kds,
+		       RegPair &p)
+{
+	TriMesh *m1 = meshes[p.i], *m2 = meshes[p.j];
+	xform xf2 = xfs[p.j];
+	vector<float> weights1, weights2;
+	p.err = ICP(m1, m2, xfs[p.i], xf2, kds[p.i], kds[p.j],
+		    weights1, weights2);
+	if (p.err < 0.0f)
+		return;
+
+	// Where the alignment puts the points of each scan in the
+	// coordinates of the other
+	xform xf21 = inv(xfs[p.i]) * xf2, xf12 = inv(xf21);
+	vector<int> samples;
+	sample_overlap(weights1, GLOBAL_SAMPLES, samples);
+	for (size_t k = 0; k < samples.size(); k++) {
+		const point &v = m1->vertices[samples[k]];
+		p.pi.push_back(v);
+		p.pj.push_back(xf12 * v);
+	}
+	sample_overlap(weights2, GLOBAL_SAMPLES, samples);
+	for (size_t k = 0; k < samples.size(); k++) {
+		const point &v = m2->vertices[samples[k]];
+		p.pi.push_back(xf21 * v);
+		p.pj.push_back(v);
+	}
+}
+
+
+// Linearize the mismatch of the virtual mates of a pair.  Points are
+// taken relative to c and divided by scale, and a motion is a rotation
+// w about c followed by a translation t:  x -> x + w CROSS x + t.
+static void pair_system(const RegPair &p, const vector<xform> &xfs,
+			const dpoint &c, double scale, PairSystem &s)
+{
+	memset(&s, 0, sizeof(s));
+	double invscale = 1.0 / scale;
+	for (size_t k = 0; k < p.pi.size(); k++) {
+		const point &pi = p.pi[k], &pj = p.pj[k];
+		dpoint a = xfs[p.i] * dpoint(pi[0], pi[1], pi[2]);
+		dpoint b = xfs[p.j] * dpoint(pj[0], pj[1], pj[2]);
+		a = (a - c) * invscale;
+		b = (b - c) * invscale;
+		dpoint e = a - b;
+
+		// Rows of the Jacobians of e: w CROSS a = -[a]x w
+		double Ji[3][6] = { { 0, a[2], -a[1], 1, 0, 0 },
+				    { -a[2], 0, a[0], 0, 1, 0 },
+				    { a[1], -a[0], 0, 0, 0, 1 } };
+		double Jj[3][6] = { { 0, -b[2], b[1], -1, 0, 0 },
+				    { b[2], 0, -b[0], 0, -1, 0 },
+				    { -b[1], b[0], 0, 0, 0, -1 } };
+		for (int r = 0; r < 3; r++) {
+			s.err2 += sqr(e[r]);
+			for (int u = 0; u < 6; u++) {
+				s.gi[u] -= Ji[r][u] * e[r];
+				s.gj[u] -= Jj[r][u] * e[r];
+				for (int v = 0; v < 6; v++) {
+					s.Hii[u][v] += Ji[r][u] * Ji[r][v];
+					s.Hjj[u][v] += Jj[r][u] * Jj[r][v];
+					s.Hji[u][v] += Jj[r][u] * Ji[r][v];
+				}
+			}
+		}
+	}
+}
+
+
+// Add a 6x6 block at (r0, c0) of a symmetric matrix, keeping only entries
+// in the lower triangle (transposed, if the block is above the diagonal)
+static void add_block(int r0, int c0, const double B[6][6],
+		      vector<int> &Ti, vector<int> &Tj, vector<double> &Tx)
+{
+	for (int u = 0; u < 6; u++) {
+		for (int v = 0; v < 6; v++) {
+			int r = r0 + u, c = c0 + v;
+			if (r0 == c0 && r < c)
+				continue;
+			Ti.push_back(max(r, c));
+			Tj.push_back(min(r, c));
+			Tx.push_back(B[u][v]);
+		}
+	}
+}
+
+
+// Solve A x = b for a symmetric positive definite A, given as triplets of
+// its lower triangle (duplicate entries are summed)
+static bool solve_spd(int n, vector<int> &Ti, vector<int> &Tj,
+		      vector<double> &Tx, vector<double> &b, vector<double> &x)
+{
+	x.assign(n, 0.0);
+#ifdef TRIMESH_USE_CHOLMOD
+	int nnz = Tx.size();
+	void *solver = CreateSolverCholeskyCHOLMOD(n, n, nnz, nnz,
+						   &Ti[0], &Tj[0], &Tx[0]);
+	if (!solver)
+		return false;
+	bool ok = SolveCholeskyCHOLMOD(solver, &x[0], &b[0]) == 0;
+	FreeSolverCholeskyCHOLMOD(solver);
+	return ok;
+#else
+	// Left-looking Cholesky, L stored in the lower triangle of A
+	vector<double> A((size_t) n * n);
+	for (size_t k = 0; k < Tx.size(); k++)
+		A[(size_t) Ti[k] * n + Tj[k]] += Tx[k];
+	for (int j = 0; j < n; j++) {
+		double *Aj = &A[(size_t) j * n];
+		double d = Aj[j];
+		for (int k = 0; k < j; k++)
+			d -= sqr(Aj[k]);
+		if (!(d > 0.0))
+			return false;
+		d = sqrt(d);
+		Aj[j] = d;
+#pragma omp parallel for if (n - j > 256)
+		for (int i = j + 1; i < n; i++) {
+			double *Ai = &A[(size_t) i * n];
+			double sum = Ai[j];
+			for (int k = 0; k < j; k++)
+				sum -= Ai[k] * Aj[k];
+			Ai[j] = sum / d;
+		}
+	}
+	for (int i = 0; i < n; i++) {
+		double sum = b[i];
+		for (int k = 0; k < i; k++)
+			sum -= A[(size_t) i * n + k] * x[k];
+		x[i] = sum / A[(size_t) i * n + i];
+	}
+	for (int i = n - 1; i >= 0; i--) {
+		double sum = x[i];
+		for (int k = i + 1; k < n; k++)
+			sum -= A[(size_t) k * n + i] * x[k];
+		x[i] = sum / A[(size_t) i * n + i];
+	}
+	return true;
+#endif
+}
+
+
+// Union-find root, with the smallest scan number as the root of each set
+static int find_root(vector<int> &parent, int k)
+{
+	while (parent[k] != k)
+		k = parent[k] = parent[parent[k]];
+	return k;
+}
+
+
+// Globally register the scans in meshes
+int global_reg(const vector<TriMesh *> &meshes, vector<xform> &xfs,
+	       float min_overlap /* = 0.1f */, int verbose /* = 0 */)
+{
+	int nscans = meshes.size();
+	xfs.resize(nscans);
+	if (nscans < 2)
+		return 0;
+
+	// Compute everything find_overlap and ICP need up front, so that
+	// the parallel stages below only read the meshes
+	timestamp t = now();
+	vector<KDtree *> kds(nscans);
+	vector<float> areas(nscans);
+#pragma omp parallel for schedule(dynamic, 1)
+	for (int k = 0; k < nscans; k++) {
+		TriMesh *mesh = meshes[k];
+		mesh->need_normals();
+		mesh->need_neighbors();
+		mesh->need_adjacentfaces();
+		mesh->need_pointareas();
+		mesh->need_bbox();
+		kds[k] = new KDtree(mesh->vertices);
+		areas[k] = mesh->stat(TriMesh::STAT_TOTAL, TriMesh::STAT_FACEAREA);
+	}
+	if (verbose > 1) {
+		dprintf("Prepared %d scans in %.2f msec.\n", nscans,
+			(now() - t) * 1000.0);
+	}
+
+	// Overlap graph: bounding boxes first, then find_overlap on the
+	// pairs whose boxes meet
+	t = now();
+	vector<box> boxes(nscans);
+	box scene;
+	for (int k = 0; k < nscans; k++) {
+		boxes[k] = xf_bbox(meshes[k], xfs[k]);
+		scene += boxes[k];
+	}
+	vector<RegPair> cands;
+	for (int i = 0; i < nscans; i++) {
+		for (int j = i + 1; j < nscans; j++) {
+			if (boxes_meet(boxes[i], boxes[j]))
+				cands.push_back(RegPair(i, j));
+		}
+	}
+	int ncands = cands.size();
+#pragma omp parallel for schedule(dynamic, 1)
+	for (int c = 0; c < ncands; c++) {
+		int i = cands[c].i, j = cands[c].j;
+		float rmsdist = 0.0f;
+		find_overlap(meshes[i], meshes[j], xfs[i], xfs[j],
+			     kds[i], kds[j], cands[c].area, rmsdist);
+	}
+	vector<RegPair> pairs;
+	for (int c = 0; c < ncands; c++) {
+		const RegPair &p = cands[c];
+		if (p.area > 0.0f &&
+		    p.area >= min_overlap * min(areas[p.i], areas[p.j]))
+			pairs.push_back(p);
+	}
+	int npairs = pairs.size();
+	if (verbose) {
+		dprintf("Overlap graph: %d of %d pairs of scans pass the "
+			"bounding box test, %d overlap (%.2f msec).\n",
+			ncands, nscans * (nscans - 1) / 2, npairs,
+			(now() - t) * 1000.0);
+	}
+
+	// Pairwise ICP
+	t = now();
+	int ndone = 0;
+#pragma omp parallel for schedule(dynamic, 1)
+	for (int p = 0; p < npairs; p++) {
+		align_pair(meshes, xfs, kds, pairs[p]);
+		if (verbose > 1) {
+#pragma omp critical
+			{
+				ndone++;
+				if (ndone == npairs || ndone % max(npairs / 10, 1) == 0)
+					dprintf("Pairwise ICP: %d of %d pairs\n",
+						ndone, npairs);
+			}
+		}
+	}
+	for (int k = 0; k < nscans; k++)
+		delete kds[k];
+
+	// Drop the pairs ICP failed on, or left much worse than most
+	vector<float> errs;
+	for (int p = 0; p < npairs; p++) {
+		if (pairs[p].err >= 0.0f)
+			errs.push_back(pairs[p].err);
+	}
+	float errthresh = 0.0f;
+	if (!errs.empty()) {
+		nth_element(errs.begin(), errs.begin() + errs.size()/2, errs.end());
+		errthresh = PAIR_ERR_THRESH * errs[errs.size()/2];
+	}
+	int next = 0;
+	for (int p = 0; p < npairs; p++) {
+		if (pairs[p].err >= 0.0f && pairs[p].err <= errthresh &&
+		    pairs[p].pi.size() >= 3)
+			pairs[next++] = pairs[p];
+	}
+	if (verbose) {
+		dprintf("Pairwise ICP: %d of %d pairs aligned (%.2f msec).\n",
+			next, npairs, (now() - t) * 1000.0);
+	}
+	pairs.erase(pairs.begin() + next, pairs.end());
+	npairs = next;
+	if (!npairs)
+		return 0;
+
+	// The first scan of each connected group stays put.  The others
+	// get 6 unknowns each.
+	vector<int> parent(nscans);
+	for (int k = 0; k < nscans; k++)
+		parent[k] = k;
+	for (int p = 0; p < npairs; p++) {
+		int ri = find_root(parent, pairs[p].i);
+		int rj = find_root(parent, pairs[p].j);
+		parent[max(ri, rj)] = min(ri, rj);
+	}
+	vector<int> base(nscans, -1);
+	int n = 0;
+	for (int k = 0; k < nscans; k++) {
+		if (find_root(parent, k) != k) {
+			base[k] = n;
+			n += 6;
+		}
+	}
+
+	// Gauss-Newton on the pose graph
+	t = now();
+	dpoint c(scene.center()[0], scene.center()[1], scene.center()[2]);
+	double scale = len(scene.size());
+	if (!(scale > 0.0))
+		scale = 1.0;
+	vector<PairSystem> systems(npairs);
+	const vector<xform> xfs_in = xfs;
+	double rms_before = 0.0, rms = 0.0;
+	int iter;
+	for (iter = 0; iter < GLOBAL_ITERS; iter++) {
+#pragma omp parallel for schedule(dynamic, 1)
+		for (int p = 0; p < npairs; p++)
+			pair_system(pairs[p], xfs, c, scale, systems[p]);
+
+		vector<int> Ti, Tj;
+		vector<double> Tx, g(n), x;
+		double err2 = 0.0;
+		size_t nmates = 0;
+		for (int p = 0; p < npairs; p++) {
+			const PairSystem &s = systems[p];
+			int bi = base[pairs[p].i], bj = base[pairs[p].j];
+			err2 += s.err2;
+			nmates += pairs[p].pi.size();
+			if (bi >= 0) {
+				add_block(bi, bi, s.Hii, Ti, Tj, Tx);
+				for (int u = 0; u < 6; u++)
+					g[bi+u] += s.gi[u];
+			}
+			if (bj >= 0) {
+				add_block(bj, bj, s.Hjj, Ti, Tj, Tx);
+				for (int u = 0; u < 6; u++)
+					g[bj+u] += s.gj[u];
+			}
+			if (bi >= 0 && bj >= 0)
+				add_block(bj, bi, s.Hji, Ti, Tj, Tx);
+		}
+		rms = scale * sqrt(err2 / nmates);
+		if (!iter)
+			rms_before = rms;
+
+		if (!solve_spd(n, Ti, Tj, Tx, g, x)) {
+			if (verbose)
+				dprintf("Couldn't solve the pose graph.\n");
+			xfs = xfs_in;
+			return -1;
+		}
+
+		double maxstep = 0.0;
+		for (int k = 0; k < nscans; k++) {
+			if (base[k] < 0)
+				continue;
+			const double *xk = &x[base[k]];
+			dpoint w(xk[0], xk[1], xk[2]), tr(xk[3], xk[4], xk[5]);
+			double angle = len(w);
+			xform R = xform::rot(angle, w);
+			xfs[k] = xform::trans(c + scale * tr) * R *
+				 xform::trans(-c) * xfs[k];
+			maxstep = max(maxstep, angle + len(tr));
+		}
+		if (verbose > 1)
+			dprintf("Pose graph iteration %d: RMS mismatch %g, "
+				"largest step %g\n", iter + 1, rms, maxstep * scale);
+		if (maxstep < GLOBAL_TOL)
+			break;
+	}
+
+	// Mismatch after the last step
+	double err2 = 0.0;
+	size_t nmates = 0;
+	for (int p = 0; p < npairs; p++) {
+		pair_system(pairs[p], xfs, c, scale, systems[p]);
+		err2 += systems[p].err2;
+		nmates += pairs[p].pi.size();
+	}
+	rms = scale * sqrt(err2 / nmates);
+
+	if (verbose) {
+		dprintf("Pose graph: %d scans moved, %d iterations, RMS "
+			"mismatch %g -> %g (%.2f msec).\n", n / 6,
+			min(iter + 1, GLOBAL_ITERS), rms_before, rms,
+			(now() - t) * 1000.0);
+	}
+	return npairs;
+}
+
+}; // namespace trimesh
@@ -12,10 +12,12 @@ Routines for doing ICP.
 #include "KDtree.h"
 #include "timestamp.h"
 #include "lineqn.h"
+#include "omputil.h"
 using namespace std;
 
 
 #define MAX_ITERS 100
+#define REFINE_ITERS 8
 #define MIN_PAIRS 25
 #define DESIRED_PAIRS 500
 #define DESIRED_PAIRS_EARLY 50
@@ -24,6 +26,9 @@ using namespace std;
 #define TERM_THRESH 5
 #define TERM_HIST 7
 #define EIG_THRESH 0.01f
+#define REDUCE_BLOCK 1024
+#define PYRAMID_MIN_POINTS 2000
+#define OVERLAP_CELL 4.0f
 #define dprintf TriMesh::dprintf
 
 
@@ -34,10 +39,13 @@ using namespace std;
 
 namespace trimesh {
 
-// Quick 'n dirty portable random number generator 
-static inline float tinyrnd()
+
+// Quick 'n dirty portable random number generator.  Each ICP run keeps
+// its own state, starting from 0, so that runs in different threads do not
+// interfere.  (The state used to be shared and carried over from one run
+// to the next, so only the first run in a process samples as it used to.)
+static inline float tinyrnd(unsigned &trand)
 {
-	static unsigned trand = 0;
 	trand = 1664525u * trand + 1013904223u;
 	return (float) trand / 4294967296.0f;
 }
@@ -80,14 +88,14 @@ public:
 // Find the median squared distance between points
 static float median_dist2(const vector<PtPair> &pairs)
 {
-	size_t n = pairs.size();
+	int n = pairs.size();
 	if (!n)
 		return 0.0f;
 
-	vector<float> distances2;
-	distances2.reserve(n);
-	for (size_t i = 0; i < n; i++)
-		distances2.push_back(dist2(pairs[i].p1, pairs[i].p2));
+	vector<float> distances2(n);
+#pragma omp parallel for if (n > REDUCE_BLOCK)
+	for (int i = 0; i < n; i++)
+		distances2[i] = dist2(pairs[i].p1, pairs[i].p2);
 
 	size_t pos = n / 2;
 	nth_element(distances2.begin(),
@@ -97,116 +105,299 @@ static float median_dist2(const vector<PtPair> &pairs)
 }
 
 
-// A spatial grid datastructure for fast overlap computation
+// Median distance from a point to its nearest neighbor, over a subset of
+// the points
+static float point_spacing(const TriMesh *mesh, const KDtree *kd)
+{
+	int nv = mesh->vertices.size();
+	int nsamp = min(nv, 333);
+	if (nsamp < 2)
+		return 0.0f;
+	vector<point> samples(nsamp);
+	for (int i = 0; i < nsamp; i++)
+		samples[i] = mesh->vertices[(size_t) i * nv / nsamp];
+	vector<int> knn(2 * nsamp);
+	kd->find_k_closest_to_pts(samples[0], nsamp, 2, &knn[0]);
+
+	vector<float> dists2;
+	for (int i = 0; i < nsamp; i++) {
+		if (knn[2*i+1] >= 0)
+			dists2.push_back(dist2(samples[i],
+					       mesh->vertices[knn[2*i+1]]));
+	}
+	if (dists2.empty())
+		return 0.0f;
+	nth_element(dists2.begin(), dists2.begin() + dists2.size()/2,
+		    dists2.end());
+	return sqrt(dists2[dists2.size()/2]);
+}
+
+
+// A sparse voxel grid for fast overlap computation.  Only the occupied
+// cells are stored, in an open-addressing hash table, so the cells can be
+// as small as the overlap test needs no matter how big the scene is.  The
+// points are also listed by cell, so that whole cells can be tested at
+// once.
 class Grid {
 public:
-	enum { GRID_SHIFT = 4, GRID_MAX = (1 << GRID_SHIFT) - 1 };
-	float xmin, xmax, ymin, ymax, zmin, zmax, scale;
-	vector<char> g;
-	bool valid(const point &p)
+	enum { GRID_BITS = 21, GRID_MAX = (1 << GRID_BITS) - 1 };
+	point origin;
+	float cell, scale;
+	int tbits;
+	vector<unsigned long long> tkeys;
+	vector<int> cellstart, cellpts;
+	vector<point> centers;
+	bool key(const point &p, unsigned long long &k) const
+	{
+		k = 0;
+		for (int j = 0; j < 3; j++) {
+			float c = scale * (p[j] - origin[j]);
+			if (!(c >= 0.0f && c < float(GRID_MAX)))
+				return false;
+			k = (k << GRID_BITS) | (unsigned long long) c;
+		}
+		return true;
+	}
+	size_t slot(unsigned long long k) const
 	{
-		return p[0] >= xmin && p[1] >= ymin && p[2] >= zmin &&
-		       p[0] <= xmax && p[1] <= ymax && p[2] <= zmax;
+		return (size_t) ((k * 0x9e3779b97f4a7c15ull) >> (64 - tbits));
 	}
-	int ind(const point &p)
+	bool has(unsigned long long k) const
 	{
-		int x = clamp(int(scale * (p[0] - xmin)), 0, int(GRID_MAX));
-		int y = clamp(int(scale * (p[1] - ymin)), 0, int(GRID_MAX));
-		int z = clamp(int(scale * (p[2] - zmin)), 0, int(GRID_MAX));
-		return (x << (2*GRID_SHIFT)) + (y << GRID_SHIFT) + z;
+		size_t mask = tkeys.size() - 1;
+		for (size_t h = slot(k); tkeys[h] != ~0ull; h = (h + 1) & mask) {
+			if (tkeys[h] == k)
+				return true;
+		}
+		return false;
 	}
-	bool overlaps(const point &p) { return valid(p) && g[ind(p)]; }
-	Grid(const vector<point> &pts);
+	// Is p in an occupied cell, or at most "rings" cells from one
+	// along each axis?
+	bool overlaps(const point &p, int rings) const
+	{
+		unsigned long long k;
+		if (key(p, k) && has(k))
+			return true;
+		int lo[3], hi[3];
+		for (int j = 0; j < 3; j++) {
+			float c = scale * (p[j] - origin[j]);
+			if (!(c > float(-rings - 1) && c < float(GRID_MAX + rings)))
+				return false;
+			int ic = int(floor(c));
+			lo[j] = max(ic - rings, 0);
+			hi[j] = min(ic + rings, int(GRID_MAX) - 1);
+		}
+		for (int x = lo[0]; x <= hi[0]; x++) {
+			for (int y = lo[1]; y <= hi[1]; y++) {
+				for (int z = lo[2]; z <= hi[2]; z++) {
+					unsigned long long kd =
+						((unsigned long long) x << (2 * GRID_BITS)) |
+						((unsigned long long) y << GRID_BITS) |
+						(unsigned long long) z;
+					if (has(kd))
+						return true;
+				}
+			}
+		}
+		return false;
+	}
+	int ncells() const { return centers.size(); }
+	Grid(const vector<point> &pts, const box &bbox, float cell_);
+private:
+	void grow(const vector<unsigned long long> &cells, vector<int> &tcells);
 };
 
 
-// Compute a Grid from a list of points
-Grid::Grid(const vector<point> &pts)
+// Double the size of the hash table, and put the cells back in it
+void Grid::grow(const vector<unsigned long long> &cells, vector<int> &tcells)
 {
-	g.resize(1 << 3*GRID_SHIFT);
-	if (pts.empty()) {
-		xmin = xmax = ymin = ymax = zmin = zmax = scale = 0.0f;
-		return;
+	tbits++;
+	tkeys.assign(size_t(1) << tbits, ~0ull);
+	tcells.resize(tkeys.size());
+	size_t mask = tkeys.size() - 1;
+	for (size_t c = 0; c < cells.size(); c++) {
+		size_t h = slot(cells[c]);
+		while (tkeys[h] != ~0ull)
+			h = (h + 1) & mask;
+		tkeys[h] = cells[c];
+		tcells[h] = c;
 	}
-	xmin = xmax = pts[0][0];
-	ymin = ymax = pts[0][1];
-	zmin = zmax = pts[0][2];
-	for (size_t i = 1; i < pts.size(); i++) {
-		if (pts[i][0] < xmin)  xmin = pts[i][0];
-		if (pts[i][0] > xmax)  xmax = pts[i][0];
-		if (pts[i][1] < ymin)  ymin = pts[i][1];
-		if (pts[i][1] > ymax)  ymax = pts[i][1];
-		if (pts[i][2] < zmin)  zmin = pts[i][2];
-		if (pts[i][2] > zmax)  zmax = pts[i][2];
-	}
-	scale = 1.0f / max(max(xmax-xmin, ymax-ymin), zmax-zmin);
-	scale *= float(1 << GRID_SHIFT);
-	for (size_t i = 0; i < pts.size(); i++)
-		g[ind(pts[i])] = 1;
 }
 
 
-// Determine which points on s1 and s2 overlap the other, filling in o1 and o2
-// Also fills in maxdist, if it is <= 0 on input
-void compute_overlaps(TriMesh *s1, TriMesh *s2,
-		      const xform &xf1, const xform &xf2,
-		      const KDtree *, const KDtree *,
-		      vector<float> &o1, vector<float> &o2,
-		      float &maxdist, int verbose)
+// Compute a Grid with the given cell size from a list of points
+Grid::Grid(const vector<point> &pts, const box &bbox, float cell_) :
+	cell(cell_)
 {
-	size_t nv1 = s1->vertices.size(), nv2 = s2->vertices.size();
+	// Leave a cell of room around the points for the neighbors, and
+	// grow the cells if the points would not fit in the keys
+	float extent = max(max(bbox.size()[0], bbox.size()[1]), bbox.size()[2]);
+	cell = max(cell, extent / float(GRID_MAX - 4));
+	if (!(cell > 0.0f))
+		cell = 1.0f;
+	scale = 1.0f / cell;
+	origin = bbox.min - point(2.0f * cell, 2.0f * cell, 2.0f * cell);
+
+	int nv = pts.size();
+	vector<unsigned long long> keys(nv);
+#pragma omp parallel for
+	for (int i = 0; i < nv; i++)
+		key(pts[i], keys[i]);
+
+	// Number the occupied cells in order of first appearance.  Keys use
+	// 63 bits, so ~0 marks an empty slot.  The table grows with the
+	// number of cells, which is usually far smaller than the number of
+	// points, and successive points are often in the same cell, so that
+	// case skips the table.
+	tbits = 10;
+	tkeys.assign(size_t(1) << tbits, ~0ull);
+	vector<int> tcells(tkeys.size());
+	vector<int> cellof(nv);
+	vector<unsigned long long> occupied;
+	for (int i = 0; i < nv; i++) {
+		if (i && keys[i] == keys[i-1]) {
+			cellof[i] = cellof[i-1];
+			continue;
+		}
+		size_t mask = tkeys.size() - 1;
+		size_t h = slot(keys[i]);
+		while (tkeys[h] != ~0ull && tkeys[h] != keys[i])
+			h = (h + 1) & mask;
+		if (tkeys[h] == ~0ull) {
+			tkeys[h] = keys[i];
+			tcells[h] = occupied.size();
+			occupied.push_back(keys[i]);
+		}
+		cellof[i] = tcells[h];
+		if (2 * occupied.size() > tkeys.size())
+			grow(occupied, tcells);
+	}
 
-	timestamp t = now();
-	Grid g1(s1->vertices);
-	Grid g2(s2->vertices);
-	xform xf12 = inv(xf2) * xf1;
-	xform xf21 = inv(xf1) * xf2;
-	if (maxdist <= 0.0f)
-		maxdist = min(1.0f / g1.scale, 1.0f / g2.scale);
+	// List the points by cell
+	int nc = occupied.size();
+	cellstart.resize(nc + 1);
+	for (int i = 0; i < nv; i++)
+		cellstart[cellof[i] + 1]++;
+	for (int c = 0; c < nc; c++)
+		cellstart[c + 1] += cellstart[c];
+	cellpts.resize(nv);
+	vector<int> fill(cellstart.begin(), cellstart.end() - 1);
+	for (int i = 0; i < nv; i++)
+		cellpts[fill[cellof[i]]++] = i;
+	centers.resize(nc);
+	for (int c = 0; c < nc; c++) {
+		for (int j = 0; j < 3; j++) {
+			int ic = (occupied[c] >> (GRID_BITS * (2 - j))) & GRID_MAX;
+			centers[c][j] = origin[j] + cell * (ic + 0.5f);
+		}
+	}
+}
 
+
+// Mark the points of s that overlap other.  With the grid, this is decided
+// for a whole cell of g at a time, by where its center lands in gother, so
+// the work is proportional to the number of cells rather than points.
+// A point is up to half a cell from its cell's center along each axis of
+// g, and xf can turn that offset onto any axis of gother, so how many
+// rings of neighbors to look at depends on xf as well as maxdist.
+static void mark_overlaps(TriMesh *s, const Grid &g, const xform &xf,
+			  TriMesh *other, const Grid &gother,
+			  const KDtree *kdother, float maxdist,
+			  vector<float> &o)
+{
+	o.clear();
+	o.resize(s->vertices.size());
 #ifdef USE_KD_FOR_OVERLAPS
 	float maxdist2 = sqr(maxdist);
-	bool pointcloud1 = (s1->faces.empty() && s1->grid.empty() && s1->tstrips.empty());
-	bool pointcloud2 = (s2->faces.empty() && s2->grid.empty() && s2->tstrips.empty());
+	bool pointcloud = (other->faces.empty() && other->grid.empty() &&
+			   other->tstrips.empty());
+	if (!pointcloud) {
+		other->need_neighbors();
+		other->need_adjacentfaces();
+	}
+#else
+	(void) other;  (void) kdother;  (void) maxdist;
 #endif
 
-	o1.resize(nv1);
-	for (size_t i = 0; i < nv1; i++) {
-		o1[i] = 0;
-		point p = xf12 * s1->vertices[i];
 #ifdef USE_GRID_FOR_OVERLAPS
-		if (!g2.overlaps(p))
-			continue;
-#endif
-#ifdef USE_KD_FOR_OVERLAPS
-		const float *match = kd2->closest_to_pt(p, maxdist2);
-		if (!match)
-			continue;
-		if (!pointcloud2 &&
-		    s2->is_bdy((match - (const float *) &s2->vertices[0][0]) / 3))
-			continue;
-#endif
-		o1[i] = 1;
+	float reach = 0.0f;
+	for (int i = 0; i < 3; i++) {
+		float r = 0.0f;
+		for (int j = 0; j < 3; j++)
+			r += fabs(xf(i,j));
+		reach = max(reach, 0.5f * g.cell * r);
 	}
+	int rings = max(1, int(ceil((reach + maxdist) / gother.cell)));
+#endif
 
-	o2.resize(nv2);
-	for (size_t i = 0; i < nv2; i++) {
-		o2[i] = 0;
-		point p = xf21 * s2->vertices[i];
+	int nc = g.ncells();
+#pragma omp parallel for schedule(dynamic, 64)
+	for (int c = 0; c < nc; c++) {
 #ifdef USE_GRID_FOR_OVERLAPS
-		if (!g1.overlaps(p))
+		if (!gother.overlaps(xf * g.centers[c], rings))
 			continue;
+#else
+		(void) gother;
 #endif
+		for (int k = g.cellstart[c]; k < g.cellstart[c+1]; k++) {
+			int i = g.cellpts[k];
 #ifdef USE_KD_FOR_OVERLAPS
-		const float *match = kd1->closest_to_pt(p, maxdist2);
-		if (!match)
-			continue;
-		if (!pointcloud1 &&
-		    s1->is_bdy((match - (const float *) &s1->vertices[0][0]) / 3))
-			continue;
+			point p = xf * s->vertices[i];
+			const float *match = kdother->closest_to_pt(p, maxdist2);
+			if (!match)
+				continue;
+			if (!pointcloud && other->is_bdy((match -
+			    (const float *) &other->vertices[0][0]) / 3))
+				continue;
 #endif
-		o2[i] = 1;
+			o[i] = 1;
+		}
 	}
+}
+
+
+// Determine which points on s1 and s2 overlap the other, filling in o1 and o2
+// Also fills in maxdist, if it is <= 0 on input
+void compute_overlaps(TriMesh *s1, TriMesh *s2,
+		      const xform &xf1, const xform &xf2,
+		      const KDtree *kd1, const KDtree *kd2,
+		      vector<float> &o1, vector<float> &o2,
+		      float &maxdist, int verbose)
+{
+	timestamp t = now();
+	s1->need_bbox();
+	s2->need_bbox();
+
+	// Cells are a few times the point spacing, and at least twice maxdist.
+	// If the scans' frames line up, a point within maxdist of the other
+	// scan is then at most a cell from it along each axis, even measured
+	// from the center of the point's cell, and mark_overlaps looks at the
+	// 27 cells around that center.  Under a rotation the center can be
+	// up to sqrt(3)/2 of a cell off along an axis, and it looks two cells
+	// out instead.
+	float spacing = 0.0f;
+	if (kd1 && kd2)
+		spacing = max(point_spacing(s1, kd1), point_spacing(s2, kd2));
+	float cell = OVERLAP_CELL * spacing;
+	vec size1 = s1->bbox.size(), size2 = s2->bbox.size();
+	float extent1 = max(max(size1[0], size1[1]), size1[2]);
+	float extent2 = max(max(size2[0], size2[1]), size2[2]);
+	if (!(cell > 0.0f))
+		cell = min(extent1, extent2) / 16.0f;
+	if (maxdist <= 0.0f)
+		maxdist = 0.5f * cell;
+	cell = max(cell, 2.0f * maxdist);
+
+	// Both grids need the same cells, including if they have to grow to
+	// fit the larger scan in the keys
+	cell = max(cell, max(extent1, extent2) / float(Grid::GRID_MAX - 4));
+
+	Grid g1(s1->vertices, s1->bbox, cell);
+	Grid g2(s2->vertices, s2->bbox, cell);
+	xform xf12 = inv(xf2) * xf1;
+	xform xf21 = inv(xf1) * xf2;
+	mark_overlaps(s1, g1, xf12, s2, g2, kd2, maxdist, o1);
+	mark_overlaps(s2, g2, xf21, s1, g1, kd1, maxdist, o2);
 	if (verbose > 1) {
 		dprintf("Computed overlaps in %.2f msec.\n",
 			(now() - t) * 1000.0);
@@ -214,11 +405,16 @@ void compute_overlaps(TriMesh *s1, TriMesh *s2,
 }
 
 
-// Select a number of points and find correspondences 
+// Select a number of points and find correspondences.  The samples are
+// drawn serially, so the random sequence does not depend on the number of
+// threads, then matched in parallel.  Each thread collects its pairs in its
+// own buffer; with a static schedule the threads get consecutive runs of
+// samples, so appending the buffers in order gives the serial result.
 static void select_and_match(TriMesh *s1, TriMesh *s2,
 			     const xform &xf1, const xform &xf2,
 			     const KDtree *kd2, const vector<float> &sampcdf1,
-			     float incr, float maxdist, int /* verbose */,
+			     float incr, unsigned &trand,
+			     float maxdist, int /* verbose */,
 			     vector<PtPair> &pairs, bool flip)
 {
 	xform xf1r = norm_xf(xf1);
@@ -227,83 +423,140 @@ static void select_and_match(TriMesh *s1, TriMesh *s2,
 	xform xf12r = norm_xf(xf12);
 	float maxdist2 = sqr(maxdist);
 
+	// Each step moves forward in the CDF, so binary search from the
+	// last sample rather than walking every vertex
+	vector<int> samples;
 	size_t i = 0;
 	float cval = 0.0f;
 	while (1) {
-		cval += incr * tinyrnd();
+		cval += incr * tinyrnd(trand);
 		if (cval >= 1.0f)
 			break;
-		while (sampcdf1[i] <= cval)
-			i++;
+		i = upper_bound(sampcdf1.begin() + i, sampcdf1.end(), cval) -
+			sampcdf1.begin();
 		cval = sampcdf1[i];
+		samples.push_back(i);
+	}
 
-		point p = xf12 * s1->vertices[i];
-		vec n = xf12r * s1->normals[i];
-
-		// Do the matching
-		bool pointcloud2 = (s2->faces.empty() && s2->tstrips.empty());
-		NormCompat nc(n, s2, pointcloud2);
-
-		const float *match = kd2->closest_to_pt(p, maxdist2, &nc);
-		if (!match)
-			continue;
-		int imatch = (match - (const float *) &(s2->vertices[0][0])) / 3;
-		if (!pointcloud2 && s2->is_bdy(imatch))
-			continue;
-
-		// Project both points into world coords and save 
-		if (flip) {
-			pairs.push_back(PtPair(xf2  * s2->vertices[imatch],
-					       xf1  * s1->vertices[i],
-					       xf2r * s2->normals[imatch]));
-		} else {
-			pairs.push_back(PtPair(xf1  * s1->vertices[i],
-					       xf2  * s2->vertices[imatch],
-					       xf1r * s1->normals[i]));
+	int nsamples = samples.size();
+	bool pointcloud2 = (s2->faces.empty() && s2->tstrips.empty());
+	vector< vector<PtPair> > thread_pairs(thread_count());
+#pragma omp parallel
+	{
+		vector<PtPair> &mypairs = thread_pairs[thread_id()];
+#pragma omp for schedule(static)
+		for (int j = 0; j < nsamples; j++) {
+			int isamp = samples[j];
+			point p = xf12 * s1->vertices[isamp];
+			vec n = xf12r * s1->normals[isamp];
+
+			// Do the matching
+			NormCompat nc(n, s2, pointcloud2);
+			const float *match = kd2->closest_to_pt(p, maxdist2, &nc);
+			if (!match)
+				continue;
+			int imatch = (match - (const float *) &(s2->vertices[0][0])) / 3;
+			if (!pointcloud2 && s2->is_bdy(imatch))
+				continue;
+
+			// Project both points into world coords and save 
+			if (flip) {
+				mypairs.push_back(PtPair(xf2  * s2->vertices[imatch],
+							 xf1  * s1->vertices[isamp],
+							 xf2r * s2->normals[imatch]));
+			} else {
+				mypairs.push_back(PtPair(xf1  * s1->vertices[isamp],
+							 xf2  * s2->vertices[imatch],
+							 xf1r * s1->normals[isamp]));
+			}
 		}
 	}
+	for (size_t t = 0; t < thread_pairs.size(); t++)
+		pairs.insert(pairs.end(), thread_pairs[t].begin(),
+			     thread_pairs[t].end());
 }
 
 
-// Compute ICP alignment matrix, including eigenvector decomposition
+// Partial sums of the point-to-plane normal equations
+struct ICPSums {
+	float A[6][6], b[6], err;
+};
+
+
+// Compute ICP alignment matrix, including eigenvector decomposition.
+// The sums are taken over fixed blocks of pairs in parallel and the blocks
+// added up in order, so the result does not depend on the number of threads.
 static void compute_ICPmatrix(const vector<PtPair> &pairs,
 			      float evec[6][6], float eval[6], float b[6],
 			      point &centroid, float &scale, float &err)
 {
-	size_t n = pairs.size();
-
+	int n = pairs.size();
+	int nblocks = (n + REDUCE_BLOCK - 1) / REDUCE_BLOCK;
+
+	vector<point> centroids(nblocks);
+#pragma omp parallel for if (nblocks > 1)
+	for (int blk = 0; blk < nblocks; blk++) {
+		int end = min(n, (blk + 1) * REDUCE_BLOCK);
+		for (int i = blk * REDUCE_BLOCK; i < end; i++)
+			centroids[blk] += pairs[i].p2;
+	}
 	centroid = point(0,0,0);
-	for (size_t i = 0; i < n; i++)
-		centroid += pairs[i].p2;
+	for (int blk = 0; blk < nblocks; blk++)
+		centroid += centroids[blk];
 	centroid /= float(n);
 
+	vector<float> scales(nblocks);
+#pragma omp parallel for if (nblocks > 1)
+	for (int blk = 0; blk < nblocks; blk++) {
+		int end = min(n, (blk + 1) * REDUCE_BLOCK);
+		float sum = 0.0f;
+		for (int i = blk * REDUCE_BLOCK; i < end; i++)
+			sum += dist2(pairs[i].p2, centroid);
+		scales[blk] = sum;
+	}
 	scale = 0.0f;
-	for (size_t i = 0; i < n; i++)
-		scale += dist2(pairs[i].p2, centroid);
+	for (int blk = 0; blk < nblocks; blk++)
+		scale += scales[blk];
 	scale /= float(n);
 	scale = 1.0f / sqrt(scale);
 
+	vector<ICPSums> sums(nblocks);
+#pragma omp parallel for if (nblocks > 1)
+	for (int blk = 0; blk < nblocks; blk++) {
+		ICPSums &s = sums[blk];
+		memset(&s, 0, sizeof(s));
+		int end = min(n, (blk + 1) * REDUCE_BLOCK);
+		for (int i = blk * REDUCE_BLOCK; i < end; i++) {
+			const point &p1 = pairs[i].p1;
+			const point &p2 = pairs[i].p2;
+			const vec &n = pairs[i].norm;
+
+			float d = (p1 - p2) DOT n;
+			d *= scale;
+			vec p2c = p2 - centroid;
+			p2c *= scale;
+			vec c = p2c CROSS n;
+
+			s.err += d * d;
+			float x[6] = { c[0], c[1], c[2], n[0], n[1], n[2] };
+			for (int j = 0; j < 6; j++) {
+				s.b[j] += d * x[j];
+				for (int k = 0; k < 6; k++)
+					s.A[j][k] += x[j] * x[k];
+			}
+		}
+	}
+
 	memset(&evec[0][0], 0, 6*6*sizeof(float));
 	memset(&b[0], 0, 6*sizeof(float));
-
 	err = 0.0f;
-	for (size_t i = 0; i < n; i++) {
-		const point &p1 = pairs[i].p1;
-		const point &p2 = pairs[i].p2;
-		const vec &n = pairs[i].norm;
-
-		float d = (p1 - p2) DOT n;
-		d *= scale;
-		vec p2c = p2 - centroid;
-		p2c *= scale;
-		vec c = p2c CROSS n;
-
-		err += d * d;
-		float x[6] = { c[0], c[1], c[2], n[0], n[1], n[2] };
+	for (int blk = 0; blk < nblocks; blk++) {
+		const ICPSums &s = sums[blk];
+		err += s.err;
 		for (int j = 0; j < 6; j++) {
-			b[j] += d * x[j];
+			b[j] += s.b[j];
 			for (int k = 0; k < 6; k++)
-				evec[j][k] += x[j] * x[k];
+				evec[j][k] += s.A[j][k];
 		}
 	}
 
@@ -440,13 +693,60 @@ void compute_scale(const vector<PtPair> &pairs, xform &alignxf,
 }
 
 
+// Recompute the sampling CDF of one mesh, weighting each point by how much
+// it constrains the alignment (given the inverse of the covariance from the
+// last iteration).  Returns false if no point has any weight.
+static bool update_cdf(const TriMesh *s, const xform &xf,
+		       const vector<float> &weights,
+		       const point &centroid, float scale,
+		       const float Cinv[6][6], vector<float> &sampcdf)
+{
+	xform xfr = norm_xf(xf);
+	int nv = s->vertices.size();
+#pragma omp parallel for
+	for (int i = 0; i < nv; i++) {
+		if (!weights[i]) {
+			sampcdf[i] = 0.0f;
+			continue;
+		}
+		point p = xf * s->vertices[i];
+		p -= centroid;
+		p *= scale;
+		vec n = xfr * s->normals[i];
+		vec c = p CROSS n;
+		float sum = 0.0f;
+		for (int j = 0; j < 6; j++) {
+			float tmp = Cinv[j][0] * c[0] + Cinv[j][1] * c[1] +
+				    Cinv[j][2] * c[2] + Cinv[j][3] * n[0] +
+				    Cinv[j][4] * n[1] + Cinv[j][5] * n[2];
+			if (j < 3)
+				sum += tmp * c[j];
+			else
+				sum += tmp * n[j-3];
+		}
+		sampcdf[i] = sum * weights[i];
+	}
+
+	for (int i = 1; i < nv; i++)
+		sampcdf[i] += sampcdf[i-1];
+	if (!sampcdf[nv-1])
+		return false;
+	float cscale = 1.0f / sampcdf[nv-1];
+#pragma omp parallel for
+	for (int i = 0; i < nv - 1; i++)
+		sampcdf[i] *= cscale;
+	sampcdf[nv-1] = 1.0f;
+	return true;
+}
+
+
 // Do one iteration of ICP
 static float ICP_iter(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 		      const KDtree *kd1, const KDtree *kd2,
 		      const vector<float> &weights1, const vector<float> &weights2,
 		      float &maxdist, int verbose,
 		      vector<float> &sampcdf1, vector<float> &sampcdf2,
-		      float &incr, bool update_cdfs,
+		      float &incr, unsigned &trand, bool update_cdfs,
 		      bool do_scale, bool do_affine)
 {
 	// Compute pairs
@@ -454,9 +754,9 @@ static float ICP_iter(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 	if (verbose > 1)
 		dprintf("maxdist = %f\n", maxdist);
 	vector<PtPair> pairs;
-	select_and_match(s1, s2, xf1, xf2, kd2, sampcdf1, incr,
+	select_and_match(s1, s2, xf1, xf2, kd2, sampcdf1, incr, trand,
 			 maxdist, verbose, pairs, false);
-	select_and_match(s2, s1, xf2, xf1, kd1, sampcdf2, incr,
+	select_and_match(s2, s1, xf2, xf1, kd1, sampcdf2, incr, trand,
 			 maxdist, verbose, pairs, true);
 
 	timestamp t2 = now();
@@ -536,73 +836,12 @@ static float ICP_iter(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 			Cinv[i][j] = x[j];
 	}
 
-	xform xf1r = norm_xf(xf1);
-	size_t n1 = s1->vertices.size();
-	for (size_t i = 0; i < n1; i++) {
-		sampcdf1[i] = 0.0;
-		if (!weights1[i])
-			continue;
-		point p = xf1 * s1->vertices[i];
-		p -= centroid;
-		p *= scale;
-		vec n = xf1r * s1->normals[i];
-		vec c = p CROSS n;
-		for (int j = 0; j < 6; j++) {
-			float tmp = Cinv[j][0] * c[0] + Cinv[j][1] * c[1] +
-				    Cinv[j][2] * c[2] + Cinv[j][3] * n[0] +
-				    Cinv[j][4] * n[1] + Cinv[j][5] * n[2];
-			if (j < 3)
-				sampcdf1[i] += tmp * c[j];
-			else
-				sampcdf1[i] += tmp * n[j-3];
-		}
-		sampcdf1[i] *= weights1[i];
-	}
-	for (size_t i = 1; i < n1; i++)
-		sampcdf1[i] += sampcdf1[i-1];
-	if (!sampcdf1[n1-1]) {
+	if (!update_cdf(s1, xf1, weights1, centroid, scale, Cinv, sampcdf1) ||
+	    !update_cdf(s2, xf2, weights2, centroid, scale, Cinv, sampcdf2)) {
 		if (verbose)
 			dprintf("No overlap.\n");
 		return -1.0f;
 	}
-	float cscale = 1.0f / sampcdf1[n1-1];
-	for (size_t i = 0; i < n1-1; i++)
-		sampcdf1[i] *= cscale;
-	sampcdf1[n1-1] = 1.0f;
-
-	xform xf2r = norm_xf(xf2);
-	size_t n2 = s2->vertices.size();
-	for (size_t i = 0; i < n2; i++) {
-		sampcdf2[i] = 0.0;
-		if (!weights2[i])
-			continue;
-		point p = xf2 * s2->vertices[i];
-		p -= centroid;
-		p *= scale;
-		vec n = xf2r * s2->normals[i];
-		vec c = p CROSS n;
-		for (int j = 0; j < 6; j++) {
-			float tmp = Cinv[j][0] * c[0] + Cinv[j][1] * c[1] +
-				    Cinv[j][2] * c[2] + Cinv[j][3] * n[0] +
-				    Cinv[j][4] * n[1] + Cinv[j][5] * n[2];
-			if (j < 3)
-				sampcdf2[i] += tmp * c[j];
-			else
-				sampcdf2[i] += tmp * n[j-3];
-		}
-		sampcdf2[i] *= weights2[i];
-	}
-	for (size_t i = 1; i < n2; i++)
-		sampcdf2[i] += sampcdf2[i-1];
-	cscale = 1.0f / sampcdf2[n2-1];
-	if (!sampcdf2[n2-1]) {
-		if (verbose)
-			dprintf("No overlap.\n");
-		return -1.0f;
-	}
-	for (size_t i = 0; i < n2-1; i++)
-		sampcdf2[i] *= cscale;
-	sampcdf2[n2-1] = 1.0f;
 
 	timestamp t5 = now();
 	if (verbose > 1) {
@@ -620,16 +859,16 @@ static float ICP_p2pt(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 		      const KDtree *kd1, const KDtree *kd2,
 		      float &maxdist, int verbose,
 		      vector<float> &sampcdf1, vector<float> &sampcdf2,
-		      float &incr, bool trans_only)
+		      float &incr, unsigned &trand, bool trans_only)
 {
 	// Compute pairs
 	timestamp t1 = now();
 	if (verbose > 1)
 		dprintf("maxdist = %f\n", maxdist);
 	vector<PtPair> pairs;
-	select_and_match(s1, s2, xf1, xf2, kd2, sampcdf1, incr,
+	select_and_match(s1, s2, xf1, xf2, kd2, sampcdf1, incr, trand,
 			 maxdist, verbose, pairs, false);
-	select_and_match(s2, s1, xf2, xf1, kd1, sampcdf2, incr,
+	select_and_match(s2, s1, xf2, xf1, kd1, sampcdf2, incr, trand,
 			 maxdist, verbose, pairs, true);
 
 	timestamp t2 = now();
@@ -718,13 +957,17 @@ static float ICP_p2pt(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 }
 
 
-// Do ICP.  Aligns mesh s2 to s1, updating xf2 with the new transform.
-// Returns alignment error, or -1 on failure
-float ICP(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
-	  const KDtree *kd1, const KDtree *kd2,
-	  vector<float> &weights1, vector<float> &weights2,
-	  float maxdist /* = 0.0f */, int verbose /* = 0 */,
-	  bool do_scale /* = false */, bool do_affine /* = false */)
+// The ICP driver.  The point-to-point iterations at the start are only
+// there to pull in a rough initial alignment.  When refining an alignment
+// that is already close (the finer levels of ICP_pyramid), they are
+// skipped, and the number of iterations is capped so that the sampling
+// CDFs are only computed once.
+// Updates maxdist to the value used in the last iteration.
+static float ICP_align(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
+		       const KDtree *kd1, const KDtree *kd2,
+		       vector<float> &weights1, vector<float> &weights2,
+		       float &maxdist, int verbose,
+		       bool do_scale, bool do_affine, bool refine)
 {
 	// Make sure we have everything precomputed
 	s1->need_normals();  s2->need_normals();
@@ -755,17 +998,20 @@ float ICP(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 	sampcdf2[nv2-1] = 1.0f;
 
 	// Do a few p2pt iterations
+	unsigned trand = 0;
 	float incr = 4.0f / DESIRED_PAIRS_EARLY;
-	for (int i = 0; i < 2; i++) {
+	for (int i = 0; !refine && i < 2; i++) {
 		if (ICP_p2pt(s1, s2, xf1, xf2, kd1, kd2, maxdist, verbose,
-			     sampcdf1, sampcdf2, incr, true) < 0.0f)
+			     sampcdf1, sampcdf2, incr, trand, true) < 0.0f)
 			return -1.0f;
 	}
-	for (int i = 0; i < 5; i++) {
+	for (int i = 0; !refine && i < 5; i++) {
 		if (ICP_p2pt(s1, s2, xf1, xf2, kd1, kd2, maxdist, verbose,
-			     sampcdf1, sampcdf2, incr, false) < 0.0f)
+			     sampcdf1, sampcdf2, incr, trand, false) < 0.0f)
 			return -1.0f;
 	}
+	if (refine)
+		incr = 4.0f / DESIRED_PAIRS;
 
 	// Do a point-to-plane iteration and update CDFs
 	if (weights1.size() != nv1 || weights2.size() != nv2)
@@ -773,7 +1019,7 @@ float ICP(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 				 weights1, weights2, maxdist, verbose);
 	float err = ICP_iter(s1, s2, xf1, xf2, kd1, kd2, weights1, weights2,
 			     maxdist, verbose, sampcdf1, sampcdf2,
-			     incr, true, false, false);
+			     incr, trand, true, false, false);
 	if (verbose > 1) {
 		timestamp tnow = now();
 		dprintf("Time for initial iterations: %.2f msec.\n\n",
@@ -795,7 +1041,7 @@ float ICP(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 			compute_overlaps(s1, s2, xf1, xf2, kd1, kd2,
 					 weights1, weights2, maxdist, verbose);
 		err = ICP_iter(s1, s2, xf1, xf2, kd1, kd2, weights1, weights2,
-			       maxdist, verbose, sampcdf1, sampcdf2, incr,
+			       maxdist, verbose, sampcdf1, sampcdf2, incr, trand,
 			       recompute, do_scale && !rigid_only,
 			       do_affine && !rigid_only);
 		if (verbose > 1) {
@@ -823,7 +1069,7 @@ float ICP(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 			err_delta_history.resize(TERM_HIST);
 			rigid_only = false;
 		}
-	} while (++iters < MAX_ITERS);
+	} while (++iters < (refine ? REFINE_ITERS : MAX_ITERS));
 
 	if (verbose > 1)
 		dprintf("Did %d iterations\n\n", iters);
@@ -835,7 +1081,7 @@ float ICP(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 	if (verbose > 1)
 		dprintf("Using incr = %f\n", incr);
 	err = ICP_iter(s1, s2, xf1, xf2, kd1, kd2, weights1, weights2,
-		       maxdist, verbose, sampcdf1, sampcdf2, incr,
+		       maxdist, verbose, sampcdf1, sampcdf2, incr, trand,
 		       false, do_scale, do_affine);
 	if (verbose > 1) {
 		timestamp tnow = now();
@@ -847,6 +1093,178 @@ float ICP(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 }
 
 
+// Do ICP.  Aligns mesh s2 to s1, updating xf2 with the new transform.
+// Returns alignment error, or -1 on failure
+float ICP(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
+	  const KDtree *kd1, const KDtree *kd2,
+	  vector<float> &weights1, vector<float> &weights2,
+	  float maxdist /* = 0.0f */, int verbose /* = 0 */,
+	  bool do_scale /* = false */, bool do_affine /* = false */)
+{
+	return ICP_align(s1, s2, xf1, xf2, kd1, kd2, weights1, weights2,
+			 maxdist, verbose, do_scale, do_affine, false);
+}
+
+
+// Replace the points (with normals) in each cell of a grid of the given
+// size by their average.  The cells of successive levels nest if the
+// cell size doubles and the origin stays the same.
+static TriMesh *voxel_downsample(const TriMesh *mesh, const point &origin,
+				 float cell)
+{
+	int nv = mesh->vertices.size();
+	float scale = 1.0f / cell;
+	vector<unsigned long long> keys(nv);
+#pragma omp parallel for
+	for (int i = 0; i < nv; i++) {
+		unsigned long long key = 0;
+		for (int j = 0; j < 3; j++) {
+			float c = (mesh->vertices[i][j] - origin[j]) * scale;
+			int ic = clamp(int(c), 0, (1 << 21) - 1);
+			key = (key << 21) | (unsigned long long) ic;
+		}
+		keys[i] = key;
+	}
+
+	// Number the cells in order of first appearance, using an
+	// open-addressing hash table.  Keys use 63 bits, so ~0 marks an
+	// empty slot.
+	const unsigned long long EMPTY = ~0ull;
+	int tbits = 1;
+	while ((size_t(1) << tbits) < 2 * (size_t) nv)
+		tbits++;
+	size_t tsize = size_t(1) << tbits;
+	vector<unsigned long long> tkeys(tsize, EMPTY);
+	vector<int> tcells(tsize);
+	vector<int> cellof(nv);
+	int ncells = 0;
+	for (int i = 0; i < nv; i++) {
+		unsigned long long key = keys[i];
+		size_t h = (size_t) ((key * 0x9e3779b97f4a7c15ull) >> (64 - tbits));
+		while (tkeys[h] != EMPTY && tkeys[h] != key)
+			h = (h + 1) & (tsize - 1);
+		if (tkeys[h] == EMPTY) {
+			tkeys[h] = key;
+			tcells[h] = ncells++;
+		}
+		cellof[i] = tcells[h];
+	}
+
+	// Normals are flipped to agree with the first in their cell, since
+	// point cloud normals need not be consistently oriented
+	TriMesh *down = new TriMesh;
+	down->vertices.resize(ncells);
+	down->normals.resize(ncells);
+	vector<int> counts(ncells);
+	vector<vec> firstnorms(ncells);
+	for (int i = 0; i < nv; i++) {
+		int c = cellof[i];
+		const vec &n = mesh->normals[i];
+		if (!counts[c]++)
+			firstnorms[c] = n;
+		down->vertices[c] += mesh->vertices[i];
+		if ((n DOT firstnorms[c]) >= 0.0f)
+			down->normals[c] += n;
+		else
+			down->normals[c] -= n;
+	}
+#pragma omp parallel for
+	for (int c = 0; c < ncells; c++) {
+		down->vertices[c] /= float(counts[c]);
+		normalize(down->normals[c]);
+	}
+	return down;
+}
+
+
+// Coarse-to-fine ICP.  Aligns mesh s2 to s1, updating xf2 with the new
+// transform.  Returns alignment error, or -1 on failure
+float ICP_pyramid(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
+		  const KDtree *kd1, const KDtree *kd2,
+		  int nlevels /* = 4 */, int verbose /* = 0 */,
+		  bool do_scale /* = false */, bool do_affine /* = false */)
+{
+	s1->need_normals();
+	s2->need_normals();
+	s1->need_bbox();
+	s2->need_bbox();
+
+	timestamp t = now();
+	vector<TriMesh *> levels1(1, s1), levels2(1, s2);
+	vector<const KDtree *> kds1(1, kd1), kds2(1, kd2);
+	vector<float> cells(1, max(point_spacing(s1, kds1[0]),
+				   point_spacing(s2, kds2[0])));
+
+	// Level k has cells 2^(k+1) times the spacing of the input points,
+	// so about 4^(k+1) times fewer points on a surface.  Stop once a level
+	// gets too small to give reliable pairs.
+	for (int k = 1; k <= nlevels && cells[0] > 0.0f; k++) {
+		float cell = cells[k-1] * ((k == 1) ? 4.0f : 2.0f);
+		TriMesh *d1 = voxel_downsample(levels1.back(), s1->bbox.min, cell);
+		TriMesh *d2 = voxel_downsample(levels2.back(), s2->bbox.min, cell);
+		if (d1->vertices.size() < PYRAMID_MIN_POINTS ||
+		    d2->vertices.size() < PYRAMID_MIN_POINTS) {
+			delete d1;
+			delete d2;
+			break;
+		}
+		levels1.push_back(d1);
+		levels2.push_back(d2);
+		kds1.push_back(new KDtree(d1->vertices));
+		kds2.push_back(new KDtree(d2->vertices));
+		cells.push_back(cell);
+	}
+	int top = levels1.size() - 1;
+	if (verbose > 1) {
+		dprintf("Built %d levels in %.2f msec.\n", top + 1,
+			(now() - t) * 1000.0);
+	}
+
+	// Only the coarsest level starts from scratch.  After that, the
+	// alignment is good to about the cell size of the level before.
+	float err = -1.0f;
+	for (int k = top; k >= 0; k--) {
+		if (verbose > 1) {
+			dprintf("Level %d: %lu and %lu points\n", k,
+				(unsigned long) levels1[k]->vertices.size(),
+				(unsigned long) levels2[k]->vertices.size());
+		}
+		float maxdist = (k == top) ? 0.0f : 2.0f * cells[k+1];
+		vector<float> weights1, weights2;
+		err = ICP_align(levels1[k], levels2[k], xf1, xf2,
+				kds1[k], kds2[k], weights1, weights2,
+				maxdist, verbose, do_scale, do_affine,
+				k < top);
+		if (err < 0.0f)
+			break;
+	}
+
+	// Level 0 belongs to the caller
+	for (int k = 1; k <= top; k++) {
+		delete kds1[k];
+		delete kds2[k];
+		delete levels1[k];
+		delete levels2[k];
+	}
+	return err;
+}
+
+
+// Same, building the full-resolution KDtrees here
+float ICP_pyramid(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
+		  int nlevels /* = 4 */, int verbose /* = 0 */,
+		  bool do_scale /* = false */, bool do_affine /* = false */)
+{
+	KDtree *kd1 = new KDtree(s1->vertices);
+	KDtree *kd2 = new KDtree(s2->vertices);
+	float err = ICP_pyramid(s1, s2, xf1, xf2, kd1, kd2, nlevels,
+				verbose, do_scale, do_affine);
+	delete kd2;
+	delete kd1;
+	return err;
+}
+
+
 // Easier-to-use interface to ICP
 float ICP(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 	  int verbose /* = 0 */,
@@ -0,0 +1,67 @@
+#ifndef ADJACENCY_H
+#define ADJACENCY_H
+/*
+Adjacency.h
+Compact per-vertex adjacency lists, stored as one offsets array and one
+indices array (CSR).  list[v] is a lightweight read-only view of the
+entries of v, so 1-ring loops written for vector< vector<int> > still work:
+
+	for (size_t i = 0; i < mesh->neighbors[v].size(); i++)
+		... mesh->neighbors[v][i] ...
+*/
+
+#include <vector>
+#include <cstddef>
+
+
+namespace trimesh {
+
+class IndexSpan {
+public:
+	typedef const int *const_iterator;
+	typedef const int *iterator;
+
+	IndexSpan() : first(0), count(0)
+		{}
+	IndexSpan(const int *first_, size_t count_) : first(first_), count(count_)
+		{}
+
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+	const int &operator[] (size_t i) const { return first[i]; }
+	const int &front() const { return first[0]; }
+	const int &back() const { return first[count-1]; }
+	const_iterator begin() const { return first; }
+	const_iterator end() const { return first + count; }
+
+private:
+	const int *first;
+	size_t count;
+};
+
+class AdjacencyList {
+public:
+	// offsets has one entry per vertex plus one, the entries of
+	// vertex v are indices[offsets[v]] .. indices[offsets[v+1]-1]
+	::std::vector<int> offsets;
+	::std::vector<int> indices;
+
+	// Empty means "not computed", as with the other need_* structures
+	bool empty() const { return offsets.empty(); }
+	size_t size() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+	IndexSpan operator[] (size_t v) const
+	{
+		return IndexSpan(indices.data() + offsets[v],
+		                 offsets[v+1] - offsets[v]);
+	}
+	// Releases the memory, not just the contents
+	void clear()
+	{
+		::std::vector<int>().swap(offsets);
+		::std::vector<int>().swap(indices);
+	}
+};
+
+}; // namespace trimesh
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef GLOBALREG_H
+#define GLOBALREG_H
+/*
+GlobalReg.h
+Global registration of many scans.
+
+Pairs of scans that overlap are found with bounding boxes and find_overlap,
+and aligned with ICP.  Each pairwise alignment is then turned into a set of
+corresponding points, and the transforms of all the scans are solved for
+together so that those points agree as well as possible (a pose graph,
+solved by sparse least squares).
+*/
+
+#include "TriMesh.h"
+#include "XForm.h"
+#include <vector>
+
+
+namespace trimesh {
+
+// Globally register the scans in meshes.  xfs holds the initial transform
+// of each scan (missing ones are the identity) and is updated with the
+// result.  Pairs of scans whose overlap area is at least min_overlap of
+// the smaller one are aligned with ICP.  The first scan of each connected
+// group stays where it is.  Overlap is measured on surface area, so the
+// scans should be meshes.
+// Returns the number of pairs used, or -1 on failure, in which case xfs
+// keeps its initial transforms.
+extern int global_reg(const ::std::vector<TriMesh *> &meshes,
+		      ::std::vector<xform> &xfs,
+		      float min_overlap = 0.1f, int verbose = 0);
+
+}; // namespace trimesh
+
+#endif
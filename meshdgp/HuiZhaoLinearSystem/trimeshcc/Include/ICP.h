@@ -27,6 +27,8 @@ extern void compute_overlaps(TriMesh *s1, TriMesh *s2,
 // Returns alignment error, or -1 on failure.
 // Pass in 0 for maxdist to figure it out...
 // Pass in vector<float>() for weights to figure it out...
+// The random sampling restarts with each call, so the result does not
+// depend on earlier calls, and calls can run in parallel.
 extern float ICP(TriMesh *s1, TriMesh *s2,
 		 const xform &xf1, xform &xf2,
 		 const KDtree *kd1, const KDtree *kd2,
@@ -34,6 +36,22 @@ extern float ICP(TriMesh *s1, TriMesh *s2,
 		 float maxdist = 0.0f, int verbose = 0,
 		 bool do_scale = false, bool do_affine = false);
 
+// Coarse-to-fine ICP.  Builds up to nlevels voxel-downsampled copies of
+// each mesh (each with about 4x fewer points than the one before), aligns
+// the coarsest pair from scratch, then refines the alignment at each finer
+// level and finally at full resolution, using kd1 and kd2 there.
+extern float ICP_pyramid(TriMesh *s1, TriMesh *s2,
+			 const xform &xf1, xform &xf2,
+			 const KDtree *kd1, const KDtree *kd2,
+			 int nlevels = 4, int verbose = 0,
+			 bool do_scale = false, bool do_affine = false);
+
+// Same, building the full-resolution KDtrees itself
+extern float ICP_pyramid(TriMesh *s1, TriMesh *s2,
+			 const xform &xf1, xform &xf2,
+			 int nlevels = 4, int verbose = 0,
+			 bool do_scale = false, bool do_affine = false);
+
 // Easier-to-use interface to ICP
 extern float ICP(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 		 int verbose = 0,
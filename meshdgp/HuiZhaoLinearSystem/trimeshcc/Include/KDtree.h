@@ -17,9 +17,30 @@ namespace trimesh {
 
 class KDtree {
 private:
-	class Node;
-	Node *root;
-	void build(const float *ptlist, size_t n);
+	// Nodes are stored depth-first: the first child of an interior node
+	// follows it, and child2 gives the second.  A leaf has at most 8
+	// points, consecutive in x/y/z.
+	struct Node {
+		float lo[3], hi[3]; // Bounding box of the points below
+		int child2;         // 0 for a leaf
+		union {
+			int start;  // Leaf: first point
+			int axis;   // Interior: split axis
+		};
+	};
+
+	const float *ptlist;
+	::std::vector<Node> nodes;
+	// Points in leaf order (padded to a whole leaf) and their numbers
+	// in ptlist
+	::std::vector<float> x, y, z;
+	::std::vector<int> ids;
+
+	struct BuildPoint;
+	void build(const float *pts, size_t n);
+	void build_node(BuildPoint *pts, size_t n, size_t node, size_t start,
+			const float *box);
+	template <class Query> void walk(Query &q) const;
 
 public:
 	// Compatibility function for closest-compatible-point searches
@@ -37,7 +58,6 @@ public:
 	template <class T> KDtree(const ::std::vector<T> &v)
 		{ build((const float *) &v[0], v.size()); }
 
-	// Destructor - recursively frees the tree
 	~KDtree();
 
 	// The queries: returns closest point to a point or a ray,
@@ -55,6 +75,30 @@ public:
 				  const float *p,
 				  float maxdist2 = 0.0f,
 				  const CompatFunc *iscompat = NULL) const;
+
+	// Find all the points within sqrt(maxdist2), in no particular order
+	void find_in_radius(::std::vector<const float *> &pts,
+			    const float *p,
+			    float maxdist2,
+			    const CompatFunc *iscompat = NULL) const;
+
+	// Batch queries for the n points at qpts (3*n floats), run in
+	// parallel and in Morton order.  Results are the numbers of points in
+	// the list the tree was built from, or -1 for none.
+	// closest gets n entries, knn gets k per query point (nearest first,
+	// padded with -1), and the points within sqrt(maxdist2) of query
+	// point i are found[starts[i]] through found[starts[i+1]-1] (offsets
+	// are size_t, since the total can pass 2^31 for large radii).
+	void closest_to_pts(const float *qpts, size_t n,
+			    int *closest,
+			    float maxdist2 = 0.0f) const;
+	void find_k_closest_to_pts(const float *qpts, size_t n,
+				   int k, int *knn,
+				   float maxdist2 = 0.0f) const;
+	void find_in_radius_pts(const float *qpts, size_t n,
+				float maxdist2,
+				::std::vector<size_t> &starts,
+				::std::vector<int> &found) const;
 };
 
 }; // namespace trimesh
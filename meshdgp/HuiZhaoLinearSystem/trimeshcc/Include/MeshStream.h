@@ -0,0 +1,193 @@
+#ifndef MESHSTREAM_H
+#define MESHSTREAM_H
+/*
+MeshStream.h
+Out-of-core processing of meshes too big to read with TriMesh::read.
+
+MeshReader hands out a PLY, OBJ or binary STL file as a sequence of
+chunks of vertices and faces, and MeshWriter writes a binary PLY file
+chunk by chunk, so that per-element operators (stream_xform, stream_clip,
+stream_stats) run in memory bounded by the chunk size.
+
+Operators that need neighborhoods go through SpatialChunks, which sorts a
+mesh into spatially coherent pieces in temporary files.  Each piece loads
+as a small TriMesh with every face touching its own vertices, so one-ring
+quantities of those vertices (e.g. stream_normals) come out exactly as
+they would for the whole mesh.
+*/
+
+#include "TriMesh.h"
+#include "XForm.h"
+#include <cstdio>
+
+
+namespace trimesh {
+
+// A run of consecutive vertices and faces.  Face indices refer to the
+// whole mesh.  normals is either empty or as long as vertices.
+struct MeshChunk {
+	size_t first_vertex, first_face;
+	::std::vector<point> vertices;
+	::std::vector<vec> normals;
+	::std::vector<TriMesh::Face> faces;
+
+	MeshChunk() : first_vertex(0), first_face(0)
+		{}
+	void clear()
+	{
+		vertices.clear(); normals.clear(); faces.clear();
+	}
+};
+
+
+class MeshReader {
+public:
+	MeshReader();
+	~MeshReader();
+
+	// Opens a PLY (ascii or binary), OBJ or binary STL file.  Chunks
+	// hold up to chunk_size vertices and faces in all.  Only v and f
+	// lines of an OBJ file are read; its vn normals are not.
+	bool open(const char *filename, size_t chunk_size = 1 << 20);
+	void close();
+
+	// Reads the next chunk.  Returns false at the end of the file or
+	// on an error, which failed() tells apart.  Polygons are split into
+	// fans, since the vertices of earlier chunks are gone.
+	bool next(MeshChunk &chunk);
+	bool failed() const { return error; }
+
+	// Vertices and faces read so far
+	size_t vertices_read() const { return nverts; }
+	size_t faces_read() const { return nfaces; }
+
+private:
+	struct PlyProperty {
+		int type, count_type;
+		::std::string name;
+	};
+	struct PlyElement {
+		::std::string name;
+		size_t count;
+		::std::vector<PlyProperty> props;
+	};
+	enum { FORMAT_PLY, FORMAT_OBJ, FORMAT_STL } format;
+
+	FILE *f;
+	size_t chunk_size, nverts, nfaces;
+	bool error;
+
+	// PLY state
+	bool binary, need_swap;
+	::std::vector<PlyElement> elements;
+	size_t elem, elem_left;
+	::std::vector<unsigned char> buf;
+	size_t buf_pos, buf_len;
+
+	// STL state
+	size_t stl_left;
+
+	bool open_ply();
+	bool next_ply(MeshChunk &chunk);
+	bool next_obj(MeshChunk &chunk);
+	bool next_stl(MeshChunk &chunk);
+	bool get_bytes(void *p, size_t n);
+	bool get_value(int type, double &val);
+
+	MeshReader(const MeshReader &);
+	MeshReader &operator = (const MeshReader &);
+};
+
+
+// Writes a native-endian binary PLY file.  Vertices go straight to the
+// file; faces are kept in a temporary file and appended by close(),
+// which also fills in the counts in the header.
+class MeshWriter {
+public:
+	MeshWriter();
+	~MeshWriter();
+
+	bool open(const char *filename, bool write_normals = false);
+	// Appends the vertices (and normals) and faces of the chunk.  Its
+	// first_vertex and first_face are not looked at.
+	bool write(const MeshChunk &chunk);
+	bool close();
+
+	size_t vertices_written() const { return nverts; }
+	size_t faces_written() const { return nfaces; }
+
+private:
+	FILE *f, *facefile;
+	bool normals;
+	size_t nverts, nfaces;
+	long vert_count_pos, face_count_pos;
+	::std::vector<unsigned char> buf;
+
+	MeshWriter(const MeshWriter &);
+	MeshWriter &operator = (const MeshWriter &);
+};
+
+
+class BucketFile;
+
+// A mesh sorted into pieces of at most max_verts vertices, each covering a
+// run of cells along a Morton curve through the bounding box.  A cell with
+// more than max_verts vertices is split into pieces in input order, so
+// those pieces need not be spatially compact.  Vertices are renumbered
+// piece by piece; piece k owns vertices first(k) through first(k+1)-1 in
+// the new order.
+class SpatialChunks {
+public:
+	SpatialChunks();
+	~SpatialChunks();
+
+	// Reads the whole mesh from "in" once.  Peak memory is one int per
+	// vertex plus a few chunks.
+	bool build(MeshReader *in, size_t max_verts);
+
+	int size() const { return (int) starts.size() - 1; }
+	size_t first(int k) const { return starts[k]; }
+
+	// Loads piece k: its own nowned vertices first, then the vertices of
+	// other pieces used by its faces, and every face with at least one
+	// vertex of its own.  ids gets the new number of each vertex.
+	bool load(int k, TriMesh *mesh, ::std::vector<int> &ids, int &nowned) const;
+
+private:
+	::std::vector<size_t> starts;
+	BucketFile *verts, *faces, *ghosts;
+
+	void free_buckets();
+
+	SpatialChunks(const SpatialChunks &);
+	SpatialChunks &operator = (const SpatialChunks &);
+};
+
+
+// Summary of a streamed mesh.  centroid is the mean of the vertices.
+struct MeshStats {
+	size_t nverts, nfaces;
+	box bbox;
+	point centroid;
+};
+
+
+// Per-chunk operators.  Each reads "in" to the end and writes the result
+// to "out" as it goes.
+
+// Transform vertices, and normals if any
+extern bool stream_xform(MeshReader *in, MeshWriter *out, const xform &xf);
+
+// Drop vertices outside the box, and faces using them, as clip() does.
+// Faces must come after their vertices.
+extern bool stream_clip(MeshReader *in, MeshWriter *out, const box &b);
+
+// Counts, bounding box and centroid
+extern bool stream_stats(MeshReader *in, MeshStats &stats);
+
+// Vertices with normals, in the order of the pieces, and each face once
+extern bool stream_normals(const SpatialChunks *chunks, MeshWriter *out);
+
+}; // namespace trimesh
+
+#endif
@@ -11,6 +11,7 @@ Class for triangle meshes.
 #include "Vec.h"
 #include "Box.h"
 #include "Color.h"
+#include "Adjacency.h"
 #include <vector>
 #include <string>
 #ifndef M_PIf
@@ -20,6 +21,32 @@ Class for triangle meshes.
 
 namespace trimesh {
 
+class TriMesh;
+
+// Structure-of-arrays copy of a mesh's geometry, for the per-face SIMD
+// kernels of need_normals, need_pointareas and need_curvatures (see
+// TriMesh_soa.h)
+struct TriMeshSoA {
+	// Vertex coordinates
+	::std::vector<float> x, y, z;
+	// Vertex indices of each face
+	::std::vector<int> f0, f1, f2;
+
+	TriMeshSoA() {}
+	explicit TriMeshSoA(const TriMesh *mesh) { build(mesh); }
+	void build(const TriMesh *mesh);
+	// Copy the current positions of the given vertices
+	void update(const TriMesh *mesh, const ::std::vector<int> &verts);
+	void clear()
+	{
+		x.clear(); y.clear(); z.clear();
+		f0.clear(); f1.clear(); f2.clear();
+	}
+	int nverts() const { return x.size(); }
+	int nfaces() const { return f0.size(); }
+};
+
+
 class TriMesh {
 public:
 	//
@@ -107,13 +134,37 @@ public:
 
 	// Connectivity structures:
 	//  For each vertex, all neighboring vertices
-	::std::vector< ::std::vector<int> > neighbors;
+	AdjacencyList neighbors;
 	//  For each vertex, all neighboring faces
-	::std::vector< ::std::vector<int> > adjacentfaces;
+	AdjacencyList adjacentfaces;
 	//  For each face, the three faces attached to its edges
 	//  (for example, across_edge[3][2] is the number of the face
 	//   that's touching the edge opposite vertex 2 of face 3)
 	::std::vector<Face> across_edge;
+	//  Each edge once, as (lower vertex, upper vertex), sorted.  Built
+	//  along with across_edge.
+	::std::vector<ivec2> edges;
+	//  Edges used by more than two faces, or by two faces of opposite
+	//  orientation (indices into edges).  across_edge is -1 across them.
+	::std::vector<int> nonmanifold_edges;
+	//  Corner table: corner 3*f+j is vertex j of face f.
+	//  opposite_corner[c] is the corner on the other side of the edge
+	//  facing c (-1 on boundary and non-manifold edges).
+	//  vertex_corner[v] is a corner of v -- on the boundary, the first
+	//  one of its fan, so that corner_swing reaches all the others.
+	::std::vector<int> opposite_corner;
+	::std::vector<int> vertex_corner;
+
+	// Vertices moved since the differential quantities were computed.
+	// update_dirty() refreshes only the regions around them.
+	::std::vector<int> dirty_verts;
+
+	// Structure-of-arrays mirror of vertices and faces, built by
+	// need_soa() and shared by need_normals, need_pointareas and
+	// need_curvatures.  The functions here that move vertices or change
+	// faces drop it, and update_* refresh the moved vertices; code that
+	// edits vertices or faces by hand should call soa.clear().
+	TriMeshSoA soa;
 
 	//
 	// Compute all this stuff...
@@ -140,6 +191,69 @@ public:
 	void need_neighbors();
 	void need_adjacentfaces();
 	void need_across_edge();
+	void need_edges();
+	void need_corners();
+	void need_soa();
+
+	//
+	// Corner table traversal and local edits.  The edits keep the corner
+	// table up to date in constant time (collapse also relabels the fan
+	// of the removed vertex) and drop the other connectivity structures.
+	// Link conditions are left to the caller.
+	//
+	static int corner_next(int c)
+	{
+		return (c % 3 == 2) ? c - 2 : c + 1;
+	}
+	static int corner_prev(int c)
+	{
+		return (c % 3 == 0) ? c + 2 : c - 1;
+	}
+	int corner_vertex(int c) const
+	{
+		return faces[c/3][c%3];
+	}
+	// Next and previous corner of the same vertex around its fan,
+	// or -1 at a boundary
+	int corner_swing(int c) const
+	{
+		int o = opposite_corner[corner_next(c)];
+		return (o < 0) ? -1 : corner_next(o);
+	}
+	int corner_unswing(int c) const
+	{
+		int o = opposite_corner[corner_prev(c)];
+		return (o < 0) ? -1 : corner_prev(o);
+	}
+	// Flip the edge facing corner c.  Returns false for boundary edges.
+	bool flip_edge(int c);
+	// Split the edge facing corner c at a new vertex p, adding one face
+	// on each side.  Returns the new vertex.
+	int split_edge(int c, const point &p);
+	// Collapse the edge facing corner c onto the vertex of
+	// corner_next(c), removing its one or two faces.  The vertex of
+	// corner_prev(c) is left unused.  Returns the remaining vertex.
+	int collapse_edge(int c);
+
+	//
+	// Incremental recomputation after moving some vertices.  Each one
+	// redoes only the faces whose values can have changed and gives the
+	// same result as a full recompute; quantities that were never
+	// computed are computed in full.  Connectivity must be unchanged.
+	//
+	void mark_dirty(int v)
+	{
+		dirty_verts.push_back(v);
+	}
+	void update_normals(const ::std::vector<int> &verts);
+	void update_pointareas(const ::std::vector<int> &verts);
+	void update_curvatures(const ::std::vector<int> &verts);
+	void update_dcurv(const ::std::vector<int> &verts);
+	void update_dirty();
+	// Faces touching the given vertices, and vertices of the given
+	// faces.  Both results are sorted and without repeats.
+	void faces_around(const ::std::vector<int> &verts, ::std::vector<int> &result);
+	void verts_of(const ::std::vector<int> &facelist, ::std::vector<int> &result);
 
 	//
 	// Delete everything
@@ -155,6 +269,10 @@ public:
 		cornerareas.clear(); pointareas.clear();
 		bbox.valid = bsphere.valid = false;
 		neighbors.clear(); adjacentfaces.clear(); across_edge.clear();
+		edges.clear(); nonmanifold_edges.clear();
+		opposite_corner.clear(); vertex_corner.clear();
+		dirty_verts.clear();
+		soa.clear();
 	}
 
 	//
@@ -168,6 +286,9 @@ public:
 	bool write(const char *filename);
 	bool write(const ::std::string &filename);
 
+	// Byte order of this machine, for the binary formats
+	static bool we_are_little_endian();
+
 
 	//
 	// Useful queries
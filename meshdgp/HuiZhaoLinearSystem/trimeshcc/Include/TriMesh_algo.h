@@ -193,10 +193,25 @@ extern void find_overlap(TriMesh *mesh1, TriMesh *mesh2,
 	const KDtree *kd1, const KDtree *kd2,
 	float &area, float &rmsdist);
 
+// The above use up to 10000 vertices of each mesh.  This evaluates nsamp
+// of them (all of them if nsamp <= 0), in parallel.  With to_surface, the
+// distances are to the closest points on the faces of the other mesh,
+// found with a bounding volume hierarchy, rather than to the tangent
+// planes at its closest vertices.
+extern void find_overlap(TriMesh *mesh1, TriMesh *mesh2,
+	const xform &xf1, const xform &xf2,
+	const KDtree *kd1, const KDtree *kd2,
+	float &area, float &rmsdist,
+	int nsamp, bool to_surface = false);
+
 // Find separate mesh vertices that should be "shared": they lie on separate
 // connected components, but they are within "tol" of each other.
 extern void shared(TriMesh *mesh, float tol);
 
+// Merge all vertices within "tol" of each other, whatever their components,
+// and remove the faces that collapse.
+extern void weld_vertices(TriMesh *mesh, float tol);
+
 }; // namespace trimesh
 
 #endif
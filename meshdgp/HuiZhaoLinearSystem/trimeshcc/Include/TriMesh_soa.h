@@ -0,0 +1,50 @@
+#ifndef TRIMESH_SOA_H
+#define TRIMESH_SOA_H
+/*
+TriMesh_soa.h
+The per-face kernels of need_normals, need_pointareas and need_curvatures,
+written against a mesh's structure-of-arrays mirror (TriMeshSoA, in
+TriMesh.h).
+
+When compiled with AVX2 (e.g. -march=native) the kernels process 8 faces
+per step; otherwise the same code runs one face at a time.  Faces are
+handed out in fixed blocks of 8, so the results do not depend on the
+number of threads.
+*/
+
+#include "TriMesh.h"
+
+
+namespace trimesh {
+
+// Number of faces processed per SIMD step (1 without AVX2)
+int soa_width();
+
+// Weighted face normal at every corner, cornernormals[3*face+corner]
+void soa_corner_normals(const TriMeshSoA &soa, ::std::vector<vec> &cornernormals);
+
+// Voronoi corner areas, cornerareas[face][corner]
+void soa_corner_areas(const TriMeshSoA &soa, ::std::vector<vec> &cornerareas);
+
+// Per-face curvature tensor fit, projected to each corner's vertex frame
+// and weighted by its corner area: cornercurv[3*face+corner] = (c1, c12, c2).
+// Faces whose fit is singular contribute zero.
+void soa_corner_curvatures(const TriMeshSoA &soa,
+	const ::std::vector<vec> &normals,
+	const ::std::vector<vec> &pdir1, const ::std::vector<vec> &pdir2,
+	const ::std::vector<vec> &cornerareas,
+	const ::std::vector<float> &pointareas,
+	::std::vector<vec> &cornercurv);
+
+// The same kernels for a list of faces, run directly on the mesh arrays.
+// Used by the incremental update_* functions; corner k of faces[i] goes
+// to out[3*i+k].  corner_areas_at writes mesh->cornerareas in place.
+void corner_normals_at(const TriMesh *mesh, const ::std::vector<int> &faces,
+	::std::vector<vec> &cornernormals);
+void corner_areas_at(TriMesh *mesh, const ::std::vector<int> &faces);
+void corner_curvatures_at(const TriMesh *mesh, const ::std::vector<int> &faces,
+	::std::vector<vec> &cornercurv);
+
+}; // namespace trimesh
+
+#endif
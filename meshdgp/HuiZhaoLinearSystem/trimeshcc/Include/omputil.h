@@ -0,0 +1,40 @@
+#ifndef OMPUTIL_H
+#define OMPUTIL_H
+/*
+omputil.h
+Number of OpenMP threads and the number of the current one, falling back
+to a single thread when built without OpenMP.  For per-thread buffers
+inside the library.
+*/
+
+
+#ifdef _OPENMP
+# include <omp.h>
+#endif
+
+
+namespace trimesh {
+
+// Most threads a parallel region can use
+static inline int thread_count()
+{
+#ifdef _OPENMP
+	return omp_get_max_threads();
+#else
+	return 1;
+#endif
+}
+
+// Number of the calling thread, from 0 to thread_count() - 1
+static inline int thread_id()
+{
+#ifdef _OPENMP
+	return omp_get_thread_num();
+#else
+	return 0;
+#endif
+}
+
+}; // namespace trimesh
+
+#endif
@@ -5,17 +5,41 @@ Princeton University
 KDtree.cc
 A K-D tree for points, with limited capabilities (find nearest point to
 a given point, or to a ray).
+
+The nodes live in one array, and the points are copied into leaf order,
+so a query walks contiguous memory instead of chasing pointers.  Each node
+splits its points along the longest axis of its box, after half of its
+leaves' worth of points.  All leaves but the last are then full, and where
+a subtree goes in the arrays follows from its size alone, so the two
+halves can be built as independent OpenMP tasks.  Leaves are scanned by
+fixed-length loops that the compiler turns into SIMD code.
+
+Batch queries sort their points along a Morton curve, so that consecutive
+queries walk mostly the same nodes, and hand out blocks of them to threads.
 */
 
 #include <cstring>
 #include <cmath>
+#include <cfloat>
 #include <vector>
 #include <utility>
 #include <algorithm>
 #include "KDtree.h"
-#include "mempool.h"
 using namespace std;
 
+// Points per leaf
+#define KD_LEAF_SIZE 8
+// Smaller subtrees are built by the task that split them off
+#define KD_TASK_CUTOFF 32768
+// Deeper than any tree: subtrees halve in size
+#define KD_MAX_DEPTH 64
+// Queries per block of a batch
+#define KD_BATCH_BLOCK 256
+
+#if defined(_OPENMP) && _OPENMP >= 200805
+#define KD_TASKS
+#endif
+
 
 namespace trimesh {
 
@@ -25,11 +49,6 @@ static inline float sqr(float x)
 	return x*x;
 }
 
-static inline float dist2(const float *x, const float *y)
-{
-	return sqr(x[0]-y[0]) + sqr(x[1]-y[1]) + sqr(x[2]-y[2]);
-}
-
 static inline float dist2ray2(const float *x, const float *p, const float *d)
 {
 	float xp0 = x[0]-p[0], xp1 = x[1]-p[1], xp2 = x[2]-p[2];
@@ -38,288 +57,379 @@ static inline float dist2ray2(const float *x, const float *p, const float *d)
 }
 
 
-// A point together with a distance - default comparison is by "first",
-// i.e., distance
-typedef pair<float, const float *> pt_with_d;
-
-
-// Class for nodes in the K-D tree
-class KDtree::Node {
-private:
-	static PoolAlloc memPool;
-
-public:
-	// A place to put all the stuff required while traversing the K-D
-	// tree, so we don't have to pass tons of variables at each fcn call
-	struct Traversal_Info {
-		const float *p, *dir;
-		const float *closest;
-		float closest_d, closest_d2;
-		const KDtree::CompatFunc *iscompat;
-		size_t k;
-		vector<pt_with_d> knn;
-	};
-
-	enum { MAX_PTS_PER_NODE = 8 };
-
-
-	// The node itself
-
-	int npts; // If this is 0, intermediate node.  If nonzero, leaf.
-
-	union {
-		struct {
-			float center[3];
-			float r;
-			int splitaxis;
-			Node *child1, *child2;
-		} node;
-		struct {
-			const float *p[MAX_PTS_PER_NODE];
-		} leaf;
-	};
-
-	Node(const float **pts, size_t n);
-	~Node();
-
-	void find_closest_to_pt(Traversal_Info &ti) const;
-	void find_k_closest_to_pt(Traversal_Info &ti) const;
-	void find_closest_to_ray(Traversal_Info &ti) const;
-
-	void *operator new(size_t n) { return memPool.alloc(n); }
-	void operator delete(void *p, size_t n) { memPool.free(p,n); }
+// A point being sorted into the tree, and its number in ptlist
+struct KDtree::BuildPoint {
+	float p[3];
+	int id;
 };
 
-
-// Class static variable
-PoolAlloc KDtree::Node::memPool(sizeof(KDtree::Node));
+template <class P>
+struct CoordLess {
+	int axis;
+	CoordLess(int axis_) : axis(axis_) {}
+	bool operator () (const P &a, const P &b) const
+		{ return a.p[axis] < b.p[axis]; }
+};
 
 
-// Create a KD tree from the points pointed to by the array pts
-KDtree::Node::Node(const float **pts, size_t n)
+// Build the subtree for the n points at pts, with its root at nodes[node]
+// and its points at x/y/z[start].  The split axis is the longest one of
+// box, which holds the points but need not be tight; the node gets the
+// tight box, gathered from its children.
+void KDtree::build_node(BuildPoint *pts, size_t n, size_t node, size_t start,
+			const float *box)
 {
+	Node &nd = nodes[node];
+
 	// Leaf nodes
-	if (n <= MAX_PTS_PER_NODE) {
-		npts = n;
-		memcpy(leaf.p, pts, n * sizeof(float *));
+	if (n <= KD_LEAF_SIZE) {
+		nd.child2 = 0;
+		nd.start = start;
+		for (int j = 0; j < 3; j++)
+			nd.lo[j] = nd.hi[j] = pts[0].p[j];
+		for (size_t i = 0; i < n; i++) {
+			for (int j = 0; j < 3; j++) {
+				nd.lo[j] = min(nd.lo[j], pts[i].p[j]);
+				nd.hi[j] = max(nd.hi[j], pts[i].p[j]);
+			}
+			x[start+i] = pts[i].p[0];
+			y[start+i] = pts[i].p[1];
+			z[start+i] = pts[i].p[2];
+			ids[start+i] = pts[i].id;
+		}
 		return;
 	}
 
-
-	// Else, interior nodes
-	npts = 0;
-
-	// Find bbox
-	float xmin = pts[0][0], xmax = pts[0][0];
-	float ymin = pts[0][1], ymax = pts[0][1];
-	float zmin = pts[0][2], zmax = pts[0][2];
-	for (size_t i = 1; i < n; i++) {
-		if (pts[i][0] < xmin)  xmin = pts[i][0];
-		if (pts[i][0] > xmax)  xmax = pts[i][0];
-		if (pts[i][1] < ymin)  ymin = pts[i][1];
-		if (pts[i][1] > ymax)  ymax = pts[i][1];
-		if (pts[i][2] < zmin)  zmin = pts[i][2];
-		if (pts[i][2] > zmax)  zmax = pts[i][2];
-	}
-
-	// Find node center and size
-	node.center[0] = 0.5f * (xmin+xmax);
-	node.center[1] = 0.5f * (ymin+ymax);
-	node.center[2] = 0.5f * (zmin+zmax);
-	float dx = xmax-xmin;
-	float dy = ymax-ymin;
-	float dz = zmax-zmin;
-	node.r = 0.5f * sqrt(sqr(dx) + sqr(dy) + sqr(dz));
-
-	// Find longest axis
-	node.splitaxis = 2;
+	// Else, interior nodes.  Find longest axis
+	float dx = box[3] - box[0];
+	float dy = box[4] - box[1];
+	float dz = box[5] - box[2];
+	int splitaxis = 2;
 	if (dx > dy) {
 		if (dx > dz)
-			node.splitaxis = 0;
+			splitaxis = 0;
 	} else {
 		if (dy > dz)
-			node.splitaxis = 1;
+			splitaxis = 1;
 	}
 
-	// Partition
-	const float splitval = node.center[node.splitaxis];
-	const float **left = pts, **right = pts + n - 1;
-	while (1) {
-		while ((*left)[node.splitaxis] < splitval)
-			left++;
-		while ((*right)[node.splitaxis] > splitval)
-			right--;
-		if (right <= left)
-			break;
-		swap(*left, *right);
-		left++; right--;
-	}
+	// Partition, giving the first child half of the leaves (rounded up)
+	// and all of them full.  The first child's subtree has 2*leaves-1
+	// nodes, so the second child comes right after it.
+	size_t nleaves = (n + KD_LEAF_SIZE - 1) / KD_LEAF_SIZE;
+	size_t nleaves1 = (nleaves + 1) / 2;
+	size_t n1 = nleaves1 * KD_LEAF_SIZE;
+	nth_element(pts, pts + n1, pts + n, CoordLess<BuildPoint>(splitaxis));
+	size_t child2 = node + 2 * nleaves1;
+	nd.child2 = child2;
+	nd.axis = splitaxis;
 
 	// Build subtrees
-	node.child1 = new Node(pts, left-pts);
-	node.child2 = new Node(left, n-(left-pts));
-}
-
-
-// Destroy a KD tree node
-KDtree::Node::~Node()
-{
-	if (!npts) {
-		delete node.child1;
-		delete node.child2;
+	float box1[6], box2[6];
+	for (int j = 0; j < 6; j++)
+		box1[j] = box2[j] = box[j];
+	box1[splitaxis+3] = box2[splitaxis] = pts[n1].p[splitaxis];
+#ifdef KD_TASKS
+#pragma omp task if (n > KD_TASK_CUTOFF)
+#endif
+	build_node(pts, n1, node + 1, start, box1);
+	build_node(pts + n1, n - n1, child2, start + n1, box2);
+#ifdef KD_TASKS
+#pragma omp taskwait
+#endif
+
+	const Node &n1d = nodes[node+1], &n2d = nodes[child2];
+	for (int j = 0; j < 3; j++) {
+		nd.lo[j] = min(n1d.lo[j], n2d.lo[j]);
+		nd.hi[j] = max(n1d.hi[j], n2d.hi[j]);
 	}
 }
 
 
-// Crawl the KD tree
-void KDtree::Node::find_closest_to_pt(KDtree::Node::Traversal_Info &ti) const
+// Create a KDtree from a list of points (i.e., pts is a list of 3*n floats)
+void KDtree::build(const float *pts, size_t n)
 {
-	// Leaf nodes
-	if (npts) {
-		for (int i = 0; i < npts; i++) {
-			float myd2 = dist2(leaf.p[i], ti.p);
-			if ((myd2 < ti.closest_d2) &&
-			    (!ti.iscompat || (*ti.iscompat)(leaf.p[i]))) {
-				ti.closest_d2 = myd2;
-				ti.closest_d = sqrt(ti.closest_d2);
-				ti.closest = leaf.p[i];
-			}
-		}
+	ptlist = pts;
+	if (!n)
 		return;
+
+	int npts = n;
+	vector<BuildPoint> bp(n);
+	float box[6] = { pts[0], pts[1], pts[2], pts[0], pts[1], pts[2] };
+	for (int i = 0; i < npts; i++) {
+		for (int j = 0; j < 3; j++) {
+			float p = pts[3*i+j];
+			bp[i].p[j] = p;
+			box[j] = min(box[j], p);
+			box[j+3] = max(box[j+3], p);
+		}
+		bp[i].id = i;
 	}
 
+	size_t nleaves = (n + KD_LEAF_SIZE - 1) / KD_LEAF_SIZE;
+	nodes.resize(2 * nleaves - 1);
+	x.resize(nleaves * KD_LEAF_SIZE);
+	y.resize(nleaves * KD_LEAF_SIZE);
+	z.resize(nleaves * KD_LEAF_SIZE);
+	ids.resize(n);
+
+#ifdef KD_TASKS
+#pragma omp parallel
+#pragma omp single
+#endif
+	build_node(&bp[0], n, 0, 0, box);
+}
 
-	// Check whether to abort
-	if (dist2(node.center, ti.p) >= sqr(node.r + ti.closest_d))
-		return;
 
-	// Recursive case
-	float myd = node.center[node.splitaxis] - ti.p[node.splitaxis];
-	if (myd >= 0.0f) {
-		node.child1->find_closest_to_pt(ti);
-		if (myd < ti.closest_d)
-			node.child2->find_closest_to_pt(ti);
-	} else {
-		node.child2->find_closest_to_pt(ti);
-		if (-myd < ti.closest_d)
-			node.child1->find_closest_to_pt(ti);
-	}
+KDtree::~KDtree()
+{
 }
 
 
-// Crawl the KD tree, retaining k closest points
-void KDtree::Node::find_k_closest_to_pt(KDtree::Node::Traversal_Info &ti) const
+// Visit the leaves that may hold points closer than q.limit(), nearer
+// subtrees first.  q.bound() gives a lower bound on the squared distance
+// to anything in a box, and q.plane_bound() one from the distance to the
+// far side of a split.  Where the latter says nothing (rays), the nearer
+// child is also checked against its box on the way down.
+template <class Query>
+void KDtree::walk(Query &q) const
 {
-	// Leaf nodes
-	if (npts) {
-		for (int i = 0; i < npts; i++) {
-			float myd2 = dist2(leaf.p[i], ti.p);
-			if ((myd2 < ti.closest_d2 || ti.knn.size() < ti.k) &&
-			    (!ti.iscompat || (*ti.iscompat)(leaf.p[i]))) {
-				float myd = sqrt(myd2);
-				ti.knn.push_back(make_pair(myd, leaf.p[i]));
-				push_heap(ti.knn.begin(), ti.knn.end());
-				if (ti.knn.size() > ti.k) {
-					pop_heap(ti.knn.begin(), ti.knn.end());
-					ti.knn.pop_back();
-				}
-				// Keep track of distance to k-th closest
-				ti.closest_d = ti.knn[0].first;
-				ti.closest_d2 = sqr(ti.closest_d);
+	if (nodes.empty())
+		return;
+
+	int stack_node[KD_MAX_DEPTH];
+	float stack_d2[KD_MAX_DEPTH];
+	int nstack = 1;
+	stack_node[0] = 0;
+	stack_d2[0] = 0.0f;
+	int npts = ids.size();
+
+	while (nstack) {
+		nstack--;
+		int i = stack_node[nstack];
+		if (stack_d2[nstack] >= q.limit() ||
+		    q.bound(nodes[i].lo, nodes[i].hi) >= q.limit())
+			continue;
+
+		// Go down to a leaf, leaving the farther children for later
+		bool pruned = false;
+		while (nodes[i].child2) {
+			int a = nodes[i].axis, c1 = i + 1, c2 = nodes[i].child2;
+			float gap1 = q.p[a] - nodes[c1].hi[a];
+			float gap2 = nodes[c2].lo[a] - q.p[a];
+			if (gap1 > gap2) {
+				swap(c1, c2);
+				gap2 = gap1;
+			}
+			float d2 = q.plane_bound(gap2);
+			if (d2 < q.limit()) {
+				stack_node[nstack] = c2;
+				stack_d2[nstack] = d2;
+				nstack++;
+			}
+			i = c1;
+			if (Query::CHECK_NEAR &&
+			    q.bound(nodes[i].lo, nodes[i].hi) >= q.limit()) {
+				pruned = true;
+				break;
 			}
 		}
-		return;
+		if (pruned)
+			continue;
+
+		int start = nodes[i].start;
+		q.leaf(&x[start], &y[start], &z[start], &ids[start],
+		       min(npts - start, KD_LEAF_SIZE));
 	}
+}
 
 
-	// Check whether to abort
-	if (dist2(node.center, ti.p) >= sqr(node.r + ti.closest_d) &&
-	    ti.knn.size() == ti.k)
-		return;
+// Squared distances from p to the (padded) points of a leaf
+static inline void leaf_dist2(const float *x, const float *y, const float *z,
+			      const float *p, float *d2)
+{
+	for (int i = 0; i < KD_LEAF_SIZE; i++)
+		d2[i] = sqr(x[i]-p[0]) + sqr(y[i]-p[1]) + sqr(z[i]-p[2]);
+}
 
-	// Recursive case
-	float myd = node.center[node.splitaxis] - ti.p[node.splitaxis];
-	if (myd >= 0.0f) {
-		node.child1->find_k_closest_to_pt(ti);
-		if (myd < ti.closest_d || ti.knn.size() != ti.k)
-			node.child2->find_k_closest_to_pt(ti);
-	} else {
-		node.child2->find_k_closest_to_pt(ti);
-		if (-myd < ti.closest_d || ti.knn.size() != ti.k)
-			node.child1->find_k_closest_to_pt(ti);
+// Squared distances from the line through p in the (unit) direction dir
+static inline void leaf_dist2ray2(const float *x, const float *y,
+				  const float *z, const float *p,
+				  const float *dir, float *d2)
+{
+	for (int i = 0; i < KD_LEAF_SIZE; i++) {
+		float xp0 = x[i]-p[0], xp1 = y[i]-p[1], xp2 = z[i]-p[2];
+		d2[i] = sqr(xp0) + sqr(xp1) + sqr(xp2) -
+			sqr(xp0*dir[0] + xp1*dir[1] + xp2*dir[2]);
 	}
 }
 
+// Squared distance from p to a box, 0 inside
+static inline float box_dist2(const float *lo, const float *hi, const float *p)
+{
+	float d0 = max(max(lo[0]-p[0], p[0]-hi[0]), 0.0f);
+	float d1 = max(max(lo[1]-p[1], p[1]-hi[1]), 0.0f);
+	float d2 = max(max(lo[2]-p[2], p[2]-hi[2]), 0.0f);
+	return sqr(d0) + sqr(d1) + sqr(d2);
+}
 
-// Crawl the KD tree to look for the closest point to
-// the line going through ti.p in the direction ti.dir
-void KDtree::Node::find_closest_to_ray(KDtree::Node::Traversal_Info &ti) const
+// Squared radius of the sphere around a box
+static inline float box_r2(const float *lo, const float *hi)
 {
-	// Leaf nodes
-	if (npts) {
-		for (int i = 0; i < npts; i++) {
-			float myd2 = dist2ray2(leaf.p[i], ti.p, ti.dir);
-			if ((myd2 < ti.closest_d2) &&
-			    (!ti.iscompat || (*ti.iscompat)(leaf.p[i]))) {
-				ti.closest_d2 = myd2;
-				ti.closest_d = sqrt(ti.closest_d2);
-				ti.closest = leaf.p[i];
+	return 0.25f * (sqr(hi[0]-lo[0]) + sqr(hi[1]-lo[1]) + sqr(hi[2]-lo[2]));
+}
+
+
+// Closest compatible point to p
+struct ClosestQuery {
+	enum { CHECK_NEAR = 0 };
+	const float *p, *ptlist;
+	const KDtree::CompatFunc *iscompat;
+	float closest_d2;
+	int closest;
+
+	float limit() const { return closest_d2; }
+	float bound(const float *lo, const float *hi) const
+		{ return box_dist2(lo, hi, p); }
+	float plane_bound(float d) const
+		{ return d > 0.0f ? sqr(d) : 0.0f; }
+	void leaf(const float *x, const float *y, const float *z,
+		  const int *ids, int n)
+	{
+		float d2[KD_LEAF_SIZE];
+		leaf_dist2(x, y, z, p, d2);
+		for (int i = 0; i < n; i++) {
+			if ((d2[i] < closest_d2) &&
+			    (!iscompat || (*iscompat)(ptlist + 3 * ids[i]))) {
+				closest_d2 = d2[i];
+				closest = ids[i];
 			}
 		}
-		return;
 	}
+};
 
 
-	// Check whether to abort
-	if (dist2ray2(node.center, ti.p, ti.dir) >= sqr(node.r + ti.closest_d))
-		return;
-
-	// Recursive case
-	if (ti.p[node.splitaxis] < node.center[node.splitaxis] ) {
-		node.child1->find_closest_to_ray(ti);
-		node.child2->find_closest_to_ray(ti);
-	} else {
-		node.child2->find_closest_to_ray(ti);
-		node.child1->find_closest_to_ray(ti);
+// Closest compatible point to the line through p in the direction dir.
+// A box is bounded by the sphere around it.
+struct RayQuery {
+	enum { CHECK_NEAR = 1 };
+	const float *p, *dir, *ptlist;
+	const KDtree::CompatFunc *iscompat;
+	float closest_d2;
+	int closest;
+
+	float limit() const { return closest_d2; }
+	float bound(const float *lo, const float *hi) const
+	{
+		float center[3] = { 0.5f * (lo[0]+hi[0]),
+				    0.5f * (lo[1]+hi[1]),
+				    0.5f * (lo[2]+hi[2]) };
+		float d = sqrt(max(dist2ray2(center, p, dir), 0.0f)) -
+			  sqrt(box_r2(lo, hi));
+		return d > 0.0f ? sqr(d) : 0.0f;
 	}
-}
-
+	float plane_bound(float) const
+		{ return 0.0f; }
+	void leaf(const float *x, const float *y, const float *z,
+		  const int *ids, int n)
+	{
+		float d2[KD_LEAF_SIZE];
+		leaf_dist2ray2(x, y, z, p, dir, d2);
+		for (int i = 0; i < n; i++) {
+			if ((d2[i] < closest_d2) &&
+			    (!iscompat || (*iscompat)(ptlist + 3 * ids[i]))) {
+				closest_d2 = d2[i];
+				closest = ids[i];
+			}
+		}
+	}
+};
 
-// Create a KDtree from a list of points (i.e., ptlist is a list of 3*n floats)
-void KDtree::build(const float *ptlist, size_t n)
-{
-	vector<const float *> pts(n);
-	for (size_t i = 0; i < n; i++)
-		pts[i] = ptlist + i * 3;
 
-	root = new Node(&(pts[0]), n);
-}
+// The k closest compatible points to p, in a max-heap on distance
+typedef pair<float, int> pt_with_d;
+
+struct KnnQuery {
+	enum { CHECK_NEAR = 0 };
+	const float *p, *ptlist;
+	const KDtree::CompatFunc *iscompat;
+	size_t k;
+	vector<pt_with_d> knn;
+	float closest_d2; // maxdist2 until there are k, then the k-th
+
+	float limit() const { return closest_d2; }
+	float bound(const float *lo, const float *hi) const
+		{ return box_dist2(lo, hi, p); }
+	float plane_bound(float d) const
+		{ return d > 0.0f ? sqr(d) : 0.0f; }
+	void leaf(const float *x, const float *y, const float *z,
+		  const int *ids, int n)
+	{
+		float d2[KD_LEAF_SIZE];
+		leaf_dist2(x, y, z, p, d2);
+		for (int i = 0; i < n; i++) {
+			if ((d2[i] < closest_d2) &&
+			    (!iscompat || (*iscompat)(ptlist + 3 * ids[i]))) {
+				knn.push_back(make_pair(d2[i], ids[i]));
+				push_heap(knn.begin(), knn.end());
+				if (knn.size() > k) {
+					pop_heap(knn.begin(), knn.end());
+					knn.pop_back();
+				}
+				if (knn.size() == k)
+					closest_d2 = knn[0].first;
+			}
+		}
+	}
+};
 
 
-// Delete a KDtree
-KDtree::~KDtree()
-{
-	delete root;
-}
+// All compatible points closer than sqrt(maxdist2) to p
+struct RadiusQuery {
+	enum { CHECK_NEAR = 0 };
+	const float *p, *ptlist;
+	const KDtree::CompatFunc *iscompat;
+	float maxdist2;
+	vector<int> *found;
+
+	float limit() const { return maxdist2; }
+	float bound(const float *lo, const float *hi) const
+		{ return box_dist2(lo, hi, p); }
+	float plane_bound(float d) const
+		{ return d > 0.0f ? sqr(d) : 0.0f; }
+	void leaf(const float *x, const float *y, const float *z,
+		  const int *ids, int n)
+	{
+		float d2[KD_LEAF_SIZE];
+		leaf_dist2(x, y, z, p, d2);
+		for (int i = 0; i < n; i++) {
+			if ((d2[i] < maxdist2) &&
+			    (!iscompat || (*iscompat)(ptlist + 3 * ids[i])))
+				found->push_back(ids[i]);
+		}
+	}
+};
 
 
 // Return the closest point in the KD tree to p
 const float *KDtree::closest_to_pt(const float *p, float maxdist2 /* = 0.0f */,
 				   const CompatFunc *iscompat /* = NULL */) const
 {
-	Node::Traversal_Info ti;
-
-	ti.p = p;
-	ti.iscompat = iscompat;
-	ti.closest = NULL;
+	if (nodes.empty())
+		return NULL;
+
+	ClosestQuery q;
+	q.p = p;
+	q.ptlist = ptlist;
+	q.iscompat = iscompat;
+	q.closest = -1;
 	if (maxdist2 <= 0.0f)
-		maxdist2 = sqr(root->node.r);
-	ti.closest_d2 = maxdist2;
-	ti.closest_d = sqrt(ti.closest_d2);
+		maxdist2 = box_r2(nodes[0].lo, nodes[0].hi);
+	q.closest_d2 = maxdist2;
 
-	root->find_closest_to_pt(ti);
+	walk(q);
 
-	return ti.closest;
+	return q.closest < 0 ? NULL : ptlist + 3 * q.closest;
 }
 
 
@@ -329,58 +439,250 @@ const float *KDtree::closest_to_ray(const float *p, const float *dir,
 				    float maxdist2 /* = 0.0f */,
 				    const CompatFunc *iscompat /* = NULL */) const
 {
-	Node::Traversal_Info ti;
+	if (nodes.empty())
+		return NULL;
 
 	float one_over_dir_len = 1.0f / sqrt(sqr(dir[0])+sqr(dir[1])+sqr(dir[2]));
-	float normalized_dir[3] = { dir[0] * one_over_dir_len, 
-				    dir[1] * one_over_dir_len, 
+	float normalized_dir[3] = { dir[0] * one_over_dir_len,
+				    dir[1] * one_over_dir_len,
 				    dir[2] * one_over_dir_len };
-	ti.dir = normalized_dir;
-	ti.p = p;
-	ti.iscompat = iscompat;
-	ti.closest = NULL;
+
+	RayQuery q;
+	q.p = p;
+	q.dir = normalized_dir;
+	q.ptlist = ptlist;
+	q.iscompat = iscompat;
+	q.closest = -1;
 	if (maxdist2 <= 0.0f)
-		maxdist2 = sqr(root->node.r);
-	ti.closest_d2 = maxdist2;
-	ti.closest_d = sqrt(ti.closest_d2);
+		maxdist2 = box_r2(nodes[0].lo, nodes[0].hi);
+	q.closest_d2 = maxdist2;
 
-	root->find_closest_to_ray(ti);
+	walk(q);
 
-	return ti.closest;
+	return q.closest < 0 ? NULL : ptlist + 3 * q.closest;
 }
 
 
-// Find the k nearest neighbors
+// Find the k nearest neighbors.  Without a maxdist2, the distance is not
+// limited at all.
 void KDtree::find_k_closest_to_pt(std::vector<const float *> &knn,
 				  int k,
 				  const float *p,
 				  float maxdist2 /* = 0.0f */,
 				  const CompatFunc *iscompat /* = NULL */) const
 {
-	Node::Traversal_Info ti;
+	knn.clear();
+	if (nodes.empty() || k <= 0)
+		return;
+
+	KnnQuery q;
+	q.p = p;
+	q.ptlist = ptlist;
+	q.iscompat = iscompat;
+	q.closest_d2 = (maxdist2 > 0.0f) ? maxdist2 : FLT_MAX;
+	q.k = k;
+	q.knn.reserve(k+1);
+
+	walk(q);
+
+	size_t found = q.knn.size();
+	knn.resize(found);
+	sort_heap(q.knn.begin(), q.knn.end());
+	for (size_t i = 0; i < found; i++)
+		knn[i] = ptlist + 3 * q.knn[i].second;
+}
+
+
+// Find all the points within sqrt(maxdist2)
+void KDtree::find_in_radius(std::vector<const float *> &pts,
+			    const float *p,
+			    float maxdist2,
+			    const CompatFunc *iscompat /* = NULL */) const
+{
+	pts.clear();
+
+	vector<int> found;
+	RadiusQuery q;
+	q.p = p;
+	q.ptlist = ptlist;
+	q.iscompat = iscompat;
+	q.maxdist2 = maxdist2;
+	q.found = &found;
+
+	walk(q);
+
+	pts.resize(found.size());
+	for (size_t i = 0; i < found.size(); i++)
+		pts[i] = ptlist + 3 * found[i];
+}
+
+
+static inline unsigned morton_spread(unsigned x)
+{
+	x = (x | (x << 16)) & 0x030000FFu;
+	x = (x | (x <<  8)) & 0x0300F00Fu;
+	x = (x | (x <<  4)) & 0x030C30C3u;
+	x = (x | (x <<  2)) & 0x09249249u;
+	return x;
+}
+
+// The n query points, in order along a Morton curve through a 1024^3 grid
+// over the box (lo, hi).  Points outside go to the nearest cell.
+static void morton_order(const float *lo, const float *hi,
+			 const float *qpts, int n, vector<int> &order)
+{
+	float scale[3];
+	for (int j = 0; j < 3; j++) {
+		float extent = hi[j] - lo[j];
+		scale[j] = (extent > 0.0f) ? 1024.0f / extent : 0.0f;
+	}
+
+	vector<unsigned long long> keys(n);
+#pragma omp parallel for
+	for (int i = 0; i < n; i++) {
+		unsigned c[3];
+		for (int j = 0; j < 3; j++) {
+			float t = (qpts[3*i+j] - lo[j]) * scale[j];
+			c[j] = (t <= 0.0f) ? 0 : (t >= 1023.0f) ? 1023 : (unsigned) t;
+		}
+		unsigned code = morton_spread(c[0]) | (morton_spread(c[1]) << 1) |
+				(morton_spread(c[2]) << 2);
+		keys[i] = ((unsigned long long) code << 32) | (unsigned) i;
+	}
+	sort(keys.begin(), keys.end());
 
-	ti.p = p;
-	ti.iscompat = iscompat;
-	ti.closest = NULL;
+	order.resize(n);
+	for (int i = 0; i < n; i++)
+		order[i] = (int) (keys[i] & 0xffffffffu);
+}
+
+
+// Closest points to qpts
+void KDtree::closest_to_pts(const float *qpts, size_t n,
+			    int *closest,
+			    float maxdist2 /* = 0.0f */) const
+{
+	if (nodes.empty()) {
+		fill(closest, closest + n, -1);
+		return;
+	}
 	if (maxdist2 <= 0.0f)
-		maxdist2 = sqr(root->node.r);
-	ti.closest_d2 = maxdist2;
-	ti.closest_d = sqrt(ti.closest_d2);
-	ti.k = k;
-	ti.knn.reserve(k+1);
+		maxdist2 = box_r2(nodes[0].lo, nodes[0].hi);
+
+	int nq = n;
+	vector<int> order;
+	morton_order(nodes[0].lo, nodes[0].hi, qpts, nq, order);
+
+	int nblocks = (nq + KD_BATCH_BLOCK - 1) / KD_BATCH_BLOCK;
+#pragma omp parallel for schedule(dynamic, 1)
+	for (int b = 0; b < nblocks; b++) {
+		ClosestQuery q;
+		q.ptlist = ptlist;
+		q.iscompat = NULL;
+		int end = min(nq, (b + 1) * KD_BATCH_BLOCK);
+		for (int i = b * KD_BATCH_BLOCK; i < end; i++) {
+			int qi = order[i];
+			q.p = qpts + 3 * qi;
+			q.closest = -1;
+			q.closest_d2 = maxdist2;
+			walk(q);
+			closest[qi] = q.closest;
+		}
+	}
+}
 
-	root->find_k_closest_to_pt(ti);
 
-	size_t found = ti.knn.size();
-	if (!found) {
-		knn.clear();
+// k nearest neighbors of qpts
+void KDtree::find_k_closest_to_pts(const float *qpts, size_t n,
+				   int k, int *knn,
+				   float maxdist2 /* = 0.0f */) const
+{
+	if (k <= 0)
+		return;
+	fill(knn, knn + n * k, -1);
+	if (nodes.empty())
 		return;
+
+	int nq = n;
+	vector<int> order;
+	morton_order(nodes[0].lo, nodes[0].hi, qpts, nq, order);
+
+	int nblocks = (nq + KD_BATCH_BLOCK - 1) / KD_BATCH_BLOCK;
+#pragma omp parallel for schedule(dynamic, 1)
+	for (int b = 0; b < nblocks; b++) {
+		KnnQuery q;
+		q.ptlist = ptlist;
+		q.iscompat = NULL;
+		q.k = k;
+		q.knn.reserve(k+1);
+		int end = min(nq, (b + 1) * KD_BATCH_BLOCK);
+		for (int i = b * KD_BATCH_BLOCK; i < end; i++) {
+			int qi = order[i];
+			q.p = qpts + 3 * qi;
+			q.closest_d2 = (maxdist2 > 0.0f) ? maxdist2 : FLT_MAX;
+			q.knn.clear();
+			walk(q);
+			sort_heap(q.knn.begin(), q.knn.end());
+			int *out = knn + (size_t) qi * k;
+			for (size_t j = 0; j < q.knn.size(); j++)
+				out[j] = q.knn[j].second;
+		}
 	}
+}
 
-	knn.resize(found);
-	sort_heap(ti.knn.begin(), ti.knn.end());
-	for (size_t i = 0; i < found; i++)
-		knn[i] = ti.knn[i].second;
+
+// Points within sqrt(maxdist2) of qpts.  Each block of queries gathers
+// its results in a buffer of its own, and they are copied into place once
+// all the counts are known.
+void KDtree::find_in_radius_pts(const float *qpts, size_t n,
+				float maxdist2,
+				std::vector<size_t> &starts,
+				std::vector<int> &found) const
+{
+	int nq = n;
+	starts.assign(nq + 1, 0);
+	found.clear();
+	if (nodes.empty())
+		return;
+
+	vector<int> order;
+	morton_order(nodes[0].lo, nodes[0].hi, qpts, nq, order);
+
+	int nblocks = (nq + KD_BATCH_BLOCK - 1) / KD_BATCH_BLOCK;
+	vector< vector<int> > block_found(nblocks);
+	vector<size_t> block_start(nq);
+#pragma omp parallel for schedule(dynamic, 1)
+	for (int b = 0; b < nblocks; b++) {
+		RadiusQuery q;
+		q.ptlist = ptlist;
+		q.iscompat = NULL;
+		q.maxdist2 = maxdist2;
+		q.found = &block_found[b];
+		int end = min(nq, (b + 1) * KD_BATCH_BLOCK);
+		for (int i = b * KD_BATCH_BLOCK; i < end; i++) {
+			int qi = order[i];
+			q.p = qpts + 3 * qi;
+			block_start[qi] = q.found->size();
+			walk(q);
+			starts[qi+1] = q.found->size() - block_start[qi];
+		}
+	}
+
+	for (int i = 0; i < nq; i++)
+		starts[i+1] += starts[i];
+	found.resize(starts[nq]);
+
+#pragma omp parallel for schedule(dynamic, 1)
+	for (int b = 0; b < nblocks; b++) {
+		int end = min(nq, (b + 1) * KD_BATCH_BLOCK);
+		for (int i = b * KD_BATCH_BLOCK; i < end; i++) {
+			int qi = order[i];
+			if (starts[qi+1] > starts[qi])
+				memcpy(&found[starts[qi]],
+				       &block_found[b][block_start[qi]],
+				       (starts[qi+1] - starts[qi]) * sizeof(int));
+		}
+	}
 }
 
 }; // namespace trimesh
@@ -0,0 +1,1076 @@
+/*
+MeshStream.cc
+Out-of-core processing of meshes: streaming readers and writers, spatially
+sorted pieces with one-ring overlap, and per-chunk operators.
+*/
+
+#include "MeshStream.h"
+#include "strutil.h"
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <climits>
+#include <algorithm>
+using namespace std;
+
+#define dprintf TriMesh::dprintf
+#define eprintf TriMesh::eprintf
+
+
+namespace trimesh {
+
+static inline void swap_bytes(unsigned char *p, int n)
+{
+	for (int i = 0, j = n - 1; i < j; i++, j--)
+		swap(p[i], p[j]);
+}
+
+// 64-bit file offsets
+static int seek64(FILE *f, long long offset)
+{
+#ifdef _WIN32
+	return _fseeki64(f, offset, SEEK_SET);
+#else
+	return fseeko(f, (off_t) offset, SEEK_SET);
+#endif
+}
+
+
+//
+// PLY property types
+//
+enum { PLY_NONE, PLY_INT8, PLY_UINT8, PLY_INT16, PLY_UINT16,
+       PLY_INT32, PLY_UINT32, PLY_FLOAT32, PLY_FLOAT64 };
+
+static int ply_type(const char *name)
+{
+	static const struct { const char *name; int type; } types[] = {
+		{ "char", PLY_INT8 }, { "int8", PLY_INT8 },
+		{ "uchar", PLY_UINT8 }, { "uint8", PLY_UINT8 },
+		{ "short", PLY_INT16 }, { "int16", PLY_INT16 },
+		{ "ushort", PLY_UINT16 }, { "uint16", PLY_UINT16 },
+		{ "int", PLY_INT32 }, { "int32", PLY_INT32 },
+		{ "uint", PLY_UINT32 }, { "uint32", PLY_UINT32 },
+		{ "float", PLY_FLOAT32 }, { "float32", PLY_FLOAT32 },
+		{ "double", PLY_FLOAT64 }, { "float64", PLY_FLOAT64 }
+	};
+	for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++)
+		if (!strcmp(name, types[i].name))
+			return types[i].type;
+	return PLY_NONE;
+}
+
+static int ply_size(int type)
+{
+	static const int sizes[] = { 0, 1, 1, 2, 2, 4, 4, 4, 8 };
+	return sizes[type];
+}
+
+// Value of type "type" at p, already in native byte order
+static double ply_value(const unsigned char *p, int type)
+{
+	switch (type) {
+		case PLY_INT8: return * (const signed char *) p;
+		case PLY_UINT8: return *p;
+	}
+	union { short s; unsigned short us; int i; unsigned u; float f; double d; } v;
+	memcpy(&v, p, ply_size(type));
+	switch (type) {
+		case PLY_INT16: return v.s;
+		case PLY_UINT16: return v.us;
+		case PLY_INT32: return v.i;
+		case PLY_UINT32: return v.u;
+		case PLY_FLOAT32: return v.f;
+		default: return v.d;
+	}
+}
+
+
+//
+// MeshReader
+//
+MeshReader::MeshReader() : format(FORMAT_PLY), f(NULL), chunk_size(0),
+	nverts(0), nfaces(0), error(false), binary(false), need_swap(false),
+	elem(0), elem_left(0), buf_pos(0), buf_len(0), stl_left(0)
+{
+}
+
+MeshReader::~MeshReader()
+{
+	close();
+}
+
+void MeshReader::close()
+{
+	if (f)
+		fclose(f);
+	f = NULL;
+	elements.clear();
+	vector<unsigned char>().swap(buf);
+}
+
+
+bool MeshReader::open(const char *filename, size_t chunk_size_)
+{
+	close();
+	chunk_size = max(chunk_size_, (size_t) 1);
+	nverts = nfaces = 0;
+	error = false;
+	buf_pos = buf_len = 0;
+
+	f = fopen(filename, "rb");
+	if (!f) {
+		eprintf("Error opening [%s] for reading: %s.\n", filename,
+			strerror(errno));
+		return false;
+	}
+
+	char magic[4] = { 0 };
+	size_t n = fread(magic, 1, 4, f);
+	rewind(f);
+	if (n >= 3 && !strncmp(magic, "ply", 3)) {
+		format = FORMAT_PLY;
+		if (!open_ply()) {
+			eprintf("Error reading PLY header of [%s].\n", filename);
+			close();
+			return false;
+		}
+	} else if (ends_with(filename, ".stl")) {
+		format = FORMAT_STL;
+		char header[80];
+		unsigned nfacets;
+		if (fread(header, 80, 1, f) != 1 || fread(&nfacets, 4, 1, f) != 1) {
+			eprintf("Error reading STL header of [%s].\n", filename);
+			close();
+			return false;
+		}
+		if (!TriMesh::we_are_little_endian())
+			swap_bytes((unsigned char *) &nfacets, 4);
+		stl_left = nfacets;
+	} else {
+		format = FORMAT_OBJ;
+	}
+	dprintf("Streaming %s in chunks of %lu...\n", filename,
+		(unsigned long) chunk_size);
+	return true;
+}
+
+
+// Parse a PLY header into the list of elements
+bool MeshReader::open_ply()
+{
+	char line[1024];
+	if (!fgets(line, sizeof(line), f))
+		return false;
+	if (!fgets(line, sizeof(line), f))
+		return false;
+	if (begins_with(line, "format binary_big_endian")) {
+		binary = true;
+		need_swap = TriMesh::we_are_little_endian();
+	} else if (begins_with(line, "format binary_little_endian")) {
+		binary = true;
+		need_swap = !TriMesh::we_are_little_endian();
+	} else if (begins_with(line, "format ascii")) {
+		binary = false;
+	} else {
+		return false;
+	}
+
+	elements.clear();
+	while (1) {
+		if (!fgets(line, sizeof(line), f))
+			return false;
+		if (begins_with(line, "end_header"))
+			break;
+		char a[256], b[256], c[256], d[256];
+		unsigned long count;
+		if (sscanf(line, "element %255s %lu", a, &count) == 2) {
+			PlyElement e;
+			e.name = a;
+			e.count = count;
+			elements.push_back(e);
+		} else if (sscanf(line, "property list %255s %255s %255s", a, b, c) == 3) {
+			PlyProperty p;
+			p.count_type = ply_type(a);
+			p.type = ply_type(b);
+			p.name = c;
+			if (elements.empty() || !p.count_type || !p.type)
+				return false;
+			elements.back().props.push_back(p);
+		} else if (sscanf(line, "property %255s %255s", a, d) == 2) {
+			PlyProperty p;
+			p.count_type = PLY_NONE;
+			p.type = ply_type(a);
+			p.name = d;
+			if (elements.empty() || !p.type)
+				return false;
+			elements.back().props.push_back(p);
+		}
+	}
+
+	elem = 0;
+	elem_left = elements.empty() ? 0 : elements[0].count;
+	if (binary) {
+		buf.resize(1 << 20);
+		buf_pos = buf_len = 0;
+	}
+	return true;
+}
+
+
+// Buffered reads from the body of a binary PLY
+bool MeshReader::get_bytes(void *p, size_t n)
+{
+	unsigned char *dst = (unsigned char *) p;
+	while (n) {
+		if (buf_pos == buf_len) {
+			buf_len = fread(&buf[0], 1, buf.size(), f);
+			buf_pos = 0;
+			if (!buf_len)
+				return false;
+		}
+		size_t len = min(n, buf_len - buf_pos);
+		memcpy(dst, &buf[buf_pos], len);
+		buf_pos += len;
+		dst += len;
+		n -= len;
+	}
+	return true;
+}
+
+bool MeshReader::get_value(int type, double &val)
+{
+	if (!binary)
+		return fscanf(f, "%lf", &val) == 1;
+	unsigned char bytes[8];
+	int size = ply_size(type);
+	if (!get_bytes(bytes, size))
+		return false;
+	if (need_swap)
+		swap_bytes(bytes, size);
+	val = ply_value(bytes, type);
+	return true;
+}
+
+
+bool MeshReader::next_ply(MeshChunk &chunk)
+{
+	vector<double> vals;
+	vector<int> inds;
+	while (chunk.vertices.size() + chunk.faces.size() < chunk_size) {
+		while (!elem_left) {
+			if (++elem >= elements.size())
+				return true;
+			elem_left = elements[elem].count;
+		}
+
+		// Read one record
+		const PlyElement &e = elements[elem];
+		vals.resize(e.props.size());
+		bool is_face = (e.name == "face");
+		for (size_t i = 0; i < e.props.size(); i++) {
+			const PlyProperty &p = e.props[i];
+			if (!p.count_type) {
+				if (!get_value(p.type, vals[i]))
+					return false;
+				continue;
+			}
+			double count;
+			if (!get_value(p.count_type, count) || count < 0)
+				return false;
+			bool want = is_face && (p.name == "vertex_indices" ||
+						p.name == "vertex_index");
+			if (want)
+				inds.clear();
+			for (int j = 0; j < (int) count; j++) {
+				double v;
+				if (!get_value(p.type, v))
+					return false;
+				if (want)
+					inds.push_back((int) v);
+			}
+		}
+		elem_left--;
+
+		if (e.name == "vertex") {
+			point pt, n;
+			bool have_n = false;
+			for (size_t i = 0; i < e.props.size(); i++) {
+				const string &name = e.props[i].name;
+				if (name == "x") pt[0] = vals[i];
+				else if (name == "y") pt[1] = vals[i];
+				else if (name == "z") pt[2] = vals[i];
+				else if (name == "nx") n[0] = vals[i], have_n = true;
+				else if (name == "ny") n[1] = vals[i];
+				else if (name == "nz") n[2] = vals[i];
+			}
+			chunk.vertices.push_back(pt);
+			if (have_n)
+				chunk.normals.push_back(n);
+			nverts++;
+		} else if (is_face) {
+			for (size_t i = 2; i < inds.size(); i++) {
+				chunk.faces.push_back(TriMesh::Face(inds[0],
+					inds[i-1], inds[i]));
+				nfaces++;
+			}
+		}
+	}
+	return true;
+}
+
+
+// Read one whole line, however long, into line.  False at end of file.
+static bool get_line(FILE *f, string &line)
+{
+	char buf[4096];
+	line.clear();
+	while (fgets(buf, sizeof(buf), f)) {
+		line += buf;
+		if (line[line.size() - 1] == '\n')
+			return true;
+	}
+	return !line.empty();
+}
+
+
+bool MeshReader::next_obj(MeshChunk &chunk)
+{
+	string line;
+	while (chunk.vertices.size() + chunk.faces.size() < chunk_size) {
+		if (!get_line(f, line))
+			return !ferror(f);
+		const char *c = line.c_str();
+		while (*c && isspace(*c))
+			c++;
+		if ((c[0] == 'v') && (c[1] == ' ' || c[1] == '\t')) {
+			float x, y, z;
+			if (sscanf(c + 1, "%f %f %f", &x, &y, &z) != 3)
+				return false;
+			chunk.vertices.push_back(point(x, y, z));
+			nverts++;
+		} else if ((c[0] == 'f' || c[0] == 't') &&
+			   (c[1] == ' ' || c[1] == '\t')) {
+			// Leading index of each field, 1-based or relative
+			int inds[3], n = 0;
+			c++;
+			while (1) {
+				while (*c && isspace(*c))
+					c++;
+				char *end;
+				long ind = strtol(c, &end, 10);
+				if (end == c)
+					break;
+				ind = (ind < 0) ? ind + (long) nverts : ind - 1;
+				if (n < 2) {
+					inds[n] = ind;
+				} else {
+					inds[2] = ind;
+					chunk.faces.push_back(TriMesh::Face(inds));
+					inds[1] = ind;
+					nfaces++;
+				}
+				n++;
+				c = end;
+				while (*c && !isspace(*c))
+					c++;
+			}
+		}
+	}
+	return true;
+}
+
+
+bool MeshReader::next_stl(MeshChunk &chunk)
+{
+	bool swap = !TriMesh::we_are_little_endian();
+	while (stl_left && chunk.vertices.size() + chunk.faces.size() < chunk_size) {
+		float fbuf[12];
+		unsigned char att[2];
+		if (fread(fbuf, 48, 1, f) != 1 || fread(att, 2, 1, f) != 1)
+			return false;
+		if (swap)
+			for (int j = 3; j < 12; j++)
+				swap_bytes((unsigned char *) &fbuf[j], 4);
+		int v = nverts;
+		chunk.vertices.push_back(point(fbuf[3], fbuf[4], fbuf[5]));
+		chunk.vertices.push_back(point(fbuf[6], fbuf[7], fbuf[8]));
+		chunk.vertices.push_back(point(fbuf[9], fbuf[10], fbuf[11]));
+		chunk.faces.push_back(TriMesh::Face(v, v+1, v+2));
+		nverts += 3;
+		nfaces++;
+		stl_left--;
+	}
+	return true;
+}
+
+
+bool MeshReader::next(MeshChunk &chunk)
+{
+	chunk.clear();
+	chunk.first_vertex = nverts;
+	chunk.first_face = nfaces;
+	if (!f || error)
+		return false;
+
+	bool ok;
+	switch (format) {
+		case FORMAT_PLY: ok = next_ply(chunk); break;
+		case FORMAT_STL: ok = next_stl(chunk); break;
+		default: ok = next_obj(chunk); break;
+	}
+	if (!ok) {
+		eprintf("Error reading mesh after %lu vertices, %lu faces.\n",
+			(unsigned long) nverts, (unsigned long) nfaces);
+		error = true;
+		return false;
+	}
+	if (!chunk.normals.empty() &&
+	    chunk.normals.size() != chunk.vertices.size())
+		chunk.normals.clear();
+	return !chunk.vertices.empty() || !chunk.faces.empty();
+}
+
+
+//
+// MeshWriter
+//
+MeshWriter::MeshWriter() : f(NULL), facefile(NULL), normals(false),
+	nverts(0), nfaces(0), vert_count_pos(0), face_count_pos(0)
+{
+}
+
+MeshWriter::~MeshWriter()
+{
+	if (f)
+		close();
+}
+
+
+// The counts in the header are written as fixed-width fields, and filled
+// in by close()
+#define COUNT_FIELD "%10lu"
+
+bool MeshWriter::open(const char *filename, bool write_normals)
+{
+	if (f)
+		close();
+	normals = write_normals;
+	nverts = nfaces = 0;
+	f = fopen(filename, "wb");
+	if (!f) {
+		eprintf("Error opening [%s] for writing: %s.\n", filename,
+			strerror(errno));
+		return false;
+	}
+	facefile = tmpfile();
+	if (!facefile) {
+		eprintf("Can't create temporary file.\n");
+		fclose(f);
+		f = NULL;
+		return false;
+	}
+
+	bool ok = fprintf(f, "ply\nformat binary_%s_endian 1.0\n",
+			  TriMesh::we_are_little_endian() ? "little" : "big") > 0 &&
+		  fprintf(f, "element vertex ") > 0;
+	vert_count_pos = ftell(f);
+	ok = ok && fprintf(f, COUNT_FIELD "\n", 0ul) > 0 &&
+	     fprintf(f, "property float x\nproperty float y\nproperty float z\n") > 0;
+	if (normals)
+		ok = ok && fprintf(f, "property float nx\nproperty float ny\n"
+				      "property float nz\n") > 0;
+	ok = ok && fprintf(f, "element face ") > 0;
+	face_count_pos = ftell(f);
+	ok = ok && fprintf(f, COUNT_FIELD "\n", 0ul) > 0 &&
+	     fprintf(f, "property list uchar int vertex_indices\nend_header\n") > 0;
+	if (!ok) {
+		eprintf("Error writing header.\n");
+		return false;
+	}
+	dprintf("Streaming to %s...\n", filename);
+	return true;
+}
+
+
+bool MeshWriter::write(const MeshChunk &chunk)
+{
+	if (!f)
+		return false;
+	size_t nv = chunk.vertices.size(), nf = chunk.faces.size();
+	if (normals && chunk.normals.size() != nv) {
+		eprintf("Chunk has no normals to write.\n");
+		return false;
+	}
+
+	if (nv) {
+		if (!normals) {
+			if (fwrite(&chunk.vertices[0][0], sizeof(point), nv, f) != nv)
+				return false;
+		} else {
+			buf.resize(nv * 24);
+			for (size_t i = 0; i < nv; i++) {
+				memcpy(&buf[24*i], &chunk.vertices[i][0], 12);
+				memcpy(&buf[24*i+12], &chunk.normals[i][0], 12);
+			}
+			if (fwrite(&buf[0], 24, nv, f) != nv)
+				return false;
+		}
+	}
+	if (nf) {
+		buf.resize(nf * 13);
+		for (size_t i = 0; i < nf; i++) {
+			buf[13*i] = 3;
+			memcpy(&buf[13*i+1], &chunk.faces[i][0], 12);
+		}
+		if (fwrite(&buf[0], 13, nf, facefile) != nf)
+			return false;
+	}
+	nverts += nv;
+	nfaces += nf;
+	return true;
+}
+
+
+bool MeshWriter::close()
+{
+	if (!f)
+		return false;
+	bool ok = !fflush(facefile);
+	rewind(facefile);
+	buf.resize(1 << 20);
+	size_t n;
+	while (ok && (n = fread(&buf[0], 1, buf.size(), facefile)) > 0)
+		ok = (fwrite(&buf[0], 1, n, f) == n);
+	ok = ok && !fseek(f, vert_count_pos, SEEK_SET) &&
+	     fprintf(f, COUNT_FIELD, (unsigned long) nverts) > 0 &&
+	     !fseek(f, face_count_pos, SEEK_SET) &&
+	     fprintf(f, COUNT_FIELD, (unsigned long) nfaces) > 0;
+	ok = !fclose(f) && ok;
+	fclose(facefile);
+	f = facefile = NULL;
+	vector<unsigned char>().swap(buf);
+	if (!ok)
+		eprintf("Error writing file.\n");
+	else
+		dprintf("Wrote %lu vertices, %lu faces.\n",
+			(unsigned long) nverts, (unsigned long) nfaces);
+	return ok;
+}
+
+
+//
+// Buckets of fixed-size records in a temporary file.  Each bucket keeps
+// one block in memory and writes it out when full, so memory use is one
+// block per bucket whatever the amount of data.
+//
+class BucketFile {
+public:
+	BucketFile(int nbuckets, size_t record_size) :
+		rec(record_size), block(max((size_t) 1, (size_t) 65536 / rec) * rec),
+		end(0), good(true), bufs(nbuckets), blocks(nbuckets),
+		counts(nbuckets)
+	{
+		f = tmpfile();
+		if (!f) {
+			eprintf("Can't create temporary file.\n");
+			good = false;
+		}
+	}
+	~BucketFile()
+	{
+		if (f)
+			fclose(f);
+	}
+	bool ok() const { return good; }
+	size_t count(int b) const { return counts[b]; }
+
+	void add(int b, const void *record)
+	{
+		vector<unsigned char> &buf = bufs[b];
+		const unsigned char *r = (const unsigned char *) record;
+		buf.insert(buf.end(), r, r + rec);
+		counts[b]++;
+		if (buf.size() >= block)
+			write_block(b);
+	}
+
+	// Write out what is left in memory
+	bool flush()
+	{
+		for (size_t b = 0; b < bufs.size(); b++) {
+			if (!bufs[b].empty())
+				write_block(b);
+			vector<unsigned char>().swap(bufs[b]);
+		}
+		return good;
+	}
+
+	// All records of bucket b, in the order they were added
+	template <class T>
+	bool read(int b, vector<T> &out)
+	{
+		out.resize(counts[b]);
+		unsigned char *p = counts[b] ? (unsigned char *) &out[0] : NULL;
+		for (size_t i = 0; good && i < blocks[b].size(); i++) {
+			if (seek64(f, blocks[b][i].first) ||
+			    fread(p, 1, blocks[b][i].second, f) != blocks[b][i].second)
+				good = false;
+			p += blocks[b][i].second;
+		}
+		size_t rest = bufs[b].size();
+		if (rest)
+			memcpy(p, &bufs[b][0], rest);
+		return good;
+	}
+
+private:
+	FILE *f;
+	size_t rec, block;
+	long long end;
+	bool good;
+	vector< vector<unsigned char> > bufs;
+	vector< vector< pair<long long, size_t> > > blocks;
+	vector<size_t> counts;
+
+	void write_block(int b)
+	{
+		vector<unsigned char> &buf = bufs[b];
+		if (good && (seek64(f, end) ||
+			     fwrite(&buf[0], 1, buf.size(), f) != buf.size()))
+			good = false;
+		blocks[b].push_back(make_pair(end, buf.size()));
+		end += buf.size();
+		buf.clear();
+	}
+};
+
+
+//
+// SpatialChunks
+//
+struct GhostRecord {
+	int id;
+	point p;
+};
+
+static inline unsigned morton_spread(unsigned x)
+{
+	x = (x | (x << 16)) & 0x030000FFu;
+	x = (x | (x <<  8)) & 0x0300F00Fu;
+	x = (x | (x <<  4)) & 0x030C30C3u;
+	x = (x | (x <<  2)) & 0x09249249u;
+	return x;
+}
+
+// Morton cell of p in a 2^level grid over the box
+static inline unsigned morton_cell(const point &p, const box &bbox, int level)
+{
+	int n = 1 << level;
+	unsigned c[3];
+	for (int j = 0; j < 3; j++) {
+		float extent = bbox.max[j] - bbox.min[j];
+		float t = (extent > 0.0f) ? (p[j] - bbox.min[j]) / extent : 0.0f;
+		int i = (int) (t * n);
+		c[j] = (unsigned) min(max(i, 0), n - 1);
+	}
+	return morton_spread(c[0]) | (morton_spread(c[1]) << 1) |
+	       (morton_spread(c[2]) << 2);
+}
+
+
+SpatialChunks::SpatialChunks() : verts(NULL), faces(NULL), ghosts(NULL)
+{
+	starts.push_back(0);
+}
+
+SpatialChunks::~SpatialChunks()
+{
+	free_buckets();
+}
+
+void SpatialChunks::free_buckets()
+{
+	delete verts;
+	delete faces;
+	delete ghosts;
+	verts = faces = ghosts = NULL;
+}
+
+
+// Reads the mesh into temporary files, then sorts vertices into pieces by
+// Morton cell, each face into the pieces owning its vertices, and finally
+// hands each piece copies of the other vertices its faces use.
+bool SpatialChunks::build(MeshReader *in, size_t max_verts)
+{
+	free_buckets();
+	starts.assign(1, 0);
+	max_verts = max(max_verts, (size_t) 1);
+
+	// Spool everything, finding the bounding box
+	FILE *vspool = tmpfile(), *fspool = tmpfile();
+	if (!vspool || !fspool) {
+		eprintf("Can't create temporary file.\n");
+		if (vspool) fclose(vspool);
+		if (fspool) fclose(fspool);
+		return false;
+	}
+	box bbox;
+	size_t nv = 0, nf = 0;
+	bool ok = true;
+	MeshChunk chunk;
+	while (ok && in->next(chunk)) {
+		for (size_t i = 0; i < chunk.vertices.size(); i++)
+			bbox += chunk.vertices[i];
+		ok = (chunk.vertices.empty() ||
+		      fwrite(&chunk.vertices[0], sizeof(point),
+			     chunk.vertices.size(), vspool) == chunk.vertices.size()) &&
+		     (chunk.faces.empty() ||
+		      fwrite(&chunk.faces[0], sizeof(TriMesh::Face),
+			     chunk.faces.size(), fspool) == chunk.faces.size());
+		nv += chunk.vertices.size();
+		nf += chunk.faces.size();
+	}
+	chunk.clear();
+	if (!ok || in->failed() || nv > (size_t) INT_MAX) {
+		fclose(vspool);
+		fclose(fspool);
+		return false;
+	}
+
+	// Fine enough cells that pieces can be cut to size
+	int level = 0;
+	size_t want_cells = 64 * (nv / max_verts + 1);
+	while (level < 7 && ((size_t) 1 << (3 * level)) < want_cells)
+		level++;
+	int ncells = 1 << (3 * level);
+	const size_t block = 65536;
+	vector<point> pts;
+
+	vector<unsigned> cell_count(ncells);
+	rewind(vspool);
+	for (size_t done = 0; done < nv; done += pts.size()) {
+		pts.resize(min(block, nv - done));
+		if (fread(&pts[0], sizeof(point), pts.size(), vspool) != pts.size()) {
+			ok = false;
+			break;
+		}
+		for (size_t i = 0; i < pts.size(); i++)
+			cell_count[morton_cell(pts[i], bbox, level)]++;
+	}
+
+	// Runs of cells along the curve make pieces
+	vector<int> cell_piece(ncells);
+	size_t in_piece = 0;
+	for (int c = 0; c < ncells; c++) {
+		if (in_piece && in_piece + cell_count[c] > max_verts) {
+			starts.push_back(starts.back() + in_piece);
+			in_piece = 0;
+		}
+		cell_piece[c] = starts.size() - 1;
+		// A cell too full for one piece (clustered input at the finest
+		// level) is cut into several, in input order
+		size_t left = cell_count[c];
+		while (left > max_verts) {
+			starts.push_back(starts.back() + max_verts);
+			left -= max_verts;
+		}
+		in_piece += left;
+	}
+	starts.push_back(starts.back() + in_piece);
+	int npieces = size();
+
+	// New number of every vertex, and the vertices of each piece
+	vector<int> newid(nv);
+	vector<size_t> fill(starts.begin(), starts.end() - 1);
+	vector<unsigned> &cell_seen = cell_count;
+	cell_seen.assign(ncells, 0);
+	verts = new BucketFile(npieces, sizeof(point));
+	rewind(vspool);
+	for (size_t done = 0; ok && done < nv; done += pts.size()) {
+		pts.resize(min(block, nv - done));
+		if (fread(&pts[0], sizeof(point), pts.size(), vspool) != pts.size()) {
+			ok = false;
+			break;
+		}
+		for (size_t i = 0; i < pts.size(); i++) {
+			int c = morton_cell(pts[i], bbox, level);
+			int k = cell_piece[c] + (int) (cell_seen[c]++ / max_verts);
+			newid[done + i] = fill[k]++;
+			verts->add(k, &pts[i]);
+		}
+	}
+	fclose(vspool);
+	vector<point>().swap(pts);
+	vector<unsigned>().swap(cell_seen);
+	ok = ok && verts->flush();
+
+	// Faces go to each piece that owns one of their vertices
+	faces = new BucketFile(npieces, sizeof(TriMesh::Face));
+	vector<TriMesh::Face> fbuf;
+	size_t nbad = 0;
+	rewind(fspool);
+	for (size_t done = 0; ok && done < nf; done += fbuf.size()) {
+		fbuf.resize(min(block, nf - done));
+		if (fread(&fbuf[0], sizeof(TriMesh::Face), fbuf.size(), fspool) != fbuf.size()) {
+			ok = false;
+			break;
+		}
+		for (size_t i = 0; i < fbuf.size(); i++) {
+			TriMesh::Face &face = fbuf[i];
+			int owner[3];
+			bool good = true;
+			for (int j = 0; j < 3; j++) {
+				if (face[j] < 0 || face[j] >= (int) nv) {
+					good = false;
+					break;
+				}
+				face[j] = newid[face[j]];
+				owner[j] = upper_bound(starts.begin(), starts.end(),
+						       (size_t) face[j]) - starts.begin() - 1;
+			}
+			if (!good) {
+				nbad++;
+				continue;
+			}
+			faces->add(owner[0], &face);
+			if (owner[1] != owner[0])
+				faces->add(owner[1], &face);
+			if (owner[2] != owner[0] && owner[2] != owner[1])
+				faces->add(owner[2], &face);
+		}
+	}
+	fclose(fspool);
+	vector<TriMesh::Face>().swap(fbuf);
+	vector<int>().swap(newid);
+	ok = ok && faces->flush();
+	if (nbad)
+		dprintf("Dropped %lu faces with bad indices\n", (unsigned long) nbad);
+
+	// Each piece asks the owners for the other vertices its faces use...
+	BucketFile requests(npieces, sizeof(ivec2));
+	vector<int> foreign;
+	for (int k = 0; ok && k < npieces; k++) {
+		ok = faces->read(k, fbuf);
+		foreign.clear();
+		for (size_t i = 0; i < fbuf.size(); i++)
+			for (int j = 0; j < 3; j++)
+				if ((size_t) fbuf[i][j] < starts[k] ||
+				    (size_t) fbuf[i][j] >= starts[k+1])
+					foreign.push_back(fbuf[i][j]);
+		sort(foreign.begin(), foreign.end());
+		foreign.erase(unique(foreign.begin(), foreign.end()), foreign.end());
+		for (size_t i = 0; i < foreign.size(); i++) {
+			int owner = upper_bound(starts.begin(), starts.end(),
+					       (size_t) foreign[i]) - starts.begin() - 1;
+			ivec2 r(foreign[i], k);
+			requests.add(owner, &r);
+		}
+	}
+	ok = ok && requests.flush();
+
+	// ... and the owners send copies back
+	ghosts = new BucketFile(npieces, sizeof(GhostRecord));
+	vector<ivec2> reqs;
+	for (int k = 0; ok && k < npieces; k++) {
+		ok = verts->read(k, pts) && requests.read(k, reqs);
+		for (size_t i = 0; i < reqs.size(); i++) {
+			GhostRecord g;
+			g.id = reqs[i][0];
+			g.p = pts[g.id - starts[k]];
+			ghosts->add(reqs[i][1], &g);
+		}
+	}
+	ok = ok && ghosts->flush();
+
+	if (!ok) {
+		eprintf("Error sorting mesh into pieces.\n");
+		free_buckets();
+		starts.assign(1, 0);
+		return false;
+	}
+	dprintf("Sorted %lu vertices, %lu faces into %d pieces\n",
+		(unsigned long) nv, (unsigned long) nf, npieces);
+	return true;
+}
+
+
+bool SpatialChunks::load(int k, TriMesh *mesh, vector<int> &ids, int &nowned) const
+{
+	mesh->clear();
+	ids.clear();
+	nowned = 0;
+	vector<GhostRecord> g;
+	if (!verts || !verts->read(k, mesh->vertices) ||
+	    !ghosts->read(k, g) || !faces->read(k, mesh->faces))
+		return false;
+
+	nowned = mesh->vertices.size();
+	ids.resize(nowned + g.size());
+	for (int i = 0; i < nowned; i++)
+		ids[i] = starts[k] + i;
+	mesh->vertices.reserve(nowned + g.size());
+	for (size_t i = 0; i < g.size(); i++) {
+		ids[nowned + i] = g[i].id;
+		mesh->vertices.push_back(g[i].p);
+	}
+
+	// Ghosts come sorted by number, so they can be looked up
+	size_t first = starts[k], last = starts[k+1];
+	for (size_t i = 0; i < mesh->faces.size(); i++) {
+		for (int j = 0; j < 3; j++) {
+			int &v = mesh->faces[i][j];
+			if ((size_t) v >= first && (size_t) v < last)
+				v -= first;
+			else
+				v = lower_bound(ids.begin() + nowned, ids.end(), v) -
+				    ids.begin();
+		}
+	}
+	return true;
+}
+
+
+//
+// Operators
+//
+bool stream_xform(MeshReader *in, MeshWriter *out, const xform &xf)
+{
+	xform nxf = norm_xf(xf);
+	MeshChunk chunk;
+	while (in->next(chunk)) {
+		int nv = chunk.vertices.size();
+#pragma omp parallel for
+		for (int i = 0; i < nv; i++)
+			chunk.vertices[i] = xf * chunk.vertices[i];
+		if (!chunk.normals.empty()) {
+#pragma omp parallel for
+			for (int i = 0; i < nv; i++) {
+				chunk.normals[i] = nxf * chunk.normals[i];
+				normalize(chunk.normals[i]);
+			}
+		}
+		if (!out->write(chunk))
+			return false;
+	}
+	return !in->failed();
+}
+
+
+// The new number of each vertex is the count of vertices kept before it:
+// one bit per vertex, and a running count at the start of every 64
+static inline int popcount64(unsigned long long x)
+{
+#if defined(__GNUC__)
+	return __builtin_popcountll(x);
+#else
+	int n = 0;
+	for (; x; x &= x - 1)
+		n++;
+	return n;
+#endif
+}
+
+bool stream_clip(MeshReader *in, MeshWriter *out, const box &b)
+{
+	vector<unsigned long long> kept_bits;
+	vector<int> kept_before;
+	size_t nkept = 0, nseen = 0;
+
+	MeshChunk chunk, result;
+	while (in->next(chunk)) {
+		result.clear();
+		bool have_normals = !chunk.normals.empty();
+		for (size_t i = 0; i < chunk.vertices.size(); i++, nseen++) {
+			if ((nseen & 63) == 0) {
+				kept_bits.push_back(0);
+				kept_before.push_back(nkept);
+			}
+			const point &p = chunk.vertices[i];
+			if (p[0] < b.min[0] || p[0] > b.max[0] ||
+			    p[1] < b.min[1] || p[1] > b.max[1] ||
+			    p[2] < b.min[2] || p[2] > b.max[2])
+				continue;
+			kept_bits.back() |= 1ull << (nseen & 63);
+			nkept++;
+			result.vertices.push_back(p);
+			if (have_normals)
+				result.normals.push_back(chunk.normals[i]);
+		}
+		for (size_t i = 0; i < chunk.faces.size(); i++) {
+			TriMesh::Face f = chunk.faces[i];
+			bool keep = true;
+			for (int j = 0; keep && j < 3; j++) {
+				size_t v = f[j];
+				if (f[j] < 0 || v >= nseen ||
+				    !(kept_bits[v >> 6] & (1ull << (v & 63)))) {
+					keep = false;
+					break;
+				}
+				f[j] = kept_before[v >> 6] + popcount64(kept_bits[v >> 6] &
+					((1ull << (v & 63)) - 1));
+			}
+			if (keep)
+				result.faces.push_back(f);
+		}
+		if (!out->write(result))
+			return false;
+	}
+	return !in->failed();
+}
+
+
+bool stream_stats(MeshReader *in, MeshStats &stats)
+{
+	stats.nverts = stats.nfaces = 0;
+	stats.bbox.clear();
+	double sum[3] = { 0, 0, 0 };
+	MeshChunk chunk;
+	while (in->next(chunk)) {
+		for (size_t i = 0; i < chunk.vertices.size(); i++) {
+			const point &p = chunk.vertices[i];
+			stats.bbox += p;
+			sum[0] += p[0];
+			sum[1] += p[1];
+			sum[2] += p[2];
+		}
+		stats.nverts += chunk.vertices.size();
+		stats.nfaces += chunk.faces.size();
+	}
+	if (stats.nverts)
+		stats.centroid = point(sum[0] / stats.nverts,
+				       sum[1] / stats.nverts,
+				       sum[2] / stats.nverts);
+	return !in->failed();
+}
+
+
+// Faces are written by the piece owning their first vertex
+bool stream_normals(const SpatialChunks *chunks, MeshWriter *out)
+{
+	TriMesh piece;
+	vector<int> ids;
+	int nowned;
+	MeshChunk result;
+	for (int k = 0; k < chunks->size(); k++) {
+		if (!chunks->load(k, &piece, ids, nowned))
+			return false;
+		piece.need_normals();
+		result.clear();
+		result.vertices.assign(piece.vertices.begin(),
+				       piece.vertices.begin() + nowned);
+		result.normals.assign(piece.normals.begin(),
+				      piece.normals.begin() + nowned);
+		for (size_t i = 0; i < piece.faces.size(); i++) {
+			const TriMesh::Face &f = piece.faces[i];
+			if (f[0] < nowned)
+				result.faces.push_back(TriMesh::Face(ids[f[0]],
+					ids[f[1]], ids[f[2]]));
+		}
+		if (!out->write(result))
+			return false;
+	}
+	return true;
+}
+
+}; // namespace trimesh
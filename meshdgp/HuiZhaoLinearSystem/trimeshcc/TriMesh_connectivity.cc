@@ -14,6 +14,61 @@ using namespace std;
 
 namespace trimesh {
 
+// Build the vertex-to-face lists in CSR form.  Counts are gathered in
+// parallel; the scatter walks the faces in order, so every list comes out
+// sorted by face index, as with the old per-vertex push_back.
+static void find_adjacentfaces(const vector<TriMesh::Face> &faces, int nv,
+                               AdjacencyList &adj)
+{
+	int nf = faces.size();
+	vector<int> &offsets = adj.offsets;
+	offsets.assign(nv + 1, 0);
+
+#pragma omp parallel for
+	for (int i = 0; i < nf; i++) {
+		for (int j = 0; j < 3; j++) {
+#pragma omp atomic
+			offsets[faces[i][j] + 1]++;
+		}
+	}
+	for (int i = 0; i < nv; i++)
+		offsets[i+1] += offsets[i];
+
+	adj.indices.resize(offsets[nv]);
+	vector<int> next(offsets.begin(), offsets.end() - 1);
+	for (int i = 0; i < nf; i++) {
+		for (int j = 0; j < 3; j++)
+			adj.indices[next[faces[i][j]]++] = i;
+	}
+}
+
+
+// Walk the faces around v in order and emit each new neighbor, in the
+// same order the old face-by-face insertion produced.  Returns the count;
+// out may be NULL for the counting pass.
+static int ring_of(const vector<TriMesh::Face> &faces, const IndexSpan &a,
+                   int v, int *out, vector<int> &scratch)
+{
+	scratch.clear();
+	for (size_t k = 0; k < a.size(); k++) {
+		const TriMesh::Face &f = faces[a[k]];
+		for (int j = 0; j < 3; j++) {
+			if (f[j] != v)
+				continue;
+			int n1 = f[(j+1)%3];
+			int n2 = f[(j+2)%3];
+			if (find(scratch.begin(), scratch.end(), n1) == scratch.end())
+				scratch.push_back(n1);
+			if (find(scratch.begin(), scratch.end(), n2) == scratch.end())
+				scratch.push_back(n2);
+		}
+	}
+	if (out)
+		copy(scratch.begin(), scratch.end(), out);
+	return scratch.size();
+}
+
+
 // Find the direct neighbors of each vertex
 void TriMesh::need_neighbors()
 {
@@ -25,29 +80,37 @@ void TriMesh::need_neighbors()
 		return;
 
 	dprintf("Finding vertex neighbors... ");
-	int nv = vertices.size(), nf = faces.size();
+	int nv = vertices.size();
 
-	vector<int> numneighbors(nv);
-	for (int i = 0; i < nf; i++) {
-		numneighbors[faces[i][0]]++;
-		numneighbors[faces[i][1]]++;
-		numneighbors[faces[i][2]]++;
+	// Neighbors are gathered from the faces around each vertex
+	AdjacencyList tmp;
+	const AdjacencyList *adj = &adjacentfaces;
+	if (adjacentfaces.empty()) {
+		find_adjacentfaces(faces, nv, tmp);
+		adj = &tmp;
 	}
 
-	neighbors.resize(nv);
+	// Two passes, both parallel over vertices: count, then fill
+	vector<int> &offsets = neighbors.offsets;
+	offsets.assign(nv + 1, 0);
+#pragma omp parallel
+	{
+		vector<int> scratch;
+#pragma omp for schedule(dynamic, 4096)
+		for (int i = 0; i < nv; i++)
+			offsets[i+1] = ring_of(faces, (*adj)[i], i, NULL, scratch);
+	}
 	for (int i = 0; i < nv; i++)
-		neighbors[i].reserve(numneighbors[i]+2); // Slop for boundaries
+		offsets[i+1] += offsets[i];
 
-	for (int i = 0; i < nf; i++) {
-		for (int j = 0; j < 3; j++) {
-			vector<int> &me = neighbors[faces[i][j]];
-			int n1 = faces[i][(j+1)%3];
-			int n2 = faces[i][(j+2)%3];
-			if (find(me.begin(), me.end(), n1) == me.end())
-				me.push_back(n1);
-			if (find(me.begin(), me.end(), n2) == me.end())
-				me.push_back(n2);
-		}
+	neighbors.indices.resize(offsets[nv]);
+#pragma omp parallel
+	{
+		vector<int> scratch;
+#pragma omp for schedule(dynamic, 4096)
+		for (int i = 0; i < nv; i++)
+			ring_of(faces, (*adj)[i], i,
+				neighbors.indices.data() + offsets[i], scratch);
 	}
 
 	dprintf("Done.\n");
@@ -65,72 +128,274 @@ void TriMesh::need_adjacentfaces()
 		return;
 
 	dprintf("Finding vertex to triangle maps... ");
-	int nv = vertices.size(), nf = faces.size();
+	find_adjacentfaces(faces, vertices.size(), adjacentfaces);
+	dprintf("Done.\n");
+}
 
-	vector<int> numadjacentfaces(nv);
-	for (int i = 0; i < nf; i++) {
-		numadjacentfaces[faces[i][0]]++;
-		numadjacentfaces[faces[i][1]]++;
-		numadjacentfaces[faces[i][2]]++;
+
+// The half-edges of the faces in a (the faces around v) whose lower
+// vertex is v, as sort keys: upper vertex, then half-edge number, then
+// whether the half-edge runs from the lower vertex to the upper one.
+// Returns the count; out may be NULL for the counting pass.
+static int lower_halfedges(const vector<TriMesh::Face> &faces,
+                           const IndexSpan &a, int v, unsigned long long *out)
+{
+	int n = 0;
+	for (size_t k = 0; k < a.size(); k++) {
+		// A face with v at two corners is listed twice in a row
+		int i = a[k];
+		if (k && a[k-1] == i)
+			continue;
+		for (int j = 0; j < 3; j++) {
+			int v1 = faces[i][(j+1)%3], v2 = faces[i][(j+2)%3];
+			if (v1 == v2 || min(v1, v2) != v)
+				continue;
+			if (out)
+				out[n] = ((unsigned long long) max(v1, v2) << 32) |
+					 (unsigned(3*i+j) << 1) | unsigned(v1 < v2);
+			n++;
+		}
 	}
+	return n;
+}
 
-	adjacentfaces.resize(vertices.size());
-	for (int i = 0; i < nv; i++)
-		adjacentfaces[i].reserve(numadjacentfaces[i]);
 
-	for (int i = 0; i < nf; i++) {
-		for (int j = 0; j < 3; j++)
-			adjacentfaces[faces[i][j]].push_back(i);
+// Pair up the two sides of every edge, and list every edge once.  The
+// half-edge facing corner c = 3*i+j is paired with the one facing
+// opposite[c].  The half-edges are bucketed by their lower vertex and
+// sorted by the upper one, so the two sides of an edge end up next to
+// each other.  Edges that can't be paired -- used by more than two
+// faces, or by two faces of opposite orientation -- stay -1 on every
+// side and are listed in nonmanifold.
+static void pair_edges(const vector<TriMesh::Face> &faces, int nv,
+                       const AdjacencyList &adjacentfaces,
+                       vector<int> &opposite, vector<ivec2> &edges,
+                       vector<int> &nonmanifold)
+{
+	int nf = faces.size();
+	opposite.assign(3 * nf, -1);
+
+	// Half-edge 3*i+j is the edge of face i opposite vertex j.  Buckets
+	// are filled from the faces around each vertex, two passes parallel
+	// over vertices as in need_neighbors.
+	AdjacencyList tmp;
+	const AdjacencyList *adj = &adjacentfaces;
+	if (adjacentfaces.empty()) {
+		find_adjacentfaces(faces, nv, tmp);
+		adj = &tmp;
 	}
+	vector<int> offsets(nv + 1);
+#pragma omp parallel for schedule(dynamic, 4096)
+	for (int v = 0; v < nv; v++)
+		offsets[v+1] = lower_halfedges(faces, (*adj)[v], v, NULL);
+	for (int v = 0; v < nv; v++)
+		offsets[v+1] += offsets[v];
 
-	dprintf("Done.\n");
+	vector<unsigned long long> keys(offsets[nv]);
+#pragma omp parallel for schedule(dynamic, 4096)
+	for (int v = 0; v < nv; v++)
+		lower_halfedges(faces, (*adj)[v], v, &keys[0] + offsets[v]);
+	vector<int>().swap(tmp.offsets);
+	vector<int>().swap(tmp.indices);
+
+	// Count the edges starting at each vertex, then number them
+	vector<int> edgestart(nv + 1);
+#pragma omp parallel for schedule(dynamic, 1024)
+	for (int v = 0; v < nv; v++) {
+		unsigned long long *k = &keys[0] + offsets[v];
+		unsigned long long *kend = &keys[0] + offsets[v+1];
+		sort(k, kend);
+		int n = 0;
+		for (unsigned long long *first = k; k != kend; k++)
+			if (k == first || (*k >> 32) != (*(k-1) >> 32))
+				n++;
+		edgestart[v+1] = n;
+	}
+	for (int v = 0; v < nv; v++)
+		edgestart[v+1] += edgestart[v];
+
+	edges.clear();
+	edges.resize(edgestart[nv]);
+	vector<char> bad(edgestart[nv]);
+#pragma omp parallel for schedule(dynamic, 1024)
+	for (int v = 0; v < nv; v++) {
+		int e = edgestart[v];
+		int k = offsets[v], kend = offsets[v+1];
+		while (k < kend) {
+			int upper = int(keys[k] >> 32), group = k;
+			while (k < kend && int(keys[k] >> 32) == upper)
+				k++;
+			edges[e] = ivec2(v, upper);
+			if (k - group == 2) {
+				unsigned h1 = unsigned(keys[group]);
+				unsigned h2 = unsigned(keys[group+1]);
+				int f1 = (h1 >> 1) / 3, j1 = (h1 >> 1) % 3;
+				int f2 = (h2 >> 1) / 3, j2 = (h2 >> 1) % 3;
+				// Consistently oriented faces walk the edge in
+				// opposite directions
+				if (f1 != f2 && ((h1 ^ h2) & 1)) {
+					opposite[3*f1+j1] = 3*f2+j2;
+					opposite[3*f2+j2] = 3*f1+j1;
+				} else {
+					bad[e] = 1;
+				}
+			} else if (k - group > 2) {
+				bad[e] = 1;
+			}
+			e++;
+		}
+	}
+
+	nonmanifold.clear();
+	for (int e = 0; e < int(bad.size()); e++)
+		if (bad[e])
+			nonmanifold.push_back(e);
 }
 
 
-// Find the face across each edge from each other face (-1 on boundary)
-// If topology is bad, not necessarily what one would expect...
+// Find the face across each edge from each other face (-1 on boundary).
+// Read off the corner table if there is one; otherwise the edges are
+// paired from scratch, which also lists every edge in edges.
+// Non-manifold edges are -1 on every side.
 void TriMesh::need_across_edge()
 {
 	if (!across_edge.empty())
 		return;
 
-	need_adjacentfaces();
-	if (adjacentfaces.empty())
+	need_faces();
+	if (faces.empty())
 		return;
 
 	dprintf("Finding across-edge maps... ");
 
 	int nf = faces.size();
-	across_edge.resize(nf, Face(-1,-1,-1));
+	vector<int> pairing;
+	bool fresh = (int(opposite_corner.size()) != 3 * nf);
+	if (fresh)
+		pair_edges(faces, vertices.size(), adjacentfaces, pairing, edges,
+			   nonmanifold_edges);
+	const int *opposite = fresh ? &pairing[0] : &opposite_corner[0];
 
+	across_edge.resize(nf);
 #pragma omp parallel for
 	for (int i = 0; i < nf; i++) {
 		for (int j = 0; j < 3; j++) {
-			if (across_edge[i][j] != -1)
-				continue;
-			int v1 = faces[i][(j+1)%3];
-			int v2 = faces[i][(j+2)%3];
-			const vector<int> &a1 = adjacentfaces[v1];
-			const vector<int> &a2 = adjacentfaces[v2];
-			for (size_t k1 = 0; k1 < a1.size(); k1++) {
-				int other = a1[k1];
-				if (other == i)
-					continue;
-				vector<int>::const_iterator it =
-					find(a2.begin(), a2.end(), other);
-				if (it == a2.end())
-					continue;
-				int ind = (faces[other].indexof(v1)+1)%3;
-				if (faces[other][(ind+1)%3] != v2)
-					continue;
-				across_edge[i][j] = other;
-				across_edge[other][ind] = i;
-				break;
-			}
+			int o = opposite[3*i+j];
+			across_edge[i][j] = (o < 0) ? -1 : o / 3;
 		}
 	}
 
 	dprintf("Done.\n");
+	if (fresh && !nonmanifold_edges.empty())
+		dprintf("Warning: %d non-manifold or inconsistently oriented edges\n",
+			int(nonmanifold_edges.size()));
+}
+
+
+// List every edge once
+void TriMesh::need_edges()
+{
+	if (!edges.empty())
+		return;
+
+	need_faces();
+	if (faces.empty())
+		return;
+
+	dprintf("Finding edges... ");
+	vector<int> pairing;
+	pair_edges(faces, vertices.size(), adjacentfaces, pairing, edges,
+		   nonmanifold_edges);
+	dprintf("Done.\n");
+}
+
+
+// Build the corner table: opposite_corner and vertex_corner
+void TriMesh::need_corners()
+{
+	need_faces();
+	int nf = faces.size(), nv = vertices.size();
+	if (!nf || (int(opposite_corner.size()) == 3 * nf &&
+	            int(vertex_corner.size()) == nv))
+		return;
+
+	dprintf("Building corner table... ");
+
+	// Same pairing as across_edge, which is then read off this table
+	pair_edges(faces, nv, adjacentfaces, opposite_corner, edges,
+		   nonmanifold_edges);
+	across_edge.clear();
+
+	// Lowest corner of each vertex, or the lowest one starting a fan
+	// on the boundary
+	vertex_corner.assign(nv, -1);
+	for (int c = 3 * nf - 1; c >= 0; c--)
+		vertex_corner[corner_vertex(c)] = c;
+	for (int c = 3 * nf - 1; c >= 0; c--)
+		if (opposite_corner[corner_prev(c)] < 0)
+			vertex_corner[corner_vertex(c)] = c;
+
+	dprintf("Done.\n");
+	if (!nonmanifold_edges.empty())
+		dprintf("Warning: %d non-manifold or inconsistently oriented edges\n",
+			int(nonmanifold_edges.size()));
+}
+
+
+// Faces touching any of the given vertices, sorted and without repeats
+void TriMesh::faces_around(const vector<int> &verts, vector<int> &result)
+{
+	need_adjacentfaces();
+	result.clear();
+	for (size_t i = 0; i < verts.size(); i++) {
+		IndexSpan a = adjacentfaces[verts[i]];
+		result.insert(result.end(), a.begin(), a.end());
+	}
+	sort(result.begin(), result.end());
+	result.erase(unique(result.begin(), result.end()), result.end());
+}
+
+
+// Vertices of the given faces, sorted and without repeats
+void TriMesh::verts_of(const vector<int> &facelist, vector<int> &result)
+{
+	result.clear();
+	result.reserve(3 * facelist.size());
+	for (size_t i = 0; i < facelist.size(); i++) {
+		const Face &f = faces[facelist[i]];
+		result.push_back(f[0]);
+		result.push_back(f[1]);
+		result.push_back(f[2]);
+	}
+	sort(result.begin(), result.end());
+	result.erase(unique(result.begin(), result.end()), result.end());
+}
+
+
+// Bring every computed quantity up to date after moving dirty_verts
+void TriMesh::update_dirty()
+{
+	if (dirty_verts.empty())
+		return;
+
+	dprintf("Updating %d moved vertices... ", int(dirty_verts.size()));
+	vector<int> verts;
+	verts.swap(dirty_verts);
+	bbox.valid = false;
+	bsphere.valid = false;
+
+	// Each update also refreshes the quantities it is built on
+	if (!dcurv.empty()) {
+		update_dcurv(verts);
+	} else if (!curv1.empty()) {
+		update_curvatures(verts);
+	} else {
+		if (!normals.empty())
+			update_normals(verts);
+		if (!pointareas.empty())
+			update_pointareas(verts);
+	}
+	dprintf("Done.\n");
 }
 
 }; // namespace trimesh
@@ -0,0 +1,239 @@
+/*
+TriMesh_corners.cc
+Corner table (Rossignac's opposite-corner representation) for TriMeshes,
+and edge flip / split / collapse operators that keep it up to date.
+
+Corner 3*f+j is vertex j of face f; corner_next and corner_prev step
+around the face, opposite_corner steps across the edge facing a corner,
+and corner_swing / corner_unswing step around a vertex.
+*/
+
+#include "TriMesh.h"
+using namespace std;
+
+
+namespace trimesh {
+
+// Everything but the corner table goes stale when faces change
+static void corners_changed(TriMesh *mesh)
+{
+	mesh->tstrips.clear();
+	mesh->neighbors.clear();
+	mesh->adjacentfaces.clear();
+	mesh->across_edge.clear();
+	mesh->edges.clear();
+	mesh->nonmanifold_edges.clear();
+	mesh->soa.clear();
+}
+
+
+// Make corners c1 and c2 opposite each other; either may be -1
+static inline void glue(vector<int> &opposite, int c1, int c2)
+{
+	if (c1 >= 0)
+		opposite[c1] = c2;
+	if (c2 >= 0)
+		opposite[c2] = c1;
+}
+
+
+/*
+     d                     d
+     +                     +
+    /|\                   / \
+   / | \                 /   \
+a +  |  + e   --->    a +-----+ e
+   \ | /                 \   /
+    \|/                   \ /
+     +                     +
+     b                     b
+
+   Faces (a,b,d) and (e,d,b) become (a,e,d) and (e,a,b).  Corner c is
+   vertex a and o = opposite_corner[c] is vertex e; the corners keep
+   their slots, as in edgeflip.
+*/
+bool TriMesh::flip_edge(int c)
+{
+	int o = opposite_corner[c];
+	if (o < 0)
+		return false;
+	int n = corner_next(c), p = corner_prev(c);
+	int on = corner_next(o), op = corner_prev(o);
+	int a = corner_vertex(c), b = corner_vertex(n);
+	int d = corner_vertex(p), e = corner_vertex(o);
+	if (a == e)
+		return false;
+
+	// Outer neighbors whose edges change faces
+	int across_ab = opposite_corner[p], across_ed = opposite_corner[op];
+
+	faces[n/3][n%3] = e;
+	faces[on/3][on%3] = a;
+	glue(opposite_corner, c, across_ed);
+	glue(opposite_corner, o, across_ab);
+	glue(opposite_corner, p, op);
+
+	// b and d each lose a corner; a and e may lose their boundary
+	// fan starts to the new diagonal
+	if (vertex_corner[b] == n)
+		vertex_corner[b] = op;
+	if (vertex_corner[d] == on)
+		vertex_corner[d] = p;
+	if (vertex_corner[a] == c && across_ab < 0)
+		vertex_corner[a] = on;
+	if (vertex_corner[e] == o && across_ed < 0)
+		vertex_corner[e] = n;
+
+	corners_changed(this);
+	return true;
+}
+
+
+/*
+   The edge (b,d) facing corner c (vertex a) is split at m: face (a,b,d)
+   becomes (a,b,m) plus a new face (a,m,d), and the face (e,d,b) on the
+   other side, if any, becomes (e,d,m) plus a new face (e,m,b).
+*/
+int TriMesh::split_edge(int c, const point &p)
+{
+	int o = opposite_corner[c];
+	int n = corner_next(c), pc = corner_prev(c);
+	int a = corner_vertex(c), b = corner_vertex(n), d = corner_vertex(pc);
+	int m = vertices.size();
+	vertices.push_back(p);
+	vertex_corner.push_back(-1);
+
+	int across_da = opposite_corner[n];
+	int c3 = 3 * faces.size();
+	faces.push_back(Face(a, m, d));
+	opposite_corner.resize(c3 + 3, -1);
+	faces[pc/3][pc%3] = m;
+	glue(opposite_corner, c3 + 1, across_da);
+	glue(opposite_corner, n, c3 + 2);
+	if (vertex_corner[d] == pc)
+		vertex_corner[d] = c3 + 2;
+	vertex_corner[m] = c3 + 1;
+
+	if (o < 0) {
+		opposite_corner[c] = opposite_corner[c3] = -1;
+	} else {
+		int on = corner_next(o), op = corner_prev(o);
+		int e = corner_vertex(o);
+		int across_be = opposite_corner[on];
+		int c4 = 3 * faces.size();
+		faces.push_back(Face(e, m, b));
+		opposite_corner.resize(c4 + 3, -1);
+		faces[op/3][op%3] = m;
+		glue(opposite_corner, c, c4);
+		glue(opposite_corner, c3, o);
+		glue(opposite_corner, c4 + 1, across_be);
+		glue(opposite_corner, on, c4 + 2);
+		if (vertex_corner[b] == op)
+			vertex_corner[b] = c4 + 2;
+	}
+
+	corners_changed(this);
+	return m;
+}
+
+
+// Move face "from" into the slot of face "to", fixing up the corner table
+static void move_face(TriMesh *mesh, int from, int to)
+{
+	mesh->faces[to] = mesh->faces[from];
+	for (int j = 0; j < 3; j++) {
+		int cf = 3 * from + j, ct = 3 * to + j;
+		glue(mesh->opposite_corner, ct, mesh->opposite_corner[cf]);
+		int &vc = mesh->vertex_corner[mesh->faces[to][j]];
+		if (vc == cf)
+			vc = ct;
+	}
+}
+
+
+// Remove a face whose corners nothing points to any more, by moving the
+// last face into its slot
+static void drop_face(TriMesh *mesh, int f)
+{
+	int last = mesh->faces.size() - 1;
+	if (f != last)
+		move_face(mesh, last, f);
+	mesh->faces.pop_back();
+	mesh->opposite_corner.resize(3 * last);
+}
+
+
+/*
+   The edge (b,d) facing corner c (vertex a) collapses onto b.  Face
+   (a,b,d) and the face (e,d,b) on the other side, if any, are removed,
+   and the edges (a,d) and (e,d) are glued to (a,b) and (e,b).
+*/
+int TriMesh::collapse_edge(int c)
+{
+	int o = opposite_corner[c];
+	int n = corner_next(c), p = corner_prev(c);
+	int a = corner_vertex(c), b = corner_vertex(n), d = corner_vertex(p);
+
+	// Relabel the fan of d, starting from the first corner on the
+	// boundary, or from p all the way around
+	int start = p;
+	while (corner_unswing(start) >= 0 && corner_unswing(start) != p)
+		start = corner_unswing(start);
+	for (int k = start; k >= 0; ) {
+		faces[k/3][k%3] = b;
+		k = corner_swing(k);
+		if (k == start)
+			break;
+	}
+
+	// Glue the outer edges of the removed faces together
+	int across_da = opposite_corner[n], across_ab = opposite_corner[p];
+	glue(opposite_corner, across_da, across_ab);
+	if (vertex_corner[a] == c)
+		vertex_corner[a] = (across_ab >= 0) ? corner_prev(across_ab) :
+				   (across_da >= 0) ? corner_next(across_da) : -1;
+
+	int e = -1, across_be = -1, across_ed = -1;
+	if (o >= 0) {
+		e = corner_vertex(o);
+		across_be = opposite_corner[corner_next(o)];
+		across_ed = opposite_corner[corner_prev(o)];
+		glue(opposite_corner, across_be, across_ed);
+		if (vertex_corner[e] == o)
+			vertex_corner[e] = (across_ed >= 0) ? corner_prev(across_ed) :
+					   (across_be >= 0) ? corner_next(across_be) : -1;
+	}
+	vertex_corner[d] = -1;
+
+	// Any surviving corner of b, then back to the start of its fan
+	int bc = (across_ab >= 0) ? corner_next(across_ab) :
+		 (across_da >= 0) ? corner_prev(across_da) :
+		 (across_be >= 0) ? corner_prev(across_be) :
+		 (across_ed >= 0) ? corner_next(across_ed) : -1;
+	if (bc >= 0) {
+		int first = bc;
+		while (corner_unswing(first) >= 0 && corner_unswing(first) != bc)
+			first = corner_unswing(first);
+		bc = first;
+	}
+	vertex_corner[b] = bc;
+
+	// Remove the faces, higher index first so the lower one stays put
+	int f1 = c / 3, f2 = (o >= 0) ? o / 3 : -1;
+	opposite_corner[c] = -1;
+	if (o >= 0)
+		opposite_corner[o] = -1;
+	if (f2 > f1) {
+		drop_face(this, f2);
+		drop_face(this, f1);
+	} else {
+		drop_face(this, f1);
+		if (f2 >= 0)
+			drop_face(this, f2);
+	}
+
+	corners_changed(this);
+	return b;
+}
+
+}; // namespace trimesh
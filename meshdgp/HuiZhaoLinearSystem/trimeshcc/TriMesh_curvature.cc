@@ -13,7 +13,9 @@ Uses algorithm from
 
 #include "TriMesh.h"
 #include "TriMesh_algo.h"
+#include "TriMesh_soa.h"
 #include "lineqn.h"
+#include <algorithm>
 using namespace std;
 
 
@@ -142,6 +144,7 @@ void TriMesh::need_curvatures()
 	need_faces();
 	need_normals();
 	need_pointareas();
+	need_adjacentfaces();
 
 	dprintf("Computing curvatures... ");
 
@@ -150,6 +153,9 @@ void TriMesh::need_curvatures()
 	curv1.clear(); curv1.resize(nv); curv2.clear(); curv2.resize(nv);
 	pdir1.clear(); pdir1.resize(nv); pdir2.clear(); pdir2.resize(nv);
 	vector<float> curv12(nv);
+	// Weighted curvature tensor (c1, c12, c2) of every corner, summed
+	// per vertex afterwards so that no two threads write the same vertex
+	vector<vec> cornercurv;
 
 	// Set up an initial coordinate system per vertex
 	for (int i = 0; i < nf; i++) {
@@ -167,65 +173,27 @@ void TriMesh::need_curvatures()
 		pdir2[i] = normals[i] CROSS pdir1[i];
 	}
 
-	// Compute curvature per-face
+	// Compute curvature per-face, fitting the variation of normals
+	// along the edges and projecting it to each corner's vertex frame
+	need_soa();
+	soa_corner_curvatures(soa, normals, pdir1, pdir2,
+			      cornerareas, pointareas, cornercurv);
+
 #pragma omp parallel for
-	for (int i = 0; i < nf; i++) {
-		// Edges
-		vec e[3] = { vertices[faces[i][2]] - vertices[faces[i][1]],
-			     vertices[faces[i][0]] - vertices[faces[i][2]],
-			     vertices[faces[i][1]] - vertices[faces[i][0]] };
-
-		// N-T-B coordinate system per face
-		vec t = e[0];
-		normalize(t);
-		vec n = e[0] CROSS e[1];
-		vec b = n CROSS t;
-		normalize(b);
-
-		// Estimate curvature based on variation of normals
-		// along edges
-		float m[3] = { 0, 0, 0 };
-		float w[3][3] = { {0,0,0}, {0,0,0}, {0,0,0} };
-		for (int j = 0; j < 3; j++) {
-			float u = e[j] DOT t;
-			float v = e[j] DOT b;
-			w[0][0] += u*u;
-			w[0][1] += u*v;
-			//w[1][1] += v*v + u*u; 
-			//w[1][2] += u*v; 
-			w[2][2] += v*v;
-			vec dn = normals[faces[i][PREV(j)]] -
-				 normals[faces[i][NEXT(j)]];
-			float dnu = dn DOT t;
-			float dnv = dn DOT b;
-			m[0] += dnu*u;
-			m[1] += dnu*v + dnv*u;
-			m[2] += dnv*v;
-		}
-		w[1][1] = w[0][0] + w[2][2];
-		w[1][2] = w[0][1];
-
-		// Least squares solution
-		float diag[3];
-		if (!ldltdc<float,3>(w, diag)) {
-			//dprintf("ldltdc failed!\n");
-			continue;
-		}
-		ldltsl<float,3>(w, diag, m, m);
-
-		// Push it back out to the vertices
-		for (int j = 0; j < 3; j++) {
-			int vj = faces[i][j];
-			float c1, c12, c2;
-			proj_curv(t, b, m[0], m[1], m[2],
-				  pdir1[vj], pdir2[vj], c1, c12, c2);
-			float wt = cornerareas[i][j] / pointareas[vj];
-#pragma omp atomic
-			curv1[vj]  += wt * c1;
-#pragma omp atomic
-			curv12[vj] += wt * c12;
-#pragma omp atomic
-			curv2[vj]  += wt * c2;
+	for (int i = 0; i < int(adjacentfaces.size()); i++) {
+		IndexSpan a = adjacentfaces[i];
+		for (size_t k = 0; k < a.size(); k++) {
+			int f = a[k];
+			if (k && a[k-1] == f)
+				continue;
+			for (int j = 0; j < 3; j++) {
+				if (faces[f][j] != i)
+					continue;
+				const vec &cc = cornercurv[3*f+j];
+				curv1[i]  += cc[0];
+				curv12[i] += cc[1];
+				curv2[i]  += cc[2];
+			}
 		}
 	}
 
@@ -241,91 +209,246 @@ void TriMesh::need_curvatures()
 }
 
 
+// Derivative of curvature on face i, weighted and projected to the frame
+// of each of its corners
+static void corner_dcurv(const TriMesh *mesh, int i, Vec<4,float> out[3])
+{
+	const vector<point> &vertices = mesh->vertices;
+	const vector<TriMesh::Face> &faces = mesh->faces;
+	const vector<vec> &pdir1 = mesh->pdir1, &pdir2 = mesh->pdir2;
+	const vector<float> &curv1 = mesh->curv1, &curv2 = mesh->curv2;
+	const vector<vec> &cornerareas = mesh->cornerareas;
+	const vector<float> &pointareas = mesh->pointareas;
+
+	// Edges
+	vec e[3] = { vertices[faces[i][2]] - vertices[faces[i][1]],
+		     vertices[faces[i][0]] - vertices[faces[i][2]],
+		     vertices[faces[i][1]] - vertices[faces[i][0]] };
+
+	// N-T-B coordinate system per face
+	vec t = e[0];
+	normalize(t);
+	vec n = e[0] CROSS e[1];
+	vec b = n CROSS t;
+	normalize(b);
+
+	// Project curvature tensor from each vertex into this
+	// face's coordinate system
+	vec fcurv[3];
+	for (int j = 0; j < 3; j++) {
+		int vj = faces[i][j];
+		proj_curv(pdir1[vj], pdir2[vj], curv1[vj], 0, curv2[vj],
+			  t, b, fcurv[j][0], fcurv[j][1], fcurv[j][2]);
+
+	}
+
+	// Estimate dcurv based on variation of curvature along edges
+	float m[4] = { 0, 0, 0, 0 };
+	float w[4][4] = { {0,0,0,0}, {0,0,0,0}, {0,0,0,0}, {0,0,0,0} };
+	for (int j = 0; j < 3; j++) {
+		// Variation of curvature along each edge
+		vec dfcurv = fcurv[PREV(j)] - fcurv[NEXT(j)];
+		float u = e[j] DOT t;
+		float v = e[j] DOT b;
+		float u2 = u*u, v2 = v*v, uv = u*v;
+		w[0][0] += u2;
+		w[0][1] += uv;
+		//w[1][1] += 2.0f*u2 + v2;
+		//w[1][2] += 2.0f*uv;
+		//w[2][2] += u2 + 2.0f*v2;
+		//w[2][3] += uv;
+		w[3][3] += v2;
+		m[0] += u*dfcurv[0];
+		m[1] += v*dfcurv[0] + 2.0f*u*dfcurv[1];
+		m[2] += 2.0f*v*dfcurv[1] + u*dfcurv[2];
+		m[3] += v*dfcurv[2];
+	}
+	w[1][1] = 2.0f * w[0][0] + w[3][3];
+	w[1][2] = 2.0f * w[0][1];
+	w[2][2] = w[0][0] + 2.0f * w[3][3];
+	w[2][3] = w[0][1];
+
+	// Least squares solution
+	float d[4];
+	if (!ldltdc<float,4>(w, d)) {
+		//dprintf("ldltdc failed!\n");
+		out[0] = out[1] = out[2] = Vec<4,float>();
+		return;
+	}
+	ldltsl<float,4>(w, d, m, m);
+	Vec<4> face_dcurv(m);
+
+	// Push it back out to each vertex
+	for (int j = 0; j < 3; j++) {
+		int vj = faces[i][j];
+		Vec<4> this_vert_dcurv;
+		proj_dcurv(t, b, face_dcurv,
+			   pdir1[vj], pdir2[vj], this_vert_dcurv);
+		float wt = cornerareas[i][j] / pointareas[vj];
+		out[j] = wt * this_vert_dcurv;
+	}
+}
+
+
 // Compute derivatives of curvature.
 void TriMesh::need_dcurv()
 {
 	if (dcurv.size() == vertices.size())
 		return;
 	need_curvatures();
+	need_adjacentfaces();
 
 	dprintf("Computing dcurv... ");
 
 	// Resize the arrays we'll be using
 	int nv = vertices.size(), nf = faces.size();
 	dcurv.clear(); dcurv.resize(nv);
+	vector< Vec<4,float> > cornerdcurv(3 * nf);
 
 	// Compute dcurv per-face
 #pragma omp parallel for
-	for (int i = 0; i < nf; i++) {
-		// Edges
-		vec e[3] = { vertices[faces[i][2]] - vertices[faces[i][1]],
-			     vertices[faces[i][0]] - vertices[faces[i][2]],
-			     vertices[faces[i][1]] - vertices[faces[i][0]] };
-
-		// N-T-B coordinate system per face
-		vec t = e[0];
-		normalize(t);
-		vec n = e[0] CROSS e[1];
-		vec b = n CROSS t;
-		normalize(b);
-
-		// Project curvature tensor from each vertex into this
-		// face's coordinate system
-		vec fcurv[3];
-		for (int j = 0; j < 3; j++) {
-			int vj = faces[i][j];
-			proj_curv(pdir1[vj], pdir2[vj], curv1[vj], 0, curv2[vj],
-				  t, b, fcurv[j][0], fcurv[j][1], fcurv[j][2]);
-
+	for (int i = 0; i < nf; i++)
+		corner_dcurv(this, i, &cornerdcurv[3*i]);
+#pragma omp parallel for
+	for (int i = 0; i < int(adjacentfaces.size()); i++) {
+		IndexSpan a = adjacentfaces[i];
+		float d[4] = { 0, 0, 0, 0 };
+		for (size_t k = 0; k < a.size(); k++) {
+			int f = a[k];
+			if (k && a[k-1] == f)
+				continue;
+			for (int j = 0; j < 3; j++) {
+				if (faces[f][j] != i)
+					continue;
+				const Vec<4,float> &cd = cornerdcurv[3*f+j];
+				for (int l = 0; l < 4; l++)
+					d[l] += cd[l];
+			}
 		}
+		dcurv[i] = Vec<4,float>(d);
+	}
 
-		// Estimate dcurv based on variation of curvature along edges
-		float m[4] = { 0, 0, 0, 0 };
-		float w[4][4] = { {0,0,0,0}, {0,0,0,0}, {0,0,0,0}, {0,0,0,0} };
-		for (int j = 0; j < 3; j++) {
-			// Variation of curvature along each edge
-			vec dfcurv = fcurv[PREV(j)] - fcurv[NEXT(j)];
-			float u = e[j] DOT t;
-			float v = e[j] DOT b;
-			float u2 = u*u, v2 = v*v, uv = u*v;
-			w[0][0] += u2;
-			w[0][1] += uv;
-			//w[1][1] += 2.0f*u2 + v2;
-			//w[1][2] += 2.0f*uv;
-			//w[2][2] += u2 + 2.0f*v2;
-			//w[2][3] += uv;
-			w[3][3] += v2;
-			m[0] += u*dfcurv[0];
-			m[1] += v*dfcurv[0] + 2.0f*u*dfcurv[1];
-			m[2] += 2.0f*v*dfcurv[1] + u*dfcurv[2];
-			m[3] += v*dfcurv[2];
-		}
-		w[1][1] = 2.0f * w[0][0] + w[3][3];
-		w[1][2] = 2.0f * w[0][1];
-		w[2][2] = w[0][0] + 2.0f * w[3][3];
-		w[2][3] = w[0][1];
-
-		// Least squares solution
-		float d[4];
-		if (!ldltdc<float,4>(w, d)) {
-			//dprintf("ldltdc failed!\n");
-			continue;
+	dprintf("Done.\n");
+}
+
+
+// Recompute curvatures after moving the given vertices
+void TriMesh::update_curvatures(const vector<int> &verts)
+{
+	update_normals(verts);
+	update_pointareas(verts);
+	if (curv1.size() != vertices.size()) {
+		curv1.clear();
+		need_curvatures();
+		return;
+	}
+
+	// Normals and point areas changed on the vertices of the faces
+	// around the moved ones; the curvature of every vertex sharing a
+	// face with one of those changes too
+	vector<int> changed, region, ring;
+	faces_around(verts, changed);
+	verts_of(changed, region);
+	faces_around(region, changed);
+	verts_of(changed, region);
+	faces_around(region, ring);
+	int n = region.size();
+
+	// Same initial frame as need_curvatures: the edge leaving the
+	// vertex's last corner, in face order
+#pragma omp parallel for if (n > 4096)
+	for (int r = 0; r < n; r++) {
+		int i = region[r];
+		IndexSpan a = adjacentfaces[i];
+		pdir1[i] = vec();
+		if (!a.empty()) {
+			const Face &f = faces[a.back()];
+			int j = (f[2] == i) ? 2 : (f[1] == i) ? 1 : 0;
+			pdir1[i] = vertices[f[NEXT(j)]] - vertices[i];
 		}
-		ldltsl<float,4>(w, d, m, m);
-		Vec<4> face_dcurv(m);
-
-		// Push it back out to each vertex
-		for (int j = 0; j < 3; j++) {
-			int vj = faces[i][j];
-			Vec<4> this_vert_dcurv;
-			proj_dcurv(t, b, face_dcurv,
-				   pdir1[vj], pdir2[vj], this_vert_dcurv);
-			float wt = cornerareas[i][j] / pointareas[vj];
-			dcurv[vj] += wt * this_vert_dcurv;
+		pdir1[i] = pdir1[i] CROSS normals[i];
+		normalize(pdir1[i]);
+		pdir2[i] = normals[i] CROSS pdir1[i];
+	}
+
+	// Corners of vertices outside the region see their final frames
+	// and are simply not gathered
+	vector<vec> cornercurv;
+	corner_curvatures_at(this, ring, cornercurv);
+
+#pragma omp parallel for if (n > 4096)
+	for (int r = 0; r < n; r++) {
+		int i = region[r];
+		IndexSpan a = adjacentfaces[i];
+		float c1 = 0, c12 = 0, c2 = 0;
+		for (size_t k = 0; k < a.size(); k++) {
+			int f = a[k];
+			if (k && a[k-1] == f)
+				continue;
+			int slot = lower_bound(ring.begin(), ring.end(), f) - ring.begin();
+			for (int j = 0; j < 3; j++) {
+				if (faces[f][j] != i)
+					continue;
+				const vec &cc = cornercurv[3*slot+j];
+				c1  += cc[0];
+				c12 += cc[1];
+				c2  += cc[2];
+			}
 		}
+		diagonalize_curv(pdir1[i], pdir2[i], c1, c12, c2,
+				 normals[i], pdir1[i], pdir2[i],
+				 curv1[i], curv2[i]);
 	}
+}
 
-	dprintf("Done.\n");
+
+// Recompute derivatives of curvature after moving the given vertices
+void TriMesh::update_dcurv(const vector<int> &verts)
+{
+	update_curvatures(verts);
+	if (dcurv.size() != vertices.size()) {
+		dcurv.clear();
+		need_dcurv();
+		return;
+	}
+
+	// Curvatures changed on the 2-ring of the moved vertices: redo
+	// every face around them and every vertex of those faces
+	vector<int> changed, region, ring;
+	faces_around(verts, changed);
+	for (int step = 0; step < 2; step++) {
+		verts_of(changed, region);
+		faces_around(region, changed);
+	}
+	verts_of(changed, region);
+	faces_around(region, ring);
+	int n = region.size(), nring = ring.size();
+
+	vector< Vec<4,float> > cornerdcurv(3 * nring);
+#pragma omp parallel for if (nring > 4096)
+	for (int k = 0; k < nring; k++)
+		corner_dcurv(this, ring[k], &cornerdcurv[3*k]);
+
+#pragma omp parallel for if (n > 4096)
+	for (int r = 0; r < n; r++) {
+		int i = region[r];
+		IndexSpan a = adjacentfaces[i];
+		float d[4] = { 0, 0, 0, 0 };
+		for (size_t k = 0; k < a.size(); k++) {
+			int f = a[k];
+			if (k && a[k-1] == f)
+				continue;
+			int slot = lower_bound(ring.begin(), ring.end(), f) - ring.begin();
+			for (int j = 0; j < 3; j++) {
+				if (faces[f][j] != i)
+					continue;
+				const Vec<4,float> &cd = cornerdcurv[3*slot+j];
+				for (int l = 0; l < 4; l++)
+					d[l] += cd[l];
+			}
+		}
+		dcurv[i] = Vec<4,float>(d);
+	}
 }
 
 }; // namespace trimesh
@@ -4,8 +4,10 @@ Princeton University
 
 TriMesh_io.cc
 Input and output of triangle meshes
-Can read: PLY (triangle mesh and range grid), OFF, OBJ, RAY, SM, 3DS, VVD, STL
-Can write: PLY (triangle mesh and range grid), OFF, OBJ, RAY, SM, STL, C++, DAE
+Can read: PLY (triangle mesh and range grid), OFF, OBJ, RAY, SM, 3DS, VVD, STL,
+	  TMC (native cache), TQM (quantized)
+Can write: PLY (triangle mesh and range grid), OFF, OBJ, RAY, SM, STL, C++, DAE,
+	   TMC (native cache), TQM (quantized)
 */
 
 #include <cstdio>
@@ -14,8 +16,26 @@ Can write: PLY (triangle mesh and range grid), OFF, OBJ, RAY, SM, STL, C++, DAE
 #include <cerrno>
 #include <cctype>
 #include <cstdarg>
+#include <cmath>
+#include <cfloat>
+#include <climits>
 #include "TriMesh.h"
 #include "strutil.h"
+#include "omputil.h"
+#ifdef _WIN32
+# ifndef WIN32_LEAN_AND_MEAN
+#  define WIN32_LEAN_AND_MEAN
+# endif
+# ifndef NOMINMAX
+#  define NOMINMAX
+# endif
+# include <windows.h>
+#else
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+#endif
 using namespace std;
 
 #define dprintf TriMesh::dprintf
@@ -34,14 +54,17 @@ using namespace std;
 namespace trimesh {
 
 // Forward declarations
-static bool read_ply(FILE *f, TriMesh *mesh);
+static bool read_ply(FILE *f, TriMesh *mesh, const char *filename);
 static bool read_3ds(FILE *f, TriMesh *mesh);
 static bool read_vvd(FILE *f, TriMesh *mesh);
 static bool read_ray(FILE *f, TriMesh *mesh);
 static bool read_obj(FILE *f, TriMesh *mesh);
+static bool read_obj_file(FILE *f, const char *filename, TriMesh *mesh);
+static bool read_obj_mapped(const char *data, size_t size, TriMesh *mesh);
 static bool read_off(FILE *f, TriMesh *mesh);
 static bool read_sm( FILE *f, TriMesh *mesh);
 static bool read_stl( FILE *f, TriMesh *mesh);
+static bool read_native(FILE *f, const char *filename, TriMesh *mesh);
 
 static bool read_verts_bin(FILE *f, TriMesh *mesh, bool &need_swap,
 	int nverts, int vert_len, int vert_pos, int vert_norm,
@@ -53,6 +76,13 @@ static bool read_verts_asc(FILE *f, TriMesh *mesh,
 	int vert_color, bool float_color, int vert_conf);
 static bool read_faces_bin(FILE *f, TriMesh *mesh, bool need_swap,
 	int nfaces, int face_len, int face_count, int face_idx);
+static bool read_verts_mapped(const unsigned char *&p,
+	const unsigned char *end, TriMesh *mesh, bool &need_swap,
+	int nverts, int vert_len, int vert_pos, int vert_norm,
+	int vert_color, bool float_color, int vert_conf);
+static bool read_faces_mapped(const unsigned char *&p,
+	const unsigned char *end, TriMesh *mesh, bool need_swap,
+	int nfaces, int face_len, int face_count, int face_idx);
 static bool read_faces_asc(FILE *f, TriMesh *mesh, int nfaces,
 	int face_len, int face_count, int face_idx, bool read_to_eol = false);
 static bool read_strips_bin(FILE *f, TriMesh *mesh, bool need_swap);
@@ -67,6 +97,8 @@ static void check_ind_range(TriMesh *mesh);
 static void skip_comments(FILE *f);
 static void tess(const vector<point> &verts, const vector<int> &thisface,
 		 vector<TriMesh::Face> &tris);
+static void tess(const vector<point> &verts, const int *ind, int n,
+		 TriMesh::Face *tris);
 
 static bool write_ply_ascii(TriMesh *mesh, FILE *f,
 	bool write_norm, bool write_grid, bool float_color);
@@ -80,6 +112,8 @@ static bool write_stl(TriMesh *mesh, FILE *f);
 static bool write_cc(TriMesh *mesh, FILE *f, const char *filename,
 	bool write_norm, bool float_color);
 static bool write_dae(TriMesh *mesh, FILE *f);
+static bool write_tmc(TriMesh *mesh, FILE *f);
+static bool write_tqm(TriMesh *mesh, FILE *f, int pos_bits);
 static bool write_verts_asc(TriMesh *mesh, FILE *f,
 			    const char *before_vert,
 			    const char *before_norm,
@@ -91,7 +125,8 @@ static bool write_verts_bin(TriMesh *mesh, FILE *f, bool need_swap,
 			    bool write_norm, bool write_color,
 			    bool float_color, bool write_conf);
 static bool write_faces_asc(TriMesh *mesh, FILE *f,
-			    const char *before_face, const char *after_line);
+			    const char *before_face, const char *after_line,
+			    int offset = 0, bool obj_normals = false);
 static bool write_faces_bin(TriMesh *mesh, FILE *f, bool need_swap,
 			    int before_face_len, const char *before_face,
 			    int after_face_len, const char *after_face);
@@ -101,9 +136,8 @@ static bool write_grid_asc(TriMesh *mesh, FILE *f);
 static bool write_grid_bin(TriMesh *mesh, FILE *f, bool need_swap);
 
 
-
 // Figure out whether this machine is little- or big-endian
-static bool we_are_little_endian()
+bool TriMesh::we_are_little_endian()
 {
 	// The following appears to be legal according to
 	// C99 strict-aliasing rules
@@ -199,6 +233,79 @@ static void pushback(const char *buf, FILE *f)
 }
 
 
+// A whole file mapped read-only into memory.  Mapping fails, and callers
+// fall back to stdio, for empty files, pipes, and the like.
+class MappedFile {
+public:
+	const char *data;
+	size_t size;
+	MappedFile() : data(0), size(0)
+#ifdef _WIN32
+		, file(INVALID_HANDLE_VALUE), mapping(NULL)
+#endif
+		{}
+	~MappedFile()
+	{
+#ifdef _WIN32
+		if (data)
+			UnmapViewOfFile(data);
+		if (mapping)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+#else
+		if (data)
+			munmap((void *) data, size);
+#endif
+	}
+	bool map(const char *filename)
+	{
+#ifdef _WIN32
+		file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+			OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER len;
+		if (!GetFileSizeEx(file, &len) || len.QuadPart <= 0 ||
+		    (unsigned long long) len.QuadPart > (size_t) -1)
+			return false;
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (!mapping)
+			return false;
+		data = (const char *) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (!data)
+			return false;
+		size = (size_t) len.QuadPart;
+#else
+		int fd = open(filename, O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat st;
+		if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+			close(fd);
+			return false;
+		}
+		void *p = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (p == MAP_FAILED)
+			return false;
+		data = (const char *) p;
+		size = st.st_size;
+# ifdef MADV_SEQUENTIAL
+		madvise(p, size, MADV_SEQUENTIAL);
+# endif
+#endif
+		return true;
+	}
+private:
+#ifdef _WIN32
+	HANDLE file, mapping;
+#endif
+	MappedFile(const MappedFile &);
+	MappedFile &operator = (const MappedFile &);
+};
+
+
 // std::string versions of read/write
 TriMesh *TriMesh::read(const ::std::string &filename)
 {
@@ -275,7 +382,7 @@ bool TriMesh::read_helper(const char *filename, TriMesh *mesh)
 			goto out;
 		}
 		if (strncmp(buf, "ly", 2) == 0)
-			ok = read_ply(f, mesh);
+			ok = read_ply(f, mesh, (f == stdin) ? NULL : filename);
 	} else if (c == 0x4d) {
 		int c2 = fgetc(f);
 		ungetc(c2, f);
@@ -301,12 +408,15 @@ bool TriMesh::read_helper(const char *filename, TriMesh *mesh)
 			ok = read_ray(f, mesh);
 		} else {
 			// Assume an obj file
-			ok = read_obj(f, mesh);
+			ok = read_obj_file(f, filename, mesh);
 		}
 	} else if (c == 'v' || c == 'u' || c == 'f' || c == 'g' || c == 's' || c == 'o') {
 		// Assume an obj file
 		ungetc(c, f);
-		ok = read_obj(f, mesh);
+		ok = read_obj_file(f, filename, mesh);
+	} else if (c == 'T') {
+		// Native cache or quantized file
+		ok = read_native(f, (f == stdin) ? NULL : filename, mesh);
 	} else if (c == 'O') {
 		// Assume an OFF file
 		char buf[3];
@@ -338,8 +448,9 @@ out:
 }
 
 
-// Read a ply file
-static bool read_ply(FILE *f, TriMesh *mesh)
+// Read a ply file.  If filename is given and the file is binary, the body
+// is read through a memory map.
+static bool read_ply(FILE *f, TriMesh *mesh, const char *filename)
 {
 	char buf[1024];	
 	bool binary = false, need_swap = false, float_color = false;
@@ -354,10 +465,10 @@ static bool read_ply(FILE *f, TriMesh *mesh)
 		GET_LINE();
 	if (LINE_IS("format binary_big_endian 1.0")) {
 		binary = true;
-		need_swap = we_are_little_endian();
+		need_swap = TriMesh::we_are_little_endian();
 	} else if (LINE_IS("format binary_little_endian 1.0")) {
 		binary = true;
-		need_swap = !we_are_little_endian();
+		need_swap = !TriMesh::we_are_little_endian();
 	} else if (LINE_IS("format ascii 1.0")) {
 		binary = false;
 	} else {
@@ -500,32 +611,61 @@ static bool read_ply(FILE *f, TriMesh *mesh)
 	}
 
 
-	// Actually read everything in
-	if (skip1) {
-		if (binary)
-			fseek(f, skip1, SEEK_CUR);
-		else
-			for (int i = 0; i < skip1; i++)
-				fscanf(f, "%s", buf);
+	// Map the body of binary files if we can.  Vertices and faces are
+	// read straight from the map; grids and strips continue with stdio.
+	MappedFile file;
+	const unsigned char *body = NULL, *body_end = NULL;
+	if (binary && filename) {
+		long header_len = ftell(f);
+		if (header_len > 0 && file.map(filename) &&
+		    (size_t) header_len <= file.size) {
+			body = (const unsigned char *) file.data + header_len;
+			body_end = (const unsigned char *) file.data + file.size;
+		}
 	}
-	if (binary) {
-		if (!read_verts_bin(f, mesh, need_swap, nverts, vert_len,
-				    vert_pos, vert_norm, vert_color,
-				    float_color, vert_conf))
+
+	// Actually read everything in
+	if (body) {
+		if ((size_t) (body_end - body) < (size_t) skip1)
 			return false;
-	} else {
-		if (!read_verts_asc(f, mesh, nverts, vert_len,
-				    vert_pos, vert_norm, vert_color,
-				    float_color, vert_conf))
+		body += skip1;
+		if (!read_verts_mapped(body, body_end, mesh, need_swap,
+				       nverts, vert_len, vert_pos, vert_norm,
+				       vert_color, float_color, vert_conf))
 			return false;
-	}
+		if ((size_t) (body_end - body) < (size_t) skip2)
+			return false;
+		body += skip2;
+		if ((ngrid || nstrips) &&
+		    fseek(f, (long) (body - (const unsigned char *) file.data), SEEK_SET))
+			return false;
+	} else {
+		if (skip1) {
+			if (binary)
+				fseek(f, skip1, SEEK_CUR);
+			else
+				for (int i = 0; i < skip1; i++)
+					fscanf(f, "%s", buf);
+		}
+		if (binary) {
+			if (!read_verts_bin(f, mesh, need_swap, nverts, vert_len,
+					    vert_pos, vert_norm, vert_color,
+					    float_color, vert_conf))
+				return false;
+		} else {
+			if (!read_verts_asc(f, mesh, nverts, vert_len,
+					    vert_pos, vert_norm, vert_color,
+					    float_color, vert_conf))
+				return false;
+		}
 
-	if (skip2) {
-		if (binary)
-			fseek(f, skip2, SEEK_CUR);
-		else
-			for (int i = 0; i < skip2; i++)
-				fscanf(f, "%s", buf);
+		if (skip2) {
+			if (binary)
+				fseek(f, skip2, SEEK_CUR);
+			else
+				for (int i = 0; i < skip2; i++)
+					fscanf(f, "%s", buf);
+		}
 	}
 
 	if (ngrid) {
@@ -546,7 +686,11 @@ static bool read_ply(FILE *f, TriMesh *mesh)
 		}
 		mesh->convert_strips(TriMesh::TSTRIP_LENGTH);
 	} else if (nfaces) {
-		if (binary) {
+		if (body) {
+			if (!read_faces_mapped(body, body_end, mesh, need_swap,
+					       nfaces, face_len, face_count, face_idx))
+				return false;
+		} else if (binary) {
 			if (!read_faces_bin(f, mesh, need_swap, nfaces,
 					    face_len, face_count, face_idx))
 				return false;
@@ -571,7 +715,7 @@ static bool read_ply(FILE *f, TriMesh *mesh)
 // Read a 3DS file.
 static bool read_3ds(FILE *f, TriMesh *mesh)
 {
-	bool need_swap = !we_are_little_endian();
+	bool need_swap = !TriMesh::we_are_little_endian();
 	int mstart = 0;
 
 	while (!feof(f)) {
@@ -648,7 +792,7 @@ static bool read_3ds(FILE *f, TriMesh *mesh)
 // Read a VVD file.
 static bool read_vvd(FILE *f, TriMesh *mesh)
 {
-	bool need_swap = we_are_little_endian();
+	bool need_swap = TriMesh::we_are_little_endian();
 	const int skip = 127;
 	char buf[skip];
 	fread(buf, skip, 1, f);
@@ -739,7 +883,7 @@ static bool read_obj(FILE *f, TriMesh *mesh)
 	while (1) {
 		skip_comments(f);
 		if (feof(f))
-			return true;
+			break;
 		char buf[1024];
 		GET_LINE();
 		if (LINE_IS("v ") || LINE_IS("v\t")) {
@@ -788,6 +932,341 @@ static bool read_obj(FILE *f, TriMesh *mesh)
 }
 
 
+// Read an obj file through a memory map if possible, else through stdio
+static bool read_obj_file(FILE *f, const char *filename, TriMesh *mesh)
+{
+	if (f != stdin) {
+		MappedFile file;
+		if (file.map(filename))
+			return read_obj_mapped(file.data, file.size, mesh);
+	}
+	return read_obj(f, mesh);
+}
+
+
+// Character classes for the obj scanner.  Newlines end lines, and
+// everything else isspace() knows about separates fields.
+static inline bool obj_blank(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static inline bool obj_digit(char c)
+{
+	return (unsigned) (c - '0') < 10u;
+}
+
+static inline const char *obj_skip_blanks(const char *p, const char *eol)
+{
+	while (p < eol && obj_blank(*p))
+		p++;
+	return p;
+}
+
+
+// Parse an int like sscanf(" %d"), advancing p past it
+static inline bool obj_int(const char *&p, const char *eol, int &val)
+{
+	const char *c = obj_skip_blanks(p, eol);
+	bool neg = false;
+	if (c < eol && (*c == '-' || *c == '+'))
+		neg = (*c++ == '-');
+	if (c == eol || !obj_digit(*c))
+		return false;
+	unsigned u = 0;
+	while (c < eol && obj_digit(*c))
+		u = 10u * u + (unsigned) (*c++ - '0');
+	val = neg ? -(int) u : (int) u;
+	p = c;
+	return true;
+}
+
+
+// Parse a float like sscanf(" %f"), advancing p past it.  Plain decimals
+// with at most 19 digits are converted exactly in double precision and
+// rounded to float, which gives the same result as strtof unless the
+// double lands exactly halfway between two floats.  That case, and
+// anything else (hex, inf, nan, long mantissas, huge exponents, denormals),
+// goes through strtof on a copy of the token.
+static bool obj_float(const char *&p, const char *eol, float &val)
+{
+	static const double pow10[] = {
+		1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+		1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+		1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+
+	const char *start = obj_skip_blanks(p, eol), *c = start;
+	bool neg = false;
+	if (c < eol && (*c == '-' || *c == '+'))
+		neg = (*c++ == '-');
+	unsigned long long m = 0;
+	int ndigits = 0, nsig = 0, exp10 = 0;
+	for (; c < eol && obj_digit(*c); c++, ndigits++) {
+		if (m || *c != '0')
+			nsig++;
+		m = 10u * m + (unsigned) (*c - '0');
+	}
+	if (c < eol && *c == '.') {
+		for (c++; c < eol && obj_digit(*c); c++, ndigits++, exp10--) {
+			if (m || *c != '0')
+				nsig++;
+			m = 10u * m + (unsigned) (*c - '0');
+		}
+	}
+	bool simple = ndigits > 0 && nsig <= 19;
+	if (simple && c < eol && (*c == 'e' || *c == 'E')) {
+		const char *e = c + 1;
+		int x = 0;
+		if (obj_int(e, eol, x) && e - c < 7 && !obj_blank(c[1])) {
+			exp10 += x;
+			c = e;
+		} else {
+			simple = false;
+		}
+	}
+	if (simple && c < eol && !obj_blank(*c))
+		simple = false;
+
+	if (simple && m == 0) {
+		val = neg ? -0.0f : 0.0f;
+		p = c;
+		return true;
+	}
+	if (simple && m <= (1ull << 53) && exp10 >= -22 && exp10 <= 22) {
+		double d = (exp10 < 0) ? (double) m / pow10[-exp10] :
+					 (double) m * pow10[exp10];
+		unsigned long long bits;
+		memcpy(&bits, &d, sizeof(bits));
+		if (d >= FLT_MIN && d <= FLT_MAX &&
+		    (bits & 0x1fffffffull) != 0x10000000ull) {
+			val = neg ? -(float) d : (float) d;
+			p = c;
+			return true;
+		}
+	}
+
+	// strtof wants a terminated string, so copy the whole token
+	for (c = start; c < eol && !obj_blank(*c); c++)
+		;
+	size_t len = c - start;
+	char small[64];
+	string big;
+	char *buf = small;
+	if (len >= sizeof(small)) {
+		big.assign(start, len);
+		buf = &big[0];
+	} else {
+		memcpy(small, start, len);
+		small[len] = '\0';
+	}
+	char *end;
+	val = strtof(buf, &end);
+	if (end == buf)
+		return false;
+	p = start + (end - buf);
+	return true;
+}
+
+
+// Walk the lines of [begin, end) the way read_obj does: leading blanks
+// and comment lines are skipped, and "line" is called with each record
+// type and the text after it.
+enum { OBJ_OTHER, OBJ_VERTEX, OBJ_NORMAL, OBJ_FACE };
+
+static inline int obj_record(const char *&p, const char *eol)
+{
+	p = obj_skip_blanks(p, eol);
+	if (eol - p < 2)
+		return OBJ_OTHER;
+	if (p[0] == 'v') {
+		if (p[1] == ' ' || p[1] == '\t') {
+			p += 2;
+			return OBJ_VERTEX;
+		}
+		if (p[1] == 'n' && eol - p > 2 && (p[2] == ' ' || p[2] == '\t')) {
+			p += 3;
+			return OBJ_NORMAL;
+		}
+	} else if ((p[0] == 'f' || p[0] == 't') &&
+		   (p[1] == ' ' || p[1] == '\t')) {
+		p += 2;
+		return OBJ_FACE;
+	}
+	return OBJ_OTHER;
+}
+
+static inline const char *obj_eol(const char *p, const char *end)
+{
+	const char *eol = (const char *) memchr(p, '\n', end - p);
+	return eol ? eol : end;
+}
+
+
+// Face indices are the leading ints of blank-separated fields, so v,
+// v/vt, v//vn and v/vt/vn all work.  Reading stops at the first field
+// that doesn't start with an int.
+static inline bool obj_next_index(const char *&p, const char *eol, int &ind)
+{
+	p = obj_skip_blanks(p, eol);
+	if (!obj_int(p, eol, ind))
+		return false;
+	while (p < eol && !obj_blank(*p))
+		p++;
+	return true;
+}
+
+
+// Counts of records in a chunk, and where the chunk's records go
+struct ObjCounts {
+	size_t verts, norms, tris;
+};
+
+static void obj_count(const char *p, const char *end, ObjCounts &counts)
+{
+	counts.verts = counts.norms = counts.tris = 0;
+	while (p < end) {
+		const char *eol = obj_eol(p, end);
+		switch (obj_record(p, eol)) {
+			case OBJ_VERTEX:
+				counts.verts++;
+				break;
+			case OBJ_NORMAL:
+				counts.norms++;
+				break;
+			case OBJ_FACE: {
+				size_t n = 0;
+				int ind;
+				while (obj_next_index(p, eol, ind))
+					n++;
+				if (n >= 3)
+					counts.tris += n - 2;
+				break;
+			}
+		}
+		p = eol + 1;
+	}
+}
+
+
+// Parse a chunk into the slots given by "first".  Quads get split once
+// all the vertices are in, so they are only recorded here.
+static bool obj_parse(const char *p, const char *end, TriMesh *mesh,
+	const ObjCounts &first, vector< pair<size_t, Vec<4,int> > > &quads)
+{
+	size_t v = first.verts, n = first.norms, t = first.tris;
+	vector<int> thisface;
+	while (p < end) {
+		const char *eol = obj_eol(p, end);
+		switch (obj_record(p, eol)) {
+			case OBJ_VERTEX: {
+				point &pt = mesh->vertices[v++];
+				if (!obj_float(p, eol, pt[0]) ||
+				    !obj_float(p, eol, pt[1]) ||
+				    !obj_float(p, eol, pt[2]))
+					return false;
+				break;
+			}
+			case OBJ_NORMAL: {
+				vec &nrm = mesh->normals[n++];
+				if (!obj_float(p, eol, nrm[0]) ||
+				    !obj_float(p, eol, nrm[1]) ||
+				    !obj_float(p, eol, nrm[2]))
+					return false;
+				break;
+			}
+			case OBJ_FACE: {
+				thisface.clear();
+				int ind;
+				while (obj_next_index(p, eol, ind))
+					thisface.push_back(ind < 0 ? ind + (int) v : ind - 1);
+				size_t nf = thisface.size();
+				if (nf == 4) {
+					quads.push_back(make_pair(t, Vec<4,int>(
+						thisface[0], thisface[1],
+						thisface[2], thisface[3])));
+					t += 2;
+				} else {
+					for (size_t i = 2; i < nf; i++)
+						mesh->faces[t++] = TriMesh::Face(thisface[0],
+							thisface[i-1], thisface[i]);
+				}
+				break;
+			}
+		}
+		p = eol + 1;
+	}
+	return true;
+}
+
+
+// Read an obj file held in memory.  The file is cut into chunks at line
+// boundaries, the records in each chunk are counted in parallel to find
+// where they go, and then the chunks are parsed in parallel straight into
+// the arrays.  Gives the same mesh as read_obj.
+static bool read_obj_mapped(const char *data, size_t size, TriMesh *mesh)
+{
+	const size_t min_chunk = 1 << 20;
+	int nchunks = 8 * thread_count();
+	if ((size_t) nchunks > size / min_chunk)
+		nchunks = max(1, (int) (size / min_chunk));
+
+	vector<size_t> bounds(nchunks + 1);
+	bounds[0] = 0;
+	bounds[nchunks] = size;
+	for (int k = 1; k < nchunks; k++) {
+		size_t b = max(bounds[k-1], size / nchunks * k);
+		const char *eol = obj_eol(data + b, data + size);
+		bounds[k] = min(size, (size_t) (eol - data) + 1);
+	}
+
+	vector<ObjCounts> counts(nchunks + 1);
+#pragma omp parallel for schedule(dynamic, 1)
+	for (int k = 0; k < nchunks; k++)
+		obj_count(data + bounds[k], data + bounds[k+1], counts[k]);
+
+	// Turn the counts into each chunk's first slots
+	ObjCounts total = { 0, 0, 0 };
+	for (int k = 0; k <= nchunks; k++) {
+		ObjCounts c = counts[k];
+		counts[k] = total;
+		total.verts += c.verts;
+		total.norms += c.norms;
+		total.tris += c.tris;
+	}
+	if (total.verts > (size_t) INT_MAX || total.tris > (size_t) INT_MAX) {
+		eprintf("Too many vertices or faces.\n");
+		return false;
+	}
+	mesh->vertices.resize(total.verts);
+	mesh->normals.resize(total.norms);
+	mesh->faces.resize(total.tris);
+
+	vector< vector< pair<size_t, Vec<4,int> > > > quads(nchunks);
+	int nbad = 0;
+#pragma omp parallel for schedule(dynamic, 1) reduction(+ : nbad)
+	for (int k = 0; k < nchunks; k++)
+		if (!obj_parse(data + bounds[k], data + bounds[k+1], mesh,
+			       counts[k], quads[k]))
+			nbad++;
+	if (nbad)
+		return false;
+
+	// Triangulate the quads, now that all the vertices are in
+#pragma omp parallel for schedule(dynamic, 1)
+	for (int k = 0; k < nchunks; k++)
+		for (size_t q = 0; q < quads[k].size(); q++)
+			tess(mesh->vertices, &quads[k][q].second[0], 4,
+			     &mesh->faces[quads[k][q].first]);
+
+	// Only per-vertex normals are supported, as in read_obj
+	if (mesh->vertices.size() != mesh->normals.size())
+		mesh->normals.clear();
+
+	return true;
+}
+
+
 // Read an off file
 static bool read_off(FILE *f, TriMesh *mesh)
 {
@@ -830,7 +1309,7 @@ static bool read_sm(FILE *f, TriMesh *mesh)
 // Read a binary STL file
 static bool read_stl(FILE *f, TriMesh *mesh)
 {
-	bool need_swap = !we_are_little_endian();
+	bool need_swap = !TriMesh::we_are_little_endian();
 
 	char header[80];
 	COND_READ(true, header, 80);
@@ -861,6 +1340,821 @@ static bool read_stl(FILE *f, TriMesh *mesh)
 }
 
 
+// Native cache (.tmc) files: a header, a table of sections, and then the
+// arrays of the mesh, each starting on a 64-byte boundary so that the
+// file can be mapped.  Every array that has been computed is stored,
+// including connectivity, along with a checksum of its contents.
+// Everything is in the byte order of the machine that wrote the file.
+#define TMC_MAGIC "TMCACHE"
+#define TMC_VERSION 1
+#define TMC_ALIGN 64
+
+struct TmcHeader {
+	char magic[8];
+	unsigned version;
+	unsigned byte_order;
+	int grid_width, grid_height;
+	unsigned nsections;
+	unsigned reserved;
+	unsigned long long table_checksum;
+};
+
+struct TmcSection {
+	unsigned id, elem_size;
+	unsigned long long count, offset, checksum;
+};
+
+// One vector of a TriMesh, seen through its element size
+struct TmcArray {
+	unsigned id, elem_size;
+	void *vec;
+	size_t (*size)(const void *vec);
+	void *(*data)(void *vec);
+	void *(*resize)(void *vec, size_t n);
+};
+
+template <class T>
+static size_t tmc_size(const void *vec)
+{
+	return ((const vector<T> *) vec)->size();
+}
+
+template <class T>
+static void *tmc_data(void *vec)
+{
+	vector<T> &v = * (vector<T> *) vec;
+	return v.empty() ? NULL : (void *) &v[0];
+}
+
+template <class T>
+static void *tmc_resize(void *vec, size_t n)
+{
+	((vector<T> *) vec)->resize(n);
+	return tmc_data<T>(vec);
+}
+
+template <class T>
+static TmcArray tmc_array(unsigned id, vector<T> &vec)
+{
+	TmcArray a = { id, sizeof(T), &vec, tmc_size<T>, tmc_data<T>,
+		       tmc_resize<T> };
+	return a;
+}
+
+// The arrays in a cache file.  Ids are part of the format: add new ones
+// at the end, and never reuse one.
+static void tmc_arrays(TriMesh *mesh, vector<TmcArray> &arrays)
+{
+	arrays.clear();
+	arrays.push_back(tmc_array(1, mesh->vertices));
+	arrays.push_back(tmc_array(2, mesh->faces));
+	arrays.push_back(tmc_array(3, mesh->tstrips));
+	arrays.push_back(tmc_array(4, mesh->grid));
+	arrays.push_back(tmc_array(5, mesh->colors));
+	arrays.push_back(tmc_array(6, mesh->confidences));
+	arrays.push_back(tmc_array(7, mesh->flags));
+	arrays.push_back(tmc_array(8, mesh->normals));
+	arrays.push_back(tmc_array(9, mesh->pdir1));
+	arrays.push_back(tmc_array(10, mesh->pdir2));
+	arrays.push_back(tmc_array(11, mesh->curv1));
+	arrays.push_back(tmc_array(12, mesh->curv2));
+	arrays.push_back(tmc_array(13, mesh->dcurv));
+	arrays.push_back(tmc_array(14, mesh->cornerareas));
+	arrays.push_back(tmc_array(15, mesh->pointareas));
+	arrays.push_back(tmc_array(16, mesh->neighbors.offsets));
+	arrays.push_back(tmc_array(17, mesh->neighbors.indices));
+	arrays.push_back(tmc_array(18, mesh->adjacentfaces.offsets));
+	arrays.push_back(tmc_array(19, mesh->adjacentfaces.indices));
+	arrays.push_back(tmc_array(20, mesh->across_edge));
+	arrays.push_back(tmc_array(21, mesh->edges));
+	arrays.push_back(tmc_array(22, mesh->nonmanifold_edges));
+	arrays.push_back(tmc_array(23, mesh->opposite_corner));
+	arrays.push_back(tmc_array(24, mesh->vertex_corner));
+}
+
+static inline size_t tmc_align(size_t n)
+{
+	return (n + TMC_ALIGN - 1) & ~(size_t) (TMC_ALIGN - 1);
+}
+
+
+// 64-bit checksum of one block: four interleaved multiply-xor lanes over
+// little-endian 8-byte words, then the leftover bytes.  The checksum of
+// given bytes is the same on any machine.
+static unsigned long long tmc_hash_block(const unsigned char *p, size_t n)
+{
+	const bool little_endian = TriMesh::we_are_little_endian();
+	const unsigned long long prime = 0x100000001b3ull;
+	unsigned long long h[4] = { 0xcbf29ce484222325ull, 0x84222325cbf29ce4ull,
+				    0x9ce484222325cbf2ull, 0x2325cbf29ce48422ull };
+	size_t i = 0;
+	for (; i + 32 <= n; i += 32) {
+		for (int j = 0; j < 4; j++) {
+			unsigned long long w;
+			memcpy(&w, p + i + 8 * j, 8);
+			if (!little_endian)
+				swap_64((unsigned char *) &w);
+			h[j] = (h[j] ^ w) * prime;
+		}
+	}
+	for (; i < n; i++)
+		h[0] = (h[0] ^ p[i]) * prime;
+	unsigned long long r = n;
+	for (int j = 0; j < 4; j++) {
+		r = (r ^ h[j] ^ (h[j] >> 31)) * prime;
+		r ^= r >> 29;
+	}
+	return r;
+}
+
+// Checksum of an array, hashed in blocks in parallel and combined in
+// order.  If src is given, the array is copied from it into dst on the
+// way, while the blocks are in cache.
+#define TMC_BLOCK (1 << 20)
+static unsigned long long tmc_checksum(void *dst, const void *src, size_t n)
+{
+	int nblocks = (n + TMC_BLOCK - 1) / TMC_BLOCK;
+	vector<unsigned long long> h(nblocks);
+#pragma omp parallel for schedule(dynamic, 1)
+	for (int b = 0; b < nblocks; b++) {
+		size_t first = (size_t) b * TMC_BLOCK;
+		size_t len = min((size_t) TMC_BLOCK, n - first);
+		unsigned char *d = (unsigned char *) dst + first;
+		if (src)
+			memcpy(d, (const unsigned char *) src + first, len);
+		h[b] = tmc_hash_block(d, len);
+	}
+	unsigned char len[8];
+	for (int i = 0; i < 8; i++)
+		len[i] = (unsigned char) ((unsigned long long) n >> (8 * i));
+	unsigned long long r = tmc_hash_block(len, 8);
+	for (int b = 0; b < nblocks; b++)
+		r = (r ^ h[b]) * 0x100000001b3ull ^ (r >> 32);
+	return r;
+}
+
+static unsigned tmc_byte_order()
+{
+	return 0x01020304u;
+}
+
+
+// Read a cache file that has been loaded or mapped into memory
+static bool read_tmc_data(const unsigned char *data, size_t size, TriMesh *mesh)
+{
+	TmcHeader header;
+	if (size < sizeof(header))
+		return false;
+	memcpy(&header, data, sizeof(header));
+	if (memcmp(header.magic, TMC_MAGIC, 8) != 0)
+		return false;
+	if (header.version != TMC_VERSION) {
+		eprintf("Unsupported cache version %u.\n", header.version);
+		return false;
+	}
+	if (header.byte_order != tmc_byte_order()) {
+		eprintf("Cache was written on a machine of different endianness.\n");
+		return false;
+	}
+	if (header.nsections > (size - sizeof(header)) / sizeof(TmcSection))
+		return false;
+
+	vector<TmcSection> table(header.nsections);
+	if (header.nsections)
+		memcpy(&table[0], data + sizeof(header),
+		       header.nsections * sizeof(TmcSection));
+	if (tmc_checksum(header.nsections ? &table[0] : NULL, NULL,
+			 header.nsections * sizeof(TmcSection)) !=
+	    header.table_checksum) {
+		eprintf("Cache section table is corrupt.\n");
+		return false;
+	}
+
+	vector<TmcArray> arrays;
+	tmc_arrays(mesh, arrays);
+	mesh->grid_width = header.grid_width;
+	mesh->grid_height = header.grid_height;
+	for (size_t i = 0; i < table.size(); i++) {
+		const TmcSection &s = table[i];
+		size_t k = 0;
+		while (k < arrays.size() && arrays[k].id != s.id)
+			k++;
+		if (k == arrays.size()) {
+			dprintf("\n  Skipping unknown cache section %u... ", s.id);
+			continue;
+		}
+		if (s.elem_size != arrays[k].elem_size) {
+			eprintf("Cache section %u has the wrong element size.\n", s.id);
+			return false;
+		}
+		if (s.offset > size ||
+		    s.count > (size - s.offset) / s.elem_size) {
+			eprintf("Cache file is truncated.\n");
+			return false;
+		}
+		size_t len = s.count * s.elem_size;
+		void *dst = arrays[k].resize(arrays[k].vec, s.count);
+		if (tmc_checksum(dst, data + s.offset, len) != s.checksum) {
+			eprintf("Checksum mismatch in cache section %u.\n", s.id);
+			return false;
+		}
+	}
+	dprintf("\n  Read %lu vertices, %lu faces, %u arrays... ",
+		(unsigned long) mesh->vertices.size(),
+		(unsigned long) mesh->faces.size(), header.nsections);
+
+	return true;
+}
+
+
+// Quantized (.tqm) files, for archiving and sending meshes around.
+// Positions are stored with pos_bits bits per coordinate within the
+// bounding box, normals in octahedral coordinates with norm_bits bits
+// each, colors as bytes, and confidences exactly, as the four byte planes
+// of their floats.  Faces are put in vertex cache order and
+// vertices in the order the faces first use them, and each face is coded
+// by the edge it shares with a recent face plus a short code for its
+// third vertex.  Each block of vertices or faces codes its bytes with an
+// order-0 rANS coder and decodes independently of the others.
+// Everything is little-endian.
+#define TQM_MAGIC "TMQUANT"
+#define TQM_VERSION 1
+#define TQM_HEADER_SIZE 72
+#define TQM_BLOCK 65536
+#define TQM_NORMALS 1
+#define TQM_COLORS 2
+#define TQM_CONFIDENCES 4
+#define TQM_DEFAULT_BITS 16
+#define TQM_NORM_BITS 12
+
+// Edge and vertex FIFOs of the face coder
+#define TQM_EDGES 16
+#define TQM_VERTS 16
+#define TQM_NO_EDGE 15
+#define TQM_NEXT 0
+#define TQM_EXPLICIT 15
+
+// rANS coder with 12-bit probabilities and byte-wise renormalization.
+// Consecutive bytes go to RANS_WAYS interleaved states, so that decoding
+// them overlaps (the decoder is unrolled for 4).
+#define RANS_SCALE_BITS 12
+#define RANS_SCALE (1u << RANS_SCALE_BITS)
+#define RANS_L (1u << 23)
+#define RANS_WAYS 4
+
+static inline void put_le(vector<unsigned char> &out, unsigned long long x,
+			  int nbytes)
+{
+	for (int i = 0; i < nbytes; i++, x >>= 8)
+		out.push_back((unsigned char) (x & 0xff));
+}
+
+static inline unsigned long long get_le(const unsigned char *p, int nbytes)
+{
+	unsigned long long x = 0;
+	for (int i = nbytes - 1; i >= 0; i--)
+		x = (x << 8) | p[i];
+	return x;
+}
+
+static inline void put_le_float(vector<unsigned char> &out, float x)
+{
+	unsigned u;
+	memcpy(&u, &x, 4);
+	put_le(out, u, 4);
+}
+
+static inline float get_le_float(const unsigned char *p)
+{
+	unsigned u = (unsigned) get_le(p, 4);
+	float x;
+	memcpy(&x, &u, 4);
+	return x;
+}
+
+static inline void put_varint(vector<unsigned char> &out, unsigned x)
+{
+	while (x >= 0x80) {
+		out.push_back((unsigned char) (x | 0x80));
+		x >>= 7;
+	}
+	out.push_back((unsigned char) x);
+}
+
+static inline bool get_varint(const unsigned char *&p, const unsigned char *end,
+			      unsigned &x)
+{
+	x = 0;
+	for (int shift = 0; shift < 35; shift += 7) {
+		if (p == end)
+			return false;
+		unsigned char c = *p++;
+		x |= (unsigned) (c & 0x7f) << shift;
+		if (!(c & 0x80))
+			return true;
+	}
+	return false;
+}
+
+static inline unsigned zigzag(int x)
+{
+	return ((unsigned) x << 1) ^ (unsigned) (x >> 31);
+}
+
+static inline int unzigzag(unsigned x)
+{
+	return (int) (x >> 1) ^ -(int) (x & 1);
+}
+
+
+// Frequencies of the bytes in a stream, scaled to sum to RANS_SCALE with
+// every byte that occurs getting at least 1
+static void rans_freqs(const vector<unsigned char> &raw, unsigned freq[256])
+{
+	size_t count[256] = { 0 };
+	for (size_t i = 0; i < raw.size(); i++)
+		count[raw[i]]++;
+	int sum = 0, biggest = 0;
+	for (int s = 0; s < 256; s++) {
+		freq[s] = 0;
+		if (!count[s])
+			continue;
+		freq[s] = max((unsigned) ((double) count[s] * RANS_SCALE / raw.size()), 1u);
+		sum += freq[s];
+		if (freq[s] > freq[biggest])
+			biggest = s;
+	}
+	if (sum <= (int) RANS_SCALE) {
+		freq[biggest] += RANS_SCALE - sum;
+		return;
+	}
+	// Too many rounded up to 1: take the excess from the biggest ones
+	while (sum > (int) RANS_SCALE) {
+		for (int s = 0; s < 256 && sum > (int) RANS_SCALE; s++) {
+			if (freq[s] > 1 && freq[s] * 2 >= freq[biggest]) {
+				freq[s]--;
+				sum--;
+			}
+		}
+		biggest = 0;
+		for (int s = 1; s < 256; s++)
+			if (freq[s] > freq[biggest])
+				biggest = s;
+	}
+}
+
+// Append a stream: its length, then either the raw bytes or the
+// frequency table and the rANS-coded bytes, whichever is smaller
+static void tqm_put_stream(vector<unsigned char> &out,
+			   const vector<unsigned char> &raw)
+{
+	put_varint(out, raw.size());
+	if (raw.empty())
+		return;
+
+	unsigned freq[256], start[256];
+	rans_freqs(raw, freq);
+	for (int s = 0, cum = 0; s < 256; s++) {
+		start[s] = cum;
+		cum += freq[s];
+	}
+
+	// Code backwards from the end of the buffer
+	vector<unsigned char> coded(2 * raw.size() + 4 * RANS_WAYS);
+	unsigned char *end = &coded[0] + coded.size(), *p = end;
+	unsigned x[RANS_WAYS];
+	for (int w = 0; w < RANS_WAYS; w++)
+		x[w] = RANS_L;
+	for (size_t i = raw.size(); i--; ) {
+		unsigned &xi = x[i % RANS_WAYS];
+		unsigned f = freq[raw[i]];
+		unsigned x_max = ((RANS_L >> RANS_SCALE_BITS) << 8) * f;
+		while (xi >= x_max) {
+			*--p = (unsigned char) (xi & 0xff);
+			xi >>= 8;
+		}
+		xi = ((xi / f) << RANS_SCALE_BITS) + (xi % f) + start[raw[i]];
+	}
+	for (int w = RANS_WAYS - 1; w >= 0; w--) {
+		p -= 4;
+		p[0] = (unsigned char) x[w];
+		p[1] = (unsigned char) (x[w] >> 8);
+		p[2] = (unsigned char) (x[w] >> 16);
+		p[3] = (unsigned char) (x[w] >> 24);
+	}
+
+	vector<unsigned char> table;
+	for (int s = 0; s < 256; s++)
+		put_varint(table, freq[s]);
+	size_t ncoded = end - p;
+	if (table.size() + ncoded + 5 >= raw.size()) {
+		out.push_back(0);
+		out.insert(out.end(), raw.begin(), raw.end());
+		return;
+	}
+	out.push_back(1);
+	out.insert(out.end(), table.begin(), table.end());
+	put_varint(out, ncoded);
+	out.insert(out.end(), p, end);
+}
+
+// Read a stream written by tqm_put_stream
+static bool tqm_get_stream(const unsigned char *&p, const unsigned char *end,
+			   vector<unsigned char> &raw)
+{
+	unsigned n;
+	if (!get_varint(p, end, n))
+		return false;
+	raw.resize(n);
+	if (!n)
+		return true;
+	if (p == end)
+		return false;
+	unsigned char mode = *p++;
+	if (mode == 0) {
+		if ((size_t) (end - p) < n)
+			return false;
+		memcpy(&raw[0], p, n);
+		p += n;
+		return true;
+	}
+	if (mode != 1)
+		return false;
+
+	// For each slot: the byte, its frequency, and the slot's offset from
+	// the byte's first slot
+	struct Slot { unsigned char sym; unsigned short freq, bias; };
+	Slot slots[RANS_SCALE];
+	unsigned cum = 0;
+	for (int s = 0; s < 256; s++) {
+		unsigned freq;
+		if (!get_varint(p, end, freq) || freq > RANS_SCALE - cum)
+			return false;
+		for (unsigned k = 0; k < freq; k++) {
+			slots[cum + k].sym = (unsigned char) s;
+			slots[cum + k].freq = (unsigned short) freq;
+			slots[cum + k].bias = (unsigned short) k;
+		}
+		cum += freq;
+	}
+	if (cum != RANS_SCALE)
+		return false;
+
+	unsigned ncoded;
+	if (!get_varint(p, end, ncoded) || ncoded < 4 * RANS_WAYS ||
+	    (size_t) (end - p) < ncoded)
+		return false;
+	const unsigned char *q = p, *qend = p + ncoded;
+	p = qend;
+	unsigned x[RANS_WAYS];
+	for (int w = 0; w < RANS_WAYS; w++, q += 4)
+		x[w] = (unsigned) get_le(q, 4);
+	const unsigned mask = RANS_SCALE - 1;
+	unsigned char *out = &raw[0];
+	bool ok = true;
+#define RANS_DECODE(xi, i) do { \
+		const Slot &slot = slots[(xi) & mask]; \
+		out[i] = slot.sym; \
+		(xi) = slot.freq * ((xi) >> RANS_SCALE_BITS) + slot.bias; \
+		while ((xi) < RANS_L) { \
+			if (q == qend) { ok = false; break; } \
+			(xi) = ((xi) << 8) | *q++; \
+		} \
+	} while (0)
+	unsigned x0 = x[0], x1 = x[1], x2 = x[2], x3 = x[3], i = 0;
+	for (; ok && i + 4 <= n; i += 4) {
+		RANS_DECODE(x0, i);
+		RANS_DECODE(x1, i + 1);
+		RANS_DECODE(x2, i + 2);
+		RANS_DECODE(x3, i + 3);
+	}
+	if (ok && i < n)
+		RANS_DECODE(x0, i);
+	if (ok && i + 1 < n)
+		RANS_DECODE(x1, i + 1);
+	if (ok && i + 2 < n)
+		RANS_DECODE(x2, i + 2);
+#undef RANS_DECODE
+	return ok;
+}
+
+
+// Octahedral coordinates of a normal, with "bits" bits each
+static inline void oct_encode(const vec &n, int bits, int &u, int &v)
+{
+	float l1 = fabs(n[0]) + fabs(n[1]) + fabs(n[2]);
+	float x = l1 ? n[0] / l1 : 0.0f, y = l1 ? n[1] / l1 : 0.0f;
+	if (n[2] < 0.0f) {
+		float ox = x;
+		x = (1.0f - fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		y = (1.0f - fabs(ox)) * (y >= 0.0f ? 1.0f : -1.0f);
+	}
+	float maxq = (float) ((1 << bits) - 1);
+	u = min(max(int((x * 0.5f + 0.5f) * maxq + 0.5f), 0), (1 << bits) - 1);
+	v = min(max(int((y * 0.5f + 0.5f) * maxq + 0.5f), 0), (1 << bits) - 1);
+}
+
+static inline vec oct_decode(int u, int v, int bits)
+{
+	float scale = 2.0f / ((1 << bits) - 1);
+	float x = u * scale - 1.0f, y = v * scale - 1.0f;
+	float z = 1.0f - fabs(x) - fabs(y);
+	if (z < 0.0f) {
+		float ox = x;
+		x = (1.0f - fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		y = (1.0f - fabs(ox)) * (y >= 0.0f ? 1.0f : -1.0f);
+	}
+	vec n(x, y, z);
+	normalize(n);
+	return n;
+}
+
+
+// The FIFOs shared by the face coder and decoder.  Edges are stored the
+// way a neighboring face would run along them.
+struct TqmFifos {
+	int edges[TQM_EDGES][2], verts[TQM_VERTS];
+	int edge_head, vert_head;
+
+	TqmFifos() : edge_head(0), vert_head(0)
+	{
+		for (int i = 0; i < TQM_EDGES; i++)
+			edges[i][0] = edges[i][1] = -1;
+		for (int i = 0; i < TQM_VERTS; i++)
+			verts[i] = -1;
+	}
+	void push_edge(int a, int b)
+	{
+		edges[edge_head][0] = a;
+		edges[edge_head][1] = b;
+		edge_head = (edge_head + 1) % TQM_EDGES;
+	}
+	void push_vert(int v)
+	{
+		verts[vert_head] = v;
+		vert_head = (vert_head + 1) % TQM_VERTS;
+	}
+	// i-th most recent entries
+	const int *edge(int i) const
+	{
+		return edges[(edge_head + TQM_EDGES - 1 - i) % TQM_EDGES];
+	}
+	int vert(int i) const
+	{
+		return verts[(vert_head + TQM_VERTS - 1 - i) % TQM_VERTS];
+	}
+};
+
+// Decode a vertex code, updating next and the vertex FIFO
+static inline bool tqm_get_vert(int code, TqmFifos &fifos, int &next,
+				const unsigned char *&p, const unsigned char *end,
+				int &v)
+{
+	if (code == TQM_NEXT) {
+		v = next++;
+		fifos.push_vert(v);
+	} else if (code == TQM_EXPLICIT) {
+		unsigned d;
+		if (!get_varint(p, end, d) || d >= (unsigned) next)
+			return false;
+		v = next - 1 - (int) d;
+		fifos.push_vert(v);
+	} else {
+		v = fifos.vert(code - 1);
+	}
+	return v >= 0;
+}
+
+
+// Decode one block of vertices into the mesh
+static bool tqm_decode_verts(const unsigned char *p, const unsigned char *end,
+			     TriMesh *mesh, size_t first, size_t count,
+			     unsigned flags, int pos_bits, int norm_bits,
+			     const point &pmin, const Vec<3,double> &step)
+{
+	vector<unsigned char> raw;
+	if (!tqm_get_stream(p, end, raw))
+		return false;
+	const unsigned char *r = raw.empty() ? NULL : &raw[0];
+	const unsigned char *rend = r + raw.size();
+	int q[3] = { 0, 0, 0 };
+	const int maxq = (1 << pos_bits) - 1;
+	for (size_t i = first; i < first + count; i++) {
+		for (int j = 0; j < 3; j++) {
+			unsigned d;
+			if (!get_varint(r, rend, d))
+				return false;
+			q[j] += unzigzag(d);
+			if (q[j] < 0 || q[j] > maxq)
+				return false;
+		}
+		mesh->vertices[i] = point(pmin[0] + q[0] * step[0],
+					  pmin[1] + q[1] * step[1],
+					  pmin[2] + q[2] * step[2]);
+	}
+
+	if (flags & TQM_NORMALS) {
+		if (!tqm_get_stream(p, end, raw))
+			return false;
+		r = raw.empty() ? NULL : &raw[0];
+		rend = r + raw.size();
+		int u = 0, v = 0;
+		const int maxn = (1 << norm_bits) - 1;
+		for (size_t i = first; i < first + count; i++) {
+			unsigned du, dv;
+			if (!get_varint(r, rend, du) || !get_varint(r, rend, dv))
+				return false;
+			u += unzigzag(du);
+			v += unzigzag(dv);
+			if (u < 0 || u > maxn || v < 0 || v > maxn)
+				return false;
+			mesh->normals[i] = oct_decode(u, v, norm_bits);
+		}
+	}
+
+	if (flags & TQM_COLORS) {
+		if (!tqm_get_stream(p, end, raw) || raw.size() != 3 * count)
+			return false;
+		unsigned char c[3] = { 0, 0, 0 };
+		for (size_t i = 0; i < count; i++) {
+			for (int j = 0; j < 3; j++)
+				c[j] += raw[3*i+j];
+			mesh->colors[first+i] = Color(c);
+		}
+	}
+
+	if (flags & TQM_CONFIDENCES) {
+		if (!tqm_get_stream(p, end, raw) || raw.size() != 4 * count)
+			return false;
+		for (size_t i = 0; i < count; i++) {
+			unsigned u = 0;
+			for (int b = 3; b >= 0; b--)
+				u = (u << 8) | raw[b*count+i];
+			memcpy(&mesh->confidences[first+i], &u, 4);
+		}
+	}
+	return true;
+}
+
+
+// Decode one block of faces into the mesh
+static bool tqm_decode_faces(const unsigned char *p, const unsigned char *end,
+			     TriMesh *mesh, size_t first, size_t count, int next)
+{
+	vector<unsigned char> codes, extra;
+	if (!tqm_get_stream(p, end, codes) || !tqm_get_stream(p, end, extra))
+		return false;
+	const unsigned char *c = codes.empty() ? NULL : &codes[0];
+	const unsigned char *cend = c + codes.size();
+	const unsigned char *e = extra.empty() ? NULL : &extra[0];
+	const unsigned char *eend = e + extra.size();
+	const int nv = mesh->vertices.size();
+
+	TqmFifos fifos;
+	for (size_t i = first; i < first + count; i++) {
+		if (c == cend)
+			return false;
+		int code = *c++;
+		int fe = code >> 4, a, b, v;
+		if (fe != TQM_NO_EDGE) {
+			a = fifos.edge(fe)[0];
+			b = fifos.edge(fe)[1];
+			if (a < 0 || !tqm_get_vert(code & 15, fifos, next, e, eend, v))
+				return false;
+			fifos.push_edge(v, b);
+			fifos.push_edge(a, v);
+		} else {
+			if (c == cend)
+				return false;
+			int code2 = *c++;
+			if (!tqm_get_vert(code & 15, fifos, next, e, eend, a) ||
+			    !tqm_get_vert(code2 >> 4, fifos, next, e, eend, b) ||
+			    !tqm_get_vert(code2 & 15, fifos, next, e, eend, v))
+				return false;
+			fifos.push_edge(b, a);
+			fifos.push_edge(v, b);
+			fifos.push_edge(a, v);
+		}
+		if (next > nv)
+			return false;
+		mesh->faces[i] = TriMesh::Face(a, b, v);
+	}
+	return true;
+}
+
+
+// Read a quantized file that has been loaded or mapped into memory
+static bool read_tqm_data(const unsigned char *data, size_t size, TriMesh *mesh)
+{
+	if (size < TQM_HEADER_SIZE || memcmp(data, TQM_MAGIC, 8) != 0)
+		return false;
+	unsigned version = (unsigned) get_le(data + 8, 4);
+	if (version != TQM_VERSION) {
+		eprintf("Unsupported quantized mesh version %u.\n", version);
+		return false;
+	}
+	unsigned flags = (unsigned) get_le(data + 12, 4);
+	size_t nv = (size_t) get_le(data + 16, 4);
+	size_t nf = (size_t) get_le(data + 20, 4);
+	int pos_bits = (int) get_le(data + 24, 4);
+	int norm_bits = (int) get_le(data + 28, 4);
+	point pmin, pmax;
+	for (int j = 0; j < 3; j++) {
+		pmin[j] = get_le_float(data + 32 + 4 * j);
+		pmax[j] = get_le_float(data + 44 + 4 * j);
+	}
+	size_t nvblocks = (size_t) get_le(data + 56, 4);
+	unsigned long long checksum = get_le(data + 64, 8);
+	size_t nfblocks = (nf + TQM_BLOCK - 1) / TQM_BLOCK;
+	if (pos_bits < 1 || pos_bits > 24 || norm_bits < 1 || norm_bits > 24 ||
+	    nv > (size_t) INT_MAX || nf > (size_t) INT_MAX ||
+	    nvblocks != (nv + TQM_BLOCK - 1) / TQM_BLOCK ||
+	    get_le(data + 60, 4) != nfblocks ||
+	    (nvblocks + nfblocks) > (size - TQM_HEADER_SIZE) / 16) {
+		eprintf("Quantized mesh header is corrupt.\n");
+		return false;
+	}
+	if (tmc_checksum((void *) (data + TQM_HEADER_SIZE), NULL,
+			 size - TQM_HEADER_SIZE) != checksum) {
+		eprintf("Checksum mismatch in quantized mesh.\n");
+		return false;
+	}
+
+	mesh->vertices.resize(nv);
+	if (flags & TQM_NORMALS)
+		mesh->normals.resize(nv);
+	if (flags & TQM_COLORS)
+		mesh->colors.resize(nv);
+	if (flags & TQM_CONFIDENCES)
+		mesh->confidences.resize(nv);
+	mesh->faces.resize(nf);
+	Vec<3,double> step;
+	for (int j = 0; j < 3; j++)
+		step[j] = ((double) pmax[j] - pmin[j]) / ((1 << pos_bits) - 1);
+
+	const unsigned char *table = data + TQM_HEADER_SIZE;
+	int nblocks = (int) (nvblocks + nfblocks), nbad = 0;
+#pragma omp parallel for schedule(dynamic, 1) reduction(+ : nbad)
+	for (int b = 0; b < nblocks; b++) {
+		unsigned long long offset = get_le(table + 16 * b, 8);
+		unsigned long long len = get_le(table + 16 * b + 8, 4);
+		int next = (int) get_le(table + 16 * b + 12, 4);
+		if (offset > size || len > size - offset) {
+			nbad++;
+			continue;
+		}
+		const unsigned char *p = data + offset, *end = p + len;
+		bool ok;
+		if (b < (int) nvblocks) {
+			size_t first = (size_t) b * TQM_BLOCK;
+			ok = tqm_decode_verts(p, end, mesh, first,
+				min((size_t) TQM_BLOCK, nv - first), flags,
+				pos_bits, norm_bits, pmin, step);
+		} else {
+			size_t first = (size_t) (b - nvblocks) * TQM_BLOCK;
+			ok = (next >= 0) && tqm_decode_faces(p, end, mesh, first,
+				min((size_t) TQM_BLOCK, nf - first), next);
+		}
+		if (!ok)
+			nbad++;
+	}
+	if (nbad) {
+		eprintf("Quantized mesh is corrupt.\n");
+		return false;
+	}
+	dprintf("\n  Read %lu vertices, %lu faces at %d bits... ",
+		(unsigned long) nv, (unsigned long) nf, pos_bits);
+	return true;
+}
+
+
+// Read a cache or quantized file, through a memory map if possible.  The
+// first character of the magic number has already been read from f.
+static bool read_native(FILE *f, const char *filename, TriMesh *mesh)
+{
+	MappedFile file;
+	const unsigned char *data = NULL;
+	size_t size = 0;
+	vector<unsigned char> buf;
+	if (filename && file.map(filename)) {
+		data = (const unsigned char *) file.data;
+		size = file.size;
+	} else {
+		// Slurp the rest of the file
+		buf.assign(1, 'T');
+		unsigned char chunk[65536];
+		size_t n;
+		while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+			buf.insert(buf.end(), chunk, chunk + n);
+		data = &buf[0];
+		size = buf.size();
+	}
+	if (size >= 8 && !memcmp(data, TQM_MAGIC, 8))
+		return read_tqm_data(data, size, mesh);
+	return read_tmc_data(data, size, mesh);
+}
+
+
 // Read nverts vertices from a binary file.
 // vert_len = total length of a vertex record in bytes
 // vert_pos, vert_norm, vert_color, vert_conf =
@@ -1085,15 +2379,209 @@ static bool read_faces_bin(FILE *f, TriMesh *mesh, bool need_swap,
 				this_ninds = buf[face_count];
 			}
 		}
-		thisface.resize(this_ninds);
-		COND_READ(true, thisface[0], 4*this_ninds);
-		if (need_swap) {
-			for (size_t j = 0; j < thisface.size(); j++)
-				swap_int(thisface[j]);
+		thisface.resize(this_ninds);
+		COND_READ(true, thisface[0], 4*this_ninds);
+		if (need_swap) {
+			for (size_t j = 0; j < thisface.size(); j++)
+				swap_int(thisface[j]);
+		}
+		tess(mesh->vertices, thisface, mesh->faces);
+		COND_READ(face_skip > 0, buf[0], face_skip);
+	}
+
+	return true;
+}
+
+
+// Read vertices from a mapped binary file, advancing p past them.
+// Parameters are as in read_verts_bin.  Records that hold nothing but
+// the position are copied in one go; others are picked apart in parallel.
+static bool read_verts_mapped(const unsigned char *&p,
+	const unsigned char *end, TriMesh *mesh, bool &need_swap,
+	int nverts, int vert_len, int vert_pos, int vert_norm,
+	int vert_color, bool float_color, int vert_conf)
+{
+	if (nverts <= 0 || vert_len < 12 || vert_pos < 0)
+		return false;
+	if ((size_t) (end - p) / vert_len < (size_t) nverts)
+		return false;
+
+	int old_nverts = mesh->vertices.size();
+	int new_nverts = old_nverts + nverts;
+	mesh->vertices.resize(new_nverts);
+
+	bool have_norm = (vert_norm >= 0);
+	bool have_color = (vert_color >= 0);
+	bool have_conf = (vert_conf >= 0);
+	if (have_norm)
+		mesh->normals.resize(new_nverts);
+	if (have_color)
+		mesh->colors.resize(new_nverts);
+	if (have_conf)
+		mesh->confidences.resize(new_nverts);
+
+	point first;
+	memcpy(&first[0], p + vert_pos, 12);
+	check_need_swap(first, need_swap);
+
+	dprintf("\n  Reading %d vertices... ", nverts);
+	if (vert_len == 12 && sizeof(point) == 12) {
+		memcpy(&mesh->vertices[old_nverts][0], p, 12 * (size_t) nverts);
+		if (need_swap) {
+#pragma omp parallel for
+			for (int i = old_nverts; i < new_nverts; i++) {
+				swap_float(mesh->vertices[i][0]);
+				swap_float(mesh->vertices[i][1]);
+				swap_float(mesh->vertices[i][2]);
+			}
+		}
+		p += 12 * (size_t) nverts;
+		return true;
+	}
+
+	const int color_size = float_color ? 12 : 3;
+#pragma omp parallel for
+	for (int i = old_nverts; i < new_nverts; i++) {
+		const unsigned char *rec = p + (size_t) (i - old_nverts) * vert_len;
+		memcpy(&mesh->vertices[i][0], rec + vert_pos, 12);
+		if (have_norm)
+			memcpy(&mesh->normals[i][0], rec + vert_norm, 12);
+		if (have_color && float_color)
+			memcpy(&mesh->colors[i][0], rec + vert_color, color_size);
+		if (have_color && !float_color)
+			mesh->colors[i] = Color(rec + vert_color);
+		if (have_conf)
+			memcpy(&mesh->confidences[i], rec + vert_conf, 4);
+
+		if (need_swap) {
+			swap_float(mesh->vertices[i][0]);
+			swap_float(mesh->vertices[i][1]);
+			swap_float(mesh->vertices[i][2]);
+			if (have_norm) {
+				swap_float(mesh->normals[i][0]);
+				swap_float(mesh->normals[i][1]);
+				swap_float(mesh->normals[i][2]);
+			}
+			if (have_color && float_color) {
+				swap_float(mesh->colors[i][0]);
+				swap_float(mesh->colors[i][1]);
+				swap_float(mesh->colors[i][2]);
+			}
+			if (have_conf)
+				swap_float(mesh->confidences[i]);
+		}
+	}
+	p += (size_t) nverts * vert_len;
+
+	return true;
+}
+
+
+// Number of indices in a binary face record, from a 1- or 4-byte count
+static inline unsigned ply_face_ninds(const unsigned char *rec,
+	int face_count, int face_idx, bool need_swap)
+{
+	if (face_count < 0)
+		return 3;
+	if (face_idx - face_count != 4)
+		return rec[face_count];
+	unsigned n;
+	memcpy(&n, rec + face_count, 4);
+	if (need_swap)
+		swap_unsigned(n);
+	return n;
+}
+
+
+// Read faces from a mapped binary file, advancing p past them.
+// Parameters are as in read_faces_bin.  If every face is a triangle the
+// records have a fixed size and are copied in parallel; otherwise one
+// serial pass over the counts finds the records, and they are
+// tesselated in parallel.
+static bool read_faces_mapped(const unsigned char *&p,
+	const unsigned char *end, TriMesh *mesh, bool need_swap,
+	int nfaces, int face_len, int face_count, int face_idx)
+{
+	if (nfaces < 0 || face_idx < 0)
+		return false;
+
+	if (nfaces == 0)
+		return true;
+
+	dprintf("\n  Reading %d faces... ", nfaces);
+
+	int old_nfaces = mesh->faces.size();
+	int face_skip = face_len - face_idx;
+	size_t avail = end - p;
+
+	size_t tri_len = face_idx + 12 + face_skip;
+	bool all_tris = (avail / tri_len >= (size_t) nfaces);
+	if (all_tris && face_count >= 0) {
+		int nbad = 0;
+#pragma omp parallel for reduction(+ : nbad)
+		for (int i = 0; i < nfaces; i++)
+			if (ply_face_ninds(p + i * tri_len, face_count,
+					   face_idx, need_swap) != 3)
+				nbad++;
+		all_tris = !nbad;
+	}
+	if (all_tris) {
+		mesh->faces.resize(old_nfaces + nfaces);
+#pragma omp parallel for
+		for (int i = 0; i < nfaces; i++) {
+			TriMesh::Face &f = mesh->faces[old_nfaces + i];
+			memcpy(&f[0], p + i * tri_len + face_idx, 12);
+			if (need_swap) {
+				swap_int(f[0]);
+				swap_int(f[1]);
+				swap_int(f[2]);
+			}
+		}
+		p += nfaces * tri_len;
+		return true;
+	}
+
+	// Where each record, and the triangles made from it, start
+	vector<size_t> offsets(nfaces), first_tri(nfaces + 1);
+	size_t off = 0, ntris = 0;
+	for (int i = 0; i < nfaces; i++) {
+		if (avail - off < (size_t) face_idx)
+			return false;
+		unsigned ninds = ply_face_ninds(p + off, face_count,
+						face_idx, need_swap);
+		size_t len = face_idx + 4 * (size_t) ninds + face_skip;
+		if (avail - off < len)
+			return false;
+		offsets[i] = off;
+		first_tri[i] = ntris;
+		off += len;
+		if (ninds >= 3)
+			ntris += ninds - 2;
+	}
+	first_tri[nfaces] = ntris;
+	if (old_nfaces + ntris > (size_t) INT_MAX)
+		return false;
+	mesh->faces.resize(old_nfaces + ntris);
+
+#pragma omp parallel
+	{
+		vector<int> thisface;
+#pragma omp for
+		for (int i = 0; i < nfaces; i++) {
+			int ninds = first_tri[i+1] - first_tri[i] + 2;
+			if (ninds < 3)
+				continue;
+			thisface.resize(ninds);
+			memcpy(&thisface[0], p + offsets[i] + face_idx, 4 * ninds);
+			if (need_swap) {
+				for (int j = 0; j < ninds; j++)
+					swap_int(thisface[j]);
+			}
+			tess(mesh->vertices, &thisface[0], ninds,
+			     &mesh->faces[old_nfaces + first_tri[i]]);
 		}
-		tess(mesh->vertices, thisface, mesh->faces);
-		COND_READ(face_skip > 0, buf[0], face_skip);
 	}
+	p += off;
 
 	return true;
 }
@@ -1376,34 +2864,40 @@ static void tess(const vector<point> &verts, const vector<int> &thisface,
 {
 	if (thisface.size() < 3)
 		return;
-	if (thisface.size() == 3) {
-		tris.push_back(TriMesh::Face(thisface[0],
-					     thisface[1],
-					     thisface[2]));
+	size_t first = tris.size();
+	tris.resize(first + thisface.size() - 2);
+	tess(verts, &thisface[0], thisface.size(), &tris[first]);
+}
+
+
+// Tesselate an n-gon, n >= 3, into the n-2 triangles starting at "tris"
+static void tess(const vector<point> &verts, const int *ind, int n,
+		 TriMesh::Face *tris)
+{
+	if (n == 3) {
+		tris[0] = TriMesh::Face(ind[0], ind[1], ind[2]);
 		return;
 	}
-	if (thisface.size() == 4) {
+	if (n == 4) {
 		// Triangulate in the direction that
 		// gives the shorter diagonal
-		const point &p0 = verts[thisface[0]], &p1 = verts[thisface[1]];
-		const point &p2 = verts[thisface[2]], &p3 = verts[thisface[3]];
-		float d02 = dist2(p0, p2);
-		float d13 = dist2(p1, p3);
-		int i = (d02 < d13) ? 0 : 1;
-		tris.push_back(TriMesh::Face(thisface[i],
-					     thisface[(i+1)%4],
-					     thisface[(i+2)%4]));
-		tris.push_back(TriMesh::Face(thisface[i],
-					     thisface[(i+2)%4],
-					     thisface[(i+3)%4]));
+		int i = 0, nv = verts.size();
+		if (ind[0] >= 0 && ind[0] < nv && ind[1] >= 0 && ind[1] < nv &&
+		    ind[2] >= 0 && ind[2] < nv && ind[3] >= 0 && ind[3] < nv) {
+			const point &p0 = verts[ind[0]], &p1 = verts[ind[1]];
+			const point &p2 = verts[ind[2]], &p3 = verts[ind[3]];
+			float d02 = dist2(p0, p2);
+			float d13 = dist2(p1, p3);
+			i = (d02 < d13) ? 0 : 1;
+		}
+		tris[0] = TriMesh::Face(ind[i], ind[(i+1)%4], ind[(i+2)%4]);
+		tris[1] = TriMesh::Face(ind[i], ind[(i+2)%4], ind[(i+3)%4]);
 		return;
 	}
 
 	// 5-gon or higher - just tesselate arbitrarily...
-	for (size_t i = 2; i < thisface.size(); i++)
-		tris.push_back(TriMesh::Face(thisface[0],
-					     thisface[i-1],
-					     thisface[i]));
+	for (int i = 2; i < n; i++)
+		tris[i-2] = TriMesh::Face(ind[0], ind[i-1], ind[i]);
 }
 
 
@@ -1421,17 +2915,19 @@ bool TriMesh::write(const char *filename)
 	}
 
 	enum { PLY_ASCII, PLY_BINARY_BE, PLY_BINARY_LE,
-	       RAY, OBJ, OFF, SM, STL, CC, DAE } filetype;
+	       RAY, OBJ, OFF, SM, STL, CC, DAE, TMC, TQM } filetype;
 	// Set default file type to be native-endian binary ply
-	filetype = we_are_little_endian() ? PLY_BINARY_LE : PLY_BINARY_BE;
+	filetype = TriMesh::we_are_little_endian() ?
+		PLY_BINARY_LE : PLY_BINARY_BE;
 
 	bool write_norm = false;
 	bool write_grid = !grid.empty();
 	bool float_color = false;
+	int pos_bits = TQM_DEFAULT_BITS;
 
 	// Infer file type from file extension
 	if (ends_with(filename, ".ply"))
-		filetype = we_are_little_endian() ?
+		filetype = TriMesh::we_are_little_endian() ?
 				PLY_BINARY_LE : PLY_BINARY_BE;
 	else if (ends_with(filename, ".ray"))
 		filetype = RAY;
@@ -1453,6 +2949,10 @@ bool TriMesh::write(const char *filename)
 		filetype = CC;
 	else if (ends_with(filename, ".dae"))
 		filetype = DAE;
+	else if (ends_with(filename, ".tmc"))
+		filetype = TMC;
+	else if (ends_with(filename, ".tqm"))
+		filetype = TQM;
 
 	// Handle filetype:filename.foo constructs
 	while (1) {
@@ -1467,12 +2967,12 @@ bool TriMesh::write(const char *filename)
 			float_color = true;
 		} else if (begins_with(filename, "ply:")) {
 			filename += 4;
-			filetype = we_are_little_endian() ?
+			filetype = TriMesh::we_are_little_endian() ?
 					PLY_BINARY_LE :
 					PLY_BINARY_BE;
 		} else if (begins_with(filename, "ply_binary:")) {
 			filename += 11;
-			filetype = we_are_little_endian() ?
+			filetype = TriMesh::we_are_little_endian() ?
 					PLY_BINARY_LE :
 					PLY_BINARY_BE;
 		} else if (begins_with(filename, "ply_binary_be:")) {
@@ -1520,10 +3020,26 @@ bool TriMesh::write(const char *filename)
 		} else if (begins_with(filename, "dae:")) {
 			filename += 4;
 			filetype = DAE;
+		} else if (begins_with(filename, "tmc:")) {
+			filename += 4;
+			filetype = TMC;
+		} else if (begins_with(filename, "tqm:")) {
+			filename += 4;
+			filetype = TQM;
+		} else if (filename[0] == 'q' && isdigit(filename[1]) &&
+			   (filename[2] == ':' ||
+			    (isdigit(filename[2]) && filename[3] == ':'))) {
+			// Bits per coordinate for TQM, as in "q12:"
+			pos_bits = atoi(filename + 1);
+			filename += (filename[2] == ':') ? 3 : 4;
 		} else {
 			break;
 		}
 	}
+	if (filetype == TQM && (pos_bits < 1 || pos_bits > 24)) {
+		eprintf("Can't quantize to %d bits per coordinate.\n", pos_bits);
+		return false;
+	}
 
 
 	FILE *f = NULL;
@@ -1549,11 +3065,13 @@ bool TriMesh::write(const char *filename)
 			break;
 		case PLY_BINARY_BE:
 			ok = write_ply_binary(this, f,
-				we_are_little_endian(), write_norm, write_grid, float_color);
+				TriMesh::we_are_little_endian(),
+				write_norm, write_grid, float_color);
 			break;
 		case PLY_BINARY_LE:
 			ok = write_ply_binary(this, f,
-				!we_are_little_endian(), write_norm, write_grid, float_color);
+				!TriMesh::we_are_little_endian(),
+				write_norm, write_grid, float_color);
 			break;
 		case RAY:
 			ok = write_ray(this, f);
@@ -1576,6 +3094,14 @@ bool TriMesh::write(const char *filename)
 		case DAE:
 			ok = write_dae(this, f);
 			break;
+		case TMC:
+			ok = write_tmc(this, f);
+			break;
+		case TQM:
+			if (write_norm)
+				need_normals();
+			ok = write_tqm(this, f, pos_bits);
+			break;
 	}
 
 	fclose(f);
@@ -1680,7 +3206,7 @@ static bool write_ply_binary(TriMesh *mesh, FILE *f, bool need_swap,
 
 	bool write_tstrips = !write_grid && !mesh->tstrips.empty();
 
-	const char *format = (need_swap ^ we_are_little_endian()) ?
+	const char *format = (need_swap ^ TriMesh::we_are_little_endian()) ?
 		"binary_little_endian" : "binary_big_endian";
 	if (!write_ply_header(mesh, f, format, write_grid, write_tstrips,
 			      write_norm, float_color))
@@ -1732,38 +3258,8 @@ static bool write_obj(TriMesh *mesh, FILE *f, bool write_norm)
 	if (!write_verts_asc(mesh, f, "v ", write_norm ? "\nvn " : 0, 0, false, 0, ""))
 		return false;
 
-	mesh->need_faces();
-
-	// Indices in OBJ files are 1-based.  Temporarily increment them.
-	for (size_t i = 0; i < mesh->faces.size(); i++) {
-		mesh->faces[i][0]++;
-		mesh->faces[i][1]++;
-		mesh->faces[i][2]++;
-	}
-
-	bool ok = true;
-	if (!write_norm) {
-		ok = write_faces_asc(mesh, f, "f ", "");
-	} else {
-		for (size_t i = 0; i < mesh->faces.size(); i++) {
-			int n = fprintf(f, "f %d//%d %d//%d %d//%d\n",
-					mesh->faces[i][0], mesh->faces[i][0],
-					mesh->faces[i][1], mesh->faces[i][1],
-					mesh->faces[i][2], mesh->faces[i][2]);
-			if (n < 6) {
-				ok = false;
-				break;
-			}
-		}
-	}
-
-	// Put indices back
-	for (size_t i = 0; i < mesh->faces.size(); i++) {
-		mesh->faces[i][0]--;
-		mesh->faces[i][1]--;
-		mesh->faces[i][2]--;
-	}
-	return ok;
+	// Indices in OBJ files are 1-based
+	return write_faces_asc(mesh, f, "f ", "", 1, write_norm);
 }
 
 
@@ -1797,7 +3293,7 @@ static bool write_sm(TriMesh *mesh, FILE *f)
 // Write an STL file
 static bool write_stl(TriMesh *mesh, FILE *f)
 {
-	bool need_swap = !we_are_little_endian();
+	bool need_swap = !TriMesh::we_are_little_endian();
 
 	char header[80];
 	memset(header, ' ', 80);
@@ -1990,183 +3486,768 @@ static bool write_dae(TriMesh *mesh, FILE *f)
 }
 
 
-// Write a bunch of vertices to an ASCII file
-static bool write_verts_asc(TriMesh *mesh, FILE *f,
-			    const char *before_vert,
-			    const char *before_norm,
-			    const char *before_color,
-			    bool float_color,
-			    const char *before_conf,
-			    const char *after_line)
+// Write a native cache file, with every array that is present
+static bool write_tmc(TriMesh *mesh, FILE *f)
 {
-    for (size_t i = 0; i < mesh->vertices.size(); i++) {
-		FPRINTF(f, "%s%.7g %.7g %.7g", before_vert,
-				mesh->vertices[i][0],
-				mesh->vertices[i][1],
-				mesh->vertices[i][2]);
-		if (!mesh->normals.empty() && before_norm)
-			FPRINTF(f, "%s%.7g %.7g %.7g", before_norm,
-				mesh->normals[i][0],
-				mesh->normals[i][1],
-				mesh->normals[i][2]);
-		if (!mesh->colors.empty() && before_color && float_color)
-			FPRINTF(f, "%s%.7g %.7g %.7g", before_color,
-				mesh->colors[i][0],
-				mesh->colors[i][1],
-				mesh->colors[i][2]);
-		if (!mesh->colors.empty() && before_color && !float_color)
-			FPRINTF(f, "%s%d %d %d", before_color,
-				color2uchar(mesh->colors[i][0]),
-				color2uchar(mesh->colors[i][1]),
-				color2uchar(mesh->colors[i][2]));
-		if (!mesh->confidences.empty() && before_conf)
-			FPRINTF(f, "%s%.7g", before_conf, mesh->confidences[i]);
-		FPRINTF(f, "%s\n", after_line);
+	vector<TmcArray> arrays, present;
+	tmc_arrays(mesh, arrays);
+	for (size_t i = 0; i < arrays.size(); i++)
+		if (arrays[i].size(arrays[i].vec))
+			present.push_back(arrays[i]);
+
+	TmcHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TMC_MAGIC, 8);
+	header.version = TMC_VERSION;
+	header.byte_order = tmc_byte_order();
+	header.grid_width = mesh->grid_width;
+	header.grid_height = mesh->grid_height;
+	header.nsections = present.size();
+
+	vector<TmcSection> table(present.size());
+	size_t offset = tmc_align(sizeof(header) +
+				  table.size() * sizeof(TmcSection));
+	for (size_t i = 0; i < present.size(); i++) {
+		TmcSection &s = table[i];
+		memset(&s, 0, sizeof(s));
+		s.id = present[i].id;
+		s.elem_size = present[i].elem_size;
+		s.count = present[i].size(present[i].vec);
+		s.offset = offset;
+		s.checksum = tmc_checksum(present[i].data(present[i].vec), NULL,
+					  s.count * s.elem_size);
+		offset = tmc_align(offset + s.count * s.elem_size);
+	}
+	header.table_checksum = tmc_checksum(table.empty() ? NULL : &table[0],
+		NULL, table.size() * sizeof(TmcSection));
+
+	static const char zeros[TMC_ALIGN] = { 0 };
+	FWRITE(&header, sizeof(header), 1, f);
+	size_t written = sizeof(header);
+	if (!table.empty()) {
+		FWRITE(&table[0], sizeof(TmcSection), table.size(), f);
+		written += table.size() * sizeof(TmcSection);
+	}
+	for (size_t i = 0; i < present.size(); i++) {
+		size_t pad = table[i].offset - written;
+		if (pad)
+			FWRITE(zeros, 1, pad, f);
+		size_t len = table[i].count * table[i].elem_size;
+		FWRITE(present[i].data(present[i].vec), 1, len, f);
+		written = table[i].offset + len;
 	}
 	return true;
 }
 
 
-// Byte-swap vertex properties
-static void swap_vert_props(TriMesh *mesh, bool swap_color)
+// Order faces for a vertex cache of TQM_VERTS entries, with the greedy
+// fanning of Sander et al., "Fast Triangle Reordering for Vertex Locality
+// and Reduced Overdraw" (SIGGRAPH 2007)
+static void tqm_face_order(TriMesh *mesh, vector<int> &order)
 {
-	for (size_t i = 0; i < mesh->vertices.size(); i++) {
-		swap_float(mesh->vertices[i][0]);
-		swap_float(mesh->vertices[i][1]);
-		swap_float(mesh->vertices[i][2]);
+	order.clear();
+	const int nv = mesh->vertices.size(), nf = mesh->faces.size();
+	if (!nf)
+		return;
+	mesh->need_adjacentfaces();
+	const int cache_size = TQM_VERTS;
+	vector<int> live(nv), cache_time(nv, 0);
+	for (int i = 0; i < nv; i++)
+		live[i] = mesh->adjacentfaces[i].size();
+	vector<bool> emitted(nf, false);
+	vector<int> dead_end, candidates;
+	order.reserve(nf);
+
+	int fan = 0, time = cache_size + 1, cursor = 1;
+	while (fan >= 0) {
+		candidates.clear();
+		IndexSpan a = mesh->adjacentfaces[fan];
+		for (size_t k = 0; k < a.size(); k++) {
+			int f = a[k];
+			if (emitted[f])
+				continue;
+			emitted[f] = true;
+			order.push_back(f);
+			for (int j = 0; j < 3; j++) {
+				int v = mesh->faces[f][j];
+				dead_end.push_back(v);
+				candidates.push_back(v);
+				live[v]--;
+				if (time - cache_time[v] > cache_size)
+					cache_time[v] = time++;
+			}
+		}
+
+		// Next fanning vertex: one still in the cache with the most
+		// faces left, or else a recent dead end, or else the next one
+		// with any faces left
+		fan = -1;
+		int best = -1;
+		for (size_t k = 0; k < candidates.size(); k++) {
+			int v = candidates[k];
+			if (live[v] <= 0)
+				continue;
+			int priority = 0;
+			if (time - cache_time[v] + 2 * live[v] <= cache_size)
+				priority = time - cache_time[v];
+			if (priority > best) {
+				best = priority;
+				fan = v;
+			}
+		}
+		while (fan < 0 && !dead_end.empty()) {
+			int v = dead_end.back();
+			dead_end.pop_back();
+			if (live[v] > 0)
+				fan = v;
+		}
+		while (fan < 0 && cursor < nv) {
+			if (live[cursor] > 0)
+				fan = cursor;
+			cursor++;
+		}
 	}
-	if (!mesh->normals.empty()) {
-		for (size_t i = 0; i < mesh->normals.size(); i++) {
-			swap_float(mesh->normals[i][0]);
-			swap_float(mesh->normals[i][1]);
-			swap_float(mesh->normals[i][2]);
+}
+
+
+// Code the third vertex of a face, or any vertex of one that shares no
+// recent edge, updating next and the vertex FIFO
+static inline int tqm_put_vert(int v, TqmFifos &fifos, int &next,
+			       vector<unsigned char> &extra)
+{
+	if (v == next) {
+		next++;
+		fifos.push_vert(v);
+		return TQM_NEXT;
+	}
+	for (int i = 0; i < TQM_EXPLICIT - 1; i++)
+		if (fifos.vert(i) == v)
+			return i + 1;
+	put_varint(extra, next - 1 - v);
+	fifos.push_vert(v);
+	return TQM_EXPLICIT;
+}
+
+// Code one block of faces, whose indices are already in first-use order
+static void tqm_encode_faces(const vector<TriMesh::Face> &faces, size_t first,
+			     size_t count, int next, vector<unsigned char> &out)
+{
+	vector<unsigned char> codes, extra;
+	TqmFifos fifos;
+	for (size_t i = first; i < first + count; i++) {
+		const TriMesh::Face &f = faces[i];
+		int fe = TQM_NO_EDGE, r = 0;
+		for (int k = 0; fe == TQM_NO_EDGE && k < TQM_NO_EDGE; k++) {
+			const int *e = fifos.edge(k);
+			for (r = 0; r < 3; r++) {
+				if (e[0] == f[r] && e[1] == f[(r+1)%3]) {
+					fe = k;
+					break;
+				}
+			}
+		}
+		if (fe != TQM_NO_EDGE) {
+			int a = f[r], b = f[(r+1)%3], v = f[(r+2)%3];
+			int code = tqm_put_vert(v, fifos, next, extra);
+			codes.push_back((unsigned char) ((fe << 4) | code));
+			fifos.push_edge(v, b);
+			fifos.push_edge(a, v);
+		} else {
+			int a = f[0], b = f[1], v = f[2];
+			int ca = tqm_put_vert(a, fifos, next, extra);
+			int cb = tqm_put_vert(b, fifos, next, extra);
+			int cv = tqm_put_vert(v, fifos, next, extra);
+			codes.push_back((unsigned char) ((TQM_NO_EDGE << 4) | ca));
+			codes.push_back((unsigned char) ((cb << 4) | cv));
+			fifos.push_edge(b, a);
+			fifos.push_edge(v, b);
+			fifos.push_edge(a, v);
 		}
 	}
-	if (!mesh->colors.empty() && swap_color) {
-		for (size_t i = 0; i < mesh->normals.size(); i++) {
-			swap_float(mesh->colors[i][0]);
-			swap_float(mesh->colors[i][1]);
-			swap_float(mesh->colors[i][2]);
+	tqm_put_stream(out, codes);
+	tqm_put_stream(out, extra);
+}
+
+
+// Code one block of vertices, given as indices into the mesh
+static void tqm_encode_verts(const TriMesh *mesh, const int *verts,
+			     size_t count, unsigned flags, int pos_bits,
+			     const point &pmin, const Vec<3,double> &scale,
+			     vector<unsigned char> &out)
+{
+	vector<unsigned char> raw;
+	int prev[3] = { 0, 0, 0 };
+	const int maxq = (1 << pos_bits) - 1;
+	for (size_t i = 0; i < count; i++) {
+		const point &p = mesh->vertices[verts[i]];
+		for (int j = 0; j < 3; j++) {
+			int q = int(((double) p[j] - pmin[j]) * scale[j] + 0.5);
+			q = min(max(q, 0), maxq);
+			put_varint(raw, zigzag(q - prev[j]));
+			prev[j] = q;
 		}
 	}
-	if (!mesh->confidences.empty()) {
-		for (size_t i = 0; i < mesh->confidences.size(); i++)
-			swap_float(mesh->confidences[i]);
+	tqm_put_stream(out, raw);
+
+	if (flags & TQM_NORMALS) {
+		raw.clear();
+		int pu = 0, pv = 0;
+		for (size_t i = 0; i < count; i++) {
+			int u, v;
+			oct_encode(mesh->normals[verts[i]], TQM_NORM_BITS, u, v);
+			put_varint(raw, zigzag(u - pu));
+			put_varint(raw, zigzag(v - pv));
+			pu = u;
+			pv = v;
+		}
+		tqm_put_stream(out, raw);
+	}
+
+	if (flags & TQM_COLORS) {
+		raw.clear();
+		unsigned char prev_c[3] = { 0, 0, 0 };
+		for (size_t i = 0; i < count; i++) {
+			const Color &c = mesh->colors[verts[i]];
+			for (int j = 0; j < 3; j++) {
+				unsigned char cj = color2uchar(c[j]);
+				raw.push_back((unsigned char) (cj - prev_c[j]));
+				prev_c[j] = cj;
+			}
+		}
+		tqm_put_stream(out, raw);
+	}
+
+	// Byte planes keep the mostly constant sign and exponent bytes
+	// together, where the coder squeezes them well
+	if (flags & TQM_CONFIDENCES) {
+		raw.resize(4 * count);
+		for (size_t i = 0; i < count; i++) {
+			unsigned u;
+			memcpy(&u, &mesh->confidences[verts[i]], 4);
+			for (int b = 0; b < 4; b++, u >>= 8)
+				raw[b*count+i] = (unsigned char) (u & 0xff);
+		}
+		tqm_put_stream(out, raw);
 	}
 }
 
 
-// Helper for write_verts_bin: actually does the writing.
-static bool write_verts_bin_helper(TriMesh *mesh, FILE *f,
-				   bool write_norm, bool write_color,
-				   bool float_color, bool write_conf)
+// Write a quantized file with pos_bits bits per coordinate.  Vertices and
+// faces are written in the order given by tqm_face_order, so they come
+// back reordered.
+static bool write_tqm(TriMesh *mesh, FILE *f, int pos_bits)
 {
-	if ((mesh->normals.empty() || !write_norm) &&
-	    (mesh->colors.empty() || !write_color) &&
-	    (mesh->confidences.empty() || !write_conf)) {
-		// Optimized vertex-only code
-		FWRITE(&(mesh->vertices[0][0]), 12*mesh->vertices.size(), 1, f);
-	} else {
-		// Generic code
-		for (size_t i = 0; i < mesh->vertices.size(); i++) {
-			FWRITE(&(mesh->vertices[i][0]), 12, 1, f);
-			if (!mesh->normals.empty() && write_norm)
-				FWRITE(&(mesh->normals[i][0]), 12, 1, f);
-			if (!mesh->colors.empty() && write_color && float_color)
-				FWRITE(&(mesh->colors[i][0]), 12, 1, f);
-			if (!mesh->colors.empty() && write_color && !float_color) {
-				unsigned char c[3] = {
-					color2uchar(mesh->colors[i][0]),
-					color2uchar(mesh->colors[i][1]),
-					color2uchar(mesh->colors[i][2]) };
-				FWRITE(&c, 3, 1, f);
+	mesh->need_faces();
+	mesh->need_bbox();
+	const int nv = mesh->vertices.size(), nf = mesh->faces.size();
+	unsigned flags = 0;
+	if (mesh->normals.size() == mesh->vertices.size())
+		flags |= TQM_NORMALS;
+	if (mesh->colors.size() == mesh->vertices.size())
+		flags |= TQM_COLORS;
+	if (mesh->confidences.size() == mesh->vertices.size())
+		flags |= TQM_CONFIDENCES;
+
+	// Faces in cache order, and vertices in the order they are used
+	vector<int> face_order, vert_order, remap(nv, -1);
+	tqm_face_order(mesh, face_order);
+	vector<TriMesh::Face> faces(nf);
+	vert_order.reserve(nv);
+	for (int i = 0; i < nf; i++) {
+		const TriMesh::Face &face = mesh->faces[face_order[i]];
+		for (int j = 0; j < 3; j++) {
+			int v = face[j];
+			if (remap[v] < 0) {
+				remap[v] = vert_order.size();
+				vert_order.push_back(v);
 			}
-			if (!mesh->confidences.empty() && write_conf)
-				FWRITE(&(mesh->confidences[i]), 4, 1, f);
+			faces[i][j] = remap[v];
+		}
+	}
+	for (int i = 0; i < nv; i++)
+		if (remap[i] < 0)
+			vert_order.push_back(i);
+
+	point pmin = mesh->bbox.min, pmax = mesh->bbox.max;
+	Vec<3,double> scale;
+	for (int j = 0; j < 3; j++) {
+		double extent = (double) pmax[j] - pmin[j];
+		scale[j] = (extent > 0.0) ? ((1 << pos_bits) - 1) / extent : 0.0;
+	}
+
+	// Where each block of faces starts numbering new vertices
+	int nvblocks = (nv + TQM_BLOCK - 1) / TQM_BLOCK;
+	int nfblocks = (nf + TQM_BLOCK - 1) / TQM_BLOCK;
+	int nblocks = nvblocks + nfblocks;
+	vector<int> next(nblocks, 0);
+	for (int i = 0, seen = 0; i < nf; i++) {
+		if (i % TQM_BLOCK == 0)
+			next[nvblocks + i / TQM_BLOCK] = seen;
+		for (int j = 0; j < 3; j++)
+			seen = max(seen, faces[i][j] + 1);
+	}
+
+	vector< vector<unsigned char> > blocks(nblocks);
+#pragma omp parallel for schedule(dynamic, 1)
+	for (int b = 0; b < nblocks; b++) {
+		if (b < nvblocks) {
+			size_t first = (size_t) b * TQM_BLOCK;
+			tqm_encode_verts(mesh, &vert_order[first],
+				min((size_t) TQM_BLOCK, (size_t) nv - first),
+				flags, pos_bits, pmin, scale, blocks[b]);
+		} else {
+			size_t first = (size_t) (b - nvblocks) * TQM_BLOCK;
+			tqm_encode_faces(faces, first,
+				min((size_t) TQM_BLOCK, (size_t) nf - first),
+				next[b], blocks[b]);
+		}
+	}
+
+	// Block table, then the blocks, all covered by the checksum
+	vector<unsigned char> body;
+	size_t offset = TQM_HEADER_SIZE + 16 * nblocks;
+	for (int b = 0; b < nblocks; b++) {
+		put_le(body, offset, 8);
+		put_le(body, blocks[b].size(), 4);
+		put_le(body, next[b], 4);
+		offset += blocks[b].size();
+	}
+	for (int b = 0; b < nblocks; b++) {
+		body.insert(body.end(), blocks[b].begin(), blocks[b].end());
+		vector<unsigned char>().swap(blocks[b]);
+	}
+
+	vector<unsigned char> header(TQM_MAGIC, TQM_MAGIC + 8);
+	put_le(header, TQM_VERSION, 4);
+	put_le(header, flags, 4);
+	put_le(header, nv, 4);
+	put_le(header, nf, 4);
+	put_le(header, pos_bits, 4);
+	put_le(header, TQM_NORM_BITS, 4);
+	for (int j = 0; j < 3; j++)
+		put_le_float(header, pmin[j]);
+	for (int j = 0; j < 3; j++)
+		put_le_float(header, pmax[j]);
+	put_le(header, nvblocks, 4);
+	put_le(header, nfblocks, 4);
+	put_le(header, tmc_checksum(&body[0], NULL, body.size()), 8);
+
+	FWRITE(&header[0], header.size(), 1, f);
+	FWRITE(&body[0], body.size(), 1, f);
+	dprintf("\n  Wrote %d vertices, %d faces in %lu bytes... ", nv, nf,
+		(unsigned long) (header.size() + body.size()));
+	return true;
+}
+
+
+// Formatted output.  Records are formatted in parallel, a block at a time
+// per thread, and the blocks written in order with one fwrite each.
+// A formatter has a max_len no record goes over, and operator()(p, i)
+// that puts record i at p and returns the end.
+template <class Fmt>
+static bool write_formatted(FILE *f, size_t n, const Fmt &fmt)
+{
+	if (!n)
+		return true;
+	const size_t block = max((size_t) 256, (size_t) (1 << 18) / fmt.max_len);
+	size_t nblocks = (n + block - 1) / block;
+	vector< vector<char> > bufs(min(nblocks, (size_t) 4 * thread_count()));
+	vector<size_t> lens(bufs.size());
+	for (size_t first = 0; first < nblocks; first += bufs.size()) {
+		int nb = (int) min(bufs.size(), nblocks - first);
+#pragma omp parallel for schedule(dynamic) if (nb > 1)
+		for (int b = 0; b < nb; b++) {
+			vector<char> &buf = bufs[b];
+			buf.resize(block * fmt.max_len);
+			size_t start = (first + b) * block;
+			size_t end = min(n, start + block);
+			char *p = &buf[0];
+			for (size_t i = start; i < end; i++)
+				p = fmt(p, i);
+			lens[b] = p - &buf[0];
 		}
+		for (int b = 0; b < nb; b++)
+			FWRITE(&bufs[b][0], 1, lens[b], f);
 	}
 	return true;
 }
 
 
+// Text for unsigned and signed ints
+static inline char *format_uint(char *p, unsigned long long x)
+{
+	char digits[20];
+	int n = 0;
+	do {
+		digits[n++] = '0' + (char) (x % 10);
+		x /= 10;
+	} while (x);
+	while (n)
+		*p++ = digits[--n];
+	return p;
+}
+
+static inline char *format_int(char *p, int x)
+{
+	if (x < 0) {
+		*p++ = '-';
+		return format_uint(p, 0ull - (unsigned long long) x);
+	}
+	return format_uint(p, (unsigned long long) x);
+}
+
+static inline char *format_str(char *p, const char *s)
+{
+	while (*s)
+		*p++ = *s++;
+	return p;
+}
+
+static inline size_t str_len(const char *s)
+{
+	return s ? strlen(s) : 0;
+}
+
+
+// Text for a float, exactly as printf("%.7g") would give it.  The seven
+// digits come from scaling by an exact power of ten in double precision,
+// which is off by far less than the rounding step except right next to a
+// tie, and those (along with denormals, infinities and NaNs) go to printf.
+#define FLOAT_TEXT_LEN 16
+
+static char *format_float(char *p, float x)
+{
+	static const double pow10[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+		1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20,
+		1e21, 1e22
+	};
+	double d = x;
+	if (d == 0.0) {
+		if (1.0 / d < 0.0)
+			*p++ = '-';
+		*p++ = '0';
+		return p;
+	}
+	if (!(fabs(d) >= FLT_MIN && fabs(d) <= FLT_MAX))
+		return p + sprintf(p, "%.7g", d);
+	if (d < 0.0) {
+		*p++ = '-';
+		d = -d;
+	}
+
+	// Decimal exponent e, so that d * 10^(6-e) is in [1e6, 1e7)
+	int e = (int) floor(log10(d));
+	double m = 0.0;
+	for (int tries = 0; tries < 3; tries++) {
+		int k = 6 - e;
+		if (k > 22 || k < -22)
+			return p + sprintf(p, "%.7g", d);
+		m = (k >= 0) ? d * pow10[k] : d / pow10[-k];
+		if (m < 1e6)
+			e--;
+		else if (m >= 1e7)
+			e++;
+		else
+			break;
+	}
+	double whole = floor(m), frac = m - whole;
+	if (!(m >= 1e6 && m < 1e7) || fabs(frac - 0.5) < 1e-6)
+		return p + sprintf(p, "%.7g", d);
+	unsigned digits = (unsigned) whole + (frac > 0.5 ? 1 : 0);
+	if (digits == 10000000) {
+		digits = 1000000;
+		e++;
+	}
+
+	char s[7];
+	for (int i = 6; i >= 0; i--, digits /= 10)
+		s[i] = '0' + (char) (digits % 10);
+	int last = 6;
+	while (last > 0 && s[last] == '0')
+		last--;
+
+	if (e < -4 || e >= 7) {
+		*p++ = s[0];
+		if (last > 0) {
+			*p++ = '.';
+			for (int i = 1; i <= last; i++)
+				*p++ = s[i];
+		}
+		*p++ = 'e';
+		*p++ = (e < 0) ? '-' : '+';
+		int ae = abs(e);
+		if (ae < 10)
+			*p++ = '0';
+		return format_uint(p, ae);
+	}
+	if (e < 0) {
+		*p++ = '0';
+		*p++ = '.';
+		for (int i = -1; i > e; i--)
+			*p++ = '0';
+		for (int i = 0; i <= last; i++)
+			*p++ = s[i];
+		return p;
+	}
+	for (int i = 0; i <= e; i++)
+		*p++ = s[i];
+	if (last > e) {
+		*p++ = '.';
+		for (int i = e + 1; i <= last; i++)
+			*p++ = s[i];
+	}
+	return p;
+}
+
+static inline char *format_vec(char *p, const char *before, const vec &v)
+{
+	p = format_str(p, before);
+	p = format_float(p, v[0]);
+	*p++ = ' ';
+	p = format_float(p, v[1]);
+	*p++ = ' ';
+	return format_float(p, v[2]);
+}
+
+
+// Vertex lines for write_verts_asc
+struct VertFormatter {
+	const TriMesh *mesh;
+	const char *before_vert, *before_norm, *before_color, *before_conf;
+	const char *after_line;
+	bool float_color;
+	size_t max_len;
+
+	char *operator () (char *p, size_t i) const
+	{
+		p = format_vec(p, before_vert, mesh->vertices[i]);
+		if (before_norm)
+			p = format_vec(p, before_norm, mesh->normals[i]);
+		if (before_color && float_color)
+			p = format_vec(p, before_color, mesh->colors[i]);
+		if (before_color && !float_color) {
+			p = format_str(p, before_color);
+			p = format_uint(p, color2uchar(mesh->colors[i][0]));
+			*p++ = ' ';
+			p = format_uint(p, color2uchar(mesh->colors[i][1]));
+			*p++ = ' ';
+			p = format_uint(p, color2uchar(mesh->colors[i][2]));
+		}
+		if (before_conf) {
+			p = format_str(p, before_conf);
+			p = format_float(p, mesh->confidences[i]);
+		}
+		p = format_str(p, after_line);
+		*p++ = '\n';
+		return p;
+	}
+};
+
+
+// Write a bunch of vertices to an ASCII file
+static bool write_verts_asc(TriMesh *mesh, FILE *f,
+			    const char *before_vert,
+			    const char *before_norm,
+			    const char *before_color,
+			    bool float_color,
+			    const char *before_conf,
+			    const char *after_line)
+{
+	VertFormatter fmt;
+	fmt.mesh = mesh;
+	fmt.before_vert = before_vert;
+	fmt.before_norm = mesh->normals.empty() ? 0 : before_norm;
+	fmt.before_color = mesh->colors.empty() ? 0 : before_color;
+	fmt.before_conf = mesh->confidences.empty() ? 0 : before_conf;
+	fmt.after_line = after_line;
+	fmt.float_color = float_color;
+	fmt.max_len = str_len(before_vert) + str_len(fmt.before_norm) +
+		str_len(fmt.before_color) + str_len(fmt.before_conf) +
+		str_len(after_line) + 10 * (FLOAT_TEXT_LEN + 1) + 1;
+	return write_formatted(f, mesh->vertices.size(), fmt);
+}
+
+
+// Interleaved binary vertex records for write_verts_bin
+struct VertBinFormatter {
+	const TriMesh *mesh;
+	bool write_norm, write_color, float_color, write_conf, need_swap;
+	size_t max_len;
+
+	static char *put(char *p, const float *x, int n, bool need_swap)
+	{
+		for (int j = 0; j < n; j++, p += 4) {
+			float tmp = x[j];
+			if (need_swap)
+				swap_float(tmp);
+			memcpy(p, &tmp, 4);
+		}
+		return p;
+	}
+
+	char *operator () (char *p, size_t i) const
+	{
+		p = put(p, &mesh->vertices[i][0], 3, need_swap);
+		if (write_norm)
+			p = put(p, &mesh->normals[i][0], 3, need_swap);
+		if (write_color && float_color)
+			p = put(p, &mesh->colors[i][0], 3, need_swap);
+		if (write_color && !float_color) {
+			*p++ = (char) color2uchar(mesh->colors[i][0]);
+			*p++ = (char) color2uchar(mesh->colors[i][1]);
+			*p++ = (char) color2uchar(mesh->colors[i][2]);
+		}
+		if (write_conf)
+			p = put(p, &mesh->confidences[i], 1, need_swap);
+		return p;
+	}
+};
+
+
 // Write a bunch of vertices to a binary file
 static bool write_verts_bin(TriMesh *mesh, FILE *f, bool need_swap,
 			    bool write_norm, bool write_color,
 			    bool float_color, bool write_conf)
 {
-	if (need_swap)
-		swap_vert_props(mesh, float_color);
-	bool ok = write_verts_bin_helper(mesh, f, write_norm, write_color,
-		float_color, write_conf);
-	if (need_swap)
-		swap_vert_props(mesh, float_color);
-	return ok;
+	VertBinFormatter fmt;
+	fmt.mesh = mesh;
+	fmt.write_norm = write_norm && !mesh->normals.empty();
+	fmt.write_color = write_color && !mesh->colors.empty();
+	fmt.float_color = float_color;
+	fmt.write_conf = write_conf && !mesh->confidences.empty();
+	fmt.need_swap = need_swap;
+	fmt.max_len = 12 + (fmt.write_norm ? 12 : 0) +
+		(fmt.write_color ? (float_color ? 12 : 3) : 0) +
+		(fmt.write_conf ? 4 : 0);
+
+	// Plain vertices go straight from the array
+	if (fmt.max_len == 12 && !need_swap) {
+		if (!mesh->vertices.empty())
+			FWRITE(&(mesh->vertices[0][0]), 12, mesh->vertices.size(), f);
+		return true;
+	}
+	return write_formatted(f, mesh->vertices.size(), fmt);
 }
 
 
-// Write a bunch of faces to an ASCII file
+// Face lines for write_faces_asc, with OBJ-style normal indices if wanted
+struct FaceFormatter {
+	const TriMesh *mesh;
+	const char *before_face, *after_line;
+	int offset;
+	bool obj_normals;
+	size_t max_len;
+
+	char *operator () (char *p, size_t i) const
+	{
+		p = format_str(p, before_face);
+		for (int j = 0; j < 3; j++) {
+			if (j)
+				*p++ = ' ';
+			int v = mesh->faces[i][j] + offset;
+			p = format_int(p, v);
+			if (obj_normals) {
+				*p++ = '/';
+				*p++ = '/';
+				p = format_int(p, v);
+			}
+		}
+		p = format_str(p, after_line);
+		*p++ = '\n';
+		return p;
+	}
+};
+
+
+// Write a bunch of faces to an ASCII file.  Indices are written plus
+// offset, as "i//i" if obj_normals.
 static bool write_faces_asc(TriMesh *mesh, FILE *f,
-			    const char *before_face, const char *after_line)
+			    const char *before_face, const char *after_line,
+			    int offset, bool obj_normals)
 {
 	mesh->need_faces();
-	for (size_t i = 0; i < mesh->faces.size(); i++) {
-		FPRINTF(f, "%s%d %d %d%s\n", before_face, mesh->faces[i][0],
-			mesh->faces[i][1], mesh->faces[i][2], after_line);
-	}
-	return true;
+	FaceFormatter fmt;
+	fmt.mesh = mesh;
+	fmt.before_face = before_face;
+	fmt.after_line = after_line;
+	fmt.offset = offset;
+	fmt.obj_normals = obj_normals;
+	fmt.max_len = str_len(before_face) + str_len(after_line) + 6 * 12 + 8;
+	return write_formatted(f, mesh->faces.size(), fmt);
 }
 
 
+// Binary face records for write_faces_bin
+struct FaceBinFormatter {
+	const TriMesh *mesh;
+	int before_face_len, after_face_len;
+	const char *before_face, *after_face;
+	bool need_swap;
+	size_t max_len;
+
+	char *operator () (char *p, size_t i) const
+	{
+		memcpy(p, before_face, before_face_len);
+		p += before_face_len;
+		for (int j = 0; j < 3; j++, p += 4) {
+			int tmp = mesh->faces[i][j];
+			if (need_swap)
+				swap_int(tmp);
+			memcpy(p, &tmp, 4);
+		}
+		memcpy(p, after_face, after_face_len);
+		return p + after_face_len;
+	}
+};
+
+
 // Write a bunch of faces to a binary file
 static bool write_faces_bin(TriMesh *mesh, FILE *f, bool need_swap,
 			    int before_face_len, const char *before_face,
 			    int after_face_len, const char *after_face)
 {
 	mesh->need_faces();
-	if (need_swap) {
-		for (size_t i = 0; i < mesh->faces.size(); i++) {
-			swap_int(mesh->faces[i][0]);
-			swap_int(mesh->faces[i][1]);
-			swap_int(mesh->faces[i][2]);
-		}
-	}
-	bool ok = true;
-	for (size_t i = 0; i < mesh->faces.size(); i++) {
-		if (before_face_len) {
-			if (fwrite(before_face, before_face_len, 1, f) != 1) {
-				ok = false;
-				goto out;
-			}
-		}
-		if (fwrite(&(mesh->faces[i][0]), 12, 1, f) != 1) {
-			ok = false;
-			goto out;
-		}
-		if (after_face_len) {
-			if (fwrite(after_face, after_face_len, 1, f) != 1) {
-				ok = false;
-				goto out;
-			}
-		}
-	}
-out:
-	if (need_swap) {
-		for (size_t i = 0; i < mesh->faces.size(); i++) {
-			swap_int(mesh->faces[i][0]);
-			swap_int(mesh->faces[i][1]);
-			swap_int(mesh->faces[i][2]);
-		}
+	if (!before_face_len && !after_face_len && !need_swap) {
+		if (!mesh->faces.empty())
+			FWRITE(&(mesh->faces[0][0]), 12, mesh->faces.size(), f);
+		return true;
 	}
-	return ok;
+	FaceBinFormatter fmt;
+	fmt.mesh = mesh;
+	fmt.before_face_len = before_face_len;
+	fmt.before_face = before_face;
+	fmt.after_face_len = after_face_len;
+	fmt.after_face = after_face;
+	fmt.need_swap = need_swap;
+	fmt.max_len = before_face_len + 12 + after_face_len;
+	return write_formatted(f, mesh->faces.size(), fmt);
 }
 
 
+// Indices separated by spaces, for write_strips_asc
+struct IndexFormatter {
+	const int *ind;
+	size_t max_len;
+
+	IndexFormatter(const int *ind_) : ind(ind_), max_len(12)
+		{}
+	char *operator () (char *p, size_t i) const
+	{
+		p = format_int(p, ind[i]);
+		*p++ = ' ';
+		return p;
+	}
+};
+
+
 // Write tstrips to an ASCII file
 static bool write_strips_asc(TriMesh *mesh, FILE *f)
 {
-	for (size_t i = 0; i < mesh->tstrips.size(); i++) {
-		FPRINTF(f, "%d ", mesh->tstrips[i]);
-	}
+	if (!mesh->tstrips.empty() &&
+	    !write_formatted(f, mesh->tstrips.size(),
+			     IndexFormatter(&mesh->tstrips[0])))
+		return false;
 	FPRINTF(f, "\n");
 	return true;
 }
@@ -2188,37 +4269,57 @@ static bool write_strips_bin(TriMesh *mesh, FILE *f, bool need_swap)
 }
 
 
-// Write range grid to an ASCII file
-static bool write_grid_asc(TriMesh *mesh, FILE *f)
-{
-	for (size_t i = 0; i < mesh->grid.size(); i++) {
-		if (mesh->grid[i] < 0) {
-			FPRINTF(f, "0\n");
+// Range grid entries, as text or binary
+struct GridFormatter {
+	const int *grid;
+	bool binary, need_swap;
+	size_t max_len;
+
+	GridFormatter(const int *grid_, bool binary_, bool need_swap_) :
+		grid(grid_), binary(binary_), need_swap(need_swap_), max_len(16)
+		{}
+	char *operator () (char *p, size_t i) const
+	{
+		int g = grid[i];
+		if (binary) {
+			*p++ = (g < 0) ? 0 : 1;
+			if (g < 0)
+				return p;
+			if (need_swap)
+				swap_int(g);
+			memcpy(p, &g, 4);
+			return p + 4;
+		}
+		if (g < 0) {
+			*p++ = '0';
 		} else {
-			FPRINTF(f, "1 %d\n", mesh->grid[i]);
+			*p++ = '1';
+			*p++ = ' ';
+			p = format_int(p, g);
 		}
+		*p++ = '\n';
+		return p;
 	}
-	return true;
+};
+
+
+// Write range grid to an ASCII file
+static bool write_grid_asc(TriMesh *mesh, FILE *f)
+{
+	if (mesh->grid.empty())
+		return true;
+	return write_formatted(f, mesh->grid.size(),
+		GridFormatter(&mesh->grid[0], false, false));
 }
 
 
 // Write range grid to a binary file
 static bool write_grid_bin(TriMesh *mesh, FILE *f, bool need_swap)
 {
-	unsigned char zero = 0;
-	unsigned char one = 1;
-	for (size_t i = 0; i < mesh->grid.size(); i++) {
-		if (mesh->grid[i] < 0) {
-			FWRITE(&zero, 1, 1, f);
-		} else {
-			FWRITE(&one, 1, 1, f);
-			int g = mesh->grid[i];
-			if (need_swap)
-				swap_int(g);
-			FWRITE(&g, 4, 1, f);
-		}
-	}
-	return true;
+	if (mesh->grid.empty())
+		return true;
+	return write_formatted(f, mesh->grid.size(),
+		GridFormatter(&mesh->grid[0], true, need_swap));
 }
 
 
@@ -14,8 +14,10 @@ For raw point clouds, fits plane to k nearest neighbors.
 */
 
 #include "TriMesh.h"
+#include "TriMesh_soa.h"
 #include "KDtree.h"
 #include "lineqn.h"
+#include <algorithm>
 using namespace std;
 
 
@@ -56,32 +58,44 @@ void TriMesh::need_normals()
 			}
 		}
 	} else if (need_faces(), !faces.empty()) {
-		// Compute from faces
-		int nf = faces.size();
+		// Compute from faces: the weighted face normal of every corner
+		// goes to a per-corner array, then each vertex sums its own
+		// corners in face order.  No two threads write the same vertex,
+		// so the result is the same for any number of threads.
+		need_adjacentfaces();
+		vector<vec> cornernormals;
+		need_soa();
+		soa_corner_normals(soa, cornernormals);
 #pragma omp parallel for
-		for (int i = 0; i < nf; i++) {
-			const point &p0 = vertices[faces[i][0]];
-			const point &p1 = vertices[faces[i][1]];
-			const point &p2 = vertices[faces[i][2]];
-			vec a = p0-p1, b = p1-p2, c = p2-p0;
-			float l2a = len2(a), l2b = len2(b), l2c = len2(c);
-			if (!l2a || !l2b || !l2c)
-				continue;
-			vec facenormal = a CROSS b;
-			normals[faces[i][0]] += facenormal * (1.0f / (l2a * l2c));
-			normals[faces[i][1]] += facenormal * (1.0f / (l2b * l2a));
-			normals[faces[i][2]] += facenormal * (1.0f / (l2c * l2b));
+		for (int i = 0; i < nv; i++) {
+			IndexSpan a = adjacentfaces[i];
+			float n[3] = { 0, 0, 0 };
+			for (size_t k = 0; k < a.size(); k++) {
+				int f = a[k];
+				if (k && a[k-1] == f)
+					continue;
+				for (int j = 0; j < 3; j++) {
+					if (faces[f][j] != i)
+						continue;
+					const vec &cn = cornernormals[3*f+j];
+					n[0] += cn[0]; n[1] += cn[1]; n[2] += cn[2];
+				}
+			}
+			normals[i] = vec(n[0], n[1], n[2]);
 		}
 	} else {
 		// Find normals of a point cloud
 		const int k = 6;
 		const vec ref(0, 0, 1);
 		KDtree kd(vertices);
+		vector<int> knn((size_t) nv * k);
+		kd.find_k_closest_to_pts(vertices[0], nv, k, &knn[0]);
 #pragma omp parallel for
 		for (int i = 0; i < nv; i++) {
-			vector<const float *> knn;
-			kd.find_k_closest_to_pt(knn, k, vertices[i]);
-			int actual_k = knn.size();
+			const int *nbrs = &knn[(size_t) i * k];
+			int actual_k = 0;
+			while (actual_k < k && nbrs[actual_k] >= 0)
+				actual_k++;
 			if (actual_k < 3) {
 				dprintf("Warning: not enough points for vertex %d\n", i);
 				normals[i] = ref;
@@ -92,7 +106,7 @@ void TriMesh::need_normals()
 			// The below loop starts at 1, since element 0     
 			// is just vertices[i] itself 
 			for (int j = 1; j < actual_k; j++) {
-				vec d = point(knn[j]) - vertices[i];
+				vec d = vertices[nbrs[j]] - vertices[i];
 				for (int l = 0; l < 3; l++)
 					for (int m = 0; m < 3; m++)
 						C[l][m] += d[l] * d[m];
@@ -113,4 +127,51 @@ void TriMesh::need_normals()
 	dprintf("Done.\n");
 }
 
+
+// Recompute normals after moving the given vertices
+void TriMesh::update_normals(const vector<int> &verts)
+{
+	soa.update(this, verts);
+	int nv = vertices.size();
+	if (int(normals.size()) != nv || !tstrips.empty() ||
+	    (need_faces(), faces.empty())) {
+		// Never computed, or not from faces: do it all
+		normals.clear();
+		need_normals();
+		return;
+	}
+	need_adjacentfaces();
+
+	// The moved vertices change the normals of all vertices of their
+	// faces, each of which sums the corners of its whole ring
+	vector<int> changed, region, ring;
+	faces_around(verts, changed);
+	verts_of(changed, region);
+	faces_around(region, ring);
+
+	vector<vec> cornernormals;
+	corner_normals_at(this, ring, cornernormals);
+	int n = region.size();
+#pragma omp parallel for if (n > 4096)
+	for (int r = 0; r < n; r++) {
+		int i = region[r];
+		IndexSpan a = adjacentfaces[i];
+		float nn[3] = { 0, 0, 0 };
+		for (size_t k = 0; k < a.size(); k++) {
+			int f = a[k];
+			if (k && a[k-1] == f)
+				continue;
+			int slot = lower_bound(ring.begin(), ring.end(), f) - ring.begin();
+			for (int j = 0; j < 3; j++) {
+				if (faces[f][j] != i)
+					continue;
+				const vec &cn = cornernormals[3*slot+j];
+				nn[0] += cn[0]; nn[1] += cn[1]; nn[2] += cn[2];
+			}
+		}
+		normals[i] = vec(nn[0], nn[1], nn[2]);
+		normalize(normals[i]);
+	}
+}
+
 }; // namespace trimesh
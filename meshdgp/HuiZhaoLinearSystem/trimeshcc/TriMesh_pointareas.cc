@@ -9,6 +9,7 @@ a vertex, or to the triangle).
 */
 
 #include "TriMesh.h"
+#include "TriMesh_soa.h"
 
 
 namespace trimesh {
@@ -19,6 +20,7 @@ void TriMesh::need_pointareas()
 	if (pointareas.size() == vertices.size())
 		return;
 	need_faces();
+	need_adjacentfaces();
 
 	dprintf("Computing point areas... ");
 
@@ -28,55 +30,65 @@ void TriMesh::need_pointareas()
 	cornerareas.clear();
 	cornerareas.resize(nf);
 
-#pragma omp parallel for
-	for (int i = 0; i < nf; i++) {
-		// Edges
-		vec e[3] = { vertices[faces[i][2]] - vertices[faces[i][1]],
-			     vertices[faces[i][0]] - vertices[faces[i][2]],
-			     vertices[faces[i][1]] - vertices[faces[i][0]] };
+	// Voronoi-restricted area of each corner
+	need_soa();
+	soa_corner_areas(soa, cornerareas);
 
-		// Compute corner weights
-		float area = 0.5f * len(e[0] CROSS e[1]);
-		float l2[3] = { len2(e[0]), len2(e[1]), len2(e[2]) };
-		float ew[3] = { l2[0] * (l2[1] + l2[2] - l2[0]),
-				l2[1] * (l2[2] + l2[0] - l2[1]),
-				l2[2] * (l2[0] + l2[1] - l2[2]) };
-		if (ew[0] <= 0.0f) {
-			cornerareas[i][1] = -0.25f * l2[2] * area /
-					    (e[0] DOT e[2]);
-			cornerareas[i][2] = -0.25f * l2[1] * area /
-					    (e[0] DOT e[1]);
-			cornerareas[i][0] = area - cornerareas[i][1] -
-					    cornerareas[i][2];
-		} else if (ew[1] <= 0.0f) {
-			cornerareas[i][2] = -0.25f * l2[0] * area /
-					    (e[1] DOT e[0]);
-			cornerareas[i][0] = -0.25f * l2[2] * area /
-					    (e[1] DOT e[2]);
-			cornerareas[i][1] = area - cornerareas[i][2] -
-					    cornerareas[i][0];
-		} else if (ew[2] <= 0.0f) {
-			cornerareas[i][0] = -0.25f * l2[1] * area /
-					    (e[2] DOT e[1]);
-			cornerareas[i][1] = -0.25f * l2[0] * area /
-					    (e[2] DOT e[0]);
-			cornerareas[i][2] = area - cornerareas[i][0] -
-					    cornerareas[i][1];
-		} else {
-			float ewscale = 0.5f * area / (ew[0] + ew[1] + ew[2]);
+	// Gather the corners around each vertex, in face order
+#pragma omp parallel for
+	for (int i = 0; i < int(adjacentfaces.size()); i++) {
+		IndexSpan a = adjacentfaces[i];
+		float area = 0.0f;
+		for (size_t k = 0; k < a.size(); k++) {
+			int f = a[k];
+			if (k && a[k-1] == f)
+				continue;
 			for (int j = 0; j < 3; j++)
-				cornerareas[i][j] = ewscale * (ew[(j+1)%3] +
-							       ew[(j+2)%3]);
+				if (faces[f][j] == i)
+					area += cornerareas[f][j];
 		}
-#pragma omp atomic
-		pointareas[faces[i][0]] += cornerareas[i][0];
-#pragma omp atomic
-		pointareas[faces[i][1]] += cornerareas[i][1];
-#pragma omp atomic
-		pointareas[faces[i][2]] += cornerareas[i][2];
+		pointareas[i] = area;
 	}
 
 	dprintf("Done.\n");
 }
 
+
+// Recompute point areas after moving the given vertices
+void TriMesh::update_pointareas(const ::std::vector<int> &verts)
+{
+	soa.update(this, verts);
+	if (pointareas.size() != vertices.size() ||
+	    cornerareas.size() != faces.size()) {
+		pointareas.clear();
+		need_pointareas();
+		return;
+	}
+	need_adjacentfaces();
+
+	// Corner areas change on the faces around the moved vertices,
+	// point areas on all vertices of those faces
+	::std::vector<int> changed, region;
+	faces_around(verts, changed);
+	verts_of(changed, region);
+	corner_areas_at(this, changed);
+
+	int n = region.size();
+#pragma omp parallel for if (n > 4096)
+	for (int r = 0; r < n; r++) {
+		int i = region[r];
+		IndexSpan a = adjacentfaces[i];
+		float area = 0.0f;
+		for (size_t k = 0; k < a.size(); k++) {
+			int f = a[k];
+			if (k && a[k-1] == f)
+				continue;
+			for (int j = 0; j < 3; j++)
+				if (faces[f][j] == i)
+					area += cornerareas[f][j];
+		}
+		pointareas[i] = area;
+	}
+}
+
 }; // namespace trimesh
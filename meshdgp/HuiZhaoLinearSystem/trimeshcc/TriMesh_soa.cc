@@ -0,0 +1,496 @@
+/*
+TriMesh_soa.cc
+Structure-of-arrays geometry and SIMD per-face kernels.
+
+Each kernel is written once against a "lane" type: plain float, or f8 (8
+floats in an AVX2 register).  Branches of the scalar code become masks and
+selects.  Full blocks of 8 faces use f8, and the few faces left over at the
+end use float.  Full blocks are fixed by the face count alone, so every
+face takes the same path whatever the number of threads.
+The incremental update_* functions run the float path on any face, so
+this file is built without FMA contraction (see CMakeLists.txt), which
+would otherwise round the f8 and float paths differently.
+*/
+
+#include "TriMesh_soa.h"
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+using namespace std;
+
+
+namespace trimesh {
+
+void TriMeshSoA::build(const TriMesh *mesh)
+{
+	int nv = mesh->vertices.size(), nf = mesh->faces.size();
+	x.resize(nv); y.resize(nv); z.resize(nv);
+	f0.resize(nf); f1.resize(nf); f2.resize(nf);
+#pragma omp parallel for
+	for (int i = 0; i < nv; i++) {
+		x[i] = mesh->vertices[i][0];
+		y[i] = mesh->vertices[i][1];
+		z[i] = mesh->vertices[i][2];
+	}
+#pragma omp parallel for
+	for (int i = 0; i < nf; i++) {
+		f0[i] = mesh->faces[i][0];
+		f1[i] = mesh->faces[i][1];
+		f2[i] = mesh->faces[i][2];
+	}
+}
+
+void TriMeshSoA::update(const TriMesh *mesh, const vector<int> &verts)
+{
+	if (nverts() != int(mesh->vertices.size()))
+		return;
+	for (size_t k = 0; k < verts.size(); k++) {
+		int i = verts[k];
+		x[i] = mesh->vertices[i][0];
+		y[i] = mesh->vertices[i][1];
+		z[i] = mesh->vertices[i][2];
+	}
+}
+
+
+// Build the SoA mirror, unless there is one of the right size already
+void TriMesh::need_soa()
+{
+	need_faces();
+	if (soa.nverts() == int(vertices.size()) &&
+	    soa.nfaces() == int(faces.size()))
+		return;
+	soa.build(this);
+}
+
+
+//
+// Lane operations on scalars.  The unnamed float/f8 argument of load_idx
+// and load_strided only selects the overload.
+//
+static inline float sel(bool m, float a, float b) { return m ? a : b; }
+static inline bool le(float a, float b) { return a <= b; }
+static inline bool nle(float a, float b) { return !(a <= b); }
+static inline bool eq(float a, float b) { return a == b; }
+static inline bool mor(bool a, bool b) { return a || b; }
+static inline bool mand(bool a, bool b) { return a && b; }
+static inline float fsqrt(float a) { return sqrt(a); }
+static inline int load_idx(const int *p, float) { return *p; }
+static inline float gather(const float *base, int idx) { return base[idx]; }
+static inline float gather3(const float *base, int idx, int c) { return base[3*idx+c]; }
+static inline float load_strided(const float *base, int, float) { return *base; }
+static inline void put(float v, float *base, int) { *base = v; }
+
+template <class F> struct Lane;
+template <> struct Lane<float> {
+	typedef bool mask;
+	typedef int index;
+	enum { width = 1 };
+};
+
+
+//
+// Lane operations on 8 floats
+//
+#ifdef __AVX2__
+struct f8 {
+	__m256 v;
+	f8() {}
+	f8(__m256 v_) : v(v_) {}
+	f8(float x) : v(_mm256_set1_ps(x)) {}
+};
+static inline f8 operator + (f8 a, f8 b) { return _mm256_add_ps(a.v, b.v); }
+static inline f8 operator - (f8 a, f8 b) { return _mm256_sub_ps(a.v, b.v); }
+static inline f8 operator * (f8 a, f8 b) { return _mm256_mul_ps(a.v, b.v); }
+static inline f8 operator / (f8 a, f8 b) { return _mm256_div_ps(a.v, b.v); }
+static inline f8 operator - (f8 a) { return _mm256_xor_ps(a.v, _mm256_set1_ps(-0.0f)); }
+static inline f8 sel(f8 m, f8 a, f8 b) { return _mm256_blendv_ps(b.v, a.v, m.v); }
+static inline f8 le(f8 a, f8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ); }
+static inline f8 nle(f8 a, f8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_NLE_UQ); }
+static inline f8 eq(f8 a, f8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_EQ_OQ); }
+static inline f8 mor(f8 a, f8 b) { return _mm256_or_ps(a.v, b.v); }
+static inline f8 mand(f8 a, f8 b) { return _mm256_and_ps(a.v, b.v); }
+static inline f8 fsqrt(f8 a) { return _mm256_sqrt_ps(a.v); }
+static inline __m256i load_idx(const int *p, f8)
+{
+	return _mm256_loadu_si256((const __m256i *) p);
+}
+static inline f8 gather(const float *base, __m256i idx)
+{
+	return _mm256_i32gather_ps(base, idx, 4);
+}
+static inline f8 gather3(const float *base, __m256i idx, int c)
+{
+	__m256i i3 = _mm256_add_epi32(_mm256_mullo_epi32(idx,
+		_mm256_set1_epi32(3)), _mm256_set1_epi32(c));
+	return _mm256_i32gather_ps(base, i3, 4);
+}
+static inline f8 load_strided(const float *base, int stride, f8)
+{
+	__m256i i = _mm256_mullo_epi32(_mm256_setr_epi32(0,1,2,3,4,5,6,7),
+		_mm256_set1_epi32(stride));
+	return _mm256_i32gather_ps(base, i, 4);
+}
+static inline void put(f8 v, float *base, int stride)
+{
+	float tmp[8];
+	_mm256_storeu_ps(tmp, v.v);
+	for (int l = 0; l < 8; l++)
+		base[l*stride] = tmp[l];
+}
+
+template <> struct Lane<f8> {
+	typedef f8 mask;
+	typedef __m256i index;
+	enum { width = 8 };
+};
+typedef f8 fwide;
+#else
+typedef float fwide;
+#endif
+
+int soa_width()
+{
+	return Lane<fwide>::width;
+}
+
+
+//
+// Small 3-vectors of lanes
+//
+template <class F> struct V3 {
+	F x, y, z;
+	V3() {}
+	V3(F x_, F y_, F z_) : x(x_), y(y_), z(z_) {}
+};
+template <class F> static inline V3<F> operator + (const V3<F> &a, const V3<F> &b)
+	{ return V3<F>(a.x + b.x, a.y + b.y, a.z + b.z); }
+template <class F> static inline V3<F> operator - (const V3<F> &a, const V3<F> &b)
+	{ return V3<F>(a.x - b.x, a.y - b.y, a.z - b.z); }
+template <class F> static inline V3<F> operator - (const V3<F> &a)
+	{ return V3<F>(-a.x, -a.y, -a.z); }
+template <class F> static inline V3<F> operator * (const F &s, const V3<F> &a)
+	{ return V3<F>(s * a.x, s * a.y, s * a.z); }
+template <class F> static inline F dot(const V3<F> &a, const V3<F> &b)
+	{ return a.x * b.x + a.y * b.y + a.z * b.z; }
+template <class F> static inline V3<F> cross(const V3<F> &a, const V3<F> &b)
+{
+	return V3<F>(a.y * b.z - a.z * b.y,
+	             a.z * b.x - a.x * b.z,
+	             a.x * b.y - a.y * b.x);
+}
+template <class F> static inline V3<F> sel(const typename Lane<F>::mask &m,
+                                           const V3<F> &a, const V3<F> &b)
+	{ return V3<F>(sel(m, a.x, b.x), sel(m, a.y, b.y), sel(m, a.z, b.z)); }
+
+// As normalize() in Vec.h: zero-length vectors become (1,0,0)
+template <class F> static inline V3<F> normalized(const V3<F> &v)
+{
+	F l = fsqrt(dot(v, v));
+	typename Lane<F>::mask zero = le(l, F(0.0f));
+	V3<F> n = (F(1.0f) / l) * v;
+	return sel(zero, V3<F>(F(1.0f), F(0.0f), F(0.0f)), n);
+}
+
+template <class F>
+static inline V3<F> vertex(const TriMeshSoA &soa, const typename Lane<F>::index &i)
+{
+	return V3<F>(gather(&soa.x[0], i), gather(&soa.y[0], i),
+	             gather(&soa.z[0], i));
+}
+
+// The same kernels also run one face at a time straight on a TriMesh, for
+// the incremental update_* functions
+template <class F>
+static inline V3<F> vertex(const TriMesh &mesh, int i)
+{
+	const point &p = mesh.vertices[i];
+	return V3<F>(p[0], p[1], p[2]);
+}
+
+template <class F>
+static inline typename Lane<F>::index corner(const TriMeshSoA &soa, int f, int j)
+{
+	const int *idx = (j == 0) ? &soa.f0[f] : (j == 1) ? &soa.f1[f] : &soa.f2[f];
+	return load_idx(idx, F());
+}
+
+template <class F>
+static inline int corner(const TriMesh &mesh, int f, int j)
+{
+	return mesh.faces[f][j];
+}
+
+template <class F>
+static inline V3<F> gather_vec(const vector<vec> &v, const typename Lane<F>::index &i)
+{
+	const float *base = &v[0][0];
+	return V3<F>(gather3(base, i, 0), gather3(base, i, 1), gather3(base, i, 2));
+}
+
+template <class F>
+static inline void put_vec(const V3<F> &v, float *base, int stride)
+{
+	put(v.x, base, stride);
+	put(v.y, base + 1, stride);
+	put(v.z, base + 2, stride);
+}
+
+//
+// Normals: Max's weights, as in need_normals
+//
+// Writes the 3 corners of each face to base[0..8], face after face
+template <class F, class G>
+static inline void corner_normals_block(const G &g, int f, float *base)
+{
+	typedef typename Lane<F>::index I;
+	I i0 = corner<F>(g, f, 0), i1 = corner<F>(g, f, 1), i2 = corner<F>(g, f, 2);
+	V3<F> p0 = vertex<F>(g, i0), p1 = vertex<F>(g, i1), p2 = vertex<F>(g, i2);
+	V3<F> a = p0 - p1, b = p1 - p2, c = p2 - p0;
+	F l2a = dot(a, a), l2b = dot(b, b), l2c = dot(c, c);
+	typename Lane<F>::mask degenerate =
+		mor(eq(l2a, F(0.0f)), mor(eq(l2b, F(0.0f)), eq(l2c, F(0.0f))));
+	V3<F> facenormal = cross(a, b);
+	V3<F> zero(F(0.0f), F(0.0f), F(0.0f));
+
+	put_vec(sel(degenerate, zero, (F(1.0f) / (l2a * l2c)) * facenormal), base, 9);
+	put_vec(sel(degenerate, zero, (F(1.0f) / (l2b * l2a)) * facenormal), base + 3, 9);
+	put_vec(sel(degenerate, zero, (F(1.0f) / (l2c * l2b)) * facenormal), base + 6, 9);
+}
+
+void soa_corner_normals(const TriMeshSoA &soa, vector<vec> &cornernormals)
+{
+	int nf = soa.nfaces();
+	cornernormals.resize(3 * nf);
+	const int W = Lane<fwide>::width;
+	int nblocks = nf / W;
+#pragma omp parallel for
+	for (int blk = 0; blk < nblocks; blk++)
+		corner_normals_block<fwide>(soa, blk * W, &cornernormals[3*blk*W][0]);
+	for (int f = nblocks * W; f < nf; f++)
+		corner_normals_block<float>(soa, f, &cornernormals[3*f][0]);
+}
+
+void corner_normals_at(const TriMesh *mesh, const vector<int> &faces,
+                       vector<vec> &cornernormals)
+{
+	int n = faces.size();
+	cornernormals.resize(3 * n);
+#pragma omp parallel for if (n > 4096)
+	for (int k = 0; k < n; k++)
+		corner_normals_block<float>(*mesh, faces[k], &cornernormals[3*k][0]);
+}
+
+
+//
+// Corner areas, as in need_pointareas
+//
+// Writes the 3 corner areas of each face to base[0..2], face after face
+template <class F, class G>
+static inline void corner_areas_block(const G &g, int f, float *base)
+{
+	typedef typename Lane<F>::index I;
+	typedef typename Lane<F>::mask M;
+	I i0 = corner<F>(g, f, 0), i1 = corner<F>(g, f, 1), i2 = corner<F>(g, f, 2);
+	V3<F> p0 = vertex<F>(g, i0), p1 = vertex<F>(g, i1), p2 = vertex<F>(g, i2);
+	V3<F> e[3] = { p2 - p1, p0 - p2, p1 - p0 };
+
+	V3<F> n = cross(e[0], e[1]);
+	F area = F(0.5f) * fsqrt(dot(n, n));
+	F l2[3] = { dot(e[0], e[0]), dot(e[1], e[1]), dot(e[2], e[2]) };
+	F ew[3] = { l2[0] * (l2[1] + l2[2] - l2[0]),
+	            l2[1] * (l2[2] + l2[0] - l2[1]),
+	            l2[2] * (l2[0] + l2[1] - l2[2]) };
+
+	// Non-obtuse triangle
+	F ewscale = F(0.5f) * area / (ew[0] + ew[1] + ew[2]);
+	F c[3];
+	for (int j = 0; j < 3; j++)
+		c[j] = ewscale * (ew[(j+1)%3] + ew[(j+2)%3]);
+
+	// Obtuse at corner 2, 1, 0; applied last to first so that
+	// corner 0 wins as in the if/else chain
+	M m2 = le(ew[2], F(0.0f));
+	F a0 = F(-0.25f) * l2[1] * area / dot(e[2], e[1]);
+	F a1 = F(-0.25f) * l2[0] * area / dot(e[2], e[0]);
+	c[0] = sel(m2, a0, c[0]);
+	c[1] = sel(m2, a1, c[1]);
+	c[2] = sel(m2, area - a0 - a1, c[2]);
+
+	M m1 = le(ew[1], F(0.0f));
+	F b2 = F(-0.25f) * l2[0] * area / dot(e[1], e[0]);
+	F b0 = F(-0.25f) * l2[2] * area / dot(e[1], e[2]);
+	c[2] = sel(m1, b2, c[2]);
+	c[0] = sel(m1, b0, c[0]);
+	c[1] = sel(m1, area - b2 - b0, c[1]);
+
+	M m0 = le(ew[0], F(0.0f));
+	F d1 = F(-0.25f) * l2[2] * area / dot(e[0], e[2]);
+	F d2 = F(-0.25f) * l2[1] * area / dot(e[0], e[1]);
+	c[1] = sel(m0, d1, c[1]);
+	c[2] = sel(m0, d2, c[2]);
+	c[0] = sel(m0, area - d1 - d2, c[0]);
+
+	put(c[0], base, 3);
+	put(c[1], base + 1, 3);
+	put(c[2], base + 2, 3);
+}
+
+void soa_corner_areas(const TriMeshSoA &soa, vector<vec> &cornerareas)
+{
+	int nf = soa.nfaces();
+	cornerareas.resize(nf);
+	const int W = Lane<fwide>::width;
+	int nblocks = nf / W;
+#pragma omp parallel for
+	for (int blk = 0; blk < nblocks; blk++)
+		corner_areas_block<fwide>(soa, blk * W, &cornerareas[blk*W][0]);
+	for (int f = nblocks * W; f < nf; f++)
+		corner_areas_block<float>(soa, f, &cornerareas[f][0]);
+}
+
+void corner_areas_at(TriMesh *mesh, const vector<int> &faces)
+{
+	int n = faces.size();
+#pragma omp parallel for if (n > 4096)
+	for (int k = 0; k < n; k++)
+		corner_areas_block<float>(*mesh, faces[k],
+			&mesh->cornerareas[faces[k]][0]);
+}
+
+
+//
+// Curvature tensor per face, as in need_curvatures
+//
+struct CurvInputs {
+	const vector<vec> &normals, &pdir1, &pdir2, &cornerareas;
+	const vector<float> &pointareas;
+};
+
+// proj_curv() from (t, b) to the frame (new_u, new_v) of a vertex
+template <class F>
+static inline void proj_curv_lanes(const V3<F> &old_u, const V3<F> &old_v,
+	F ku, F kuv, F kv, const V3<F> &new_u, const V3<F> &new_v,
+	F &new_ku, F &new_kuv, F &new_kv)
+{
+	// rot_coord_sys(new_u, new_v, old_u CROSS old_v)
+	V3<F> new_norm = cross(old_u, old_v);
+	V3<F> old_norm = cross(new_u, new_v);
+	F ndot = dot(old_norm, new_norm);
+	V3<F> perp_old = new_norm - ndot * old_norm;
+	V3<F> dperp = (F(1.0f) / (F(1.0f) + ndot)) * (old_norm + new_norm);
+	V3<F> r_u = new_u - dot(new_u, perp_old) * dperp;
+	V3<F> r_v = new_v - dot(new_v, perp_old) * dperp;
+	typename Lane<F>::mask flip = le(ndot, F(-1.0f));
+	r_u = sel(flip, -new_u, r_u);
+	r_v = sel(flip, -new_v, r_v);
+
+	F u1 = dot(r_u, old_u);
+	F v1 = dot(r_u, old_v);
+	F u2 = dot(r_v, old_u);
+	F v2 = dot(r_v, old_v);
+	new_ku  = ku * u1*u1 + kuv * (F(2.0f) * u1*v1) + kv * v1*v1;
+	new_kuv = ku * u1*u2 + kuv * (u1*v2 + u2*v1) + kv * v1*v2;
+	new_kv  = ku * u2*u2 + kuv * (F(2.0f) * u2*v2) + kv * v2*v2;
+}
+
+// Writes the 3 corners of each face to base[0..8], face after face
+template <class F, class G>
+static inline void corner_curv_block(const G &g, int f, const CurvInputs &in, float *base)
+{
+	typedef typename Lane<F>::index I;
+	typedef typename Lane<F>::mask M;
+	I vi[3] = { corner<F>(g, f, 0), corner<F>(g, f, 1), corner<F>(g, f, 2) };
+	V3<F> p[3] = { vertex<F>(g, vi[0]), vertex<F>(g, vi[1]), vertex<F>(g, vi[2]) };
+	V3<F> e[3] = { p[2] - p[1], p[0] - p[2], p[1] - p[0] };
+
+	// N-T-B coordinate system per face
+	V3<F> t = normalized(e[0]);
+	V3<F> n = cross(e[0], e[1]);
+	V3<F> b = normalized(cross(n, t));
+
+	// Estimate curvature based on variation of normals along edges
+	V3<F> vn[3] = { gather_vec<F>(in.normals, vi[0]),
+	                gather_vec<F>(in.normals, vi[1]),
+	                gather_vec<F>(in.normals, vi[2]) };
+	F m0 = F(0.0f), m1 = F(0.0f), m2 = F(0.0f);
+	F w00 = F(0.0f), w01 = F(0.0f), w22 = F(0.0f);
+	for (int j = 0; j < 3; j++) {
+		F u = dot(e[j], t);
+		F v = dot(e[j], b);
+		w00 = w00 + u*u;
+		w01 = w01 + u*v;
+		w22 = w22 + v*v;
+		V3<F> dn = vn[(j+2)%3] - vn[(j+1)%3];
+		F dnu = dot(dn, t);
+		F dnv = dot(dn, b);
+		m0 = m0 + dnu*u;
+		m1 = m1 + (dnu*v + dnv*u);
+		m2 = m2 + dnv*v;
+	}
+	F w11 = w00 + w22, w12 = w01;
+
+	// ldltdc<float,3> unrolled for this matrix, whose (0,2) entry is 0
+	F r0 = F(1.0f) / w00;
+	F a10 = w01;
+	F v0 = a10 * r0;
+	F s1 = w11 - v0 * a10;
+	F r1 = F(1.0f) / s1;
+	F a21 = w12;
+	F v1 = a21 * r1;
+	F s2 = w22 - v1 * a21;
+	F r2 = F(1.0f) / s2;
+	M ok = mand(nle(w00, F(0.0f)), mand(nle(s1, F(0.0f)), nle(s2, F(0.0f))));
+
+	// ldltsl
+	F x0 = m0 * r0;
+	F x1 = (m1 - a10 * x0) * r1;
+	F x2 = (m2 - a21 * x1) * r2;
+	x1 = x1 - (a21 * x2) * r1;
+	x0 = x0 - (a10 * x1) * r0;
+
+	// Push it back out to the vertices
+	const float *ca = &in.cornerareas[f][0];
+	for (int j = 0; j < 3; j++) {
+		V3<F> d1 = gather_vec<F>(in.pdir1, vi[j]);
+		V3<F> d2 = gather_vec<F>(in.pdir2, vi[j]);
+		F c1, c12, c2;
+		proj_curv_lanes(t, b, x0, x1, x2, d1, d2, c1, c12, c2);
+		F wt = load_strided(ca + j, 3, F()) / gather(&in.pointareas[0], vi[j]);
+		V3<F> c(wt * c1, wt * c12, wt * c2);
+		put_vec(sel(ok, c, V3<F>(F(0.0f), F(0.0f), F(0.0f))), base + 3*j, 9);
+	}
+}
+
+void soa_corner_curvatures(const TriMeshSoA &soa,
+	const vector<vec> &normals,
+	const vector<vec> &pdir1, const vector<vec> &pdir2,
+	const vector<vec> &cornerareas,
+	const vector<float> &pointareas,
+	vector<vec> &cornercurv)
+{
+	int nf = soa.nfaces();
+	cornercurv.resize(3 * nf);
+	CurvInputs in = { normals, pdir1, pdir2, cornerareas, pointareas };
+	const int W = Lane<fwide>::width;
+	int nblocks = nf / W;
+#pragma omp parallel for
+	for (int blk = 0; blk < nblocks; blk++)
+		corner_curv_block<fwide>(soa, blk * W, in, &cornercurv[3*blk*W][0]);
+	for (int f = nblocks * W; f < nf; f++)
+		corner_curv_block<float>(soa, f, in, &cornercurv[3*f][0]);
+}
+
+void corner_curvatures_at(const TriMesh *mesh, const vector<int> &faces,
+                          vector<vec> &cornercurv)
+{
+	int n = faces.size();
+	cornercurv.resize(3 * n);
+	CurvInputs in = { mesh->normals, mesh->pdir1, mesh->pdir2,
+	                  mesh->cornerareas, mesh->pointareas };
+#pragma omp parallel for if (n > 4096)
+	for (int k = 0; k < n; k++)
+		corner_curv_block<float>(*mesh, faces[k], in, &cornercurv[3*k][0]);
+}
+
+}; // namespace trimesh
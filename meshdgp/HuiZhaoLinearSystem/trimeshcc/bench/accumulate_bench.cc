@@ -0,0 +1,89 @@
+/*
+accumulate_bench.cc
+Thread scaling of need_normals, need_pointareas and need_curvatures, and a
+check that every thread count gives bit-identical results.
+
+Usage: accumulate_bench [mesh file | grid size] [max threads]
+*/
+
+#include "TriMesh.h"
+#include "timestamp.h"
+#include "bench_mesh.h"
+#include <cstdio>
+#include <cstring>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+using namespace std;
+using namespace trimesh;
+
+
+template <class T>
+static bool same_bits(const vector<T> &a, const vector<T> &b)
+{
+	return a.size() == b.size() &&
+	       (a.empty() || !memcmp(&a[0], &b[0], a.size() * sizeof(T)));
+}
+
+int main(int argc, char *argv[])
+{
+	TriMesh *mesh = bench_mesh(argc, argv, 1500);
+	if (!mesh) {
+		fprintf(stderr, "Couldn't read input\n");
+		return 1;
+	}
+	int maxthreads = (argc > 2) ? atoi(argv[2]) : 64;
+	TriMesh::set_verbose(0);
+	mesh->need_faces();
+	mesh->need_adjacentfaces();
+	printf("%lu vertices, %lu faces\n",
+		(unsigned long) mesh->vertices.size(),
+		(unsigned long) mesh->faces.size());
+
+	vector<vec> ref_normals;
+	vector<float> ref_areas, ref_curv1, ref_curv2;
+	bool ok = true;
+
+	printf("%8s %12s %12s %12s %10s\n",
+		"threads", "normals", "pointareas", "curvatures", "identical");
+	for (int threads = 1; threads <= maxthreads; threads *= 2) {
+#ifdef _OPENMP
+		omp_set_num_threads(threads);
+#else
+		if (threads > 1)
+			break;
+#endif
+		mesh->normals.clear();
+		mesh->pointareas.clear();
+		mesh->curv1.clear();
+
+		timestamp t = now();
+		mesh->need_normals();
+		float t_normals = now() - t;
+		t = now();
+		mesh->need_pointareas();
+		float t_areas = now() - t;
+		t = now();
+		mesh->need_curvatures();
+		float t_curv = now() - t;
+
+		bool same = true;
+		if (threads == 1) {
+			ref_normals = mesh->normals;
+			ref_areas = mesh->pointareas;
+			ref_curv1 = mesh->curv1;
+			ref_curv2 = mesh->curv2;
+		} else {
+			same = same_bits(ref_normals, mesh->normals) &&
+			       same_bits(ref_areas, mesh->pointareas) &&
+			       same_bits(ref_curv1, mesh->curv1) &&
+			       same_bits(ref_curv2, mesh->curv2);
+			ok = ok && same;
+		}
+		printf("%8d %10.3f s %10.3f s %10.3f s %10s\n", threads,
+			t_normals, t_areas, t_curv, same ? "yes" : "NO");
+	}
+
+	delete mesh;
+	return ok ? 0 : 1;
+}
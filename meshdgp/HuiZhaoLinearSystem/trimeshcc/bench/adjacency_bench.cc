@@ -0,0 +1,209 @@
+/*
+adjacency_bench.cc
+Time the CSR neighbors/adjacentfaces build against the previous
+vector< vector<int> > build, and the sorted-edge across_edge build against
+the previous search through adjacentfaces, and check that both give the
+same results.
+
+Usage: adjacency_bench [mesh file | grid size]
+*/
+
+#include "TriMesh.h"
+#include "timestamp.h"
+#include "bench_mesh.h"
+#include <algorithm>
+#include <cstdio>
+using namespace std;
+using namespace trimesh;
+
+
+// The old per-vertex build, kept here for comparison
+static void legacy_neighbors(const TriMesh *mesh, vector< vector<int> > &neighbors)
+{
+	int nv = mesh->vertices.size(), nf = mesh->faces.size();
+	vector<int> numneighbors(nv);
+	for (int i = 0; i < nf; i++) {
+		numneighbors[mesh->faces[i][0]]++;
+		numneighbors[mesh->faces[i][1]]++;
+		numneighbors[mesh->faces[i][2]]++;
+	}
+	neighbors.resize(nv);
+	for (int i = 0; i < nv; i++)
+		neighbors[i].reserve(numneighbors[i]+2);
+	for (int i = 0; i < nf; i++) {
+		for (int j = 0; j < 3; j++) {
+			vector<int> &me = neighbors[mesh->faces[i][j]];
+			int n1 = mesh->faces[i][(j+1)%3];
+			int n2 = mesh->faces[i][(j+2)%3];
+			if (find(me.begin(), me.end(), n1) == me.end())
+				me.push_back(n1);
+			if (find(me.begin(), me.end(), n2) == me.end())
+				me.push_back(n2);
+		}
+	}
+}
+
+static void legacy_adjacentfaces(const TriMesh *mesh, vector< vector<int> > &adjacentfaces)
+{
+	int nv = mesh->vertices.size(), nf = mesh->faces.size();
+	vector<int> numadjacentfaces(nv);
+	for (int i = 0; i < nf; i++) {
+		numadjacentfaces[mesh->faces[i][0]]++;
+		numadjacentfaces[mesh->faces[i][1]]++;
+		numadjacentfaces[mesh->faces[i][2]]++;
+	}
+	adjacentfaces.resize(nv);
+	for (int i = 0; i < nv; i++)
+		adjacentfaces[i].reserve(numadjacentfaces[i]);
+	for (int i = 0; i < nf; i++)
+		for (int j = 0; j < 3; j++)
+			adjacentfaces[mesh->faces[i][j]].push_back(i);
+}
+
+// The old across_edge search, serial, on the old adjacentfaces lists
+static void legacy_across_edge(const TriMesh *mesh,
+                               const vector< vector<int> > &adjacentfaces,
+                               vector<TriMesh::Face> &across_edge)
+{
+	int nf = mesh->faces.size();
+	across_edge.assign(nf, TriMesh::Face(-1,-1,-1));
+	for (int i = 0; i < nf; i++) {
+		for (int j = 0; j < 3; j++) {
+			if (across_edge[i][j] != -1)
+				continue;
+			int v1 = mesh->faces[i][(j+1)%3];
+			int v2 = mesh->faces[i][(j+2)%3];
+			const vector<int> &a1 = adjacentfaces[v1];
+			const vector<int> &a2 = adjacentfaces[v2];
+			for (size_t k1 = 0; k1 < a1.size(); k1++) {
+				int other = a1[k1];
+				if (other == i)
+					continue;
+				if (find(a2.begin(), a2.end(), other) == a2.end())
+					continue;
+				int ind = (mesh->faces[other].indexof(v1)+1)%3;
+				if (mesh->faces[other][(ind+1)%3] != v2)
+					continue;
+				across_edge[i][j] = other;
+				across_edge[other][ind] = i;
+				break;
+			}
+		}
+	}
+}
+
+static bool same(const vector<TriMesh::Face> &a, const vector<TriMesh::Face> &b)
+{
+	if (a.size() != b.size())
+		return false;
+	for (size_t i = 0; i < a.size(); i++)
+		for (int j = 0; j < 3; j++)
+			if (a[i][j] != b[i][j])
+				return false;
+	return true;
+}
+
+static bool same(const vector< vector<int> > &a, const AdjacencyList &b)
+{
+	if (a.size() != b.size())
+		return false;
+	for (size_t i = 0; i < a.size(); i++)
+		if (a[i].size() != b[i].size() ||
+		    !equal(a[i].begin(), a[i].end(), b[i].begin()))
+			return false;
+	return true;
+}
+
+static double footprint(const vector< vector<int> > &a)
+{
+	double bytes = a.capacity() * sizeof(vector<int>);
+	for (size_t i = 0; i < a.size(); i++)
+		bytes += a[i].capacity() * sizeof(int);
+	return bytes;
+}
+
+static double footprint(const AdjacencyList &a)
+{
+	return (a.offsets.capacity() + a.indices.capacity()) * sizeof(int);
+}
+
+// Sum over all 1-rings, to compare traversal speed
+template <class LIST>
+static double ring_sum(const TriMesh *mesh, const LIST &list)
+{
+	double sum = 0;
+	int nv = mesh->vertices.size();
+#pragma omp parallel for reduction(+:sum)
+	for (int i = 0; i < nv; i++)
+		for (size_t j = 0; j < list[i].size(); j++)
+			sum += mesh->vertices[list[i][j]][2];
+	return sum;
+}
+
+int main(int argc, char *argv[])
+{
+	TriMesh *mesh = bench_mesh(argc, argv, 2000);
+	if (!mesh) {
+		fprintf(stderr, "Couldn't read input\n");
+		return 1;
+	}
+	mesh->need_faces();
+	printf("%lu vertices, %lu faces\n",
+		(unsigned long) mesh->vertices.size(),
+		(unsigned long) mesh->faces.size());
+
+	vector< vector<int> > old_neighbors, old_adjacentfaces;
+	timestamp t = now();
+	legacy_adjacentfaces(mesh, old_adjacentfaces);
+	float t_old_af = now() - t;
+	t = now();
+	legacy_neighbors(mesh, old_neighbors);
+	float t_old_n = now() - t;
+	vector<TriMesh::Face> old_across_edge;
+	t = now();
+	legacy_across_edge(mesh, old_adjacentfaces, old_across_edge);
+	float t_old_ae = now() - t;
+
+	t = now();
+	mesh->need_adjacentfaces();
+	float t_af = now() - t;
+	mesh->neighbors.clear();
+	t = now();
+	mesh->need_neighbors();
+	float t_n = now() - t;
+	t = now();
+	mesh->need_across_edge();
+	float t_ae = now() - t;
+
+	t = now();
+	double s_old = ring_sum(mesh, old_neighbors);
+	float t_old_ring = now() - t;
+	t = now();
+	double s_new = ring_sum(mesh, mesh->neighbors);
+	float t_ring = now() - t;
+
+	printf("%-16s %12s %12s %12s\n", "", "legacy", "csr", "speedup");
+	printf("%-16s %10.3f s %10.3f s %11.2fx\n", "adjacentfaces",
+		t_old_af, t_af, t_old_af / t_af);
+	printf("%-16s %10.3f s %10.3f s %11.2fx\n", "neighbors",
+		t_old_n, t_n, t_old_n / t_n);
+	printf("%-16s %10.3f s %10.3f s %11.2fx\n", "across_edge",
+		t_old_ae, t_ae, t_old_ae / t_ae);
+	printf("%-16s %10.3f s %10.3f s %11.2fx\n", "1-ring sweep",
+		t_old_ring, t_ring, t_old_ring / t_ring);
+	printf("%-16s %9.1f MB %9.1f MB\n", "memory",
+		(footprint(old_neighbors) + footprint(old_adjacentfaces)) / 1048576.0,
+		(footprint(mesh->neighbors) + footprint(mesh->adjacentfaces)) / 1048576.0);
+
+	bool ok = same(old_neighbors, mesh->neighbors) &&
+	          same(old_adjacentfaces, mesh->adjacentfaces) &&
+	          (!mesh->nonmanifold_edges.empty() ||
+	           same(old_across_edge, mesh->across_edge)) &&
+	          s_old == s_new;
+	printf("%lu edges, %lu non-manifold\n",
+		(unsigned long) mesh->edges.size(),
+		(unsigned long) mesh->nonmanifold_edges.size());
+	printf("results %s\n", ok ? "match" : "DIFFER");
+	delete mesh;
+	return ok ? 0 : 1;
+}
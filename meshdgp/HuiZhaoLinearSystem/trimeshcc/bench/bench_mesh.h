@@ -0,0 +1,53 @@
+#ifndef BENCH_MESH_H
+#define BENCH_MESH_H
+/*
+bench_mesh.h
+Input meshes for the benchmarks: a file given on the command line, or a
+synthetic wavy grid with n x n vertices.
+*/
+
+#include "TriMesh.h"
+#include <cstdlib>
+#include <cmath>
+
+
+namespace trimesh {
+
+static inline TriMesh *make_grid_mesh(int n)
+{
+	TriMesh *mesh = new TriMesh;
+	mesh->vertices.resize((size_t)n * n);
+	for (int i = 0; i < n; i++) {
+		for (int j = 0; j < n; j++) {
+			float x = (float) i / n, y = (float) j / n;
+			mesh->vertices[(size_t)i * n + j] =
+				point(x, y, 0.05f * sin(20.0f * x) * cos(17.0f * y));
+		}
+	}
+	mesh->faces.reserve(2 * (size_t)(n-1) * (n-1));
+	for (int i = 0; i < n - 1; i++) {
+		for (int j = 0; j < n - 1; j++) {
+			int v = i * n + j;
+			mesh->faces.push_back(TriMesh::Face(v, v + n, v + 1));
+			mesh->faces.push_back(TriMesh::Face(v + 1, v + n, v + n + 1));
+		}
+	}
+	return mesh;
+}
+
+// argv[1] is either a mesh file or the grid size (default n)
+static inline TriMesh *bench_mesh(int argc, char *argv[], int n)
+{
+	if (argc > 1) {
+		char *end;
+		long size = strtol(argv[1], &end, 10);
+		if (*end == '\0' && size > 1)
+			return make_grid_mesh((int) size);
+		return TriMesh::read(argv[1]);
+	}
+	return make_grid_mesh(n);
+}
+
+}; // namespace trimesh
+
+#endif
@@ -0,0 +1,90 @@
+/*
+cache_bench.cc
+Time loading a mesh and computing normals, point areas, curvatures and
+connectivity against loading all of them from a native cache file, and
+check that both give bit-identical arrays.
+
+Usage: cache_bench [mesh file | grid size] [cache file]
+*/
+
+#include "TriMesh.h"
+#include "timestamp.h"
+#include "bench_mesh.h"
+#include <cstdio>
+#include <cstring>
+using namespace std;
+using namespace trimesh;
+
+
+template <class T>
+static bool same_bits(const vector<T> &a, const vector<T> &b)
+{
+	return a.size() == b.size() &&
+	       (a.empty() || !memcmp(&a[0], &b[0], a.size() * sizeof(T)));
+}
+
+int main(int argc, char *argv[])
+{
+	TriMesh::set_verbose(0);
+	const char *cachefile = (argc > 2) ? argv[2] : "cache_bench.tmc";
+
+	timestamp t = now();
+	TriMesh *mesh = bench_mesh(argc, argv, 1000);
+	if (!mesh) {
+		fprintf(stderr, "Couldn't read input\n");
+		return 1;
+	}
+	mesh->need_normals();
+	mesh->need_pointareas();
+	mesh->need_curvatures();
+	mesh->need_dcurv();
+	mesh->need_neighbors();
+	mesh->need_adjacentfaces();
+	mesh->need_across_edge();
+	mesh->need_corners();
+	float t_compute = now() - t;
+
+	t = now();
+	if (!mesh->write(cachefile)) {
+		fprintf(stderr, "Couldn't write %s\n", cachefile);
+		return 1;
+	}
+	float t_write = now() - t;
+
+	t = now();
+	TriMesh *cached = TriMesh::read(cachefile);
+	float t_read = now() - t;
+	if (!cached) {
+		fprintf(stderr, "Couldn't read %s\n", cachefile);
+		return 1;
+	}
+
+	bool ok = same_bits(mesh->vertices, cached->vertices) &&
+		  same_bits(mesh->faces, cached->faces) &&
+		  same_bits(mesh->normals, cached->normals) &&
+		  same_bits(mesh->pointareas, cached->pointareas) &&
+		  same_bits(mesh->cornerareas, cached->cornerareas) &&
+		  same_bits(mesh->curv1, cached->curv1) &&
+		  same_bits(mesh->curv2, cached->curv2) &&
+		  same_bits(mesh->pdir1, cached->pdir1) &&
+		  same_bits(mesh->pdir2, cached->pdir2) &&
+		  same_bits(mesh->dcurv, cached->dcurv) &&
+		  same_bits(mesh->neighbors.offsets, cached->neighbors.offsets) &&
+		  same_bits(mesh->neighbors.indices, cached->neighbors.indices) &&
+		  same_bits(mesh->adjacentfaces.offsets, cached->adjacentfaces.offsets) &&
+		  same_bits(mesh->adjacentfaces.indices, cached->adjacentfaces.indices) &&
+		  same_bits(mesh->across_edge, cached->across_edge) &&
+		  same_bits(mesh->edges, cached->edges) &&
+		  same_bits(mesh->opposite_corner, cached->opposite_corner) &&
+		  same_bits(mesh->vertex_corner, cached->vertex_corner);
+
+	printf("%d vertices, %lu faces\n", (int) mesh->vertices.size(),
+		(unsigned long) mesh->faces.size());
+	printf("%12s %12s %12s %10s\n", "compute", "write", "read", "identical");
+	printf("%10.4f s %10.4f s %10.4f s %10s\n", t_compute, t_write,
+		t_read, ok ? "yes" : "NO");
+
+	delete mesh;
+	delete cached;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,190 @@
+/*
+find_overlap_bench.cc
+Time find_overlap on two overlapping scans of a wavy surface: the old
+serial version on 10000 vertices of each, the parallel one on the same
+samples and on all vertices, and the point-to-surface mode on all vertices.
+Check that the parallel version gives the old results on the same samples,
+and that the point-to-surface mode comes close to the true overlap area and
+distance.
+
+Usage: find_overlap_bench [vertices across] [offset]
+
+The scans are grids of the height field over [0,1] x [0,0.6] and
+[0,1] x [0.4,1], sampled at different rates (n and 0.77 n vertices
+across), and the second one is raised by "offset" (default 0.001).  The
+true overlap is the surface over [0,1] x [0.4,0.6], and the true distance is
+the offset times the z component of the normal.
+*/
+
+#include "TriMesh.h"
+#include "TriMesh_algo.h"
+#include "KDtree.h"
+#include "timestamp.h"
+#include <cstdio>
+#include <cstdlib>
+using namespace std;
+using namespace trimesh;
+
+
+static float height(float x, float y)
+{
+	return 0.05f * sin(20.0f * x) * cos(17.0f * y);
+}
+
+// A grid of n vertices across over [0,1] x [y0,y1], raised by dz
+static TriMesh *make_scan(int n, float y0, float y1, float dz)
+{
+	TriMesh *mesh = new TriMesh;
+	int m = max(2, int((y1 - y0) * n));
+	for (int i = 0; i < n; i++) {
+		for (int j = 0; j < m; j++) {
+			float x = (float) i / (n - 1);
+			float y = y0 + (y1 - y0) * j / (m - 1);
+			mesh->vertices.push_back(point(x, y, height(x, y) + dz));
+		}
+	}
+	for (int i = 0; i < n - 1; i++) {
+		for (int j = 0; j < m - 1; j++) {
+			int v = i * m + j;
+			mesh->faces.push_back(TriMesh::Face(v, v + m, v + 1));
+			mesh->faces.push_back(TriMesh::Face(v + 1, v + m, v + m + 1));
+		}
+	}
+	return mesh;
+}
+
+
+// The old find_overlap_onedir, kept here for comparison
+static void legacy_onedir(TriMesh *mesh1, TriMesh *mesh2, const KDtree *kd2,
+			  float &area, float &rmsdist)
+{
+	area = 0.0f;
+	rmsdist = 0.0f;
+	float area_considered = 0.0f;
+	int nv = mesh1->vertices.size();
+	int nsamp = min(nv, 10000);
+	for (int i = 0; i < nsamp; i++) {
+		int ind = int((float) i / nsamp * nv);
+		ind = trimesh::clamp(ind, 0, nv-1);
+		float this_area = mesh1->pointareas[ind];
+		area_considered += this_area;
+		point p = mesh1->vertices[ind];
+		const float *q = kd2->closest_to_pt(p);
+		if (!q)
+			continue;
+		int ind2 = (q - (const float *) &(mesh2->vertices[0][0])) / 3;
+		if (mesh2->is_bdy(ind2))
+			continue;
+		if ((mesh1->normals[ind] DOT mesh2->normals[ind2]) <= 0.0f)
+			continue;
+		area += this_area;
+		rmsdist += this_area *
+			sqr((p - point(q)) DOT mesh2->normals[ind2]);
+	}
+	if (!area)
+		return;
+	rmsdist /= area;
+	rmsdist = sqrt(rmsdist);
+	area *= mesh1->stat(TriMesh::STAT_TOTAL, TriMesh::STAT_FACEAREA)
+		/ area_considered;
+}
+
+static void legacy_find_overlap(TriMesh *mesh1, TriMesh *mesh2,
+				const KDtree *kd1, const KDtree *kd2,
+				float &area, float &rmsdist)
+{
+	float area1, area2, rmsdist1, rmsdist2;
+	legacy_onedir(mesh1, mesh2, kd2, area1, rmsdist1);
+	legacy_onedir(mesh2, mesh1, kd1, area2, rmsdist2);
+	area = 0.5f * (area1 + area2);
+	if (area)
+		rmsdist = 0.5f * (rmsdist1 + rmsdist2);
+}
+
+
+// The area of the overlap, and the RMS over it of the offset times the z
+// component of the normal: the distance between the scans, to first order
+// in the offset
+static void truth(int n, float dz, float &area, float &rmsdist)
+{
+	double sum_area = 0.0, sum_rms = 0.0;
+	for (int i = 0; i < n; i++) {
+		for (int j = 0; j < n; j++) {
+			float x = (i + 0.5f) / n;
+			float y = 0.4f + 0.2f * (j + 0.5f) / n;
+			float hx = 1.0f * cos(20.0f * x) * cos(17.0f * y);
+			float hy = -0.85f * sin(20.0f * x) * sin(17.0f * y);
+			double a = sqrt(1.0 + sqr(hx) + sqr(hy));
+			sum_area += a;
+			sum_rms += a * sqr(dz) / (1.0 + sqr(hx) + sqr(hy));
+		}
+	}
+	area = (float) (0.2 * sum_area / sqr(n));
+	rmsdist = (float) sqrt(sum_rms / sum_area);
+}
+
+int main(int argc, char *argv[])
+{
+	TriMesh::set_verbose(0);
+	int n = (argc > 1) ? atoi(argv[1]) : 1500;
+	float dz = (argc > 2) ? (float) atof(argv[2]) : 0.001f;
+	if (n < 10) {
+		fprintf(stderr, "Bad size\n");
+		return 1;
+	}
+
+	TriMesh *s1 = make_scan(n, 0.0f, 0.6f, 0.0f);
+	TriMesh *s2 = make_scan(int(0.77f * n), 0.4f, 1.0f, dz);
+	KDtree *kd1 = new KDtree(s1->vertices), *kd2 = new KDtree(s2->vertices);
+	xform xf;
+
+	// Everything find_overlap computes on the meshes, outside the timing
+	float area, rmsdist;
+	find_overlap(s1, s2, xf, xf, kd1, kd2, area, rmsdist, 10, true);
+
+	timestamp t = now();
+	float area_l = 0.0f, rms_l = 0.0f;
+	legacy_find_overlap(s1, s2, kd1, kd2, area_l, rms_l);
+	float t_legacy = now() - t;
+
+	t = now();
+	float area_s = 0.0f, rms_s = 0.0f;
+	find_overlap(s1, s2, xf, xf, kd1, kd2, area_s, rms_s);
+	float t_sampled = now() - t;
+
+	t = now();
+	float area_a = 0.0f, rms_a = 0.0f;
+	find_overlap(s1, s2, xf, xf, kd1, kd2, area_a, rms_a, 0);
+	float t_all = now() - t;
+
+	t = now();
+	float area_f = 0.0f, rms_f = 0.0f;
+	find_overlap(s1, s2, xf, xf, kd1, kd2, area_f, rms_f, 0, true);
+	float t_surf = now() - t;
+
+	float area_true, rms_true;
+	truth(n, dz, area_true, rms_true);
+	bool same = fabs(area_s - area_l) <= 1.0e-4f * area_l &&
+		    fabs(rms_s - rms_l) <= 1.0e-4f * rms_l;
+	bool close = fabs(area_f - area_true) <= 0.05f * area_true &&
+		     fabs(rms_f - rms_true) <= 0.05f * rms_true;
+
+	printf("%lu + %lu vertices, true overlap area %.5g, RMS distance %.5g\n",
+		(unsigned long) s1->vertices.size(),
+		(unsigned long) s2->vertices.size(), area_true, rms_true);
+	printf("%22s %12s %12s %12s\n", "", "time", "area", "RMS dist");
+	printf("%22s %10.4f s %12.5g %12.5g\n", "legacy, 10000 samples",
+		t_legacy, area_l, rms_l);
+	printf("%22s %10.4f s %12.5g %12.5g  %s\n", "10000 samples",
+		t_sampled, area_s, rms_s, same ? "same" : "DIFFERENT");
+	printf("%22s %10.4f s %12.5g %12.5g\n", "all vertices",
+		t_all, area_a, rms_a);
+	printf("%22s %10.4f s %12.5g %12.5g  %s\n", "all, to surface",
+		t_surf, area_f, rms_f, close ? "ok" : "FAILED");
+
+	delete kd2;
+	delete kd1;
+	delete s2;
+	delete s1;
+	return (same && close) ? 0 : 1;
+}
@@ -0,0 +1,111 @@
+/*
+globalreg_bench.cc
+Time global_reg on a surface cut into overlapping scans, each moved by a
+small random motion (except the first), and check that the motions are
+undone.
+
+Usage: globalreg_bench [tiles] [vertices per tile side] [verbose]
+
+The scans are a tiles x tiles array of patches of a wavy, rippled height field
+(the ripples keep narrow overlaps from sliding under ICP), each
+overlapping its neighbors by a third of its width.
+*/
+
+#include "TriMesh.h"
+#include "GlobalReg.h"
+#include "timestamp.h"
+#include <cstdio>
+#include <cstdlib>
+using namespace std;
+using namespace trimesh;
+
+
+static float height(float x, float y)
+{
+	return 0.05f * sin(20.0f * x) * cos(17.0f * y) +
+	       0.01f * sin(70.0f * x + 50.0f * y) + 0.1f * x * y;
+}
+
+// An n x n patch covering [x0, x0+size] x [y0, y0+size]
+static TriMesh *make_patch(float x0, float y0, float size, int n)
+{
+	TriMesh *mesh = new TriMesh;
+	for (int i = 0; i < n; i++) {
+		for (int j = 0; j < n; j++) {
+			float x = x0 + size * i / (n - 1);
+			float y = y0 + size * j / (n - 1);
+			mesh->vertices.push_back(point(x, y, height(x, y)));
+		}
+	}
+	for (int i = 0; i < n - 1; i++) {
+		for (int j = 0; j < n - 1; j++) {
+			int v = i * n + j;
+			mesh->faces.push_back(TriMesh::Face(v, v + n, v + 1));
+			mesh->faces.push_back(TriMesh::Face(v + 1, v + n, v + n + 1));
+		}
+	}
+	return mesh;
+}
+
+// How far xf moves the corners of the unit square, at most
+static float square_motion(const xform &xf)
+{
+	float maxdist = 0.0f;
+	for (int k = 0; k < 4; k++) {
+		point p((float) (k & 1), (float) (k >> 1), 0.0f);
+		maxdist = max(maxdist, dist(xf * p, p));
+	}
+	return maxdist;
+}
+
+int main(int argc, char *argv[])
+{
+	int tiles = (argc > 1) ? atoi(argv[1]) : 6;
+	int n = (argc > 2) ? atoi(argv[2]) : 150;
+	int verbose = (argc > 3) ? atoi(argv[3]) : 1;
+	if (tiles < 2 || n < 4) {
+		fprintf(stderr, "Bad tile count or size\n");
+		return 1;
+	}
+	TriMesh::set_verbose(verbose > 1);
+
+	float step = 1.0f / tiles, size = step * 4.0f / 3.0f;
+	vector<TriMesh *> scans;
+	vector<xform> xfs;
+	unsigned rnd = 1;
+	float before = 0.0f;
+	for (int i = 0; i < tiles; i++) {
+		for (int j = 0; j < tiles; j++) {
+			scans.push_back(make_patch(i * step, j * step, size, n));
+			float r[6];
+			for (int k = 0; k < 6; k++) {
+				rnd = 1664525u * rnd + 1013904223u;
+				r[k] = (float) rnd / 4294967296.0f * 2.0f - 1.0f;
+			}
+			xform xf = xform::trans(0.005 * r[3], 0.005 * r[4], 0.005 * r[5]) *
+				   xform::rot(0.01, r[0], r[1], r[2]);
+			if (scans.size() == 1)
+				xf = xform();
+			xfs.push_back(xf);
+			before = max(before, square_motion(xf));
+		}
+	}
+
+	timestamp t = now();
+	int npairs = global_reg(scans, xfs, 0.1f, verbose);
+	float t_reg = now() - t;
+
+	float after = 0.0f;
+	for (size_t k = 0; k < xfs.size(); k++)
+		after = max(after, square_motion(xfs[k]));
+	bool ok = npairs > 0 && after < 0.05f * before;
+
+	printf("%d scans of %d vertices, %d pairs used\n", tiles * tiles,
+		n * n, npairs);
+	printf("global_reg: %.4f s, largest misplacement %.3g -> %.3g: %s\n",
+		t_reg, before, after, ok ? "ok" : "FAILED");
+
+	for (size_t k = 0; k < scans.size(); k++)
+		delete scans[k];
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,123 @@
+/*
+icp_bench.cc
+Time ICP and ICP_pyramid between two interleaved halves of a point cloud,
+one of them moved by a rigid motion, and check that the motion is
+recovered.
+
+Usage: icp_bench [mesh file | grid size] [verbose] [amount of motion]
+
+The even-numbered vertices of the input (with normals from the full mesh)
+form the first scan and the odd-numbered ones the second, each with some
+noise along the normals (up to 0.02% of the bounding box diagonal).  The motion is a
+rotation of 0.05 radians and a translation of 1% of the bounding box
+diagonal, both scaled by the amount (default 1).
+*/
+
+#include "TriMesh.h"
+#include "TriMesh_algo.h"
+#include "ICP.h"
+#include "timestamp.h"
+#include "bench_mesh.h"
+#include <cstdio>
+#include <cstdlib>
+using namespace std;
+using namespace trimesh;
+
+
+// Every other point, moved along its normal by up to +- noise
+static TriMesh *every_other(const TriMesh *mesh, size_t first, float noise)
+{
+	TriMesh *half = new TriMesh;
+	unsigned rnd = first;
+	for (size_t i = first; i < mesh->vertices.size(); i += 2) {
+		rnd = 1664525u * rnd + 1013904223u;
+		float r = (float) rnd / 4294967296.0f * 2.0f - 1.0f;
+		half->vertices.push_back(mesh->vertices[i] +
+					 noise * r * mesh->normals[i]);
+		half->normals.push_back(mesh->normals[i]);
+	}
+	return half;
+}
+
+// How far xf moves the corners of the box, relative to its diagonal
+static float box_motion(const xform &xf, const box &b)
+{
+	float maxdist = 0.0f;
+	for (int i = 0; i < 8; i++) {
+		point corner((i & 1) ? b.max[0] : b.min[0],
+			     (i & 2) ? b.max[1] : b.min[1],
+			     (i & 4) ? b.max[2] : b.min[2]);
+		maxdist = max(maxdist, dist(xf * corner, corner));
+	}
+	return maxdist / len(b.size());
+}
+
+int main(int argc, char *argv[])
+{
+	int verbose = (argc > 2) ? atoi(argv[2]) : 0;
+	float amount = (argc > 3) ? (float) atof(argv[3]) : 1.0f;
+	TriMesh::set_verbose(verbose);
+
+	TriMesh *mesh = bench_mesh(argc, argv, 2000);
+	if (!mesh) {
+		fprintf(stderr, "Couldn't read input\n");
+		return 1;
+	}
+	mesh->need_normals();
+	mesh->need_bbox();
+	float size = len(mesh->bbox.size());
+
+	float noise = 2.0e-4f * size;
+	TriMesh *s1 = every_other(mesh, 0, noise), *s2 = every_other(mesh, 1, noise);
+	point c = mesh->bbox.center();
+	xform motion = xform::trans(c) * xform::rot(0.05 * amount, 0.3, 1, 0.2) *
+		       xform::trans(-c) * xform::trans(0.01f * amount * size, 0, 0);
+	apply_xform(s2, motion);
+
+	// Plain ICP, including building the KDtrees it needs
+	timestamp t = now();
+	KDtree *kd1 = new KDtree(s1->vertices);
+	KDtree *kd2 = new KDtree(s2->vertices);
+	float t_kd = now() - t;
+	xform xf1, xf2;
+	vector<float> weights1, weights2;
+	float err = ICP(s1, s2, xf1, xf2, kd1, kd2, weights1, weights2,
+			0.0f, verbose);
+	float t_icp = now() - t;
+	float resid = box_motion(xf2 * motion, mesh->bbox);
+
+	t = now();
+	xform xf2p;
+	float errp = ICP_pyramid(s1, s2, xf1, xf2p, 4, verbose);
+	float t_pyr = now() - t;
+	float residp = box_motion(xf2p * motion, mesh->bbox);
+
+	// Again, reusing the full-resolution KDtrees from above
+	t = now();
+	xform xf2k;
+	float errk = ICP_pyramid(s1, s2, xf1, xf2k, kd1, kd2, 4, verbose);
+	float t_pyrk = now() - t;
+	delete kd2;
+	delete kd1;
+
+	// The pyramid has to get it right, the same way with either set of
+	// KDtrees; plain ICP is allowed to fail on large motions
+	bool ok = errp >= 0.0f && residp < 1.0e-3f &&
+		  errk == errp && xf2k == xf2p;
+
+	printf("%lu + %lu points, initial motion %.3g of bbox diagonal\n",
+		(unsigned long) s1->vertices.size(),
+		(unsigned long) s2->vertices.size(), box_motion(motion, mesh->bbox));
+	printf("%12s %12s %12s %12s\n", "", "time", "RMS error", "residual");
+	printf("%12s %10.4f s %12.4g %12.3g  (KDtrees %.4f s)\n", "ICP",
+		t_icp, err, resid, t_kd);
+	printf("%12s %10.4f s %12.4g %12.3g  %s\n", "ICP_pyramid",
+		t_pyr, errp, residp, ok ? "ok" : "FAILED");
+	printf("%12s %10.4f s %12.4g %12.3g  (given KDtrees)\n", "ICP_pyramid",
+		t_pyrk, errk, box_motion(xf2k * motion, mesh->bbox));
+
+	delete s2;
+	delete s1;
+	delete mesh;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,514 @@
+/*
+kdtree_bench.cc
+Time building a KDtree and querying it (closest point, k nearest
+neighbors, closest point to a ray) against the pointer-based tree it
+replaced, and count the queries where the new tree finds a farther point.
+Then time the batch queries against the same queries one at a time, and
+check that they find the same points.
+(The old one sometimes finds a farther point itself, since it sorts
+neighbors by sqrt(distance).)  Distances to rays lose precision in floats,
+so only differences beyond that count.
+
+Usage: kdtree_bench [mesh file | grid size] [queries]
+
+Closest-point queries are random points in the bounding box, k-nearest
+queries are the first vertices themselves (as for point-cloud normals),
+and rays go through random points in random directions.  Radius queries
+are vertices too, a tenth as many as the other queries.
+*/
+
+#include "TriMesh.h"
+#include "KDtree.h"
+#include "mempool.h"
+#include "timestamp.h"
+#include "bench_mesh.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cfloat>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+using namespace std;
+using namespace trimesh;
+
+
+// The old tree, kept here for comparison: nodes from a PoolAlloc, and
+// leaves holding pointers into the caller's points
+class LegacyKDtree {
+public:
+	struct Traversal_Info {
+		const float *p, *dir;
+		const float *closest;
+		float closest_d, closest_d2;
+		size_t k;
+		vector< pair<float, const float *> > knn;
+	};
+
+	class Node {
+	private:
+		static PoolAlloc memPool;
+	public:
+		enum { MAX_PTS_PER_NODE = 8 };
+		int npts;
+		union {
+			struct {
+				float center[3];
+				float r;
+				int splitaxis;
+				Node *child1, *child2;
+			} node;
+			struct {
+				const float *p[MAX_PTS_PER_NODE];
+			} leaf;
+		};
+
+		Node(const float **pts, size_t n);
+		~Node();
+		void find_closest_to_pt(Traversal_Info &ti) const;
+		void find_k_closest_to_pt(Traversal_Info &ti) const;
+		void find_closest_to_ray(Traversal_Info &ti) const;
+		void *operator new(size_t n) { return memPool.alloc(n); }
+		void operator delete(void *p, size_t n) { memPool.free(p,n); }
+	};
+
+	Node *root;
+
+	LegacyKDtree(const vector<point> &v)
+	{
+		vector<const float *> pts(v.size());
+		for (size_t i = 0; i < v.size(); i++)
+			pts[i] = v[i];
+		root = new Node(&pts[0], pts.size());
+	}
+	~LegacyKDtree() { delete root; }
+
+	const float *closest_to_pt(const float *p) const;
+	const float *closest_to_ray(const float *p, const float *dir) const;
+	void find_k_closest_to_pt(vector<const float *> &knn, int k,
+				  const float *p) const;
+};
+
+PoolAlloc LegacyKDtree::Node::memPool(sizeof(LegacyKDtree::Node));
+
+static inline float dist2(const float *x, const float *y)
+{
+	return sqr(x[0]-y[0]) + sqr(x[1]-y[1]) + sqr(x[2]-y[2]);
+}
+
+static inline float dist2ray2(const float *x, const float *p, const float *d)
+{
+	float xp0 = x[0]-p[0], xp1 = x[1]-p[1], xp2 = x[2]-p[2];
+	return sqr(xp0) + sqr(xp1) + sqr(xp2) -
+	       sqr(xp0*d[0] + xp1*d[1] + xp2*d[2]);
+}
+
+LegacyKDtree::Node::Node(const float **pts, size_t n)
+{
+	if (n <= MAX_PTS_PER_NODE) {
+		npts = n;
+		memcpy(leaf.p, pts, n * sizeof(float *));
+		return;
+	}
+	npts = 0;
+	float lo[3], hi[3];
+	for (int j = 0; j < 3; j++)
+		lo[j] = hi[j] = pts[0][j];
+	for (size_t i = 1; i < n; i++) {
+		for (int j = 0; j < 3; j++) {
+			lo[j] = min(lo[j], pts[i][j]);
+			hi[j] = max(hi[j], pts[i][j]);
+		}
+	}
+	for (int j = 0; j < 3; j++)
+		node.center[j] = 0.5f * (lo[j] + hi[j]);
+	float dx = hi[0]-lo[0], dy = hi[1]-lo[1], dz = hi[2]-lo[2];
+	node.r = 0.5f * sqrt(sqr(dx) + sqr(dy) + sqr(dz));
+	node.splitaxis = 2;
+	if (dx > dy) {
+		if (dx > dz)
+			node.splitaxis = 0;
+	} else {
+		if (dy > dz)
+			node.splitaxis = 1;
+	}
+	const float splitval = node.center[node.splitaxis];
+	const float **left = pts, **right = pts + n - 1;
+	while (1) {
+		while ((*left)[node.splitaxis] < splitval)
+			left++;
+		while ((*right)[node.splitaxis] > splitval)
+			right--;
+		if (right <= left)
+			break;
+		swap(*left, *right);
+		left++; right--;
+	}
+	node.child1 = new Node(pts, left-pts);
+	node.child2 = new Node(left, n-(left-pts));
+}
+
+LegacyKDtree::Node::~Node()
+{
+	if (!npts) {
+		delete node.child1;
+		delete node.child2;
+	}
+}
+
+void LegacyKDtree::Node::find_closest_to_pt(Traversal_Info &ti) const
+{
+	if (npts) {
+		for (int i = 0; i < npts; i++) {
+			float myd2 = dist2(leaf.p[i], ti.p);
+			if (myd2 < ti.closest_d2) {
+				ti.closest_d2 = myd2;
+				ti.closest_d = sqrt(ti.closest_d2);
+				ti.closest = leaf.p[i];
+			}
+		}
+		return;
+	}
+	if (dist2(node.center, ti.p) >= sqr(node.r + ti.closest_d))
+		return;
+	float myd = node.center[node.splitaxis] - ti.p[node.splitaxis];
+	if (myd >= 0.0f) {
+		node.child1->find_closest_to_pt(ti);
+		if (myd < ti.closest_d)
+			node.child2->find_closest_to_pt(ti);
+	} else {
+		node.child2->find_closest_to_pt(ti);
+		if (-myd < ti.closest_d)
+			node.child1->find_closest_to_pt(ti);
+	}
+}
+
+void LegacyKDtree::Node::find_k_closest_to_pt(Traversal_Info &ti) const
+{
+	if (npts) {
+		for (int i = 0; i < npts; i++) {
+			float myd2 = dist2(leaf.p[i], ti.p);
+			if (myd2 < ti.closest_d2 || ti.knn.size() < ti.k) {
+				ti.knn.push_back(make_pair(sqrt(myd2), leaf.p[i]));
+				push_heap(ti.knn.begin(), ti.knn.end());
+				if (ti.knn.size() > ti.k) {
+					pop_heap(ti.knn.begin(), ti.knn.end());
+					ti.knn.pop_back();
+				}
+				ti.closest_d = ti.knn[0].first;
+				ti.closest_d2 = sqr(ti.closest_d);
+			}
+		}
+		return;
+	}
+	if (dist2(node.center, ti.p) >= sqr(node.r + ti.closest_d) &&
+	    ti.knn.size() == ti.k)
+		return;
+	float myd = node.center[node.splitaxis] - ti.p[node.splitaxis];
+	if (myd >= 0.0f) {
+		node.child1->find_k_closest_to_pt(ti);
+		if (myd < ti.closest_d || ti.knn.size() != ti.k)
+			node.child2->find_k_closest_to_pt(ti);
+	} else {
+		node.child2->find_k_closest_to_pt(ti);
+		if (-myd < ti.closest_d || ti.knn.size() != ti.k)
+			node.child1->find_k_closest_to_pt(ti);
+	}
+}
+
+void LegacyKDtree::Node::find_closest_to_ray(Traversal_Info &ti) const
+{
+	if (npts) {
+		for (int i = 0; i < npts; i++) {
+			float myd2 = dist2ray2(leaf.p[i], ti.p, ti.dir);
+			if (myd2 < ti.closest_d2) {
+				ti.closest_d2 = myd2;
+				ti.closest_d = sqrt(ti.closest_d2);
+				ti.closest = leaf.p[i];
+			}
+		}
+		return;
+	}
+	if (dist2ray2(node.center, ti.p, ti.dir) >= sqr(node.r + ti.closest_d))
+		return;
+	if (ti.p[node.splitaxis] < node.center[node.splitaxis]) {
+		node.child1->find_closest_to_ray(ti);
+		node.child2->find_closest_to_ray(ti);
+	} else {
+		node.child2->find_closest_to_ray(ti);
+		node.child1->find_closest_to_ray(ti);
+	}
+}
+
+const float *LegacyKDtree::closest_to_pt(const float *p) const
+{
+	Traversal_Info ti;
+	ti.p = p;
+	ti.closest = NULL;
+	ti.closest_d2 = sqr(root->node.r);
+	ti.closest_d = root->node.r;
+	root->find_closest_to_pt(ti);
+	return ti.closest;
+}
+
+const float *LegacyKDtree::closest_to_ray(const float *p, const float *dir) const
+{
+	Traversal_Info ti;
+	float len = sqrt(sqr(dir[0]) + sqr(dir[1]) + sqr(dir[2]));
+	float normalized_dir[3] = { dir[0] / len, dir[1] / len, dir[2] / len };
+	ti.dir = normalized_dir;
+	ti.p = p;
+	ti.closest = NULL;
+	ti.closest_d2 = sqr(root->node.r);
+	ti.closest_d = root->node.r;
+	root->find_closest_to_ray(ti);
+	return ti.closest;
+}
+
+void LegacyKDtree::find_k_closest_to_pt(vector<const float *> &knn, int k,
+					const float *p) const
+{
+	Traversal_Info ti;
+	ti.p = p;
+	ti.closest = NULL;
+	ti.closest_d2 = sqr(root->node.r);
+	ti.closest_d = root->node.r;
+	ti.k = k;
+	ti.knn.reserve(k+1);
+	root->find_k_closest_to_pt(ti);
+	knn.resize(ti.knn.size());
+	sort_heap(ti.knn.begin(), ti.knn.end());
+	for (size_t i = 0; i < knn.size(); i++)
+		knn[i] = ti.knn[i].second;
+}
+
+
+// Squared distance to a found point, or -1 for none
+static float found_d2(const float *q, const float *p)
+{
+	return q ? dist2(q, p) : -1.0f;
+}
+
+// Whether q1 is farther than q2 from the line through p along dir, by
+// more than the rounding error of computing that in floats
+static bool farther_from_ray(const float *q1, const float *q2,
+			     const float *p, const float *dir)
+{
+	if (!q1 || !q2)
+		return !q1 && q2;
+	double len2 = sqr((double) dir[0]) + sqr((double) dir[1]) + sqr((double) dir[2]);
+	double d1 = 0, d2 = 0, along1 = 0, along2 = 0;
+	for (int j = 0; j < 3; j++) {
+		d1 += sqr((double) q1[j] - p[j]);
+		d2 += sqr((double) q2[j] - p[j]);
+		along1 += ((double) q1[j] - p[j]) * dir[j];
+		along2 += ((double) q2[j] - p[j]) * dir[j];
+	}
+	double r1 = d1 - sqr(along1) / len2, r2 = d2 - sqr(along2) / len2;
+	return r1 - r2 > 8.0 * FLT_EPSILON * max(d1, d2);
+}
+
+static float uniform()
+{
+	return (float) rand() / RAND_MAX;
+}
+
+int main(int argc, char *argv[])
+{
+	TriMesh::set_verbose(0);
+	int nq = (argc > 2) ? atoi(argv[2]) : 1000000;
+	const int k = 6;
+
+	TriMesh *mesh = bench_mesh(argc, argv, 1000);
+	if (!mesh || mesh->vertices.empty()) {
+		fprintf(stderr, "Couldn't read input\n");
+		return 1;
+	}
+	const vector<point> &pts = mesh->vertices;
+	int nv = pts.size();
+	mesh->need_bbox();
+	const box &b = mesh->bbox;
+
+	// Queries
+	vector<point> qpts(nq), rays(nq), dirs(nq);
+	for (int i = 0; i < nq; i++) {
+		for (int j = 0; j < 3; j++) {
+			qpts[i][j] = b.min[j] + uniform() * (b.max[j] - b.min[j]);
+			rays[i][j] = b.min[j] + uniform() * (b.max[j] - b.min[j]);
+			dirs[i][j] = uniform() - 0.5f;
+		}
+	}
+	int nknn = min(nq, nv), nrays = max(nq / 100, 1);
+
+	timestamp t = now();
+	LegacyKDtree *old_kd = new LegacyKDtree(pts);
+	float t_build_old = now() - t;
+	t = now();
+	KDtree *kd = new KDtree(pts);
+	float t_build = now() - t;
+
+	// Closest points
+	vector<const float *> old_closest(nq), closest(nq);
+	t = now();
+#pragma omp parallel for
+	for (int i = 0; i < nq; i++)
+		old_closest[i] = old_kd->closest_to_pt(qpts[i]);
+	float t_closest_old = now() - t;
+	t = now();
+#pragma omp parallel for
+	for (int i = 0; i < nq; i++)
+		closest[i] = kd->closest_to_pt(qpts[i]);
+	float t_closest = now() - t;
+	int bad_closest = 0;
+#pragma omp parallel for reduction(+ : bad_closest)
+	for (int i = 0; i < nq; i++) {
+		if (found_d2(closest[i], qpts[i]) > found_d2(old_closest[i], qpts[i]))
+			bad_closest++;
+	}
+
+	// k nearest neighbors
+	vector<float> old_knn_d2(nknn * k, -1.0f), knn_d2(nknn * k, -1.0f);
+	t = now();
+#pragma omp parallel for
+	for (int i = 0; i < nknn; i++) {
+		vector<const float *> knn;
+		old_kd->find_k_closest_to_pt(knn, k, pts[i]);
+		for (size_t j = 0; j < knn.size(); j++)
+			old_knn_d2[i*k+j] = dist2(knn[j], pts[i]);
+	}
+	float t_knn_old = now() - t;
+	t = now();
+#pragma omp parallel for
+	for (int i = 0; i < nknn; i++) {
+		vector<const float *> knn;
+		kd->find_k_closest_to_pt(knn, k, pts[i]);
+		for (size_t j = 0; j < knn.size(); j++)
+			knn_d2[i*k+j] = dist2(knn[j], pts[i]);
+	}
+	float t_knn = now() - t;
+	int bad_knn = 0;
+#pragma omp parallel for reduction(+ : bad_knn)
+	for (int i = 0; i < nknn; i++) {
+		sort(&old_knn_d2[i*k], &old_knn_d2[i*k] + k);
+		sort(&knn_d2[i*k], &knn_d2[i*k] + k);
+		for (int j = 0; j < k; j++) {
+			if (knn_d2[i*k+j] > old_knn_d2[i*k+j]) {
+				bad_knn++;
+				break;
+			}
+		}
+	}
+
+	// Closest points to rays
+	vector<const float *> old_ray(nrays), ray(nrays);
+	t = now();
+#pragma omp parallel for
+	for (int i = 0; i < nrays; i++)
+		old_ray[i] = old_kd->closest_to_ray(rays[i], dirs[i]);
+	float t_ray_old = now() - t;
+	t = now();
+#pragma omp parallel for
+	for (int i = 0; i < nrays; i++)
+		ray[i] = kd->closest_to_ray(rays[i], dirs[i]);
+	float t_ray = now() - t;
+	int bad_ray = 0;
+#pragma omp parallel for reduction(+ : bad_ray)
+	for (int i = 0; i < nrays; i++) {
+		if (farther_from_ray(ray[i], old_ray[i], rays[i], dirs[i]))
+			bad_ray++;
+	}
+
+	// The same closest-point and k-nearest queries as batches, and radius
+	// queries one at a time and as a batch, with a radius that takes in
+	// about 2k points
+	vector<int> batch_closest(nq);
+	t = now();
+	kd->closest_to_pts(qpts[0], nq, &batch_closest[0]);
+	float t_batch_closest = now() - t;
+	int diff_closest = 0;
+#pragma omp parallel for reduction(+ : diff_closest)
+	for (int i = 0; i < nq; i++) {
+		const float *q = batch_closest[i] < 0 ? NULL : (const float *) pts[batch_closest[i]];
+		if (q != closest[i])
+			diff_closest++;
+	}
+
+	vector<int> batch_knn(nknn * k);
+	t = now();
+	kd->find_k_closest_to_pts(pts[0], nknn, k, &batch_knn[0]);
+	float t_batch_knn = now() - t;
+	int diff_knn = 0;
+#pragma omp parallel for reduction(+ : diff_knn)
+	for (int i = 0; i < nknn; i++) {
+		for (int j = 0; j < k; j++) {
+			int q = batch_knn[i*k+j];
+			if ((q < 0 ? -1.0f : dist2(pts[q], pts[i])) != knn_d2[i*k+j]) {
+				diff_knn++;
+				break;
+			}
+		}
+	}
+
+	vector<float> kth(nknn);
+	for (int i = 0; i < nknn; i++)
+		kth[i] = knn_d2[i*k+k-1];
+	nth_element(kth.begin(), kth.begin() + nknn / 2, kth.end());
+	float r2 = 2.0f * kth[nknn / 2];
+	int nradius = max(nq / 10, 1);
+	vector< vector<const float *> > radius(nradius);
+	t = now();
+#pragma omp parallel for
+	for (int i = 0; i < nradius; i++)
+		kd->find_in_radius(radius[i], pts[i % nv], r2);
+	float t_radius = now() - t;
+	vector<point> rpts(nradius);
+	for (int i = 0; i < nradius; i++)
+		rpts[i] = pts[i % nv];
+	vector<size_t> starts;
+	vector<int> found;
+	t = now();
+	kd->find_in_radius_pts(rpts[0], nradius, r2, starts, found);
+	float t_batch_radius = now() - t;
+	int diff_radius = 0;
+	for (int i = 0; i < nradius; i++) {
+		vector<int> a(radius[i].size());
+		for (size_t j = 0; j < a.size(); j++)
+			a[j] = (const point *) radius[i][j] - &pts[0];
+		vector<int> b(found.begin() + starts[i], found.begin() + starts[i+1]);
+		sort(a.begin(), a.end());
+		sort(b.begin(), b.end());
+		if (a != b)
+			diff_radius++;
+	}
+
+	printf("%d points, %d closest, %d knn (k = %d), %d ray queries\n",
+		nv, nq, nknn, k, nrays);
+	printf("%10s %14s %14s %9s %10s\n", "", "legacy", "flat", "speedup",
+		"farther");
+	printf("%10s %12.4f s %12.4f s %8.2fx %10s\n", "build",
+		t_build_old, t_build, t_build_old / t_build, "");
+	printf("%10s %10.3g q/s %10.3g q/s %8.2fx %10d\n", "closest",
+		nq / t_closest_old, nq / t_closest, t_closest_old / t_closest,
+		bad_closest);
+	printf("%10s %10.3g q/s %10.3g q/s %8.2fx %10d\n", "knn",
+		nknn / t_knn_old, nknn / t_knn, t_knn_old / t_knn, bad_knn);
+	printf("%10s %10.3g q/s %10.3g q/s %8.2fx %10d\n", "ray",
+		nrays / t_ray_old, nrays / t_ray, t_ray_old / t_ray, bad_ray);
+	printf("\n%d radius queries, %.1f points each\n", nradius,
+		(float) found.size() / nradius);
+	printf("%10s %14s %14s %9s %10s\n", "", "one by one", "batch",
+		"speedup", "differ");
+	printf("%10s %10.3g q/s %10.3g q/s %8.2fx %10d\n", "closest",
+		nq / t_closest, nq / t_batch_closest, t_closest / t_batch_closest,
+		diff_closest);
+	printf("%10s %10.3g q/s %10.3g q/s %8.2fx %10d\n", "knn",
+		nknn / t_knn, nknn / t_batch_knn, t_knn / t_batch_knn, diff_knn);
+	printf("%10s %10.3g q/s %10.3g q/s %8.2fx %10d\n", "radius",
+		nradius / t_radius, nradius / t_batch_radius,
+		t_radius / t_batch_radius, diff_radius);
+
+	delete old_kd;
+	delete kd;
+	delete mesh;
+	return (bad_closest || bad_knn || bad_ray ||
+		diff_closest || diff_knn || diff_radius) ? 1 : 0;
+}
@@ -0,0 +1,212 @@
+/*
+obj_bench.cc
+Time the memory-mapped parallel OBJ reader against the previous
+fgets/sscanf reader, and check that both give bit-identical meshes.  A small OBJ with overlong
+number tokens (scratch obj file + "_tokens.obj") is checked the same way.
+
+Usage: obj_bench [obj file | mesh file | grid size] [scratch obj file]
+
+An .obj argument is read as is; anything else is written out as an OBJ
+to the scratch file (default obj_bench.obj) first.
+*/
+
+#include "TriMesh.h"
+#include "timestamp.h"
+#include "bench_mesh.h"
+#include "strutil.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+using namespace std;
+using namespace trimesh;
+
+
+// The old reader, kept here for comparison
+static void legacy_skip_comments(FILE *f)
+{
+	int c;
+	bool in_comment = false;
+	while (1) {
+		c = fgetc(f);
+		if (c == EOF)
+			return;
+		if (in_comment) {
+			if (c == '\n')
+				in_comment = false;
+		} else if (c == '#') {
+			in_comment = true;
+		} else if (!isspace(c)) {
+			break;
+		}
+	}
+	ungetc(c, f);
+}
+
+static void legacy_tess(const vector<point> &verts, const vector<int> &thisface,
+			vector<TriMesh::Face> &tris)
+{
+	if (thisface.size() < 3)
+		return;
+	if (thisface.size() == 4) {
+		const point &p0 = verts[thisface[0]], &p1 = verts[thisface[1]];
+		const point &p2 = verts[thisface[2]], &p3 = verts[thisface[3]];
+		int i = (dist2(p0, p2) < dist2(p1, p3)) ? 0 : 1;
+		tris.push_back(TriMesh::Face(thisface[i],
+			thisface[(i+1)%4], thisface[(i+2)%4]));
+		tris.push_back(TriMesh::Face(thisface[i],
+			thisface[(i+2)%4], thisface[(i+3)%4]));
+		return;
+	}
+	for (size_t i = 2; i < thisface.size(); i++)
+		tris.push_back(TriMesh::Face(thisface[0],
+			thisface[i-1], thisface[i]));
+}
+
+static bool legacy_read_obj(const char *filename, TriMesh *mesh)
+{
+	FILE *f = fopen(filename, "rb");
+	if (!f)
+		return false;
+	vector<int> thisface;
+	bool ok = true;
+	while (1) {
+		legacy_skip_comments(f);
+		if (feof(f))
+			break;
+		char buf[1024];
+		if (!fgets(buf, 1024, f)) {
+			ok = false;
+			break;
+		}
+		if (begins_with(buf, "v ") || begins_with(buf, "v\t")) {
+			float x, y, z;
+			if (sscanf(buf+1, "%f %f %f", &x, &y, &z) != 3) {
+				ok = false;
+				break;
+			}
+			mesh->vertices.push_back(point(x,y,z));
+		} else if (begins_with(buf, "vn ") || begins_with(buf, "vn\t")) {
+			float x, y, z;
+			if (sscanf(buf+2, "%f %f %f", &x, &y, &z) != 3) {
+				ok = false;
+				break;
+			}
+			mesh->normals.push_back(vec(x,y,z));
+		} else if (begins_with(buf, "f ") || begins_with(buf, "f\t") ||
+			   begins_with(buf, "t ") || begins_with(buf, "t\t")) {
+			thisface.clear();
+			char *c = buf;
+			while (1) {
+				while (*c && *c != '\n' && !isspace(*c))
+					c++;
+				while (*c && isspace(*c))
+					c++;
+				int thisf;
+				if (sscanf(c, " %d", &thisf) != 1)
+					break;
+				if (thisf < 0)
+					thisf += mesh->vertices.size();
+				else
+					thisf--;
+				thisface.push_back(thisf);
+			}
+			legacy_tess(mesh->vertices, thisface, mesh->faces);
+		}
+	}
+	fclose(f);
+	if (mesh->vertices.size() != mesh->normals.size())
+		mesh->normals.clear();
+	return ok;
+}
+
+
+template <class T>
+static bool same_bits(const vector<T> &a, const vector<T> &b)
+{
+	return a.size() == b.size() &&
+	       (a.empty() || !memcmp(&a[0], &b[0], a.size() * sizeof(T)));
+}
+
+// Numbers longer than the fast path handles, some longer than 64 digits,
+// must be read whole by both readers
+static bool long_tokens_match(const string &filename)
+{
+	FILE *f = fopen(filename.c_str(), "w");
+	if (!f)
+		return false;
+	for (int digits = 60; digits <= 72; digits += 4) {
+		string num = "0.";
+		for (int i = 0; i < digits; i++)
+			num += (char) ('0' + (i + 1) % 10);
+		fprintf(f, "v %s 2 3\nv 4 -%s 5\nv 6 7 %se-3\n",
+			num.c_str(), num.c_str(), num.c_str());
+	}
+	fprintf(f, "f 1 2 3\n");
+	fclose(f);
+
+	TriMesh *legacy = new TriMesh;
+	bool legacy_ok = legacy_read_obj(filename.c_str(), legacy);
+	TriMesh *mesh = TriMesh::read(filename);
+	bool ok = legacy_ok && mesh && legacy->vertices.size() == 12 &&
+		  same_bits(legacy->vertices, mesh->vertices) &&
+		  same_bits(legacy->faces, mesh->faces);
+	delete legacy;
+	delete mesh;
+	return ok;
+}
+
+int main(int argc, char *argv[])
+{
+	TriMesh::set_verbose(0);
+	const char *objfile = (argc > 2) ? argv[2] : "obj_bench.obj";
+	if (argc > 1 && ends_with(argv[1], ".obj")) {
+		objfile = argv[1];
+	} else {
+		TriMesh *mesh = bench_mesh(argc, argv, 1000);
+		if (!mesh || !mesh->write(objfile)) {
+			fprintf(stderr, "Couldn't write %s\n", objfile);
+			return 1;
+		}
+		delete mesh;
+	}
+
+	FILE *f = fopen(objfile, "rb");
+	if (!f) {
+		fprintf(stderr, "Couldn't read %s\n", objfile);
+		return 1;
+	}
+	fseek(f, 0, SEEK_END);
+	double mb = ftell(f) / 1048576.0;
+	fclose(f);
+
+	TriMesh *legacy = new TriMesh;
+	timestamp t = now();
+	bool legacy_ok = legacy_read_obj(objfile, legacy);
+	float t_legacy = now() - t;
+
+	t = now();
+	TriMesh *mesh = TriMesh::read(objfile);
+	float t_mapped = now() - t;
+	if (!legacy_ok || !mesh) {
+		fprintf(stderr, "Couldn't read %s\n", objfile);
+		return 1;
+	}
+
+	bool ok = same_bits(legacy->vertices, mesh->vertices) &&
+		  same_bits(legacy->normals, mesh->normals) &&
+		  same_bits(legacy->faces, mesh->faces);
+	bool tokens_ok = long_tokens_match(string(objfile) + "_tokens.obj");
+	printf("%.1f MB, %lu vertices, %lu faces\n", mb,
+		(unsigned long) mesh->vertices.size(),
+		(unsigned long) mesh->faces.size());
+	printf("%12s %12s %12s %12s %10s\n", "legacy", "MB/s", "mapped", "MB/s",
+		"identical");
+	printf("%10.4f s %12.1f %10.4f s %12.1f %10s\n", t_legacy,
+		mb / t_legacy, t_mapped, mb / t_mapped, ok ? "yes" : "NO");
+	printf("Long number tokens: %s\n", tokens_ok ? "identical" : "DIFFERENT");
+	ok = ok && tokens_ok;
+
+	delete legacy;
+	delete mesh;
+	return ok ? 0 : 1;
+}
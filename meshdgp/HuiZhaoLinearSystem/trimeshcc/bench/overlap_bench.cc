@@ -0,0 +1,258 @@
+/*
+overlap_bench.cc
+Time compute_overlaps on two long scans that overlap only at their ends,
+against the fixed 16x16x16 grid it used to use, and compare how many points
+each one marks with the points that really are within maxdist of the other
+scan.
+
+Usage: overlap_bench [vertices across] [length] [lift]
+
+Each scan is a strip of a wavy height field, "length" times as long as it
+is wide (default 8).  The second one starts half a width before the end of
+the first, and turns by 90 degrees there, as a scanner's path around a
+corner might.  If lift is given, the second one is raised by that much
+(times the width), so that it passes over the first like the next floor of
+a building, and nothing should overlap.
+
+Then the marking is checked with the scans in rotated frames: a flat grid,
+and small patches just under maxdist below it, stored rotated by a few
+angles and placed with the matching transform.  Grid points sit at the
+bottom of their cells, so their cell centers are furthest from the patches.
+*/
+
+#include "TriMesh.h"
+#include "ICP.h"
+#include "KDtree.h"
+#include "timestamp.h"
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+using namespace std;
+using namespace trimesh;
+
+
+// The old overlap grid, kept here for comparison: a 16x16x16 bitmap over
+// the bounding box
+class LegacyGrid {
+public:
+	enum { GRID_SHIFT = 4, GRID_MAX = (1 << GRID_SHIFT) - 1 };
+	float xmin, xmax, ymin, ymax, zmin, zmax, scale;
+	vector<char> g;
+	bool valid(const point &p)
+	{
+		return p[0] >= xmin && p[1] >= ymin && p[2] >= zmin &&
+		       p[0] <= xmax && p[1] <= ymax && p[2] <= zmax;
+	}
+	int ind(const point &p)
+	{
+		int x = trimesh::clamp(int(scale * (p[0] - xmin)), 0, int(GRID_MAX));
+		int y = trimesh::clamp(int(scale * (p[1] - ymin)), 0, int(GRID_MAX));
+		int z = trimesh::clamp(int(scale * (p[2] - zmin)), 0, int(GRID_MAX));
+		return (x << (2*GRID_SHIFT)) + (y << GRID_SHIFT) + z;
+	}
+	bool overlaps(const point &p) { return valid(p) && g[ind(p)]; }
+	LegacyGrid(const vector<point> &pts);
+};
+
+LegacyGrid::LegacyGrid(const vector<point> &pts)
+{
+	g.resize(1 << 3*GRID_SHIFT);
+	xmin = xmax = pts[0][0];
+	ymin = ymax = pts[0][1];
+	zmin = zmax = pts[0][2];
+	for (size_t i = 1; i < pts.size(); i++) {
+		if (pts[i][0] < xmin)  xmin = pts[i][0];
+		if (pts[i][0] > xmax)  xmax = pts[i][0];
+		if (pts[i][1] < ymin)  ymin = pts[i][1];
+		if (pts[i][1] > ymax)  ymax = pts[i][1];
+		if (pts[i][2] < zmin)  zmin = pts[i][2];
+		if (pts[i][2] > zmax)  zmax = pts[i][2];
+	}
+	scale = 1.0f / max(max(xmax-xmin, ymax-ymin), zmax-zmin);
+	scale *= float(1 << GRID_SHIFT);
+	for (size_t i = 0; i < pts.size(); i++)
+		g[ind(pts[i])] = 1;
+}
+
+// The old compute_overlaps, with the grid test only
+static void legacy_overlaps(TriMesh *s1, TriMesh *s2,
+			    vector<float> &o1, vector<float> &o2)
+{
+	LegacyGrid g1(s1->vertices), g2(s2->vertices);
+	o1.resize(s1->vertices.size());
+	for (size_t i = 0; i < s1->vertices.size(); i++)
+		o1[i] = g2.overlaps(s1->vertices[i]);
+	o2.resize(s2->vertices.size());
+	for (size_t i = 0; i < s2->vertices.size(); i++)
+		o2[i] = g1.overlaps(s2->vertices[i]);
+}
+
+
+// A strip of n x (length * n) points starting at x0
+static TriMesh *make_strip(float x0, int n, int length)
+{
+	TriMesh *mesh = new TriMesh;
+	int m = length * (n - 1) + 1;
+	for (int i = 0; i < m; i++) {
+		for (int j = 0; j < n; j++) {
+			float x = x0 + (float) i / (n - 1);
+			float y = (float) j / (n - 1);
+			mesh->vertices.push_back(point(x, y,
+				0.05f * sin(20.0f * x) * cos(17.0f * y)));
+		}
+	}
+	return mesh;
+}
+
+// Points of s1 within maxdist of s2
+static void exact_overlaps(const TriMesh *s1, const KDtree *kd2,
+			   float maxdist, vector<float> &o1)
+{
+	int nv = s1->vertices.size();
+	o1.resize(nv);
+#pragma omp parallel for
+	for (int i = 0; i < nv; i++)
+		o1[i] = kd2->closest_to_pt(s1->vertices[i], sqr(maxdist)) ? 1 : 0;
+}
+
+static size_t count(const vector<float> &o)
+{
+	size_t n = 0;
+	for (size_t i = 0; i < o.size(); i++)
+		n += (o[i] != 0.0f);
+	return n;
+}
+
+// Number of points marked in exact but not in o
+static size_t missed(const vector<float> &exact, const vector<float> &o)
+{
+	size_t n = 0;
+	for (size_t i = 0; i < o.size(); i++)
+		n += (exact[i] != 0.0f && o[i] == 0.0f);
+	return n;
+}
+
+// A flat n x n grid over [0,1]^2, and 2x2 patches of the same spacing just
+// under maxdist below its vertices, stored rotated by angle about a skew
+// axis.  Returns how many points within maxdist of the other scan
+// compute_overlaps fails to mark.
+static size_t rotated_misses(int n, float angle)
+{
+	float h = 1.0f / (n - 1);
+	float maxdist = 2.0f * h;
+	TriMesh *plane = new TriMesh;
+	for (int i = 0; i < n; i++)
+		for (int j = 0; j < n; j++)
+			plane->vertices.push_back(point(i * h, j * h, 0.0f));
+
+	TriMesh *patches = new TriMesh;
+	unsigned rnd = 1;
+	for (int k = 0; k < 200; k++) {
+		rnd = 1664525u * rnd + 1013904223u;
+		int i = rnd % (n - 1);
+		rnd = 1664525u * rnd + 1013904223u;
+		int j = rnd % (n - 1);
+		for (int d = 0; d < 4; d++)
+			patches->vertices.push_back(point((i + d % 2) * h,
+				(j + d / 2) * h, -0.99f * maxdist));
+	}
+
+	// Exact answer in the common frame
+	KDtree *kdp = new KDtree(plane->vertices);
+	KDtree *kdq = new KDtree(patches->vertices);
+	vector<float> e1, e2;
+	exact_overlaps(plane, kdq, maxdist, e1);
+	exact_overlaps(patches, kdp, maxdist, e2);
+	delete kdq;
+
+	xform rot = xform::rot(angle, 1, 2, 3);
+	xform unrot = inv(rot);
+	for (size_t i = 0; i < patches->vertices.size(); i++)
+		patches->vertices[i] = unrot * patches->vertices[i];
+	kdq = new KDtree(patches->vertices);
+
+	vector<float> o1, o2;
+	compute_overlaps(plane, patches, xform(), rot, kdp, kdq, o1, o2,
+			 maxdist, 0);
+	size_t nmissed = missed(e1, o1) + missed(e2, o2);
+
+	delete kdq;
+	delete kdp;
+	delete patches;
+	delete plane;
+	return nmissed;
+}
+
+int main(int argc, char *argv[])
+{
+	TriMesh::set_verbose(0);
+	int n = (argc > 1) ? atoi(argv[1]) : 300;
+	int length = (argc > 2) ? atoi(argv[2]) : 8;
+	float lift = (argc > 3) ? (float) atof(argv[3]) : 0.0f;
+	if (n < 4 || length < 1) {
+		fprintf(stderr, "Bad size or length\n");
+		return 1;
+	}
+
+	TriMesh *s1 = make_strip(0.0f, n, length);
+	TriMesh *s2 = make_strip(length - 0.5f, n, length);
+	point c(length - 0.25f, 0.5f, 0.0f);
+	xform turn = xform::trans(c) * xform::rot(M_PI / 2.0, 0, 0, 1) *
+		     xform::trans(-c);
+	for (size_t i = 0; i < s2->vertices.size(); i++) {
+		point &p = s2->vertices[i];
+		p = turn * p;
+		p[2] = 0.05f * sin(20.0f * p[0]) * cos(17.0f * p[1]) + lift;
+	}
+	KDtree *kd1 = new KDtree(s1->vertices), *kd2 = new KDtree(s2->vertices);
+	s1->need_bbox();
+	s2->need_bbox();
+	size_t nv = s1->vertices.size() + s2->vertices.size();
+
+	timestamp t = now();
+	vector<float> lo1, lo2;
+	legacy_overlaps(s1, s2, lo1, lo2);
+	float t_legacy = now() - t;
+
+	t = now();
+	vector<float> o1, o2;
+	float maxdist = 0.0f;
+	compute_overlaps(s1, s2, xform(), xform(), kd1, kd2, o1, o2,
+			 maxdist, 0);
+	float t_new = now() - t;
+
+	vector<float> e1, e2;
+	exact_overlaps(s1, kd2, maxdist, e1);
+	exact_overlaps(s2, kd1, maxdist, e2);
+	size_t nexact = count(e1) + count(e2);
+	size_t nlegacy = count(lo1) + count(lo2), nnew = count(o1) + count(o2);
+	size_t nmissed = missed(e1, o1) + missed(e2, o2);
+
+	// Nothing within maxdist should be missed.  How far beyond that the
+	// marked region extends is up to the grid.
+	bool ok = (nmissed == 0);
+
+	const float angles[] = { 0.0f, 0.3f, 0.785f };
+	size_t rmissed[3];
+	for (int k = 0; k < 3; k++) {
+		rmissed[k] = rotated_misses(400, angles[k]);
+		ok = ok && (rmissed[k] == 0);
+	}
+
+	printf("%lu points, %lu within maxdist = %g of the other scan\n",
+		(unsigned long) nv, (unsigned long) nexact, maxdist);
+	printf("%16s %12s %12s\n", "", "time", "marked");
+	printf("%16s %10.4f s %11.2f%%\n", "legacy grid", t_legacy,
+		100.0 * nlegacy / nv);
+	printf("%16s %10.4f s %11.2f%%  %s\n", "compute_overlaps", t_new,
+		100.0 * nnew / nv, nmissed ? "FAILED" : "ok");
+	for (int k = 0; k < 3; k++)
+		printf("rotated frames, %.3f rad: %lu missed  %s\n", angles[k],
+			(unsigned long) rmissed[k], rmissed[k] ? "FAILED" : "ok");
+
+	delete kd2;
+	delete kd1;
+	delete s2;
+	delete s1;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,83 @@
+/*
+ply_bench.cc
+Time reading a binary PLY through the memory map against reading the
+same file through stdio (as for standard input), and check that both give
+bit-identical meshes.
+
+Usage: ply_bench [ply file | mesh file | grid size] [scratch ply file]
+
+A .ply argument is read as is; anything else is written out as a binary
+PLY to the scratch file (default ply_bench.ply) first.
+*/
+
+#include "TriMesh.h"
+#include "timestamp.h"
+#include "bench_mesh.h"
+#include "strutil.h"
+#include <cstdio>
+#include <cstring>
+using namespace std;
+using namespace trimesh;
+
+
+template <class T>
+static bool same_bits(const vector<T> &a, const vector<T> &b)
+{
+	return a.size() == b.size() &&
+	       (a.empty() || !memcmp(&a[0], &b[0], a.size() * sizeof(T)));
+}
+
+int main(int argc, char *argv[])
+{
+	TriMesh::set_verbose(0);
+	const char *plyfile = (argc > 2) ? argv[2] : "ply_bench.ply";
+	if (argc > 1 && ends_with(argv[1], ".ply")) {
+		plyfile = argv[1];
+	} else {
+		TriMesh *mesh = bench_mesh(argc, argv, 1000);
+		if (!mesh || !mesh->write(plyfile)) {
+			fprintf(stderr, "Couldn't write %s\n", plyfile);
+			return 1;
+		}
+		delete mesh;
+	}
+
+	// Standard input can't be mapped, so it goes through stdio
+	if (!freopen(plyfile, "rb", stdin)) {
+		fprintf(stderr, "Couldn't read %s\n", plyfile);
+		return 1;
+	}
+	fseek(stdin, 0, SEEK_END);
+	double mb = ftell(stdin) / 1048576.0;
+	rewind(stdin);
+
+	timestamp t = now();
+	TriMesh *stdio = TriMesh::read("-");
+	float t_stdio = now() - t;
+
+	t = now();
+	TriMesh *mesh = TriMesh::read(plyfile);
+	float t_mapped = now() - t;
+	if (!stdio || !mesh) {
+		fprintf(stderr, "Couldn't read %s\n", plyfile);
+		return 1;
+	}
+
+	bool ok = same_bits(stdio->vertices, mesh->vertices) &&
+		  same_bits(stdio->normals, mesh->normals) &&
+		  same_bits(stdio->colors, mesh->colors) &&
+		  same_bits(stdio->confidences, mesh->confidences) &&
+		  same_bits(stdio->faces, mesh->faces) &&
+		  same_bits(stdio->grid, mesh->grid);
+	printf("%.1f MB, %lu vertices, %lu faces\n", mb,
+		(unsigned long) mesh->vertices.size(),
+		(unsigned long) mesh->faces.size());
+	printf("%12s %12s %12s %12s %10s\n", "stdio", "MB/s", "mapped", "MB/s",
+		"identical");
+	printf("%10.4f s %12.1f %10.4f s %12.1f %10s\n", t_stdio,
+		mb / t_stdio, t_mapped, mb / t_mapped, ok ? "yes" : "NO");
+
+	delete stdio;
+	delete mesh;
+	return ok ? 0 : 1;
+}
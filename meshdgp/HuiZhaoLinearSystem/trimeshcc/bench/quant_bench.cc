@@ -0,0 +1,183 @@
+/*
+quant_bench.cc
+Compare the size and load time of a quantized (.tqm) file against binary
+PLY, and check that the decoded mesh is the input up to quantization:
+the same faces (up to rotation and reordering), positions within half a
+quantization step, normals within a small angle, and the same confidences.
+Meshes without confidences are given some.
+
+Usage: quant_bench [mesh file | grid size] [bits] [scratch prefix]
+*/
+
+#include "TriMesh.h"
+#include "timestamp.h"
+#include "bench_mesh.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+using namespace std;
+using namespace trimesh;
+
+
+static double file_mb(const string &filename)
+{
+	FILE *f = fopen(filename.c_str(), "rb");
+	if (!f)
+		return 0;
+	fseek(f, 0, SEEK_END);
+	double mb = ftell(f) / 1048576.0;
+	fclose(f);
+	return mb;
+}
+
+// Quantized coordinates of a point, packed for sorting
+static unsigned long long quant_key(const point &p, const box &b, int bits)
+{
+	unsigned long long key = 0;
+	for (int j = 0; j < 3; j++) {
+		double extent = (double) b.max[j] - b.min[j];
+		double scale = extent > 0.0 ? ((1 << bits) - 1) / extent : 0.0;
+		int q = int(((double) p[j] - b.min[j]) * scale + 0.5);
+		key = (key << 21) | (unsigned long long) q;
+	}
+	return key;
+}
+
+// Vertex numbers sorted by quantized position
+static vector< pair<unsigned long long, int> > by_key(const TriMesh *mesh,
+	const box &b, int bits)
+{
+	vector< pair<unsigned long long, int> > keys(mesh->vertices.size());
+	for (size_t i = 0; i < keys.size(); i++)
+		keys[i] = make_pair(quant_key(mesh->vertices[i], b, bits), (int) i);
+	sort(keys.begin(), keys.end());
+	return keys;
+}
+
+static TriMesh::Face canonical(int a, int b, int c)
+{
+	if (b < a && b < c)
+		return TriMesh::Face(b, c, a);
+	if (c < a && c < b)
+		return TriMesh::Face(c, a, b);
+	return TriMesh::Face(a, b, c);
+}
+
+static bool face_less(const TriMesh::Face &a, const TriMesh::Face &b)
+{
+	return memcmp(&a, &b, sizeof(a)) < 0;
+}
+
+int main(int argc, char *argv[])
+{
+	TriMesh::set_verbose(0);
+	int bits = (argc > 2) ? atoi(argv[2]) : 16;
+	string prefix = (argc > 3) ? argv[3] : "quant_bench";
+	string plyfile = prefix + ".ply", tqmfile = prefix + ".tqm";
+	char tqmspec[64];
+	sprintf(tqmspec, "q%d:", bits);
+
+	TriMesh *mesh = bench_mesh(argc, argv, 1000);
+	if (!mesh) {
+		fprintf(stderr, "Couldn't read input\n");
+		return 1;
+	}
+	mesh->need_faces();
+	mesh->tstrips.clear();
+	mesh->grid.clear();
+	mesh->need_normals();
+	mesh->need_bbox();
+	if (mesh->confidences.size() != mesh->vertices.size()) {
+		mesh->confidences.resize(mesh->vertices.size());
+		for (size_t i = 0; i < mesh->confidences.size(); i++)
+			mesh->confidences[i] = 0.5f + 0.5f * mesh->normals[i][2];
+	}
+
+	timestamp t = now();
+	bool ok = mesh->write(("norm:" + plyfile).c_str());
+	float t_write_ply = now() - t;
+	t = now();
+	ok = ok && mesh->write((tqmspec + tqmfile).c_str());
+	float t_write_tqm = now() - t;
+	if (!ok) {
+		fprintf(stderr, "Couldn't write files\n");
+		return 1;
+	}
+
+	t = now();
+	TriMesh *ply = TriMesh::read(plyfile);
+	float t_read_ply = now() - t;
+	t = now();
+	TriMesh *tqm = TriMesh::read(tqmfile);
+	float t_read_tqm = now() - t;
+	if (!ply || !tqm) {
+		fprintf(stderr, "Couldn't read files\n");
+		return 1;
+	}
+
+	// Match vertices by quantized position
+	size_t nv = mesh->vertices.size(), nf = mesh->faces.size();
+	ok = tqm->vertices.size() == nv && tqm->faces.size() == nf &&
+	     tqm->normals.size() == nv && tqm->confidences.size() == nv;
+	float max_err = 0.0f, max_angle = 0.0f;
+	bool unique = true, same_faces = false, same_conf = true;
+	if (ok) {
+		vector< pair<unsigned long long, int> > a = by_key(mesh, mesh->bbox, bits);
+		vector< pair<unsigned long long, int> > b = by_key(tqm, mesh->bbox, bits);
+		vector<int> to_mesh(nv);
+		for (size_t i = 0; ok && i < nv; i++) {
+			ok = (a[i].first == b[i].first);
+			if (i && a[i].first == a[i-1].first)
+				unique = false;
+			int u = a[i].second, v = b[i].second;
+			to_mesh[v] = u;
+			for (int j = 0; j < 3; j++) {
+				float extent = mesh->bbox.max[j] - mesh->bbox.min[j];
+				if (extent > 0.0f)
+					max_err = max(max_err, fabs(mesh->vertices[u][j] -
+						tqm->vertices[v][j]) / extent * ((1 << bits) - 1));
+			}
+			vec n = mesh->normals[u];
+			normalize(n);
+			float c = min(max(n DOT tqm->normals[v], -1.0f), 1.0f);
+			max_angle = max(max_angle, acos(c) * 180.0f / M_PIf);
+			if (tqm->confidences[v] != mesh->confidences[u])
+				same_conf = false;
+		}
+		if (ok && unique) {
+			vector<TriMesh::Face> fa(nf), fb(nf);
+			for (size_t i = 0; i < nf; i++) {
+				const TriMesh::Face &f = mesh->faces[i], &g = tqm->faces[i];
+				fa[i] = canonical(f[0], f[1], f[2]);
+				fb[i] = canonical(to_mesh[g[0]], to_mesh[g[1]], to_mesh[g[2]]);
+			}
+			sort(fa.begin(), fa.end(), face_less);
+			sort(fb.begin(), fb.end(), face_less);
+			same_faces = (nf == 0 || !memcmp(&fa[0], &fb[0], nf * sizeof(fa[0])));
+		}
+	}
+	ok = ok && (same_faces || !unique) && max_err <= 0.501f && max_angle < 0.1f;
+	ok = ok && (same_conf || !unique);
+
+	double mb_ply = file_mb(plyfile), mb_tqm = file_mb(tqmfile);
+	printf("%lu vertices, %lu faces, %d bits\n", (unsigned long) nv,
+		(unsigned long) nf, bits);
+	printf("%10s %10s %12s %12s\n", "", "MB", "write", "read");
+	printf("%10s %10.2f %10.4f s %10.4f s\n", "ply", mb_ply, t_write_ply,
+		t_read_ply);
+	printf("%10s %10.2f %10.4f s %10.4f s\n", "tqm", mb_tqm, t_write_tqm,
+		t_read_tqm);
+	printf("%.1fx smaller, max error %.3f steps, %.4f degrees, faces %s, "
+		"confidences %s\n", mb_ply / mb_tqm, max_err, max_angle,
+		!unique ? "not checked (duplicate positions)" :
+		same_faces ? "match" : "DIFFER",
+		!unique ? "not checked" : same_conf ? "match" : "DIFFER");
+
+	delete mesh;
+	delete ply;
+	delete tqm;
+	return ok ? 0 : 1;
+}
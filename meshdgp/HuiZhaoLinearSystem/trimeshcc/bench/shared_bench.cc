@@ -0,0 +1,169 @@
+/*
+shared_bench.cc
+Time merging the seams of a mesh cut into tiles with shared(), against the
+O(n^2) search shared() used to do, and check that both give the same mesh.
+Also times weld_vertices on the same input.
+
+Usage: shared_bench [grid size] [tile size] [legacy limit]
+
+The grid of n x n vertices is cut into tiles of t x t quads, each with its
+own copy of the vertices along its edges.  The old search is only run if
+there are at most "legacy limit" boundary vertices (default 50000).
+*/
+
+#include "TriMesh.h"
+#include "TriMesh_algo.h"
+#include "timestamp.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+using namespace std;
+using namespace trimesh;
+
+
+// The old shared(), kept here for comparison
+static void legacy_shared(TriMesh *mesh, float tol)
+{
+	int nv = mesh->vertices.size();
+	if (nv < 2 || mesh->faces.empty())
+		return;
+	mesh->tstrips.clear();
+	mesh->need_neighbors();
+	mesh->need_adjacentfaces();
+
+	vector<int> comps, compsizes;
+	find_comps(mesh, comps, compsizes, true);
+	vector<bool> bdy(nv);
+	for (int i = 0; i < nv; i++)
+		bdy[i] = mesh->is_bdy(i);
+
+	vector<int> remap(nv);
+	float tol2 = sqr(tol);
+	int next = 0;
+	for (int i = 0; i < nv; i++) {
+		remap[i] = next++;
+		if (!bdy[i] || mesh->adjacentfaces[i].empty())
+			continue;
+		for (int j = 0; j < i; j++) {
+			if (!bdy[j] || mesh->adjacentfaces[j].empty())
+				continue;
+			if (comps[mesh->adjacentfaces[i][0]] ==
+			    comps[mesh->adjacentfaces[j][0]])
+				continue;
+			if (dist2(mesh->vertices[i], mesh->vertices[j]) > tol2)
+				continue;
+			remap[i] = remap[j];
+			next--;
+			break;
+		}
+	}
+
+	mesh->adjacentfaces.clear();
+	mesh->neighbors.clear();
+	remap_verts(mesh, remap);
+	remove_unused_vertices(mesh);
+	orient(mesh);
+}
+
+// An n x n wavy grid cut into tiles of t x t quads
+static TriMesh *make_tiles(int n, int t)
+{
+	TriMesh *mesh = new TriMesh;
+	for (int ti = 0; ti < n - 1; ti += t) {
+		for (int tj = 0; tj < n - 1; tj += t) {
+			int ni = min(t, n - 1 - ti) + 1, nj = min(t, n - 1 - tj) + 1;
+			int first = mesh->vertices.size();
+			for (int i = 0; i < ni; i++) {
+				for (int j = 0; j < nj; j++) {
+					float x = (float) (ti + i) / n;
+					float y = (float) (tj + j) / n;
+					mesh->vertices.push_back(point(x, y,
+						0.05f * sin(20.0f * x) * cos(17.0f * y)));
+				}
+			}
+			for (int i = 0; i < ni - 1; i++) {
+				for (int j = 0; j < nj - 1; j++) {
+					int v = first + i * nj + j;
+					mesh->faces.push_back(TriMesh::Face(v, v + nj, v + 1));
+					mesh->faces.push_back(TriMesh::Face(v + 1, v + nj, v + nj + 1));
+				}
+			}
+		}
+	}
+	return mesh;
+}
+
+static bool same_mesh(const TriMesh *a, const TriMesh *b)
+{
+	return a->vertices.size() == b->vertices.size() &&
+	       a->faces.size() == b->faces.size() &&
+	       !memcmp(&a->vertices[0], &b->vertices[0],
+		       a->vertices.size() * sizeof(point)) &&
+	       !memcmp(&a->faces[0], &b->faces[0],
+		       a->faces.size() * sizeof(TriMesh::Face));
+}
+
+int main(int argc, char *argv[])
+{
+	TriMesh::set_verbose(0);
+	int n = (argc > 1) ? atoi(argv[1]) : 1000;
+	int t = (argc > 2) ? atoi(argv[2]) : 8;
+	int legacy_limit = (argc > 3) ? atoi(argv[3]) : 50000;
+	if (n < 2 || t < 1) {
+		fprintf(stderr, "Bad grid or tile size\n");
+		return 1;
+	}
+	float tol = 0.1f / n;
+
+	TriMesh *mesh = make_tiles(n, t);
+	mesh->need_neighbors();
+	mesh->need_adjacentfaces();
+	int nv = mesh->vertices.size(), nbdy = 0;
+	for (int i = 0; i < nv; i++) {
+		if (mesh->is_bdy(i))
+			nbdy++;
+	}
+	mesh->neighbors.clear();
+	mesh->adjacentfaces.clear();
+	TriMesh *legacy = new TriMesh(*mesh), *welded = new TriMesh(*mesh);
+
+	timestamp t0 = now();
+	shared(mesh, tol);
+	float t_shared = now() - t0;
+
+	t0 = now();
+	weld_vertices(welded, tol);
+	float t_weld = now() - t0;
+
+	// Every seam vertex should be merged, as if the grid had been one piece
+	bool ok = (mesh->vertices.size() == (size_t) n * n) &&
+		  (welded->vertices.size() == (size_t) n * n) &&
+		  (welded->faces.size() == mesh->faces.size());
+
+	float t_legacy = 0.0f;
+	bool run_legacy = (nbdy <= legacy_limit);
+	bool same = true;
+	if (run_legacy) {
+		t0 = now();
+		legacy_shared(legacy, tol);
+		t_legacy = now() - t0;
+		same = same_mesh(legacy, mesh);
+	}
+
+	printf("%d vertices, %d on boundaries, %lu after merging\n", nv, nbdy,
+		(unsigned long) mesh->vertices.size());
+	printf("%16s %12s %10s\n", "", "time", "identical");
+	if (run_legacy)
+		printf("%16s %10.4f s\n", "legacy shared", t_legacy);
+	else
+		printf("%16s %12s\n", "legacy shared", "skipped");
+	printf("%16s %10.4f s %10s\n", "shared", t_shared,
+		!run_legacy ? "-" : same ? "yes" : "NO");
+	printf("%16s %10.4f s\n", "weld_vertices", t_weld);
+
+	delete mesh;
+	delete legacy;
+	delete welded;
+	return (ok && same) ? 0 : 1;
+}
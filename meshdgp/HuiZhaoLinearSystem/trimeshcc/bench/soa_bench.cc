@@ -0,0 +1,140 @@
+/*
+soa_bench.cc
+Throughput of the SoA/SIMD per-face kernels against the scalar
+array-of-structures loops they replaced, plus need_curvatures end to end,
+and check that both kernels give the same corner curvatures up to float
+rounding.
+
+Usage: soa_bench [mesh file | grid size]
+*/
+
+#include "TriMesh.h"
+#include "TriMesh_soa.h"
+#include "lineqn.h"
+#include "timestamp.h"
+#include "bench_mesh.h"
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+using namespace std;
+using namespace trimesh;
+
+namespace trimesh {
+void proj_curv(const vec &old_u, const vec &old_v,
+	       float old_ku, float old_kuv, float old_kv,
+	       const vec &new_u, const vec &new_v,
+	       float &new_ku, float &new_kuv, float &new_kv);
+};
+
+
+// The scalar per-face curvature loop of need_curvatures before the SoA kernels
+static void scalar_corner_curvatures(const TriMesh *mesh, vector<vec> &cornercurv)
+{
+	const vector<point> &vertices = mesh->vertices;
+	const vector<TriMesh::Face> &faces = mesh->faces;
+	int nf = faces.size();
+	cornercurv.assign(3 * nf, vec());
+#pragma omp parallel for
+	for (int i = 0; i < nf; i++) {
+		vec e[3] = { vertices[faces[i][2]] - vertices[faces[i][1]],
+			     vertices[faces[i][0]] - vertices[faces[i][2]],
+			     vertices[faces[i][1]] - vertices[faces[i][0]] };
+		vec t = e[0];
+		normalize(t);
+		vec n = e[0] CROSS e[1];
+		vec b = n CROSS t;
+		normalize(b);
+		float m[3] = { 0, 0, 0 };
+		float w[3][3] = { {0,0,0}, {0,0,0}, {0,0,0} };
+		for (int j = 0; j < 3; j++) {
+			float u = e[j] DOT t;
+			float v = e[j] DOT b;
+			w[0][0] += u*u;
+			w[0][1] += u*v;
+			w[2][2] += v*v;
+			vec dn = mesh->normals[faces[i][(j+2)%3]] -
+				 mesh->normals[faces[i][(j+1)%3]];
+			float dnu = dn DOT t;
+			float dnv = dn DOT b;
+			m[0] += dnu*u;
+			m[1] += dnu*v + dnv*u;
+			m[2] += dnv*v;
+		}
+		w[1][1] = w[0][0] + w[2][2];
+		w[1][2] = w[0][1];
+		float diag[3];
+		if (!ldltdc<float,3>(w, diag))
+			continue;
+		ldltsl<float,3>(w, diag, m, m);
+		for (int j = 0; j < 3; j++) {
+			int vj = faces[i][j];
+			float c1, c12, c2;
+			proj_curv(t, b, m[0], m[1], m[2],
+				  mesh->pdir1[vj], mesh->pdir2[vj], c1, c12, c2);
+			float wt = mesh->cornerareas[i][j] / mesh->pointareas[vj];
+			cornercurv[3*i+j] = vec(wt * c1, wt * c12, wt * c2);
+		}
+	}
+}
+
+// Largest difference between two corner curvature arrays, relative to the
+// largest value in the first
+static float max_rel_diff(const vector<vec> &a, const vector<vec> &b)
+{
+	float scale = 0.0f, diff = 0.0f;
+	for (size_t i = 0; i < a.size(); i++) {
+		for (int j = 0; j < 3; j++) {
+			scale = max(scale, fabs(a[i][j]));
+			diff = max(diff, fabs(a[i][j] - b[i][j]));
+		}
+	}
+	return scale ? diff / scale : diff;
+}
+
+int main(int argc, char *argv[])
+{
+	TriMesh *mesh = bench_mesh(argc, argv, 1600);
+	if (!mesh) {
+		fprintf(stderr, "Couldn't read input\n");
+		return 1;
+	}
+	TriMesh::set_verbose(0);
+	mesh->need_faces();
+	int nf = mesh->faces.size();
+	printf("%lu vertices, %d faces, %d faces per SIMD step\n",
+		(unsigned long) mesh->vertices.size(), nf, soa_width());
+
+	timestamp t = now();
+	mesh->need_curvatures();
+	float t_curv = now() - t;
+
+	// Per-face curvature kernel alone.  pdir1/pdir2 are the final
+	// principal directions here rather than the initial frames, which
+	// does not change the amount of work.
+	const int reps = 3;
+	vector<vec> ref, out;
+	t = now();
+	for (int r = 0; r < reps; r++)
+		scalar_corner_curvatures(mesh, ref);
+	float t_scalar = (now() - t) / reps;
+
+	t = now();
+	for (int r = 0; r < reps; r++) {
+		TriMeshSoA soa(mesh);
+		soa_corner_curvatures(soa, mesh->normals, mesh->pdir1,
+			mesh->pdir2, mesh->cornerareas, mesh->pointareas, out);
+	}
+	float t_soa = (now() - t) / reps;
+	float err = (out.size() == ref.size()) ? max_rel_diff(ref, out) : 1.0f;
+	bool ok = (err < 1.0e-4f);
+
+	printf("need_curvatures            %8.3f s\n", t_curv);
+	printf("curvature kernel, scalar   %8.3f s  %7.1f Mfaces/s\n",
+		t_scalar, nf / t_scalar * 1e-6f);
+	printf("curvature kernel, SoA      %8.3f s  %7.1f Mfaces/s  %.2fx\n",
+		t_soa, nf / t_soa * 1e-6f, t_scalar / t_soa);
+	printf("largest difference         %8.2g  %s\n", err, ok ? "ok" : "MISMATCH");
+
+	delete mesh;
+	return ok ? 0 : 1;
+}
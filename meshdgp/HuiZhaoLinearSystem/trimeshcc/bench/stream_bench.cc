@@ -0,0 +1,158 @@
+/*
+stream_bench.cc
+Time computing normals out of core, through SpatialChunks and
+stream_normals, against reading the whole mesh and calling need_normals,
+and check that every vertex gets a bit-identical normal and that no
+piece is larger than asked for.
+
+Usage: stream_bench [mesh file | grid size] [piece size] [scratch prefix]
+
+The input is written out as a binary PLY (scratch prefix + "_in.ply")
+first, and the streamed result goes to scratch prefix + "_out.ply".
+Vertices are matched by position, so they should be distinct.
+*/
+
+#include "TriMesh.h"
+#include "MeshStream.h"
+#include "timestamp.h"
+#include "bench_mesh.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <algorithm>
+using namespace std;
+using namespace trimesh;
+
+
+// Vertex numbers sorted by position
+struct PositionLess {
+	const vector<point> &v;
+	PositionLess(const vector<point> &v_) : v(v_) {}
+	bool operator () (int a, int b) const
+	{
+		return memcmp(&v[a], &v[b], sizeof(point)) < 0;
+	}
+};
+
+static vector<int> by_position(const vector<point> &v)
+{
+	vector<int> order(v.size());
+	for (size_t i = 0; i < v.size(); i++)
+		order[i] = i;
+	sort(order.begin(), order.end(), PositionLess(v));
+	return order;
+}
+
+static bool face_less(const TriMesh::Face &a, const TriMesh::Face &b)
+{
+	return memcmp(&a, &b, sizeof(a)) < 0;
+}
+
+// The face, rotated to start with its smallest index
+static TriMesh::Face canonical(int a, int b, int c)
+{
+	if (b < a && b < c)
+		return TriMesh::Face(b, c, a);
+	if (c < a && c < b)
+		return TriMesh::Face(c, a, b);
+	return TriMesh::Face(a, b, c);
+}
+
+int main(int argc, char *argv[])
+{
+	TriMesh::set_verbose(0);
+	size_t piece_size = (argc > 2) ? atol(argv[2]) : 100000;
+	string prefix = (argc > 3) ? argv[3] : "stream_bench";
+	string infile = prefix + "_in.ply", outfile = prefix + "_out.ply";
+
+	TriMesh *mesh = bench_mesh(argc, argv, 1000);
+	if (!mesh) {
+		fprintf(stderr, "Couldn't read input\n");
+		return 1;
+	}
+	mesh->normals.clear();
+	mesh->need_faces();
+	if (!mesh->write(infile.c_str())) {
+		fprintf(stderr, "Couldn't write %s\n", infile.c_str());
+		return 1;
+	}
+	delete mesh;
+
+	timestamp t = now();
+	TriMesh *incore = TriMesh::read(infile.c_str());
+	if (!incore) {
+		fprintf(stderr, "Couldn't read %s\n", infile.c_str());
+		return 1;
+	}
+	incore->need_normals();
+	float t_incore = now() - t;
+
+	t = now();
+	MeshReader in;
+	SpatialChunks chunks;
+	if (!in.open(infile.c_str()) || !chunks.build(&in, piece_size)) {
+		fprintf(stderr, "Couldn't sort %s\n", infile.c_str());
+		return 1;
+	}
+	in.close();
+	float t_build = now() - t;
+	size_t largest = 0;
+	for (int k = 0; k < chunks.size(); k++)
+		largest = max(largest, chunks.first(k+1) - chunks.first(k));
+
+	t = now();
+	MeshWriter out;
+	if (!out.open(outfile.c_str(), true) ||
+	    !stream_normals(&chunks, &out) || !out.close()) {
+		fprintf(stderr, "Couldn't write %s\n", outfile.c_str());
+		return 1;
+	}
+	float t_normals = now() - t;
+
+	TriMesh *streamed = TriMesh::read(outfile.c_str());
+	if (!streamed) {
+		fprintf(stderr, "Couldn't read %s\n", outfile.c_str());
+		return 1;
+	}
+
+	// Match vertices by position, then compare normals and faces
+	size_t nv = incore->vertices.size(), nf = incore->faces.size();
+	bool ok = (streamed->vertices.size() == nv) &&
+		  (streamed->normals.size() == nv) &&
+		  (streamed->faces.size() == nf);
+	if (ok) {
+		vector<int> a = by_position(incore->vertices);
+		vector<int> b = by_position(streamed->vertices);
+		vector<int> to_incore(nv);
+		for (size_t i = 0; ok && i < nv; i++) {
+			ok = !memcmp(&incore->vertices[a[i]],
+				     &streamed->vertices[b[i]], sizeof(point)) &&
+			     !memcmp(&incore->normals[a[i]],
+				     &streamed->normals[b[i]], sizeof(vec));
+			to_incore[b[i]] = a[i];
+		}
+		vector<TriMesh::Face> fa(nf), fb(nf);
+		for (size_t i = 0; ok && i < nf; i++) {
+			const TriMesh::Face &f = incore->faces[i], &g = streamed->faces[i];
+			fa[i] = canonical(f[0], f[1], f[2]);
+			fb[i] = canonical(to_incore[g[0]], to_incore[g[1]],
+					  to_incore[g[2]]);
+		}
+		sort(fa.begin(), fa.end(), face_less);
+		sort(fb.begin(), fb.end(), face_less);
+		ok = ok && (nf == 0 || !memcmp(&fa[0], &fb[0], nf * sizeof(fa[0])));
+	}
+	ok = ok && largest <= max(piece_size, (size_t) 1);
+
+	printf("%lu vertices, %lu faces, %d pieces of at most %lu\n",
+		(unsigned long) nv, (unsigned long) nf, chunks.size(),
+		(unsigned long) largest);
+	printf("%12s %12s %12s %10s\n", "in core", "sort", "normals", "identical");
+	printf("%10.4f s %10.4f s %10.4f s %10s\n", t_incore, t_build,
+		t_normals, ok ? "yes" : "NO");
+
+	delete incore;
+	delete streamed;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,100 @@
+/*
+update_bench.cc
+Moves a small patch of vertices and compares update_dirty() with
+recomputing normals, point areas, curvatures and dcurv from scratch,
+checking that both give bit-identical results.
+
+Usage: update_bench [mesh file | grid size] [patch size] [edits]
+*/
+
+#include "TriMesh.h"
+#include "timestamp.h"
+#include "bench_mesh.h"
+#include <cstdio>
+#include <cstring>
+using namespace std;
+using namespace trimesh;
+
+
+template <class T>
+static bool same_bits(const vector<T> &a, const vector<T> &b)
+{
+	return a.size() == b.size() &&
+	       (a.empty() || !memcmp(&a[0], &b[0], a.size() * sizeof(T)));
+}
+
+static void need_all(TriMesh *mesh)
+{
+	mesh->need_normals();
+	mesh->need_pointareas();
+	mesh->need_curvatures();
+	mesh->need_dcurv();
+}
+
+static void clear_all(TriMesh *mesh)
+{
+	mesh->normals.clear();
+	mesh->pointareas.clear();
+	mesh->cornerareas.clear();
+	mesh->curv1.clear();
+	mesh->dcurv.clear();
+}
+
+int main(int argc, char *argv[])
+{
+	TriMesh *mesh = bench_mesh(argc, argv, 1000);
+	if (!mesh) {
+		fprintf(stderr, "Couldn't read input\n");
+		return 1;
+	}
+	int patch = (argc > 2) ? atoi(argv[2]) : 100;
+	int edits = (argc > 3) ? atoi(argv[3]) : 20;
+	TriMesh::set_verbose(0);
+	mesh->need_faces();
+	mesh->need_adjacentfaces();
+	int nv = mesh->vertices.size();
+	printf("%d vertices, %lu faces, %d edits of %d vertices\n", nv,
+		(unsigned long) mesh->faces.size(), edits, patch);
+	if (patch > nv)
+		patch = nv;
+	need_all(mesh);
+
+	float t_update = 0.0f, t_full = 0.0f;
+	bool ok = true;
+	srand(1);
+	for (int e = 0; e < edits; e++) {
+		// Push a run of consecutive vertices along their normals
+		int first = rand() % (nv - patch + 1);
+		for (int i = first; i < first + patch; i++) {
+			mesh->vertices[i] += 0.001f * mesh->normals[i];
+			mesh->mark_dirty(i);
+		}
+
+		timestamp t = now();
+		mesh->update_dirty();
+		t_update += now() - t;
+		vector<vec> normals = mesh->normals, pdir1 = mesh->pdir1;
+		vector<float> areas = mesh->pointareas, curv1 = mesh->curv1,
+			curv2 = mesh->curv2;
+		vector< Vec<4,float> > dcurv = mesh->dcurv;
+
+		clear_all(mesh);
+		t = now();
+		need_all(mesh);
+		t_full += now() - t;
+
+		ok = ok && same_bits(normals, mesh->normals) &&
+		     same_bits(areas, mesh->pointareas) &&
+		     same_bits(pdir1, mesh->pdir1) &&
+		     same_bits(curv1, mesh->curv1) &&
+		     same_bits(curv2, mesh->curv2) &&
+		     same_bits(dcurv, mesh->dcurv);
+	}
+
+	printf("%12s %12s %10s\n", "update", "full", "identical");
+	printf("%10.4f s %10.4f s %10s\n", t_update / edits, t_full / edits,
+		ok ? "yes" : "NO");
+
+	delete mesh;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,112 @@
+/*
+write_bench.cc
+Time writing an OBJ file with one fprintf per vertex and face, as the
+writers used to, against TriMesh::write, and check that both give the same
+bytes.  Also times ASCII and binary PLY.
+
+Usage: write_bench [mesh file | grid size] [scratch prefix]
+*/
+
+#include "TriMesh.h"
+#include "timestamp.h"
+#include "bench_mesh.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+using namespace std;
+using namespace trimesh;
+
+
+// The old writer, kept here for comparison
+static bool legacy_write_obj(const TriMesh *mesh, const char *filename)
+{
+	FILE *f = fopen(filename, "wb");
+	if (!f)
+		return false;
+	bool ok = fprintf(f, "# OBJ\n") > 0;
+	for (size_t i = 0; ok && i < mesh->vertices.size(); i++)
+		ok = fprintf(f, "v %.7g %.7g %.7g\n", mesh->vertices[i][0],
+			mesh->vertices[i][1], mesh->vertices[i][2]) > 0;
+	for (size_t i = 0; ok && i < mesh->faces.size(); i++)
+		ok = fprintf(f, "f %d %d %d\n", mesh->faces[i][0] + 1,
+			mesh->faces[i][1] + 1, mesh->faces[i][2] + 1) > 0;
+	return !fclose(f) && ok;
+}
+
+static bool read_file(const string &filename, vector<char> &contents)
+{
+	FILE *f = fopen(filename.c_str(), "rb");
+	if (!f)
+		return false;
+	fseek(f, 0, SEEK_END);
+	contents.resize(ftell(f));
+	rewind(f);
+	bool ok = contents.empty() ||
+		  fread(&contents[0], contents.size(), 1, f) == 1;
+	fclose(f);
+	return ok;
+}
+
+static double file_mb(const string &filename)
+{
+	vector<char> contents;
+	read_file(filename, contents);
+	return contents.size() / 1048576.0;
+}
+
+int main(int argc, char *argv[])
+{
+	TriMesh::set_verbose(0);
+	string prefix = (argc > 2) ? argv[2] : "write_bench";
+	string legacy_obj = prefix + "_legacy.obj", obj = prefix + ".obj";
+	string ply_asc = "ply_ascii:" + prefix + "_asc.ply";
+	string ply_bin = "ply_binary:" + prefix + "_bin.ply";
+
+	TriMesh *mesh = bench_mesh(argc, argv, 1000);
+	if (!mesh) {
+		fprintf(stderr, "Couldn't read input\n");
+		return 1;
+	}
+	mesh->need_faces();
+	mesh->tstrips.clear();
+	mesh->grid.clear();
+
+	timestamp t = now();
+	bool ok = legacy_write_obj(mesh, legacy_obj.c_str());
+	float t_legacy = now() - t;
+
+	t = now();
+	ok = ok && mesh->write(obj.c_str());
+	float t_obj = now() - t;
+
+	t = now();
+	ok = ok && mesh->write(ply_asc.c_str());
+	float t_asc = now() - t;
+
+	t = now();
+	ok = ok && mesh->write(ply_bin.c_str());
+	float t_bin = now() - t;
+	if (!ok) {
+		fprintf(stderr, "Couldn't write files\n");
+		return 1;
+	}
+
+	vector<char> a, b;
+	bool same = read_file(legacy_obj, a) && read_file(obj, b) && a == b;
+	double mb = a.size() / 1048576.0;
+	double mb_asc = file_mb(prefix + "_asc.ply");
+	double mb_bin = file_mb(prefix + "_bin.ply");
+
+	printf("%lu vertices, %lu faces\n", (unsigned long) mesh->vertices.size(),
+		(unsigned long) mesh->faces.size());
+	printf("%16s %12s %12s %10s\n", "", "time", "MB/s", "identical");
+	printf("%16s %10.4f s %12.1f\n", "legacy obj", t_legacy, mb / t_legacy);
+	printf("%16s %10.4f s %12.1f %10s\n", "obj", t_obj, mb / t_obj,
+		same ? "yes" : "NO");
+	printf("%16s %10.4f s %12.1f\n", "ascii ply", t_asc, mb_asc / t_asc);
+	printf("%16s %10.4f s %12.1f\n", "binary ply", t_bin, mb_bin / t_bin);
+
+	delete mesh;
+	return same ? 0 : 1;
+}
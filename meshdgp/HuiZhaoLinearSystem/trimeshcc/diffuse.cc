@@ -90,7 +90,8 @@ static void diffuse_vert_field(TriMesh *themesh,
 
 	flag_curr++;
 	flags[v] = flag_curr;
-	vector<int> boundary = themesh->neighbors[v];
+	IndexSpan ring = themesh->neighbors[v];
+	vector<int> boundary(ring.begin(), ring.end());
 	while (!boundary.empty()) {
 		int n = boundary.back();
 		boundary.pop_back();
@@ -184,6 +185,7 @@ void smooth_mesh(TriMesh *themesh, float sigma)
 	} // #pragma omp parallel
 
 	dprintf("Done.  Filtering took %f sec.\n", now() - t);
+	themesh->soa.clear();
 }
 
 
@@ -203,7 +205,8 @@ static void jones_filter(TriMesh *themesh,
 	float sum_w = 0.0f;
 
 	flag_curr++;
-	vector<int> boundary = themesh->adjacentfaces[v];
+	IndexSpan ring = themesh->adjacentfaces[v];
+	vector<int> boundary(ring.begin(), ring.end());
 	while (!boundary.empty()) {
 		int f = boundary.back();
 		boundary.pop_back();
@@ -289,6 +292,7 @@ void bilateral_smooth_mesh(TriMesh *themesh, float sigma1, float sigma2)
 	}
 
 	dprintf("Done.  Filtering took %f sec.\n", now() - t);
+	themesh->soa.clear();
 }
 
 
@@ -19,6 +19,9 @@ void faceflip(TriMesh *mesh)
 	bool had_tstrips = !mesh->tstrips.empty();
 	mesh->need_faces();
 	mesh->tstrips.clear();
+	mesh->opposite_corner.clear();
+	mesh->vertex_corner.clear();
+	mesh->soa.clear();
 
 	dprintf("Flipping faces... ");
 	int nf = mesh->faces.size();
@@ -44,6 +44,7 @@ void inflate(TriMesh *mesh, float amount)
 	dprintf("Done.\n");
 	mesh->bbox.valid = false;
 	mesh->bsphere.valid = false;
+	mesh->soa.clear();
 }
 
 
@@ -55,6 +56,7 @@ void apply_xform(TriMesh *mesh, const xform &xf)
 #pragma omp parallel for
 	for (int i = 0; i < nv; i++)
 		mesh->vertices[i] = xf * mesh->vertices[i];
+	mesh->soa.clear();
 
 	if (!mesh->normals.empty()) {
 		xform nxf = norm_xf(xf);
@@ -386,6 +388,7 @@ void orient(TriMesh *mesh)
 {
 	mesh->need_faces();
 	mesh->tstrips.clear();
+	mesh->soa.clear();
 	mesh->need_adjacentfaces();
 
 	mesh->flags.clear();
@@ -411,7 +414,7 @@ void orient(TriMesh *mesh)
 			for (int j = 0; j < 3; j++) {
 				int v0 = mesh->faces[f][j];
 				int v1 = mesh->faces[f][(j+1)%3];
-				const vector<int> &a = mesh->adjacentfaces[v0];
+				IndexSpan a = mesh->adjacentfaces[v0];
 				for (size_t k = 0; k < a.size(); k++) {
 					int f1 = a[k];
 					if (mesh->flags[f1] != NONE)
@@ -447,7 +450,7 @@ void orient(TriMesh *mesh)
 		else
 			if (v2[0] > v0[0]) j = 2;
 		int v = mesh->faces[f][j];
-		const vector<int> &a = mesh->adjacentfaces[v];
+		IndexSpan a = mesh->adjacentfaces[v];
 		vec n;
 		for (size_t k = 0; k < a.size(); k++) {
 			int f1 = a[k];
@@ -504,6 +507,7 @@ void noisify(TriMesh *mesh, float amount)
 	}
 	for (int i = 0; i < nv; i++)
 		mesh->vertices[i] += disp[i];
+	mesh->soa.clear();
 }
 
 }; // namespace trimesh
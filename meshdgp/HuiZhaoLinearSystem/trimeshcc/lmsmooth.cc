@@ -68,6 +68,7 @@ void umbrella(TriMesh *mesh, float stepsize, bool tangent /* = false */)
 
 	mesh->bbox.valid = false;
 	mesh->bsphere.valid = false;
+	mesh->soa.clear();
 }
 
 
@@ -85,6 +86,7 @@ void lmsmooth(TriMesh *mesh, int niters)
 
 	mesh->bbox.valid = false;
 	mesh->bsphere.valid = false;
+	mesh->soa.clear();
 }
 
 }; // namespace trimesh
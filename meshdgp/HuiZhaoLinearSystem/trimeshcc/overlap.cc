@@ -8,9 +8,21 @@ Compute overlap area and mesh-to-mesh distance for two meshes
 
 #include "TriMesh.h"
 #include "TriMesh_algo.h"
+#include "KDtree.h"
+#include <cfloat>
+#include <cmath>
+#include <algorithm>
 using namespace std;
 
 
+// Vertices sampled by default, and the block size for summing over them
+#define OVERLAP_SAMPLES 10000
+#define OVERLAP_BLOCK 1024
+
+// Most faces in a BVH leaf
+#define BVH_LEAF 4
+
+
 namespace trimesh {
 
 // Quick 'n dirty portable random number generator 
@@ -22,57 +34,349 @@ static inline float tinyrnd()
 }
 
 
+// Orders faces by one coordinate of their centroids
+struct CentroidLess {
+	const vector<point> &centroids;
+	int axis;
+	CentroidLess(const vector<point> &centroids_, int axis_) :
+		centroids(centroids_), axis(axis_)
+		{}
+	bool operator () (int i, int j) const
+		{ return centroids[i][axis] < centroids[j][axis]; }
+};
+
+
+// A bounding volume hierarchy over the faces of a mesh, for finding the
+// closest point on the surface.  Nodes are stored depth-first, as in the
+// KDtree: the first child of an interior node follows it, and child2 gives
+// the second.  A leaf has at most BVH_LEAF faces, consecutive in order.
+class FaceBVH {
+private:
+	struct Node {
+		float lo[3], hi[3]; // Bounding box of the faces below
+		int child2;         // 0 for a leaf
+		int start, n;       // Faces below, in order
+	};
+	const TriMesh *mesh;
+	vector<Node> nodes;
+	vector<int> order;
+	vector<point> centroids;
+	void build_node(int start, int n);
+
+public:
+	FaceBVH(const TriMesh *mesh_);
+	int closest(const point &p, float &d2, point &q, vec &bary) const;
+};
+
+
+// Build the subtree for faces order[start] through order[start+n-1],
+// splitting at the median centroid along the longest axis.  Boxes are
+// made from the children's boxes on the way back up.
+void FaceBVH::build_node(int start, int n)
+{
+	int ind = nodes.size();
+	nodes.push_back(Node());
+	nodes[ind].start = start;
+	nodes[ind].n = n;
+	nodes[ind].child2 = 0;
+	float *lo = nodes[ind].lo, *hi = nodes[ind].hi;
+	if (n <= BVH_LEAF) {
+		lo[0] = lo[1] = lo[2] = FLT_MAX;
+		hi[0] = hi[1] = hi[2] = -FLT_MAX;
+		for (int i = start; i < start + n; i++) {
+			const TriMesh::Face &f = mesh->faces[order[i]];
+			for (int k = 0; k < 3; k++) {
+				const point &v = mesh->vertices[f[k]];
+				for (int j = 0; j < 3; j++) {
+					lo[j] = min(lo[j], v[j]);
+					hi[j] = max(hi[j], v[j]);
+				}
+			}
+		}
+		return;
+	}
+
+	float clo[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float chi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for (int i = start; i < start + n; i++) {
+		const point &c = centroids[order[i]];
+		for (int j = 0; j < 3; j++) {
+			clo[j] = min(clo[j], c[j]);
+			chi[j] = max(chi[j], c[j]);
+		}
+	}
+	int axis = 0;
+	for (int j = 1; j < 3; j++) {
+		if (chi[j] - clo[j] > chi[axis] - clo[axis])
+			axis = j;
+	}
+	int half = n / 2;
+	vector<int>::iterator first = order.begin() + start;
+	nth_element(first, first + half, first + n,
+		    CentroidLess(centroids, axis));
+	build_node(start, half);
+	int child2 = nodes.size();
+	build_node(start + half, n - half);
+
+	// nodes may have moved while building the children
+	Node &node = nodes[ind];
+	const Node &c1 = nodes[ind + 1], &c2 = nodes[child2];
+	node.child2 = child2;
+	for (int j = 0; j < 3; j++) {
+		node.lo[j] = min(c1.lo[j], c2.lo[j]);
+		node.hi[j] = max(c1.hi[j], c2.hi[j]);
+	}
+}
+
+
+FaceBVH::FaceBVH(const TriMesh *mesh_) : mesh(mesh_)
+{
+	int nf = mesh->faces.size();
+	order.resize(nf);
+	centroids.resize(nf);
+#pragma omp parallel for
+	for (int i = 0; i < nf; i++) {
+		const TriMesh::Face &f = mesh->faces[i];
+		order[i] = i;
+		centroids[i] = (mesh->vertices[f[0]] + mesh->vertices[f[1]] +
+				mesh->vertices[f[2]]) / 3.0f;
+	}
+	nodes.reserve(nf);
+	if (nf)
+		build_node(0, nf);
+}
+
+
+// Squared distance from p to a box
+static inline float box_dist2(const point &p, const float *lo, const float *hi)
+{
+	float d2 = 0.0f;
+	for (int j = 0; j < 3; j++) {
+		if (p[j] < lo[j])
+			d2 += sqr(lo[j] - p[j]);
+		else if (p[j] > hi[j])
+			d2 += sqr(p[j] - hi[j]);
+	}
+	return d2;
+}
+
+
+// Closest point q to p on triangle abc, with its barycentric coordinates.
+// From Ericson, "Real-Time Collision Detection": the coordinates of the
+// vertices and edges that q is not on come out exactly 0.
+static point closest_on_tri(const point &p, const point &a, const point &b,
+			    const point &c, vec &bary)
+{
+	vec ab = b - a, ac = c - a, ap = p - a;
+	float d1 = ab DOT ap, d2 = ac DOT ap;
+	if (d1 <= 0.0f && d2 <= 0.0f) {
+		bary = vec(1, 0, 0);
+		return a;
+	}
+	vec bp = p - b;
+	float d3 = ab DOT bp, d4 = ac DOT bp;
+	if (d3 >= 0.0f && d4 <= d3) {
+		bary = vec(0, 1, 0);
+		return b;
+	}
+	float vc = d1 * d4 - d3 * d2;
+	if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) {
+		float v = d1 / (d1 - d3);
+		bary = vec(1.0f - v, v, 0);
+		return a + v * ab;
+	}
+	vec cp = p - c;
+	float d5 = ab DOT cp, d6 = ac DOT cp;
+	if (d6 >= 0.0f && d5 <= d6) {
+		bary = vec(0, 0, 1);
+		return c;
+	}
+	float vb = d5 * d2 - d1 * d6;
+	if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) {
+		float w = d2 / (d2 - d6);
+		bary = vec(1.0f - w, 0, w);
+		return a + w * ac;
+	}
+	float va = d3 * d6 - d5 * d4;
+	if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) {
+		float w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+		bary = vec(0, 1.0f - w, w);
+		return b + w * (c - b);
+	}
+	float denom = 1.0f / (va + vb + vc);
+	float v = vb * denom, w = vc * denom;
+	bary = vec(1.0f - v - w, v, w);
+	return a + v * ab + w * ac;
+}
+
+
+// Closest point q on the mesh to p, if it is closer than sqrt(d2), which is
+// updated.  Returns the face, or -1 if there is none that close.
+int FaceBVH::closest(const point &p, float &d2, point &q, vec &bary) const
+{
+	int best = -1;
+	if (nodes.empty())
+		return best;
+	int stack[64], nstack = 0;
+	stack[nstack++] = 0;
+	while (nstack) {
+		const Node &node = nodes[stack[--nstack]];
+		if (box_dist2(p, node.lo, node.hi) >= d2)
+			continue;
+		if (!node.child2) {
+			for (int i = node.start; i < node.start + node.n; i++) {
+				const TriMesh::Face &f = mesh->faces[order[i]];
+				vec b;
+				point c = closest_on_tri(p,
+					mesh->vertices[f[0]],
+					mesh->vertices[f[1]],
+					mesh->vertices[f[2]], b);
+				float this_d2 = dist2(p, c);
+				if (this_d2 < d2) {
+					d2 = this_d2;
+					q = c;
+					bary = b;
+					best = order[i];
+				}
+			}
+			continue;
+		}
+		// Visit the nearer child first, so it is pushed last
+		int c1 = &node - &nodes[0] + 1, c2 = node.child2;
+		float d21 = box_dist2(p, nodes[c1].lo, nodes[c1].hi);
+		float d22 = box_dist2(p, nodes[c2].lo, nodes[c2].hi);
+		if (d21 < d22)
+			swap(c1, c2);
+		stack[nstack++] = c1;
+		stack[nstack++] = c2;
+	}
+	return best;
+}
+
+
+// Is the closest point on face f, with barycentric coordinates bary, on the
+// boundary of the mesh?
+static bool on_bdy(TriMesh *mesh, int f, const vec &bary)
+{
+	int nzero = (bary[0] == 0.0f) + (bary[1] == 0.0f) + (bary[2] == 0.0f);
+	if (nzero == 2) {
+		int j = (bary[0] != 0.0f) ? 0 : (bary[1] != 0.0f) ? 1 : 2;
+		return mesh->is_bdy(mesh->faces[f][j]);
+	}
+	for (int j = 0; j < 3; j++) {
+		if (bary[j] == 0.0f && mesh->across_edge[f][j] < 0)
+			return true;
+	}
+	return false;
+}
+
+
 // Find the overlap area and RMS distance from mesh1 to mesh2.  Used by
-// find_overlap in both directions, below
+// find_overlap in both directions, below.  The samples are matched in
+// parallel, and their contributions are summed over fixed blocks and then
+// over the blocks in order, so the result does not depend on the number of
+// threads.  With a BVH, distances are to the closest point on the faces of
+// mesh2; otherwise to the tangent plane at its closest vertex.
 static void find_overlap_onedir(TriMesh *mesh1, TriMesh *mesh2,
 				const xform &xf1, const xform &xf2,
-				const KDtree *kd2, float &area, float &rmsdist)
+				const KDtree *kd2, const FaceBVH *bvh2,
+				int nsamp, float &area, float &rmsdist)
 {
 	area = 0.0f;
 	rmsdist = 0.0f;
-	float area_considered = 0.0f;
 
 	xform xf12 = inv(xf2) * xf1;
 	xform xf12r = norm_xf(xf12);
 	int nv = mesh1->vertices.size();
-	int nsamp = min(nv, 10000);
+	if (nsamp <= 0 || nsamp > nv)
+		nsamp = nv;
+	if (!nsamp || mesh2->vertices.empty())
+		return;
 
+	vector<int> inds(nsamp);
+	vector<point> pts(nsamp);
+#pragma omp parallel for
 	for (int i = 0; i < nsamp; i++) {
-		int ind = int((float) i / nsamp * nv);
+		int ind = (nsamp == nv) ? i : int((float) i / nsamp * nv);
 		ind = clamp(ind, 0, nv-1);
-		float this_area = mesh1->pointareas[ind];
-		area_considered += this_area;
-		point p = xf12 * mesh1->vertices[ind];
-		const float *q = kd2->closest_to_pt(p);
-		if (!q)
-			continue;
-		int ind2 = (q - (const float *) &(mesh2->vertices[0][0])) / 3;
-		if (mesh2->is_bdy(ind2))
-			continue;
-		if (((xf12r * mesh1->normals[ind]) DOT mesh2->normals[ind2])
-				<= 0.0f)
-			continue;
-		area += this_area;
-		rmsdist += this_area *
-			sqr((p - point(q)) DOT mesh2->normals[ind2]);
+		inds[i] = ind;
+		pts[i] = xf12 * mesh1->vertices[ind];
+	}
+	vector<int> closest(nsamp);
+	kd2->closest_to_pts(&pts[0][0], nsamp, &closest[0]);
+
+	int nblocks = (nsamp + OVERLAP_BLOCK - 1) / OVERLAP_BLOCK;
+	vector<double> bconsidered(nblocks), barea(nblocks), brms(nblocks);
+#pragma omp parallel for schedule(dynamic, 1)
+	for (int b = 0; b < nblocks; b++) {
+		double considered = 0.0, a = 0.0, rms = 0.0;
+		int end = min(nsamp, (b + 1) * OVERLAP_BLOCK);
+		for (int i = b * OVERLAP_BLOCK; i < end; i++) {
+			int ind = inds[i], ind2 = closest[i];
+			float this_area = mesh1->pointareas[ind];
+			considered += this_area;
+			if (ind2 < 0)
+				continue;
+			const point &p = pts[i];
+			vec n1 = xf12r * mesh1->normals[ind];
+			float d2;
+			if (bvh2) {
+				// The closest vertex bounds the search
+				float maxd2 = nextafterf(dist2(p,
+					mesh2->vertices[ind2]), FLT_MAX);
+				point q;
+				vec bary;
+				int f = bvh2->closest(p, maxd2, q, bary);
+				if (f < 0 || on_bdy(mesh2, f, bary))
+					continue;
+				const TriMesh::Face &face = mesh2->faces[f];
+				vec n2 = trinorm(mesh2->vertices[face[0]],
+						 mesh2->vertices[face[1]],
+						 mesh2->vertices[face[2]]);
+				if ((n1 DOT n2) <= 0.0f)
+					continue;
+				d2 = dist2(p, q);
+			} else {
+				if (mesh2->is_bdy(ind2))
+					continue;
+				const vec &n2 = mesh2->normals[ind2];
+				if ((n1 DOT n2) <= 0.0f)
+					continue;
+				d2 = sqr((p - mesh2->vertices[ind2]) DOT n2);
+			}
+			a += this_area;
+			rms += this_area * d2;
+		}
+		bconsidered[b] = considered;
+		barea[b] = a;
+		brms[b] = rms;
 	}
 
-	if (!area)
+	double area_considered = 0.0, sum_area = 0.0, sum_rms = 0.0;
+	for (int b = 0; b < nblocks; b++) {
+		area_considered += bconsidered[b];
+		sum_area += barea[b];
+		sum_rms += brms[b];
+	}
+	if (!sum_area)
 		return;
 
-	rmsdist /= area;
-	rmsdist = sqrt(rmsdist);
-	area *= mesh1->stat(TriMesh::STAT_TOTAL, TriMesh::STAT_FACEAREA)
-		/ area_considered;
+	rmsdist = (float) sqrt(sum_rms / sum_area);
+	area = (float) (sum_area *
+		mesh1->stat(TriMesh::STAT_TOTAL, TriMesh::STAT_FACEAREA) /
+		area_considered);
 }
 
 
-// Find overlap area and RMS distance between mesh1 and mesh2. 
-// rmsdist is unchanged if area returned as zero 
+// Find overlap area and RMS distance between mesh1 and mesh2, from nsamp
+// vertices of each (all of them if nsamp <= 0), and optionally to the
+// surface rather than to the closest vertex.
+// rmsdist is unchanged if area returned as zero
 void find_overlap(TriMesh *mesh1, TriMesh *mesh2,
 		  const xform &xf1, const xform &xf2,
 		  const KDtree *kd1, const KDtree *kd2,
-		  float &area, float &rmsdist)
+		  float &area, float &rmsdist,
+		  int nsamp, bool to_surface /* = false */)
 {
 	mesh1->need_normals();
 	mesh1->need_neighbors();
@@ -83,20 +387,52 @@ void find_overlap(TriMesh *mesh1, TriMesh *mesh2,
 	mesh2->need_adjacentfaces();
 	mesh2->need_pointareas();
 
+	// Point clouds have no surface to measure to
+	FaceBVH *bvh1 = NULL, *bvh2 = NULL;
+	if (to_surface) {
+		mesh1->need_faces();
+		mesh2->need_faces();
+		if (!mesh1->faces.empty()) {
+			mesh1->need_across_edge();
+			bvh1 = new FaceBVH(mesh1);
+		}
+		if (!mesh2->faces.empty()) {
+			mesh2->need_across_edge();
+			bvh2 = new FaceBVH(mesh2);
+		}
+	}
+
 	float area1, area2, rmsdist1, rmsdist2;
-	
+
 	TriMesh::dprintf("Finding overlap 1->2... ");
-	find_overlap_onedir(mesh1, mesh2, xf1, xf2, kd2, area1, rmsdist1);
+	find_overlap_onedir(mesh1, mesh2, xf1, xf2, kd2, bvh2, nsamp,
+			    area1, rmsdist1);
 	TriMesh::dprintf("area = %g, RMS distance = %g\n", area1, rmsdist1);
 	TriMesh::dprintf("Finding overlap 2->1... ");
-	find_overlap_onedir(mesh2, mesh1, xf2, xf1, kd1, area2, rmsdist2);
+	find_overlap_onedir(mesh2, mesh1, xf2, xf1, kd1, bvh1, nsamp,
+			    area2, rmsdist2);
 	TriMesh::dprintf("area = %g, RMS distance = %g\n", area2, rmsdist2);
+	delete bvh2;
+	delete bvh1;
 	area = 0.5f * (area1 + area2);
 	if (area)
 		rmsdist = 0.5f * (rmsdist1 + rmsdist2);
 }
 
 
+// Find overlap area and RMS distance between mesh1 and mesh2, from up to
+// 10000 vertices of each
+// rmsdist is unchanged if area returned as zero 
+void find_overlap(TriMesh *mesh1, TriMesh *mesh2,
+		  const xform &xf1, const xform &xf2,
+		  const KDtree *kd1, const KDtree *kd2,
+		  float &area, float &rmsdist)
+{
+	find_overlap(mesh1, mesh2, xf1, xf2, kd1, kd2, area, rmsdist,
+		     OVERLAP_SAMPLES, false);
+}
+
+
 // Easy-to-use interfaces
 void find_overlap(TriMesh *mesh1, TriMesh *mesh2, float &area, float &rmsdist)
 {
@@ -82,8 +82,13 @@ void remove_faces(TriMesh *mesh, const vector<bool> &toremove)
 	mesh->adjacentfaces.clear();
 	mesh->neighbors.clear();
 	mesh->across_edge.clear();
+	mesh->edges.clear();
+	mesh->nonmanifold_edges.clear();
+	mesh->opposite_corner.clear();
+	mesh->vertex_corner.clear();
 	mesh->cornerareas.clear();
 	mesh->pointareas.clear();
+	mesh->soa.clear();
 
 	dprintf("Removing faces... ");
 	int next = 0;
@@ -165,7 +165,16 @@ void remap_verts(TriMesh *mesh, const std::vector<int> &remap_table)
 		mesh->adjacentfaces.clear();
 		mesh->need_adjacentfaces();
 	}
-	if (!mesh->across_edge.empty()) {
+	bool have_across_edge = !mesh->across_edge.empty();
+	mesh->soa.clear();
+	mesh->edges.clear();
+	mesh->nonmanifold_edges.clear();
+	if (!mesh->opposite_corner.empty()) {
+		mesh->opposite_corner.clear();
+		mesh->vertex_corner.clear();
+		mesh->need_corners();
+	}
+	if (have_across_edge) {
 		mesh->across_edge.clear();
 		mesh->need_across_edge();
 	}
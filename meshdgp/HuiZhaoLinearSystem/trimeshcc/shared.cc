@@ -4,18 +4,80 @@ Princeton University
 
 shared.cc
 Find separate mesh vertices that should be "shared": they lie on separate
-connected components, but they are very close to each other.
+connected components, but they are very close to each other.  Also merge
+close vertices regardless of components.
 */
 
 
 #include "TriMesh.h"
 #include "TriMesh_algo.h"
+#include "KDtree.h"
 #include <vector>
+#include <cfloat>
 using namespace std;
+#define dprintf TriMesh::dprintf
 
 
 namespace trimesh {
 
+// For each vertex in cands (in increasing order), find the first earlier
+// one of cands within tol and, if comps is given, on a different
+// component.  match gets its number, or -1 for none.
+static void first_within(const TriMesh *mesh, const vector<int> &cands,
+			 float tol, const vector<int> *comps,
+			 vector<int> &match)
+{
+	int nc = cands.size();
+	match.assign(mesh->vertices.size(), -1);
+	if (nc < 2)
+		return;
+
+	vector<point> pts(nc);
+#pragma omp parallel for
+	for (int c = 0; c < nc; c++)
+		pts[c] = mesh->vertices[cands[c]];
+
+	// Candidates from a radius a bit bigger than tol, so that no pair is
+	// lost to rounding.  The test below is the exact one.
+	float tol2 = sqr(tol);
+	KDtree kd(pts);
+	vector<size_t> starts;
+	vector<int> found;
+	kd.find_in_radius_pts(pts[0], nc, tol2 * (1.0f + 16.0f * FLT_EPSILON) + FLT_MIN,
+			      starts, found);
+
+#pragma omp parallel for
+	for (int c = 0; c < nc; c++) {
+		int i = cands[c], best = -1;
+		for (size_t k = starts[c]; k < starts[c+1]; k++) {
+			if (found[k] >= c)
+				continue;
+			int j = cands[found[k]];
+			if (best >= 0 && j >= best)
+				continue;
+			if (comps && (*comps)[i] == (*comps)[j])
+				continue;
+			if (dist2(mesh->vertices[i], mesh->vertices[j]) > tol2)
+				continue;
+			best = j;
+		}
+		match[i] = best;
+	}
+}
+
+
+// Number the vertices, giving each matched one the number of its match
+static int remap_matches(const vector<int> &match, vector<int> &remap)
+{
+	int nv = match.size();
+	remap.resize(nv);
+	int next = 0;
+	for (int i = 0; i < nv; i++)
+		remap[i] = (match[i] >= 0) ? remap[match[i]] : next++;
+	return next;
+}
+
+
 // Merge vertices within tol
 void shared(TriMesh *mesh, float tol)
 {
@@ -33,36 +95,25 @@ void shared(TriMesh *mesh, float tol)
 	vector<int> comps, compsizes;
 	find_comps(mesh, comps, compsizes, true);
 
-	// Find boundary vertices
+	// Find boundary vertices, and the component of each
 	vector<bool> bdy(nv);
+	vector<int> vcomps(nv, -1);
 #pragma omp parallel for
 	for (int i = 0; i < nv; i++) {
-		bdy[i] = mesh->is_bdy(i);
+		bdy[i] = mesh->is_bdy(i) && !mesh->adjacentfaces[i].empty();
+		if (bdy[i])
+			vcomps[i] = comps[mesh->adjacentfaces[i][0]];
 	}
-
-	vector<int> remap(nv);
-	float tol2 = sqr(tol);
-
-	// TODO: use KD tree to avoid O(n^2)
-	int next = 0;
+	vector<int> cands;
 	for (int i = 0; i < nv; i++) {
-		remap[i] = next++;
-		if (!bdy[i] || mesh->adjacentfaces[i].empty())
-			continue;
-		for (int j = 0; j < i; j++) {
-			if (!bdy[j] || mesh->adjacentfaces[j].empty())
-				continue;
-			if (comps[mesh->adjacentfaces[i][0]] ==
-			    comps[mesh->adjacentfaces[j][0]])
-				continue;
-			if (dist2(mesh->vertices[i], mesh->vertices[j]) > tol2)
-				continue;
-			remap[i] = remap[j];
-			next--;
-			break;
-		}
+		if (bdy[i])
+			cands.push_back(i);
 	}
 
+	vector<int> match, remap;
+	first_within(mesh, cands, tol, &vcomps, match);
+	remap_matches(match, remap);
+
 	mesh->adjacentfaces.clear();
 	mesh->neighbors.clear();
 	remap_verts(mesh, remap);
@@ -70,4 +121,41 @@ void shared(TriMesh *mesh, float tol)
 	orient(mesh);
 }
 
+
+// Merge all vertices within tol of each other, and remove the faces that
+// collapse
+void weld_vertices(TriMesh *mesh, float tol)
+{
+	int nv = mesh->vertices.size();
+	if (nv < 2)
+		return;
+	mesh->need_faces();
+	mesh->tstrips.clear();
+
+	dprintf("Welding vertices... ");
+	vector<int> cands(nv);
+	for (int i = 0; i < nv; i++)
+		cands[i] = i;
+	vector<int> match, remap;
+	first_within(mesh, cands, tol, NULL, match);
+	int next = remap_matches(match, remap);
+	if (next == nv) {
+		dprintf("None merged.\n");
+		return;
+	}
+	remap_verts(mesh, remap);
+
+	int nf = mesh->faces.size();
+	vector<bool> collapsed(nf);
+	bool any_collapsed = false;
+	for (int i = 0; i < nf; i++) {
+		const TriMesh::Face &f = mesh->faces[i];
+		collapsed[i] = (f[0] == f[1] || f[1] == f[2] || f[2] == f[0]);
+		any_collapsed = any_collapsed || collapsed[i];
+	}
+	if (any_collapsed)
+		remove_faces(mesh, collapsed);
+	dprintf("%d vertices merged... Done.\n", nv - next);
+}
+
 }; // namespace trimesh
@@ -162,7 +162,7 @@ static point avg_bdy(TriMesh *mesh, int v)
 {
 	point p;
 	int n = 0;
-	const vector<int> &a = mesh->adjacentfaces[v];
+	IndexSpan a = mesh->adjacentfaces[v];
 	for (size_t i = 0; i < a.size(); i++) {
 		int f = a[i];
 		for (int j = 0; j < 3; j++) {
@@ -281,6 +281,7 @@ void subdiv(TriMesh *mesh, int scheme /* = SUBDIV_LOOP */)
 	mesh->cornerareas.clear(); mesh->pointareas.clear();
 	mesh->bbox.valid = false;
 	mesh->bsphere.valid = false;
+	mesh->soa.clear();
 	mesh->need_faces(); mesh->tstrips.clear(); mesh->grid.clear();
 	mesh->grid_width = mesh->grid_height = -1;
 	mesh->neighbors.clear();
@@ -392,6 +393,8 @@ void subdiv(TriMesh *mesh, int scheme /* = SUBDIV_LOOP */)
 
 	// Insert new faces
 	mesh->adjacentfaces.clear(); mesh->across_edge.clear();
+	mesh->edges.clear(); mesh->nonmanifold_edges.clear();
+	mesh->opposite_corner.clear(); mesh->vertex_corner.clear();
 	mesh->faces.reserve(4*nf);
 	for (int i = 0; i < nf; i++) {
 		TriMesh::Face &v = mesh->faces[i];
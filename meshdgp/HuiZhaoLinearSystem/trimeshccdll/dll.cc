@@ -1,7 +1,13 @@
+#ifdef _WIN32
+#define EXPORT_VISIBILITY __declspec (dllexport)
+#else
+#define EXPORT_VISIBILITY __attribute__ ((visibility ("default")))
+#endif
+
 #ifdef __cplusplus 
-#define EXPORT extern "C" __declspec (dllexport)
+#define EXPORT extern "C" EXPORT_VISIBILITY
 #else
-#define EXPORT __declspec (dllexport)
+#define EXPORT EXPORT_VISIBILITY
 #endif
 
 #include "TriMesh.h"
@@ -52,4 +58,17 @@ EXPORT int GetDCurv(float buff[][4])
 		}
 	}
 	return mesh -> dcurv.size();
-}
\ No newline at end of file
+}
+// Corner table of the loaded mesh, without copying: the arrays belong to
+// the mesh and stay valid until it changes.  faces and opposite hold
+// 3 ints per face, vertexCorner one per vertex.  Returns the face count.
+EXPORT int GetCornerTable(int **faces, int **opposite, int **vertexCorner, int *numberOfVertex)
+{
+	mesh -> need_corners();
+	int nf = mesh -> faces.size();
+	*faces = nf ? &mesh -> faces[0][0] : NULL;
+	*opposite = nf ? &mesh -> opposite_corner[0] : NULL;
+	*vertexCorner = nf ? &mesh -> vertex_corner[0] : NULL;
+	*numberOfVertex = mesh -> vertices.size();
+	return nf;
+}